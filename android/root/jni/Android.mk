@@ -31,6 +31,7 @@ config/oor_config_confuse.c    \
 		  fwd_policies/fwd_policy.c	     \
 		  fwd_policies/flow_balancing/fb_addr_func.c         \
 		  fwd_policies/flow_balancing/flow_balancing.c       \
+		  fwd_policies/maglev/maglev.c   \
 		  liblisp/liblisp.c              \
 		  liblisp/lisp_address.c         \
 		  liblisp/lisp_data.c            \
@@ -47,6 +48,7 @@ config/oor_config_confuse.c    \
 		  lib/int_table.c                \
 		  lib/lbuf.c                     \
 		  lib/lisp_site.c                \
+		  lib/lpm4.c                     \
 		  lib/oor_log.c                  \
 		  lib/mapping_db.c               \
 		  lib/map_cache_entry.c          \
@@ -22,6 +22,8 @@
 #include "../lib/oor_log.h"
 #include "../liblisp/liblisp.h"
 #include "../lib/mem_util.h"
+#include "../lib/sockets.h"
+#include "../lib/timers.h"
 #include <libxml/tree.h>
 #include <libxml/parser.h>
 #include <zmq.h>
@@ -31,7 +33,16 @@
 #include <assert.h>
 
 
+/* Seconds between checks of the API requests when the ZMQ_FD can not be
+ * polled */
+#define OOR_API_POLL_INTERVAL   1
+
+/* Buffer to receive API messages */
+static uint8_t api_recv_buf[MAX_API_PKT_LEN];
+
 lisp_addr_t * lxml_lcaf_get_lisp_addr (xmlNodePtr xml_lcaf);
+static int oor_api_process_cb(sock_t *sl);
+static int oor_api_poll_cb(oor_timer_t *timer);
 
 xmlNodePtr
 get_inner_xmlNodePtr(xmlNodePtr parent, char *name)
@@ -417,6 +428,9 @@ oor_api_init_server(oor_api_connection_t *conn)
 {
 
 	int error;
+	int zmq_fd;
+	size_t zmq_fd_len = sizeof(zmq_fd);
+	oor_timer_t *timer;
 
     conn->context = zmq_ctx_new();
     OOR_LOG(LDBG_3,"OOR_API: zmq_ctx_new errno: %s\n",zmq_strerror (errno));
@@ -433,6 +447,23 @@ oor_api_init_server(oor_api_connection_t *conn)
     	goto err;
     }
 
+    /* Requests are processed by the socket master when the file descriptor
+     * signaling events on the ZMQ socket becomes readable. The descriptor
+     * belongs to ZMQ, which closes it with the socket. Otherwise they are
+     * checked periodically */
+    if (zmq_getsockopt(conn->socket, ZMQ_FD, &zmq_fd, &zmq_fd_len) != 0){
+        OOR_LOG(LDBG_2,"OOR_API: Error while obtaining ZMQ_FD: %s\n",zmq_strerror (errno));
+        zmq_fd = -1;
+    }
+    if (zmq_fd < 0 || sockmstr_register_read_listener_flags(smaster,
+            oor_api_process_cb, conn, zmq_fd, SOCK_NOT_OWNED) == NULL){
+        OOR_LOG(LWRN,"OOR_API: Couldn't poll the ZMQ socket. Checking the API "
+                "requests every %d seconds\n", OOR_API_POLL_INTERVAL);
+        timer = oor_timer_create(API_POLL_TIMER);
+        oor_timer_init(timer, NULL, oor_api_poll_cb, conn, NULL, NULL);
+        oor_timer_start(timer, OOR_API_POLL_INTERVAL);
+    }
+
     OOR_LOG(LDBG_2,"OOR_API: API server initiated using ZMQ\n");
 
     return (GOOD);
@@ -1102,10 +1133,43 @@ int
     return (process_func);
 }
 
+/* Returns TRUE if there are API messages pending to be read. It also clears
+ * the notification of the ZMQ_FD */
+static int
+oor_api_pending(oor_api_connection_t *conn)
+{
+    int events;
+    size_t events_len = sizeof(events);
+
+    if (zmq_getsockopt(conn->socket, ZMQ_EVENTS, &events, &events_len) != 0){
+        OOR_LOG(LERR, "oor_api_pending: Error while obtaining ZMQ_EVENTS: %s\n",
+                zmq_strerror (errno));
+        return (FALSE);
+    }
+
+    return ((events & ZMQ_POLLIN) ? TRUE : FALSE);
+}
+
+static int
+oor_api_process_cb(sock_t *sl)
+{
+    oor_api_loop((oor_api_connection_t *)sl->arg);
+    return (GOOD);
+}
+
+static int
+oor_api_poll_cb(oor_timer_t *timer)
+{
+    oor_api_loop((oor_api_connection_t *)oor_timer_cb_argument(timer));
+    oor_timer_start(timer, OOR_API_POLL_INTERVAL);
+    return (GOOD);
+}
+
+/* Process all the pending API messages */
 void
 oor_api_loop(oor_api_connection_t *conn)
 {
-    uint8_t *buffer;
+    uint8_t *buffer = api_recv_buf;
     uint8_t *data;
     int nbytes;
     int datalen;
@@ -1114,45 +1178,42 @@ oor_api_loop(oor_api_connection_t *conn)
     uint8_t *result_msg;
     int result_msg_len;
 
-    buffer = xzalloc(MAX_API_PKT_LEN);
-
-    nbytes = oor_api_recv(conn,buffer,OOR_API_DONTWAIT);
+    /* ZMQ_FD is edge triggered: it doesn't signal again until all the
+     * messages are read */
+    while (oor_api_pending(conn)) {
+        nbytes = oor_api_recv(conn,buffer,OOR_API_DONTWAIT);
 
-    if (nbytes == OOR_API_NOTHINGTOREAD){
-    	goto end;
-    }
+        if (nbytes == OOR_API_NOTHINGTOREAD){
+            return;
+        }
 
-    if (nbytes == OOR_API_ERROR){
-    	OOR_LOG(LERR, "oor_api_loop: Error while trying to retrieve API packet\n");
-    	goto end;
-    }
+        if (nbytes == OOR_API_ERROR){
+            OOR_LOG(LERR, "oor_api_loop: Error while trying to retrieve API packet\n");
+            return;
+        }
 
-    header = (oor_api_msg_hdr_t *)buffer;
+        header = (oor_api_msg_hdr_t *)buffer;
 
-    data = CO(buffer,sizeof(oor_api_msg_hdr_t));
-    datalen = nbytes - sizeof(oor_api_msg_hdr_t);
+        data = CO(buffer,sizeof(oor_api_msg_hdr_t));
+        datalen = nbytes - sizeof(oor_api_msg_hdr_t);
 
-    if (header->datalen < datalen){
-        OOR_LOG(LWRN, "oor_api_loop: API packet longer than expected\n");
-    }
-    else if (header->datalen > datalen){
-        OOR_LOG(LERR, "oor_api_loop: API packet shorter than expected\n");
-        goto end;
-    }
+        if (header->datalen < datalen){
+            OOR_LOG(LWRN, "oor_api_loop: API packet longer than expected\n");
+        }
+        else if (header->datalen > datalen){
+            OOR_LOG(LERR, "oor_api_loop: API packet shorter than expected\n");
+            continue;
+        }
 
-    process_func = oor_api_get_proc_func(header);
+        process_func = oor_api_get_proc_func(header);
 
-    if (process_func != NULL){
-    	(*process_func)(conn,header,data);
-    }else {
-        result_msg_len = oor_api_result_msg_new(&result_msg,header->device,header->target,header->operation,OOR_API_RES_ERR);
-        oor_api_send(conn,result_msg,result_msg_len,OOR_API_NOFLAGS);
+        if (process_func != NULL){
+            (*process_func)(conn,header,data);
+        }else {
+            result_msg_len = oor_api_result_msg_new(&result_msg,header->device,header->target,header->operation,OOR_API_RES_ERR);
+            oor_api_send(conn,result_msg,result_msg_len,OOR_API_NOFLAGS);
+        }
     }
-
-end:
-    free(buffer);
-
-    return;
 }
 
 
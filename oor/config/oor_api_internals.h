@@ -22,7 +22,7 @@
 #include "oor_api.h"
 
 
-/* API main loop */
+/* Process the pending API requests */
 void oor_api_loop(oor_api_connection_t *conn);
 
 /* Initialize API system (server) */
@@ -346,10 +346,12 @@ configure_tunnel_router(cfg_t *cfg, lisp_xtr_t *xtr, shash_t *lcaf_ht)
     int i,n,ret;
     char *map_resolver;
     char *encap;
+    char *rx_backend;
+    char *evict;
     mapping_t *mapping;
 
     /* FWD POLICY STRUCTURES */
-    xtr->fwd_policy = fwd_policy_class_find("flow_balancing");
+    xtr->fwd_policy = select_fwd_policy(cfg_getstr(cfg, "forwarding-policy"));
     xtr->fwd_policy_dev_parm = xtr->fwd_policy->new_dev_policy_inf(ctrl_dev,NULL);
 
     if ((encap = cfg_getstr(cfg, "encapsulation")) != NULL) {
@@ -388,6 +390,44 @@ configure_tunnel_router(cfg_t *cfg, lisp_xtr_t *xtr, shash_t *lcaf_ht)
 
     }
 
+    /* DATA PLANE CONFIG */
+    cfg_t *dp = cfg_getnsec(cfg, "data-plane", 0);
+    if (dp != NULL) {
+        dplane_conf.rx_batch_size = cfg_getint(dp, "rx-batch-size");
+        dplane_conf.tun_queues = cfg_getint(dp, "tun-queues");
+        dplane_conf.tun_offload = cfg_getbool(dp, "tun-offload") ? TRUE : FALSE;
+        dplane_conf.udp_gso = cfg_getbool(dp, "udp-gso") ? TRUE : FALSE;
+        dplane_conf.udp_gro = cfg_getbool(dp, "udp-gro") ? TRUE : FALSE;
+        dplane_conf.io_uring = cfg_getbool(dp, "io-uring") ? TRUE : FALSE;
+        dplane_conf.rtr_workers = cfg_getint(dp, "rtr-workers");
+        dplane_conf.dplane_thread = cfg_getbool(dp, "data-plane-thread") ? TRUE : FALSE;
+        dplane_conf.encap_sport_min = cfg_getint(dp, "encap-src-port-min");
+        dplane_conf.encap_sport_max = cfg_getint(dp, "encap-src-port-max");
+        dplane_conf.zero_udp_csum_v4 = cfg_getbool(dp, "zero-udp-checksum-ipv4") ? TRUE : FALSE;
+        dplane_conf.zero_udp_csum_v6 = cfg_getbool(dp, "zero-udp-checksum-ipv6") ? TRUE : FALSE;
+        dplane_conf.flow_cache_size = cfg_getint(dp, "flow-cache-size");
+        dplane_conf.flow_cache_mem = cfg_getint(dp, "flow-cache-memory");
+        dplane_conf.flow_cache_tcp_close = cfg_getbool(dp, "flow-cache-tcp-close") ? TRUE : FALSE;
+        dplane_conf.flowlet_gap = cfg_getint(dp, "flowlet-gap");
+        evict = cfg_getstr(dp, "flow-cache-eviction");
+        if (evict != NULL && strcmp(evict, "clock") == 0) {
+            dplane_conf.flow_cache_evict = DPLANE_FLOW_EVICT_CLOCK;
+        } else if (evict != NULL && strcmp(evict, "lru") != 0) {
+            OOR_LOG(LWRN, "Unknown data plane flow cache eviction: %s. "
+                    "Using lru", evict);
+        }
+        rx_backend = cfg_getstr(dp, "rx-backend");
+        if (rx_backend != NULL && strcmp(rx_backend, "packet-ring") == 0) {
+            dplane_conf.rx_backend = DPLANE_RX_PACKET_RING;
+        } else if (rx_backend != NULL && strcmp(rx_backend, "xdp") == 0) {
+            dplane_conf.rx_backend = DPLANE_RX_XDP;
+        } else if (rx_backend != NULL && strcmp(rx_backend, "socket") != 0) {
+            OOR_LOG(LWRN, "Unknown data plane rx backend: %s. Using socket",
+                    rx_backend);
+        }
+    }
+    validate_data_plane_parameters(&dplane_conf);
+
 
     /* MAP-RESOLVER CONFIG  */
     n = cfg_size(cfg, "map-resolver");
@@ -802,6 +842,28 @@ handle_config_file()
             CFG_END()
     };
 
+    static cfg_opt_t data_plane_opts[] = {
+            CFG_INT("rx-batch-size",    DPLANE_DEFAULT_RX_BATCH, CFGF_NONE),
+            CFG_INT("tun-queues",       DPLANE_DEFAULT_TUN_QUEUES, CFGF_NONE),
+            CFG_BOOL("tun-offload",     cfg_false, CFGF_NONE),
+            CFG_BOOL("udp-gso",         cfg_false, CFGF_NONE),
+            CFG_BOOL("udp-gro",         cfg_false, CFGF_NONE),
+            CFG_STR("rx-backend",       "socket", CFGF_NONE),
+            CFG_BOOL("io-uring",        cfg_false, CFGF_NONE),
+            CFG_INT("rtr-workers",      DPLANE_DEFAULT_RTR_WORKERS, CFGF_NONE),
+            CFG_BOOL("data-plane-thread", cfg_false, CFGF_NONE),
+            CFG_INT("encap-src-port-min", 0, CFGF_NONE),
+            CFG_INT("encap-src-port-max", 0, CFGF_NONE),
+            CFG_BOOL("zero-udp-checksum-ipv4", cfg_false, CFGF_NONE),
+            CFG_BOOL("zero-udp-checksum-ipv6", cfg_false, CFGF_NONE),
+            CFG_INT("flow-cache-size",  DPLANE_DEFAULT_FLOW_CACHE, CFGF_NONE),
+            CFG_INT("flow-cache-memory", 0, CFGF_NONE),
+            CFG_STR("flow-cache-eviction", "lru", CFGF_NONE),
+            CFG_BOOL("flow-cache-tcp-close", cfg_false, CFGF_NONE),
+            CFG_INT("flowlet-gap",      0, CFGF_NONE),
+            CFG_END()
+    };
+
     static cfg_opt_t elp_node_opts[] = {
             CFG_STR("address",      0,          CFGF_NONE),
             CFG_BOOL("strict",      cfg_false,  CFGF_NONE),
@@ -859,7 +921,9 @@ handle_config_file()
             CFG_SEC("rtr-ifaces",           rtr_ifaces_opts,        CFGF_MULTI),
             CFG_SEC("proxy-etr",            petr_mapping_opts,      CFGF_MULTI),
             CFG_STR("encapsulation",        0,                      CFGF_NONE),
+            CFG_STR("forwarding-policy",    0,                      CFGF_NONE),
             CFG_SEC("rloc-probing",         rloc_probing_opts,      CFGF_MULTI),
+            CFG_SEC("data-plane",           data_plane_opts,        CFGF_MULTI),
             CFG_INT("map-request-retries",  0, CFGF_NONE),
             CFG_INT("control-port",         0, CFGF_NONE),
             CFG_INT("debug",                0, CFGF_NONE),
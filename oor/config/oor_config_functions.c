@@ -26,6 +26,7 @@
 #include "../data-plane/data-plane.h"
 #include "../lib/oor_log.h"
 #include "../lib/prefixes.h"
+#include "../lib/ttable.h"
 #include "../lib/util.h"
 
 /***************************** FUNCTIONS DECLARATION *************************/
@@ -230,6 +231,169 @@ validate_rloc_probing_parameters(int *interval,int *retries,int *retries_int)
     }
 }
 
+void
+validate_data_plane_parameters(dplane_conf_t *conf)
+{
+    if (conf->rx_batch_size < 1) {
+        conf->rx_batch_size = 1;
+        OOR_LOG(LWRN, "Data plane rx batch size should be between 1 and %d. "
+                "Using 1", DPLANE_MAX_RX_BATCH);
+    } else if (conf->rx_batch_size > DPLANE_MAX_RX_BATCH) {
+        conf->rx_batch_size = DPLANE_MAX_RX_BATCH;
+        OOR_LOG(LWRN, "Data plane rx batch size should be between 1 and %d. "
+                "Using %d", DPLANE_MAX_RX_BATCH, DPLANE_MAX_RX_BATCH);
+    }
+    OOR_LOG(LDBG_1, "Data plane rx batch size: %d", conf->rx_batch_size);
+
+    if (conf->tun_queues < 1) {
+        conf->tun_queues = 1;
+        OOR_LOG(LWRN, "Data plane tun queues should be between 1 and %d. "
+                "Using 1", DPLANE_MAX_TUN_QUEUES);
+    } else if (conf->tun_queues > DPLANE_MAX_TUN_QUEUES) {
+        conf->tun_queues = DPLANE_MAX_TUN_QUEUES;
+        OOR_LOG(LWRN, "Data plane tun queues should be between 1 and %d. "
+                "Using %d", DPLANE_MAX_TUN_QUEUES, DPLANE_MAX_TUN_QUEUES);
+    }
+    OOR_LOG(LDBG_1, "Data plane tun queues: %d", conf->tun_queues);
+    OOR_LOG(LDBG_1, "Data plane tun offloads: %s",
+            conf->tun_offload ? "enabled" : "disabled");
+    OOR_LOG(LDBG_1, "Data plane UDP segmentation offload: %s",
+            conf->udp_gso ? "enabled" : "disabled");
+    if (conf->rx_backend != DPLANE_RX_SOCKET && conf->udp_gro) {
+        conf->udp_gro = FALSE;
+        OOR_LOG(LWRN, "UDP receive offload is only used with the socket rx "
+                "backend");
+    }
+    OOR_LOG(LDBG_1, "Data plane UDP receive offload: %s",
+            conf->udp_gro ? "enabled" : "disabled");
+    switch (conf->rx_backend) {
+    case DPLANE_RX_PACKET_RING:
+        OOR_LOG(LDBG_1, "Data plane rx backend: packet-ring");
+        break;
+    case DPLANE_RX_XDP:
+        OOR_LOG(LDBG_1, "Data plane rx backend: xdp");
+        break;
+    default:
+        OOR_LOG(LDBG_1, "Data plane rx backend: socket");
+        break;
+    }
+    OOR_LOG(LDBG_1, "Data plane io_uring: %s",
+            conf->io_uring ? "enabled" : "disabled");
+
+    if (conf->rtr_workers < 1) {
+        conf->rtr_workers = 1;
+        OOR_LOG(LWRN, "Data plane RTR workers should be between 1 and %d. "
+                "Using 1", DPLANE_MAX_RTR_WORKERS);
+    } else if (conf->rtr_workers > DPLANE_MAX_RTR_WORKERS) {
+        conf->rtr_workers = DPLANE_MAX_RTR_WORKERS;
+        OOR_LOG(LWRN, "Data plane RTR workers should be between 1 and %d. "
+                "Using %d", DPLANE_MAX_RTR_WORKERS, DPLANE_MAX_RTR_WORKERS);
+    }
+    if (conf->rx_backend != DPLANE_RX_SOCKET && conf->rtr_workers > 1) {
+        conf->rtr_workers = 1;
+        OOR_LOG(LWRN, "RTR data plane workers are only used with the socket "
+                "rx backend");
+    }
+    OOR_LOG(LDBG_1, "Data plane RTR workers: %d", conf->rtr_workers);
+
+    /* The sockets of the AF_XDP backend and io_uring are served by the main
+     * loop */
+    if (conf->dplane_thread && conf->rx_backend == DPLANE_RX_XDP) {
+        conf->dplane_thread = FALSE;
+        OOR_LOG(LWRN, "The data plane thread is not used with the xdp rx "
+                "backend");
+    }
+    if (conf->dplane_thread && conf->io_uring) {
+        conf->io_uring = FALSE;
+        OOR_LOG(LWRN, "io_uring is not used with the data plane thread");
+    }
+    OOR_LOG(LDBG_1, "Data plane thread: %s",
+            conf->dplane_thread ? "enabled" : "disabled");
+
+    if (conf->encap_sport_min == 0 && conf->encap_sport_max == 0) {
+        OOR_LOG(LDBG_1, "Data plane encapsulation source port: data port");
+    } else if (conf->encap_sport_min < DPLANE_MIN_ENCAP_SPORT
+            || conf->encap_sport_max > 65535
+            || conf->encap_sport_min > conf->encap_sport_max) {
+        OOR_LOG(LWRN, "The range of encapsulation source ports should be "
+                "between %d and 65535. Using the data port",
+                DPLANE_MIN_ENCAP_SPORT);
+        conf->encap_sport_min = 0;
+        conf->encap_sport_max = 0;
+    } else {
+        OOR_LOG(LDBG_1, "Data plane encapsulation source ports: %d-%d",
+                conf->encap_sport_min, conf->encap_sport_max);
+    }
+    if (conf->udp_gso && (conf->zero_udp_csum_v4 || conf->zero_udp_csum_v6)) {
+        OOR_LOG(LWRN, "The packets sent with UDP segmentation offload keep "
+                "their UDP checksum. The zero UDP checksum is only used with "
+                "raw sockets");
+    }
+    OOR_LOG(LDBG_1, "Data plane zero UDP checksum: IPv4 %s, IPv6 %s",
+            conf->zero_udp_csum_v4 ? "enabled" : "disabled",
+            conf->zero_udp_csum_v6 ? "enabled" : "disabled");
+
+    if (conf->flow_cache_size < 1) {
+        conf->flow_cache_size = DPLANE_DEFAULT_FLOW_CACHE;
+        OOR_LOG(LWRN, "Data plane flow cache size should be between 1 and %d. "
+                "Using %d", DPLANE_MAX_FLOW_CACHE, DPLANE_DEFAULT_FLOW_CACHE);
+    } else if (conf->flow_cache_size > DPLANE_MAX_FLOW_CACHE) {
+        conf->flow_cache_size = DPLANE_MAX_FLOW_CACHE;
+        OOR_LOG(LWRN, "Data plane flow cache size should be between 1 and %d. "
+                "Using %d", DPLANE_MAX_FLOW_CACHE, DPLANE_MAX_FLOW_CACHE);
+    }
+    if (conf->flow_cache_mem < 0
+            || conf->flow_cache_mem > DPLANE_MAX_FLOW_CACHE_MEM) {
+        conf->flow_cache_mem = 0;
+        OOR_LOG(LWRN, "Data plane flow cache memory should be between 0 and "
+                "%d MB. Using the flow cache size", DPLANE_MAX_FLOW_CACHE_MEM);
+    }
+    if (conf->flow_cache_mem > 0) {
+        conf->flow_cache_size = ttable_size_for_memory(
+                (size_t)conf->flow_cache_mem << 20);
+        OOR_LOG(LDBG_1, "Data plane flow cache memory: %d MB",
+                conf->flow_cache_mem);
+    }
+    OOR_LOG(LDBG_1, "Data plane flow cache size: %d flows",
+            conf->flow_cache_size);
+    OOR_LOG(LDBG_1, "Data plane flow cache eviction: %s",
+            conf->flow_cache_evict == DPLANE_FLOW_EVICT_CLOCK ? "clock" : "lru");
+    OOR_LOG(LDBG_1, "Data plane flow cache TCP close: %s",
+            conf->flow_cache_tcp_close ? "enabled" : "disabled");
+
+    if (conf->flowlet_gap < 0 || conf->flowlet_gap > DPLANE_MAX_FLOWLET_GAP) {
+        conf->flowlet_gap = 0;
+        OOR_LOG(LWRN, "Data plane flowlet gap should be between 0 and %d ms. "
+                "Flowlets disabled", DPLANE_MAX_FLOWLET_GAP);
+    }
+    if (conf->flowlet_gap > 0) {
+        OOR_LOG(LDBG_1, "Data plane flowlet gap: %d ms", conf->flowlet_gap);
+    } else {
+        OOR_LOG(LDBG_1, "Data plane flowlets: disabled");
+    }
+}
+
+/* Forwarding policy used to select the RLOCs of the flows. flow_balancing if
+ * not specified or unknown */
+fwd_policy_class *
+select_fwd_policy(const char *name)
+{
+    fwd_policy_class *fwd_policy;
+
+    if (name == NULL) {
+        name = "flow_balancing";
+    }
+    fwd_policy = fwd_policy_class_find((char *)name);
+    if (fwd_policy == NULL) {
+        OOR_LOG(LWRN, "Unknown forwarding policy: %s. Using flow_balancing",
+                name);
+        name = "flow_balancing";
+        fwd_policy = fwd_policy_class_find((char *)name);
+    }
+    OOR_LOG(LDBG_1, "Forwarding policy: %s", name);
+    return (fwd_policy);
+}
+
 int
 validate_priority_weight(int p, int w)
 {
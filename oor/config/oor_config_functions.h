@@ -22,6 +22,7 @@
 
 #include "../control/lisp_ms.h"
 #include "../control/lisp_xtr.h"
+#include "../data-plane/data-plane.h"
 #include "../lib/iface_locators.h"
 #include "../lib/lisp_site.h"
 #include "../lib/map_local_entry.h"
@@ -110,6 +111,12 @@ get_no_addr_loct_from_list(glist_t *list, locator_t *locator);
 void
 validate_rloc_probing_parameters(int *interval,int *retries,int *retries_int);
 
+void
+validate_data_plane_parameters(dplane_conf_t *conf);
+
+fwd_policy_class *
+select_fwd_policy(const char *name);
+
 int
 validate_priority_weight(int p, int w);
 
@@ -87,6 +87,16 @@ parse_elp_node(
         struct uci_section      *section,
         shash_t                *ht);
 
+static void
+parse_data_plane(
+        struct uci_context      *ctx,
+        struct uci_section      *sect);
+
+static const char *
+parse_fwd_policy(
+        struct uci_context      *ctx,
+        struct uci_package      *pck);
+
 /********************************** FUNCTIONS ********************************/
 
 int
@@ -213,7 +223,7 @@ configure_xtr(struct uci_context *ctx, struct uci_package *pck)
     xtr = CONTAINER_OF(ctrl_dev, lisp_xtr_t, super);
 
     /* FWD POLICY STRUCTURES */
-    xtr->fwd_policy = fwd_policy_class_find("flow_balancing");
+    xtr->fwd_policy = select_fwd_policy(parse_fwd_policy(ctx, pck));
     xtr->fwd_policy_dev_parm = xtr->fwd_policy->new_dev_policy_inf(ctrl_dev,NULL);
 
     /* CREATE LCAFS HTABLE */
@@ -270,6 +280,12 @@ configure_xtr(struct uci_context *ctx, struct uci_package *pck)
                 }
             }
 
+            /* DATA PLANE CONFIG */
+            if (strcmp(sect->type, "data-plane") == 0){
+                parse_data_plane(ctx, sect);
+                continue;
+            }
+
             /* RLOC PROBING CONFIG */
 
             if (strcmp(sect->type, "rloc-probing") == 0){
@@ -495,7 +511,7 @@ configure_mn(struct uci_context *ctx, struct uci_package *pck)
     xtr = CONTAINER_OF(ctrl_dev, lisp_xtr_t, super);
 
     /* FWD POLICY STRUCTURES */
-    xtr->fwd_policy = fwd_policy_class_find("flow_balancing");
+    xtr->fwd_policy = select_fwd_policy(parse_fwd_policy(ctx, pck));
     xtr->fwd_policy_dev_parm = xtr->fwd_policy->new_dev_policy_inf(ctrl_dev,NULL);
 
     /* CREATE LCAFS HTABLE */
@@ -552,6 +568,12 @@ configure_mn(struct uci_context *ctx, struct uci_package *pck)
             }
         }
 
+        /* DATA PLANE CONFIG */
+        if (strcmp(sect->type, "data-plane") == 0){
+            parse_data_plane(ctx, sect);
+            continue;
+        }
+
         /* RLOC PROBING CONFIG */
 
         if (strcmp(sect->type, "rloc-probing") == 0){
@@ -778,7 +800,7 @@ configure_rtr(struct uci_context *ctx, struct uci_package *pck)
     xtr = CONTAINER_OF(ctrl_dev, lisp_xtr_t, super);
 
     /* FWD POLICY STRUCTURES */
-    xtr->fwd_policy = fwd_policy_class_find("flow_balancing");
+    xtr->fwd_policy = select_fwd_policy(parse_fwd_policy(ctx, pck));
     xtr->fwd_policy_dev_parm = xtr->fwd_policy->new_dev_policy_inf(ctrl_dev,NULL);
 
     /* CREATE LCAFS HTABLE */
@@ -815,6 +837,12 @@ configure_rtr(struct uci_context *ctx, struct uci_package *pck)
             }
         }
 
+        /* DATA PLANE CONFIG */
+        if (strcmp(sect->type, "data-plane") == 0){
+            parse_data_plane(ctx, sect);
+            continue;
+        }
+
         /* RLOC PROBING CONFIG */
 
         if (strcmp(sect->type, "rloc-probing") == 0){
@@ -1532,3 +1560,125 @@ parse_elp_node(struct uci_context *ctx, struct uci_section *section, shash_t *ht
     return (GOOD);
 }
 
+static void
+parse_data_plane(struct uci_context *ctx, struct uci_section *sect)
+{
+    const char *uci_batch;
+    const char *uci_queues;
+    const char *uci_offload;
+    const char *uci_gso;
+    const char *uci_gro;
+    const char *uci_backend;
+    const char *uci_uring;
+    const char *uci_workers;
+    const char *uci_thread;
+    const char *uci_sport;
+    const char *uci_csum;
+    const char *uci_flows;
+    const char *uci_evict;
+    const char *uci_tcp_close;
+
+    uci_batch = uci_lookup_option_string(ctx, sect, "rx_batch_size");
+    if (uci_batch != NULL){
+        dplane_conf.rx_batch_size = strtol(uci_batch,NULL,10);
+    }
+    uci_queues = uci_lookup_option_string(ctx, sect, "tun_queues");
+    if (uci_queues != NULL){
+        dplane_conf.tun_queues = strtol(uci_queues,NULL,10);
+    }
+    uci_offload = uci_lookup_option_string(ctx, sect, "tun_offload");
+    if (uci_offload != NULL){
+        dplane_conf.tun_offload = (strcmp(uci_offload, "on") == 0) ? TRUE : FALSE;
+    }
+    uci_gso = uci_lookup_option_string(ctx, sect, "udp_gso");
+    if (uci_gso != NULL){
+        dplane_conf.udp_gso = (strcmp(uci_gso, "on") == 0) ? TRUE : FALSE;
+    }
+    uci_gro = uci_lookup_option_string(ctx, sect, "udp_gro");
+    if (uci_gro != NULL){
+        dplane_conf.udp_gro = (strcmp(uci_gro, "on") == 0) ? TRUE : FALSE;
+    }
+    uci_backend = uci_lookup_option_string(ctx, sect, "rx_backend");
+    if (uci_backend != NULL){
+        if (strcmp(uci_backend, "packet-ring") == 0){
+            dplane_conf.rx_backend = DPLANE_RX_PACKET_RING;
+        }else if (strcmp(uci_backend, "xdp") == 0){
+            dplane_conf.rx_backend = DPLANE_RX_XDP;
+        }else if (strcmp(uci_backend, "socket") != 0){
+            OOR_LOG(LWRN, "Unknown data plane rx backend: %s. Using socket",
+                    uci_backend);
+        }
+    }
+    uci_uring = uci_lookup_option_string(ctx, sect, "io_uring");
+    if (uci_uring != NULL){
+        dplane_conf.io_uring = (strcmp(uci_uring, "on") == 0) ? TRUE : FALSE;
+    }
+    uci_workers = uci_lookup_option_string(ctx, sect, "rtr_workers");
+    if (uci_workers != NULL){
+        dplane_conf.rtr_workers = strtol(uci_workers,NULL,10);
+    }
+    uci_thread = uci_lookup_option_string(ctx, sect, "data_plane_thread");
+    if (uci_thread != NULL){
+        dplane_conf.dplane_thread = (strcmp(uci_thread, "on") == 0) ? TRUE : FALSE;
+    }
+    uci_sport = uci_lookup_option_string(ctx, sect, "encap_src_port_min");
+    if (uci_sport != NULL){
+        dplane_conf.encap_sport_min = strtol(uci_sport,NULL,10);
+    }
+    uci_sport = uci_lookup_option_string(ctx, sect, "encap_src_port_max");
+    if (uci_sport != NULL){
+        dplane_conf.encap_sport_max = strtol(uci_sport,NULL,10);
+    }
+    uci_csum = uci_lookup_option_string(ctx, sect, "zero_udp_checksum_ipv4");
+    if (uci_csum != NULL){
+        dplane_conf.zero_udp_csum_v4 = (strcmp(uci_csum, "on") == 0) ? TRUE : FALSE;
+    }
+    uci_csum = uci_lookup_option_string(ctx, sect, "zero_udp_checksum_ipv6");
+    if (uci_csum != NULL){
+        dplane_conf.zero_udp_csum_v6 = (strcmp(uci_csum, "on") == 0) ? TRUE : FALSE;
+    }
+    uci_flows = uci_lookup_option_string(ctx, sect, "flow_cache_size");
+    if (uci_flows != NULL){
+        dplane_conf.flow_cache_size = strtol(uci_flows,NULL,10);
+    }
+    uci_flows = uci_lookup_option_string(ctx, sect, "flow_cache_memory");
+    if (uci_flows != NULL){
+        dplane_conf.flow_cache_mem = strtol(uci_flows,NULL,10);
+    }
+    uci_evict = uci_lookup_option_string(ctx, sect, "flow_cache_eviction");
+    if (uci_evict != NULL){
+        if (strcmp(uci_evict, "clock") == 0){
+            dplane_conf.flow_cache_evict = DPLANE_FLOW_EVICT_CLOCK;
+        }else if (strcmp(uci_evict, "lru") != 0){
+            OOR_LOG(LWRN, "Unknown data plane flow cache eviction: %s. "
+                    "Using lru", uci_evict);
+        }
+    }
+    uci_tcp_close = uci_lookup_option_string(ctx, sect, "flow_cache_tcp_close");
+    if (uci_tcp_close != NULL){
+        dplane_conf.flow_cache_tcp_close = (strcmp(uci_tcp_close, "on") == 0) ? TRUE : FALSE;
+    }
+    uci_flows = uci_lookup_option_string(ctx, sect, "flowlet_gap");
+    if (uci_flows != NULL){
+        dplane_conf.flowlet_gap = strtol(uci_flows,NULL,10);
+    }
+
+    validate_data_plane_parameters(&dplane_conf);
+}
+
+/* Name of the forwarding policy of the daemon section. NULL if not
+ * specified */
+static const char *
+parse_fwd_policy(struct uci_context *ctx, struct uci_package *pck)
+{
+    struct uci_element *element;
+    struct uci_section *sect;
+
+    uci_foreach_element(&pck->sections, element) {
+        sect = uci_to_section(element);
+        if (strcmp(sect->type, "daemon") == 0){
+            return (uci_lookup_option_string(ctx, sect, "forwarding_policy"));
+        }
+    }
+    return (NULL);
+}
@@ -29,8 +29,13 @@
 
 static int mc_entry_expiration_timer_cb(oor_timer_t *t);
 static void mc_entry_start_expiration_timer(lisp_xtr_t *, mcache_entry_t *);
-static int handle_locator_probe_reply(lisp_xtr_t *, mcache_entry_t *, lisp_addr_t *);
+static int handle_locator_probe_reply(lisp_xtr_t *, mcache_entry_t *, lisp_addr_t *,
+        int64_t rtt);
 static int update_mcache_entry(lisp_xtr_t *, mapping_t *);
+static void tr_mcache_update_fwd_info(lisp_xtr_t *xtr, mcache_entry_t *mce);
+static void tr_mcache_invalidate_fwd_info(lisp_xtr_t *xtr, mcache_entry_t *mce);
+static void tr_local_update_fwd_info(lisp_xtr_t *xtr, map_local_entry_t *mle);
+static void tr_mcache_invalidate_covering(lisp_xtr_t *xtr, lisp_addr_t *eid);
 static int tr_recv_map_reply(lisp_xtr_t *, lbuf_t *, uconn_t *);
 static int tr_reply_to_smr(lisp_xtr_t *xtr, lisp_addr_t *src_eid, lisp_addr_t *req_eid);
 static int tr_recv_map_request(lisp_xtr_t *, lbuf_t *, uconn_t *);
@@ -144,10 +149,11 @@ mc_entry_start_expiration_timer(lisp_xtr_t *xtr, mcache_entry_t *mce)
             mapping_ttl(mcache_entry_mapping(mce)));
 }
 
-/* Process a record from map-reply probe message */
+/* Process a record from map-reply probe message. 'rtt' is the time in us
+ * since the probe was sent, -1 if unknown */
 static int
 handle_locator_probe_reply(lisp_xtr_t *xtr, mcache_entry_t *mce,
-        lisp_addr_t *probed_addr)
+        lisp_addr_t *probed_addr, int64_t rtt)
 {
     locator_t * loct = NULL;
     mapping_t * map = NULL;
@@ -168,6 +174,13 @@ handle_locator_probe_reply(lisp_xtr_t *xtr, mcache_entry_t *mce,
                 lisp_addr_to_char(locator_addr(loct)),
                 lisp_addr_to_char(mapping_eid(map)));
 
+    if (rtt >= 0) {
+        locator_rtt_sample(loct, rtt > UINT32_MAX ? UINT32_MAX : (uint32_t)rtt);
+        OOR_LOG(LDBG_2," RTT of RLOC %s: %"PRId64" us (smoothed %u us, %u%% "
+                "of probes lost)", lisp_addr_to_char(locator_addr(loct)), rtt,
+                locator_srtt(loct),
+                locator_loss(loct) * 100 / LOCATOR_LOSS_SCALE);
+    }
 
     if (loct->state == DOWN) {
         loct->state = UP;
@@ -176,7 +189,11 @@ handle_locator_probe_reply(lisp_xtr_t *xtr, mcache_entry_t *mce,
                 lisp_addr_to_char(locator_addr(loct)));
 
         /* [re]Calculate forwarding info if status changed*/
-        xtr->fwd_policy->updated_map_cache_inf(xtr->fwd_policy_dev_parm,mce);
+        tr_mcache_update_fwd_info(xtr, mce);
+    } else if (rtt >= 0 && xtr->fwd_policy->updated_map_cache_rtt != NULL
+            && xtr->fwd_policy->updated_map_cache_rtt(xtr->fwd_policy_dev_parm, mce)) {
+        /* The policy selects the locators by their RTT */
+        tr_mcache_invalidate_fwd_info(xtr, mce);
     }
 
     /* Reprogramming timers of rloc probing */
@@ -212,7 +229,7 @@ update_mcache_entry(lisp_xtr_t *xtr, mapping_t *recv_map)
     mapping_update_locators(map, mapping_locators_lists(recv_map));
 
     /* Update forwarding info */
-    xtr->fwd_policy->updated_map_cache_inf(xtr->fwd_policy_dev_parm,mce);
+    tr_mcache_update_fwd_info(xtr, mce);
 
     /* Reprogramming timers */
     mc_entry_start_expiration_timer(xtr, mce);
@@ -229,6 +246,7 @@ tr_recv_map_reply(lisp_xtr_t *xtr, lbuf_t *buf, uconn_t *udp_con)
     void *mrep_hdr;
     locator_t *probed;
     lisp_addr_t *probed_addr;
+    int64_t rtt;
     mapping_t *m, *aux_m;
     lbuf_t b;
     mcache_entry_t *mce;
@@ -250,6 +268,7 @@ tr_recv_map_reply(lisp_xtr_t *xtr, lbuf_t *buf, uconn_t *udp_con)
         return(BAD);
     }
     timer = nonces_list_timer(nonces_lst);
+    rtt = nonces_list_elapsed(nonces_lst, MREP_NONCE(mrep_hdr));
     /* If it is not a Map Reply Probe */
     if (!MREP_RLOC_PROBE(mrep_hdr)){
         t_mr_arg = (timer_map_req_argument *)oor_timer_cb_argument(timer);
@@ -328,7 +347,7 @@ tr_recv_map_reply(lisp_xtr_t *xtr, lbuf_t *buf, uconn_t *udp_con)
                 }
             }
 
-            handle_locator_probe_reply(xtr, mce, probed_addr);
+            handle_locator_probe_reply(xtr, mce, probed_addr, rtt);
 
             /* No need to free 'probed' since it's a pointer to a locator in
              * of m's */
@@ -588,7 +607,7 @@ tr_update_nat_info(lisp_xtr_t *xtr, map_local_entry_t *mle, locator_t *loct,
     mle_nat_info_update(mle, loct, final_rtr_list);
 
     /* Update forwarding info of the local entry*/
-    xtr->fwd_policy->updated_map_loc_inf(xtr->fwd_policy_dev_parm,mle);
+    tr_local_update_fwd_info(xtr, mle);
 
     /* Update forwarding info of rtrs */
     tr_update_fwd_info_rtrs(xtr);
@@ -623,7 +642,7 @@ tr_update_fwd_info_rtrs(lisp_xtr_t *xtr)
     }local_map_db_foreach_end;
 
     /* Update forwarding info of rtrs */
-    xtr->fwd_policy->updated_map_cache_inf(xtr->fwd_policy_dev_parm,xtr->rtrs);
+    tr_mcache_update_fwd_info(xtr, xtr->rtrs);
 }
 
 glist_t *
@@ -713,7 +732,7 @@ handle_merge_semantics(lisp_xtr_t *xtr, mapping_t *rec_map)
         mapping_update_locators(map,mapping_locators_lists(rec_map));
 
         /* Update forward info*/
-        xtr->fwd_policy->updated_map_cache_inf(xtr->fwd_policy_dev_parm,mce);
+        tr_mcache_update_fwd_info(xtr, mce);
 
         program_mce_rloc_probing(xtr, mce);
 
@@ -1651,6 +1670,11 @@ rloc_probing_cb(oor_timer_t *timer)
     // XXX alopez -> What we have to do with ELP and probe bit
     drloc = xtr->fwd_policy->get_fwd_ip_addr(locator_addr(loct), ctrl_rlocs(xtr->super.ctrl));
 
+    /* The previous probe was not answered */
+    if (nonces_list_size(nonces_lst) > 0) {
+        locator_rtt_loss(loct);
+    }
+
     if ((nonces_list_size(nonces_lst) -1) < xtr->probe_retries){
         nonce = nonce_new();
         if (rloc_probing(xtr, map,loct,nonce) != GOOD){
@@ -1690,7 +1714,7 @@ rloc_probing_cb(oor_timer_t *timer)
                 mce = xtr->petrs;
             }
 
-            xtr->fwd_policy->updated_map_cache_inf(xtr->fwd_policy_dev_parm,mce);
+            tr_mcache_update_fwd_info(xtr, mce);
         }
 
         /* Reprogram time for next probe interval */
@@ -1784,6 +1808,50 @@ program_mce_rloc_probing(lisp_xtr_t *xtr, mcache_entry_t *mce)
 }
 
 
+/* Recalculate the forwarding information of the map cache entry. The flows
+ * cached by the data plane with the previous one are invalidated */
+static void
+tr_mcache_update_fwd_info(lisp_xtr_t *xtr, mcache_entry_t *mce)
+{
+    xtr->fwd_policy->updated_map_cache_inf(xtr->fwd_policy_dev_parm,mce);
+    tr_mcache_invalidate_fwd_info(xtr, mce);
+}
+
+/* Invalidate the flows cached by the data plane with the forwarding
+ * information of the map cache entry */
+static void
+tr_mcache_invalidate_fwd_info(lisp_xtr_t *xtr, mcache_entry_t *mce)
+{
+    /* The PeTRs and the RTRs are used by flows of any EID */
+    if (mce == xtr->petrs || mce == xtr->rtrs){
+        fwd_gen_invalidate_all();
+    }else{
+        fwd_gen_invalidate_map(mapping_eid(mcache_entry_mapping(mce)));
+    }
+}
+
+/* Recalculate the forwarding information of a local mapping. Any cached flow
+ * may use its locators */
+static void
+tr_local_update_fwd_info(lisp_xtr_t *xtr, map_local_entry_t *mle)
+{
+    xtr->fwd_policy->updated_map_loc_inf(xtr->fwd_policy_dev_parm,mle);
+    fwd_gen_invalidate_all();
+}
+
+/* The flows of a new mapping were forwarded according to the less specific
+ * one covering it, if any */
+static void
+tr_mcache_invalidate_covering(lisp_xtr_t *xtr, lisp_addr_t *eid)
+{
+    mcache_entry_t *mce;
+
+    mce = mcache_lookup(xtr->map_cache, eid);
+    if (mce){
+        fwd_gen_invalidate_map(mapping_eid(mcache_entry_mapping(mce)));
+    }
+}
+
 int
 tr_mcache_add_mapping(lisp_xtr_t *xtr, mapping_t *m)
 {
@@ -1805,6 +1873,7 @@ tr_mcache_add_mapping(lisp_xtr_t *xtr, mapping_t *m)
         return(BAD);
     }
 
+    tr_mcache_invalidate_covering(xtr, mapping_eid(m));
     if (mcache_add_entry(xtr->map_cache, mapping_eid(m), mce) != GOOD) {
         OOR_LOG(LDBG_1, "tr_mcache_add_mapping: Couldn't add map cache entry %s to data base!. Discarding it.",
                 lisp_addr_to_char(mapping_eid(m)));
@@ -1843,6 +1912,7 @@ tr_mcache_add_static_mapping(lisp_xtr_t *xtr, mapping_t *m)
         return(BAD);
     }
 
+    tr_mcache_invalidate_covering(xtr, mapping_eid(m));
     if (mcache_add_entry(xtr->map_cache, mapping_eid(m), mce) != GOOD) {
         OOR_LOG(LDBG_1, "tr_mcache_add_static_mapping: Couldn't add static map cache entry %s to data base!. Discarding it.",
                         lisp_addr_to_char(mapping_eid(m)));
@@ -1860,6 +1930,8 @@ tr_mcache_remove_entry(lisp_xtr_t *xtr, mcache_entry_t *mce)
     void *data = NULL;
     lisp_addr_t *eid = mapping_eid(mcache_entry_mapping(mce));
 
+    /* Including the flows waiting for the reply to a Map-Request */
+    fwd_gen_invalidate_map(eid);
     data = mcache_remove_entry(xtr->map_cache, eid);
     mcache_entry_del(data);
     mcache_dump_db(xtr->map_cache, LDBG_3);
@@ -1930,11 +2002,11 @@ xtr_if_link_update(oor_ctrl_dev_t *dev, char *iface_name, uint8_t status)
     /* Recalculate forwarding info of the affected mappings */
     glist_for_each_entry(it_m, if_loct->map_loc_entries){
         map_loc_e = (map_local_entry_t *)glist_entry_data(it_m);
-        xtr->fwd_policy->updated_map_loc_inf(xtr->fwd_policy_dev_parm,map_loc_e);
+        tr_local_update_fwd_info(xtr, map_loc_e);
     }
 
     if (xtr->super.mode == RTR_MODE && xtr->all_locs_map) {
-        xtr->fwd_policy->updated_map_loc_inf(xtr->fwd_policy_dev_parm,xtr->all_locs_map);
+        tr_local_update_fwd_info(xtr, xtr->all_locs_map);
     }
 
     xtr_iface_event_signaling(xtr, if_loct);
@@ -2008,7 +2080,7 @@ xtr_if_addr_update(oor_ctrl_dev_t *dev, char *iface_name, lisp_addr_t *old_addr,
             /* Activate locator */
             mapping_activate_locator(mapping,locator,new_addr);
             /* Recalculate forwarding info of the mappings with activated locators */
-            xtr->fwd_policy->updated_map_loc_inf(xtr->fwd_policy_dev_parm,map_loc_e);
+            tr_local_update_fwd_info(xtr, map_loc_e);
 
         }else{
             locator_clone_addr(locator,new_addr);
@@ -2037,7 +2109,7 @@ xtr_if_addr_update(oor_ctrl_dev_t *dev, char *iface_name, lisp_addr_t *old_addr,
     }
 
     if (xtr->super.mode == RTR_MODE && xtr->all_locs_map) {
-        xtr->fwd_policy->updated_map_loc_inf(xtr->fwd_policy_dev_parm,xtr->all_locs_map);
+        tr_local_update_fwd_info(xtr, xtr->all_locs_map);
     }
 
     xtr_iface_event_signaling(xtr, if_loct);
@@ -2310,7 +2382,7 @@ xtr_run(lisp_xtr_t *xtr)
                 "may prevent mobility in some scenarios.");
         oor_timer_sleep(2);
     } else {
-        xtr->fwd_policy->updated_map_cache_inf(xtr->fwd_policy_dev_parm,xtr->petrs);
+        tr_mcache_update_fwd_info(xtr, xtr->petrs);
     }
 
     /* Check configured parameters when NAT-T activated. */
@@ -2390,7 +2462,7 @@ xtr_run(lisp_xtr_t *xtr)
         /* Update forwarding info of the local mappings. When it is created during conf file process,
          * the local rlocs are not set. For this reason should be calculated again. It can not be removed
          * from the conf file process -> In future could appear fwd_map_info parameters*/
-        xtr->fwd_policy->updated_map_loc_inf(xtr->fwd_policy_dev_parm,map_loc_e);
+        tr_local_update_fwd_info(xtr, map_loc_e);
 
     } local_map_db_foreach_end;
 
@@ -2432,7 +2504,7 @@ rtr_run(lisp_xtr_t *xtr)
     if (xtr->all_locs_map) {
         mapping = map_local_entry_mapping(xtr->all_locs_map);
         OOR_LOG(LINF, "Active interfaces status");
-        xtr->fwd_policy->updated_map_loc_inf(xtr->fwd_policy_dev_parm,xtr->all_locs_map);
+        tr_local_update_fwd_info(xtr, xtr->all_locs_map);
         OOR_LOG(LINF, "%s", mapping_to_char(mapping));
     }
 }
@@ -2602,6 +2674,9 @@ tr_get_fwd_entry(lisp_xtr_t *xtr, packet_tuple_t *tuple)
         OOR_LOG(LDBG_1, "No map cache for EID %s. Sending Map-Request!",
                 lisp_addr_to_char(dst_eid));
         handle_map_cache_miss(xtr, dst_eid, src_eid);
+        /* The EID has been converted to the prefix of the temporary entry,
+         * which is removed when the reply arrives */
+        fwd_info_set_map_gen(fwd_info, dst_eid);
         /* If the EID is not from a iid net, try to fordward to the PeTR */
         if (lisp_addr_is_iid(dst_eid) == FALSE){
             if (mcache_has_locators(xtr->petrs) == FALSE){
@@ -2620,6 +2695,7 @@ tr_get_fwd_entry(lisp_xtr_t *xtr, packet_tuple_t *tuple)
             return (fwd_info);
         }
     } else if (mce->active == NOT_ACTIVE) {
+        fwd_info_set_map_gen(fwd_info, mapping_eid(mcache_entry_mapping(mce)));
         fwd_info->temporal = TRUE;
         OOR_LOG(LDBG_2, "Already sent Map-Request for %s. Waiting for reply!",
                 lisp_addr_to_char(dst_eid));
@@ -2643,6 +2719,9 @@ tr_get_fwd_entry(lisp_xtr_t *xtr, packet_tuple_t *tuple)
     }
 
     dmap = mcache_entry_mapping(mce);
+    if (mce != xtr->petrs && mce != xtr->rtrs){
+        fwd_info_set_map_gen(fwd_info, mapping_eid(dmap));
+    }
     if (mapping_locator_count(dmap) == 0) {
         OOR_LOG(LDBG_3, "Destination %s has a NEGATIVE mapping!",
                 lisp_addr_to_char(dst_eid));
@@ -22,6 +22,27 @@
 
 data_plane_struct_t *data_plane = NULL;
 
+dplane_conf_t dplane_conf = {
+        .rx_batch_size = DPLANE_DEFAULT_RX_BATCH,
+        .tun_queues = DPLANE_DEFAULT_TUN_QUEUES,
+        .tun_offload = FALSE,
+        .udp_gso = FALSE,
+        .udp_gro = FALSE,
+        .rx_backend = DPLANE_RX_SOCKET,
+        .io_uring = FALSE,
+        .rtr_workers = DPLANE_DEFAULT_RTR_WORKERS,
+        .dplane_thread = FALSE,
+        .encap_sport_min = 0,
+        .encap_sport_max = 0,
+        .zero_udp_csum_v4 = FALSE,
+        .zero_udp_csum_v6 = FALSE,
+        .flow_cache_size = DPLANE_DEFAULT_FLOW_CACHE,
+        .flow_cache_mem = 0,
+        .flow_cache_evict = DPLANE_FLOW_EVICT_LRU,
+        .flow_cache_tcp_close = FALSE,
+        .flowlet_gap = 0
+};
+
 void data_plane_select()
 {
 #ifdef VPNAPI
@@ -30,3 +51,15 @@ void data_plane_select()
     data_plane = &dplane_tun;
 #endif
 }
+
+/* Switch to the backend requested in the configuration file. It should be
+ * called once the file has been parsed, before datap_init */
+void
+data_plane_select_from_conf()
+{
+#if !defined(VPNAPI) && !defined(ANDROID)
+    if (dplane_conf.rx_backend == DPLANE_RX_XDP){
+        data_plane = &dplane_xdp;
+    }
+#endif
+}
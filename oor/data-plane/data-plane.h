@@ -24,6 +24,74 @@
 typedef struct iface iface_t;
 typedef struct sock sock_t;
 
+/* Number of packets drained from a data input socket per wakeup */
+#define DPLANE_DEFAULT_RX_BATCH     32
+#define DPLANE_MAX_RX_BATCH         256
+/* Number of tun queues, each one processed by its own worker thread */
+#define DPLANE_DEFAULT_TUN_QUEUES   1
+#define DPLANE_MAX_TUN_QUEUES       16
+/* Number of threads decapsulating and re-encapsulating packets in RTR mode */
+#define DPLANE_DEFAULT_RTR_WORKERS  1
+#define DPLANE_MAX_RTR_WORKERS      16
+/* Lowest source port of the encapsulated packets when it is derived from the
+ * hash of the inner flow */
+#define DPLANE_MIN_ENCAP_SPORT      1024
+/* Number of flows of the flow cache of each output context */
+#define DPLANE_DEFAULT_FLOW_CACHE   16384
+#define DPLANE_MAX_FLOW_CACHE       (1 << 24)
+/* Memory in MB of the flow cache of each output context, enough for the
+ * maximum number of flows */
+#define DPLANE_MAX_FLOW_CACHE_MEM   2048
+/* Maximum idle time in ms of a flow before its next packets start a new
+ * flowlet */
+#define DPLANE_MAX_FLOWLET_GAP      10000
+
+/* Backends used to receive the encapsulated packets */
+typedef enum {
+    DPLANE_RX_SOCKET,
+    DPLANE_RX_PACKET_RING,
+    /* AF_XDP sockets on the RLOC interfaces. Selects the dplane_xdp backend */
+    DPLANE_RX_XDP
+} dplane_rx_backend_e;
+
+/* Flow replaced when the slot of a new flow in the flow cache is full */
+typedef enum {
+    DPLANE_FLOW_EVICT_LRU,
+    DPLANE_FLOW_EVICT_CLOCK
+} dplane_flow_evict_e;
+
+/* Tuning parameters of the data plane obtained from the configuration file.
+ * They should be filled before calling datap_init */
+typedef struct dplane_conf_ {
+    int rx_batch_size;
+    int tun_queues;
+    int tun_offload;
+    int udp_gso;
+    int udp_gro;
+    dplane_rx_backend_e rx_backend;
+    int io_uring;
+    int rtr_workers;
+    /* Serve the data plane from its own thread instead of the main loop */
+    int dplane_thread;
+    /* Range of the outer UDP source ports selected by the hash of the inner
+     * flow. 0 to use the data port */
+    int encap_sport_min;
+    int encap_sport_max;
+    /* Send the encapsulated packets with a zero UDP checksum */
+    int zero_udp_csum_v4;
+    int zero_udp_csum_v6;
+    int flow_cache_size;
+    /* Memory in MB of the flow cache. When not 0, the size of the cache is
+     * the number of flows that fit in it */
+    int flow_cache_mem;
+    dplane_flow_evict_e flow_cache_evict;
+    /* Expire the cached TCP flows once a FIN or RST is seen */
+    int flow_cache_tcp_close;
+    /* Idle time in ms after which the locators of a flow are selected again
+     * for its next packets. 0 to keep them for the whole flow */
+    int flowlet_gap;
+} dplane_conf_t;
+
 /* functions to manipulate routing */
 typedef struct data_plane_struct {
     int (*datap_init)(oor_dev_type_e dev_type, oor_encap_t encap_type,  ...);
@@ -43,9 +111,13 @@ typedef struct data_plane_struct {
 } data_plane_struct_t;
 
 void data_plane_select();
+void data_plane_select_from_conf();
+
+extern dplane_conf_t dplane_conf;
 
 extern data_plane_struct_t dplane_tun;
 extern data_plane_struct_t dplane_vpnapi;
+extern data_plane_struct_t dplane_xdp;
 
 
 #endif /* DATA_PLANE_H_ */
@@ -73,6 +73,19 @@ vxlan_gpe_data_encap(lbuf_t *b, int lp, int rp, lisp_addr_t *la, lisp_addr_t *ra
     return(lbuf_data(b));
 }
 
+/* Prebuild the headers pushed by vxlan_gpe_data_encap. The next protocol
+ * is the one of the inner packets */
+int
+vxlan_gpe_data_outer_hdr_init(pkt_outer_hdr_t *oh, int lp, int rp,
+        lisp_addr_t *la, lisp_addr_t *ra, uint32_t vni, vxlan_gpe_nprot_t np)
+{
+    vxlan_gpe_hdr_t vhdr;
+
+    vxlan_gpe_data_hdr_init(&vhdr, vni, np);
+    return (pkt_outer_hdr_init(oh, lisp_addr_ip(la), lisp_addr_ip(ra), lp, rp,
+            &vhdr, sizeof(vxlan_gpe_hdr_t)));
+}
+
 void *
 vxlan_gpe_data_pull_hdr(lbuf_t *b)
 {
@@ -22,6 +22,7 @@
 
 #include "../../lib/lbuf.h"
 #include "../../lib/mem_util.h"
+#include "../../lib/packets.h"
 #include "../../liblisp/lisp_address.h"
 
 #define VXLAN_GPE_DATA_PORT  4790
@@ -72,6 +73,8 @@
 void * vxlan_gpe_data_push_hdr(lbuf_t *b, uint32_t vni, vxlan_gpe_nprot_t np);
 void * vxlan_gpe_data_encap(lbuf_t *b, int lp, int rp, lisp_addr_t *la, lisp_addr_t *ra,
         uint32_t vni);
+int vxlan_gpe_data_outer_hdr_init(pkt_outer_hdr_t *oh, int lp, int rp,
+        lisp_addr_t *la, lisp_addr_t *ra, uint32_t vni, vxlan_gpe_nprot_t np);
 void * vxlan_gpe_data_pull_hdr(lbuf_t *b);
 
 uint32_t vxlan_gpe_hdr_get_vni(vxlan_gpe_hdr_t *hdr);
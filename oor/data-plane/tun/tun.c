@@ -25,10 +25,14 @@
 #include "tun.h"
 #include "tun_input.h"
 #include "tun_output.h"
+#include "tun_thread.h"
+#include "tun_uring.h"
 #include "../data-plane.h"
 #include "../../oor_external.h"
+#include "../../fwd_policies/fwd_policy.h"
 #include "../../lib/oor_log.h"
 #include "../../lib/routing_tables_lib.h"
+#include "../../lib/sockets-util.h"
 
 
 int tun_configure_data_plane(oor_dev_type_e dev_type, oor_encap_t encap_type, ...);
@@ -40,7 +44,8 @@ int tun_remove_eid_prefix(oor_dev_type_e dev_type, lisp_addr_t *eid_prefix);
 int configure_routing_to_tun_router(int afi);
 //int configure_routing_to_tun_mn(lisp_addr_t *eid_addr);
 int remove_routing_to_tun_mn(lisp_addr_t *eid_addr);
-int create_tun();
+int create_tun(int queues, int offload);
+int tun_open_data_input_socket(int afi, int port, int udp_gro);
 int configure_routing_to_tun_mn(lisp_addr_t *eid_addr);
 int tun_bring_up_iface();
 int tun_add_eid_to_iface(lisp_addr_t *addr);
@@ -60,6 +65,14 @@ void tun_set_default_output_ifaces();
 void tun_iface_remove_routing_rules(iface_t *iface);
 
 
+/* File descriptors of the queues of the tun interface. The first one is
+ * tun_receive_fd */
+static int tun_queue_fds[DPLANE_MAX_TUN_QUEUES];
+static int tun_num_queues;
+/* Size of the virtio header of the packets exchanged with the tun interface.
+ * Only used when offloads are enabled */
+static int tun_vnet_hdr_len;
+
 data_plane_struct_t dplane_tun = {
         .datap_init = tun_configure_data_plane,
         .datap_uninit = tun_uninit_data_plane,
@@ -83,31 +96,62 @@ int
 tun_configure_data_plane(oor_dev_type_e dev_type, oor_encap_t encap_type, ...)
 {
     int (*cb_func)(sock_t *) = NULL;
+    int (*ring_cb_func)(sock_t *) = NULL;
     int ipv4_data_input_fd = -1;
     int ipv6_data_input_fd = -1;
+    int ring_fd;
     int data_port;
+    int data_fds[2];
+    int ndata_fds = 0;
+    int tun_read_fd;
+    int num_queues, offload, udp_gro, i;
+    int sock_flags = 0;
     tun_dplane_data_t *data;
+    sockmstr_t *dp_master;
 
     /* Configure data plane */
-    if (create_tun() <= BAD){
+    /* Only xTRs and MNs read packets from the tun interface */
+    /* RTRs re-encapsulate the received packets in place, so they can not
+     * use the coalesced buffers of UDP GRO */
+    if (dev_type == RTR_MODE){
+        num_queues = 1;
+        offload = FALSE;
+        udp_gro = FALSE;
+    }else{
+        num_queues = dplane_conf.tun_queues;
+        offload = dplane_conf.tun_offload;
+        udp_gro = dplane_conf.udp_gro;
+    }
+
+    if (create_tun(num_queues, offload) <= BAD){
         return (BAD);
     }
 
+    /* Packets are read from the tun interface and the data sockets in
+     * batches until no more packets are pending */
+    if (dplane_conf.rx_batch_size > 1){
+        for (i = 0; i < tun_num_queues; i++){
+            fcntl(tun_queue_fds[i], F_SETFL, fcntl(tun_queue_fds[i], F_GETFL) | O_NONBLOCK);
+        }
+        sock_flags = SOCK_EDGE_TRIGGERED;
+    }
+
     switch (dev_type){
     case MN_MODE:
-        sockmstr_register_read_listener(smaster, tun_output_recv, NULL,tun_receive_fd);
         cb_func = tun_process_input_packet;
+        ring_cb_func = tun_ring_process_input_packet;
         break;
     case xTR_MODE:
         /* We add route tables for IPv4 and IPv6 even no EID exists for this afi*/
         /* Rules created for EID will redirect traffic to this table*/
         configure_routing_to_tun_router(AF_INET);
         configure_routing_to_tun_router(AF_INET6);
-        sockmstr_register_read_listener(smaster, tun_output_recv, NULL,tun_receive_fd);
         cb_func = tun_process_input_packet;
+        ring_cb_func = tun_ring_process_input_packet;
         break;
     case RTR_MODE:
         cb_func = tun_rtr_process_input_packet;
+        ring_cb_func = tun_rtr_ring_process_input_packet;
         break;
     default:
         return (BAD);
@@ -124,22 +168,91 @@ tun_configure_data_plane(oor_dev_type_e dev_type, oor_encap_t encap_type, ...)
         return (BAD);
     }
 
-    /* Generate receive sockets for data port (4341) */
-    if (default_rloc_afi != AF_INET6) {
-        ipv4_data_input_fd = open_data_raw_input_socket(AF_INET, data_port);
-        sockmstr_register_read_listener(smaster, cb_func, NULL,
-                ipv4_data_input_fd);
+    /* The other backends provide whole IP packets, which can not be mixed
+     * with the coalesced datagrams of UDP GRO in the rx ring */
+    if (dplane_conf.rx_backend != DPLANE_RX_SOCKET) {
+        udp_gro = FALSE;
     }
 
-    if (default_rloc_afi != AF_INET) {
-        ipv6_data_input_fd = open_data_raw_input_socket(AF_INET6, data_port);
-        sockmstr_register_read_listener(smaster, cb_func, NULL,
-                ipv6_data_input_fd);
-    }
     data = xmalloc(sizeof(tun_dplane_data_t));
     data->encap_type = encap_type;
     dplane_tun.datap_data = (void *)data;
-    tun_output_init();
+    tun_input_init(dplane_conf.rx_batch_size, udp_gro, data_port);
+    tun_output_init(dplane_conf.rx_batch_size);
+
+    /* The data plane thread serves the descriptors of the data plane with
+     * its own socket master */
+    dp_master = smaster;
+    if (dplane_conf.dplane_thread) {
+        dp_master = tun_thread_init();
+        if (!dp_master) {
+            OOR_LOG(LWRN, "Data plane: The data plane thread could not be "
+                    "used. Using the main loop");
+            dp_master = smaster;
+        }
+    }
+
+    /* With several RTR workers, each one receives the data packets from its
+     * own SO_REUSEPORT sockets and the main loop doesn't open any */
+    if (dev_type == RTR_MODE && dplane_conf.rtr_workers > 1
+            && tun_input_rtr_workers_start(dplane_conf.rtr_workers,
+                    data_port) == GOOD) {
+        OOR_LOG(LDBG_1, "Data plane: Data packets received by the RTR workers");
+    } else if (dplane_conf.rx_backend == DPLANE_RX_PACKET_RING) {
+        /* A single packet socket receives the data packets of both afis */
+        ring_fd = tun_input_ring_init(data_port);
+        if (ring_fd == ERR_SOCKET) {
+            return (BAD);
+        }
+        sockmstr_register_read_listener_flags(dp_master, ring_cb_func, NULL,
+                ring_fd, sock_flags);
+    } else {
+        /* Generate receive sockets for data port (4341). With AF_XDP they
+         * get the packets of the interfaces without an XDP program */
+        if (default_rloc_afi != AF_INET6) {
+            ipv4_data_input_fd = tun_open_data_input_socket(AF_INET, data_port, udp_gro);
+            data_fds[ndata_fds++] = ipv4_data_input_fd;
+        }
+
+        if (default_rloc_afi != AF_INET) {
+            ipv6_data_input_fd = tun_open_data_input_socket(AF_INET6, data_port, udp_gro);
+            data_fds[ndata_fds++] = ipv6_data_input_fd;
+        }
+    }
+
+    /* Only xTRs and MNs read packets from the tun interface. With several
+     * queues, they are read by the worker threads */
+    tun_read_fd = (dev_type != RTR_MODE && tun_num_queues == 1) ? tun_receive_fd : -1;
+    if (!dplane_conf.io_uring || (ndata_fds == 0 && tun_read_fd == -1)
+            || tun_uring_init(data_fds, ndata_fds,
+            tun_read_fd, dev_type == RTR_MODE, dplane_conf.rx_batch_size,
+            udp_gro, cb_func, sock_flags) != GOOD){
+        if (dplane_conf.io_uring && (ndata_fds > 0 || tun_read_fd != -1)){
+            OOR_LOG(LWRN, "Data plane: io_uring could not be used. Using the "
+                    "socket master");
+        }
+        for (i = 0; i < ndata_fds; i++){
+            sockmstr_register_read_listener_flags(dp_master, cb_func, NULL,
+                    data_fds[i], sock_flags);
+        }
+        if (tun_read_fd != -1){
+            sockmstr_register_read_listener_flags(dp_master, tun_output_recv, NULL,
+                    tun_read_fd, sock_flags);
+        }
+    }
+
+    if (dp_master != smaster && tun_thread_start() != GOOD){
+        return (BAD);
+    }
+
+    /* With a multi queue tun interface, each queue is processed by its own
+     * worker thread instead of the main loop */
+    if (tun_num_queues > 1){
+        if (tun_output_workers_start(tun_queue_fds, tun_num_queues,
+                dplane_conf.rx_batch_size) != GOOD){
+            return (BAD);
+        }
+    }
 
     /* Select the default rlocs for output data packets and output control
      * packets */
@@ -155,6 +268,7 @@ tun_uninit_data_plane()
     tun_dplane_data_t *data = (tun_dplane_data_t *)dplane_tun.datap_data;
     glist_entry_t *iface_it;
     iface_t *iface;
+    int i;
 
     if (data){
         /* Remove routes associated to each interface */
@@ -163,7 +277,14 @@ tun_uninit_data_plane()
             tun_iface_remove_routing_rules(iface);
         }
 
+        tun_thread_stop();
+        tun_uring_uninit();
+        tun_input_uninit();
         tun_output_uninit();
+        for (i = 1; i < tun_num_queues; i++){
+            close(tun_queue_fds[i]);
+        }
+        tun_num_queues = 0;
         free(data);
     }
 }
@@ -206,6 +327,7 @@ tun_add_datap_iface_addr(iface_t *iface, int afi)
         }
         break;
     }
+    tun_input_ring_update_addrs();
 
     return (GOOD);
 }
@@ -286,13 +408,67 @@ tun_remove_eid_prefix(oor_dev_type_e dev_type, lisp_addr_t *eid_prefix){
 
 
 int
-create_tun()
+tun_get_vnet_hdr_len()
+{
+    return (tun_vnet_hdr_len);
+}
+
+/* Open the socket used to receive the encapsulated packets of the afi. With
+ * UDP GRO, a datagram socket that coalesces the datagrams of the same flow is
+ * used instead of a raw one */
+int
+tun_open_data_input_socket(int afi, int port, int udp_gro)
+{
+    int sock;
+
+    if (!udp_gro){
+        return (open_data_raw_input_socket(afi, port));
+    }
+
+    sock = open_data_datagram_input_socket(afi, port);
+    if (sock == ERR_SOCKET){
+        return (ERR_SOCKET);
+    }
+    /* Without kernel support, datagrams are received one by one */
+    socket_conf_udp_gro(sock);
+
+    return (sock);
+}
+
+/* Let the kernel deliver TCP super-packets of up to 64 KB and packets with
+ * the checksum to be completed through the queue 'fd'. They are segmented
+ * after looking up the forwarding information. Applied to every queue, so
+ * that all of them deliver the virtio header whatever the kernel keeps per
+ * device or per queue */
+static void
+tun_set_offload(int fd)
+{
+    if (ioctl(fd, TUNSETVNETHDRSZ, &tun_vnet_hdr_len) < 0){
+        OOR_LOG(LWRN, "TUN/TAP: Failed to set the virtio header size, errno: %d.", errno);
+    }
+    if (ioctl(fd, TUNSETOFFLOAD, TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6) < 0){
+        OOR_LOG(LWRN, "TUN/TAP: Failed to enable offloads, errno: %d.", errno);
+    }else{
+        OOR_LOG(LDBG_1, "TUN/TAP: Checksum and TSO offloads enabled on fd %d", fd);
+    }
+}
+
+int
+create_tun(int queues, int offload)
 {
     struct ifreq ifr;
     int err = 0;
     int tmpsocket = 0;
     int flags = IFF_TUN | IFF_NO_PI; // Create a tunnel without persistence
     char *clonedev = CLONEDEV;
+    int i;
+
+    if (queues > 1){
+        flags |= IFF_MULTI_QUEUE;
+    }
+    if (offload){
+        flags |= IFF_VNET_HDR;
+    }
 
 
     /* Arguments taken by the function:
@@ -323,6 +499,12 @@ create_tun()
         return(BAD);
     }
 
+    tun_vnet_hdr_len = 0;
+    if (offload){
+        tun_vnet_hdr_len = sizeof(struct virtio_net_hdr);
+        tun_set_offload(tun_receive_fd);
+    }
+
     // get the ifindex for the tun/tap
     tmpsocket = socket(AF_INET, SOCK_DGRAM, 0); // Dummy socket for the ioctl, type/details unimportant
     if ((err = ioctl(tmpsocket, SIOCGIFINDEX, (void *)&ifr)) < 0) {
@@ -348,6 +530,35 @@ create_tun()
 
     close(tmpsocket);
 
+    /* Open the rest of queues of the interface. The first queue is
+     * tun_receive_fd */
+    tun_queue_fds[0] = tun_receive_fd;
+    tun_num_queues = 1;
+    for (i = 1; i < queues; i++){
+        if ((tun_queue_fds[i] = open(clonedev, O_RDWR)) < 0 ){
+            OOR_LOG(LERR, "TUN/TAP: Failed to open clone device for queue %d", i);
+            break;
+        }
+        /* The flags share the union of ifr with the ifindex and the MTU
+         * obtained above */
+        memset(&ifr, 0, sizeof(ifr));
+        ifr.ifr_flags = flags;
+        strncpy(ifr.ifr_name, TUN_IFACE_NAME, IFNAMSIZ - 1);
+        if ((err = ioctl(tun_queue_fds[i], TUNSETIFF, (void *) &ifr)) < 0) {
+            OOR_LOG(LERR, "TUN/TAP: Failed to attach queue %d to the tunnel "
+                    "interface, errno: %d.", i, errno);
+            close(tun_queue_fds[i]);
+            break;
+        }
+        if (offload){
+            tun_set_offload(tun_queue_fds[i]);
+        }
+        tun_num_queues++;
+    }
+    if (tun_num_queues != queues){
+        OOR_LOG(LWRN, "TUN/TAP: Using %d queues instead of %d", tun_num_queues, queues);
+    }
+
     tun_receive_buf = (uint8_t *)malloc(TUN_RECEIVE_SIZE);
 
     if (tun_receive_buf == NULL){
@@ -956,6 +1167,8 @@ tun_updated_addr(iface_t *iface, lisp_addr_t *old_addr, lisp_addr_t *new_addr)
     bind_socket(sckt, new_addr_ip_afi, new_addr,0);
 
     lisp_addr_copy(iface_addr, new_addr);
+    tun_input_ring_update_addrs();
+    fwd_gen_invalidate_all();
 
     return (GOOD);
 }
@@ -999,6 +1212,7 @@ tun_updated_link(iface_t *iface, int old_iface_index, int new_iface_index,
 
     /* Change status of the interface */
     iface->status = status;
+    fwd_gen_invalidate_all();
 
     if (data->default_out_iface_v4 == iface
             || data->default_out_iface_v6 == iface
@@ -27,6 +27,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <linux/if_tun.h>
+#include <linux/virtio_net.h>
 #include "../encapsulations/vxlan-gpe.h"
 #include "../../liblisp/liblisp.h"
 
@@ -40,6 +41,9 @@
 #define TUN_IFACE_NAME          "lispTun0"
 
 #define TUN_RECEIVE_SIZE        2048 // Should probably tune to match largest MTU
+/* With offloads enabled, the tun interface provides packets of up to 64 KB
+ * preceded by a virtio header */
+#define TUN_GSO_RECEIVE_SIZE    (LBUF_STACK_OFFSET + sizeof(struct virtio_net_hdr) + 65535)
 
 /*
  * From section 5.4.1 of LISP RFC (6830)
@@ -76,6 +80,7 @@ uint8_t *tun_receive_buf;
 
 lisp_addr_t * tun_get_default_output_address(int afi);
 int tun_get_default_output_socket(int);
+int tun_get_vnet_hdr_len();
 
 typedef struct iface iface_t;
 
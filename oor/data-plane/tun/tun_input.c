@@ -19,53 +19,307 @@
 
 #include <string.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 #include "tun.h"
 #include "tun_input.h"
 #include "tun_output.h"
+#include "tun_uring.h"
 #include "../../lib/packets.h"
 #include "../../lib/mem_util.h"
+#include "../../lib/sockets-util.h"
+#include "../../lib/timers.h"
 #include "../../liblisp/liblisp.h"
 #include "../../lib/oor_log.h"
 
-/* static buffer to receive packets */
-static uint8_t pkt_recv_buf[MAX_IP_PKT_LEN+1];
-static lbuf_t pkt_buf;
+/* Maximum number of datagrams coalesced by the kernel in a buffer received
+ * with UDP GRO, and size of the buffer */
+#define TUN_GRO_MAX_SEGS        64
+#define TUN_GRO_RECEIVE_SIZE    (LBUF_STACK_OFFSET + 65535)
 
-int
-tun_read_and_decap_pkt(int sock, lbuf_t *b, uint32_t *iid)
+/* Interval between logs of the data input counters (seconds) */
+#define TUN_INPUT_STATS_INTERVAL    300
+
+/* Time a worker of the RTR waits for packets before checking if it should
+ * finish (ms) */
+#define TUN_RTR_WORKER_POLL_TIMEOUT 1000
+
+/* Counters of the data input sockets. The datagrams discarded by the socket
+ * filter of the raw sockets never reach OOR, so they are estimated from the
+ * UDP counters of the host */
+typedef struct tun_input_stats_ {
+    uint64_t pkts;
+    uint64_t bytes;
+    uint64_t not_encap;
+} tun_input_stats_t;
+
+/* Ring of preallocated buffers used to drain the data input sockets in
+ * batches. Every buffer can hold a packet of MAX_IP_PKT_LEN bytes, or a
+ * buffer of coalesced datagrams when UDP GRO is used */
+typedef struct tun_rx_ring_ {
+    uint8_t *mem;
+    lbuf_t *bufs;
+    data_recv_md_t *md;
+    int buf_len;
+    int size;
+    /* Packets obtained from the received buffers, with the result of their
+     * decapsulation. With UDP GRO each buffer may hold several packets */
+    lbuf_t *pkts;
+    uint32_t *iid;
+    int *status;
+    int max_pkts;
+    /* Data is received through datagram sockets, with UDP GRO or bound to
+     * the port with other sockets. Buffers hold the payload of the outer UDP
+     * datagrams sent to data_port */
+    uint8_t dgram;
+    uint8_t udp_gro;
+    int data_port;
+    /* Context used to re-encapsulate the packets. NULL for the one of the
+     * main loop */
+    tun_output_ctx_t *out;
+    tun_input_stats_t stats;
+} tun_rx_ring_t;
+
+static tun_rx_ring_t rx_ring;
+
+/* Worker thread of the RTR, with its own data sockets sharing the data port,
+ * rx ring and output context */
+typedef struct tun_rtr_worker_ {
+    tun_rx_ring_t ring;
+    int socks[2];
+    int nsocks;
+    pthread_t thread;
+} tun_rtr_worker_t;
+
+static tun_rtr_worker_t *rtr_workers;
+static int num_rtr_workers;
+static volatile int rtr_workers_running;
+
+static uint64_t host_udp_base;
+static oor_timer_t *stats_timer;
+
+/* Receive ring of the packet socket backend. The UDP sockets bound to the
+ * data port only avoid ICMP port unreachable messages */
+static pkt_ring_t *data_ring;
+static int data_ring_port;
+static int ring_dummy_socks[2] = {ERR_SOCKET, ERR_SOCKET};
+
+/* Empty virtio header written before each packet when the tun interface has
+ * offloads enabled */
+static uint8_t tun_empty_vnet_hdr[sizeof(struct virtio_net_hdr_mrg_rxbuf)];
+
+static int tun_decap_pkt(tun_rx_ring_t *ring, lbuf_t *b, data_recv_md_t *md,
+        uint32_t *iid);
+static int tun_read_and_decap_batch(tun_rx_ring_t *ring, int sock,
+        uint32_t headroom);
+static void tun_input_forward_pkts(tun_rx_ring_t *ring, int npkts);
+static void tun_input_rtr_workers_stop();
+static uint64_t tun_host_udp_in_datagrams();
+static int tun_input_stats_cb(oor_timer_t *timer);
+
+static void
+tun_rx_ring_init(tun_rx_ring_t *ring, int batch_size, int dgram, int udp_gro,
+        int data_port)
+{
+    if (batch_size < 1) {
+        batch_size = 1;
+    } else if (batch_size > DPLANE_MAX_RX_BATCH) {
+        batch_size = DPLANE_MAX_RX_BATCH;
+    }
+
+    memset(ring, 0, sizeof(tun_rx_ring_t));
+    ring->dgram = dgram;
+    ring->udp_gro = udp_gro;
+    ring->data_port = data_port;
+    ring->size = batch_size;
+    ring->buf_len = udp_gro ? TUN_GRO_RECEIVE_SIZE : MAX_IP_PKT_LEN;
+    ring->max_pkts = udp_gro ? batch_size * TUN_GRO_MAX_SEGS : batch_size;
+    ring->mem = xmalloc(batch_size * ring->buf_len);
+    ring->bufs = xzalloc(batch_size * sizeof(lbuf_t));
+    ring->md = xzalloc(batch_size * sizeof(data_recv_md_t));
+    ring->pkts = xzalloc(ring->max_pkts * sizeof(lbuf_t));
+    ring->iid = xzalloc(ring->max_pkts * sizeof(uint32_t));
+    ring->status = xzalloc(ring->max_pkts * sizeof(int));
+}
+
+static void
+tun_rx_ring_uninit(tun_rx_ring_t *ring)
+{
+    free(ring->mem);
+    free(ring->bufs);
+    free(ring->md);
+    free(ring->pkts);
+    free(ring->iid);
+    free(ring->status);
+    memset(ring, 0, sizeof(tun_rx_ring_t));
+}
+
+/* With 'udp_gro', the data input sockets are datagram sockets bound to
+ * 'data_port' that may return several coalesced datagrams per buffer */
+void
+tun_input_init(int batch_size, int udp_gro, int data_port)
+{
+    tun_rx_ring_init(&rx_ring, batch_size, udp_gro, udp_gro, data_port);
+
+    OOR_LOG(LDBG_1, "Data input: receiving up to %d %s per wakeup",
+            rx_ring.size, udp_gro ? "buffers of coalesced datagrams" : "packets");
+
+    host_udp_base = tun_host_udp_in_datagrams();
+    stats_timer = oor_timer_create(DATA_PLANE_STATS_TIMER);
+    oor_timer_init(stats_timer, NULL, tun_input_stats_cb, NULL, NULL, NULL);
+    oor_timer_start(stats_timer, TUN_INPUT_STATS_INTERVAL);
+}
+
+void
+tun_input_uninit()
+{
+    int i;
+
+    if (stats_timer) {
+        tun_input_log_stats();
+        tun_output_log_stats();
+        oor_timer_stop(stats_timer);
+        stats_timer = NULL;
+    }
+    tun_input_rtr_workers_stop();
+    pkt_ring_close(data_ring);
+    data_ring = NULL;
+    for (i = 0; i < 2; i++) {
+        if (ring_dummy_socks[i] != ERR_SOCKET) {
+            close(ring_dummy_socks[i]);
+            ring_dummy_socks[i] = ERR_SOCKET;
+        }
+    }
+    tun_rx_ring_uninit(&rx_ring);
+}
+
+/* Number of UDP datagrams received by the host according to the SNMP
+ * counters of the kernel. Raw UDP sockets get a copy of all of them */
+static uint64_t
+tun_host_udp_in_datagrams()
+{
+    FILE *f;
+    char line[512];
+    char name[64];
+    unsigned long long in, noports, errors, val;
+    uint64_t total = 0;
+    int header = TRUE;
+
+    /* The first "Udp:" line has the names of the fields and the second one
+     * their values */
+    if ((f = fopen("/proc/net/snmp", "r")) != NULL) {
+        while (fgets(line, sizeof(line), f) != NULL) {
+            if (strncmp(line, "Udp:", 4) != 0) {
+                continue;
+            }
+            if (header) {
+                header = FALSE;
+                continue;
+            }
+            if (sscanf(line + 4, "%llu %llu %llu", &in, &noports, &errors) == 3) {
+                total += in + noports + errors;
+            }
+            break;
+        }
+        fclose(f);
+    }
+
+    if ((f = fopen("/proc/net/snmp6", "r")) != NULL) {
+        while (fgets(line, sizeof(line), f) != NULL) {
+            if (sscanf(line, "%63s %llu", name, &val) != 2) {
+                continue;
+            }
+            if (strcmp(name, "Udp6InDatagrams") == 0
+                    || strcmp(name, "Udp6NoPorts") == 0
+                    || strcmp(name, "Udp6InErrors") == 0) {
+                total += val;
+            }
+        }
+        fclose(f);
+    }
+
+    return (total);
+}
+
+void
+tun_input_log_stats()
+{
+    tun_input_stats_t total = rx_ring.stats;
+    uint64_t host_pkts;
+    int i;
+
+    /* The counters of the workers are read without synchronization */
+    for (i = 0; i < num_rtr_workers; i++) {
+        total.pkts += rtr_workers[i].ring.stats.pkts;
+        total.bytes += rtr_workers[i].ring.stats.bytes;
+        total.not_encap += rtr_workers[i].ring.stats.not_encap;
+    }
+
+    OOR_LOG(LDBG_1, "Data input: %llu packets (%llu bytes) received, %llu of "
+            "them not encapsulated", (unsigned long long)total.pkts,
+            (unsigned long long)total.bytes,
+            (unsigned long long)total.not_encap);
+
+    /* Datagram sockets only get the datagrams sent to the data port */
+    if (rx_ring.dgram || num_rtr_workers > 0) {
+        return;
+    }
+    host_pkts = tun_host_udp_in_datagrams() - host_udp_base;
+    OOR_LOG(LDBG_1, "Data input: %llu UDP datagrams of the host discarded by "
+            "the socket filter (estimated)", host_pkts > total.pkts ?
+            (unsigned long long)(host_pkts - total.pkts) : 0ULL);
+}
+
+static int
+tun_input_stats_cb(oor_timer_t *timer)
+{
+    tun_input_log_stats();
+    tun_output_log_stats();
+    oor_timer_start(timer, TUN_INPUT_STATS_INTERVAL);
+    return (GOOD);
+}
+
+static int
+tun_decap_pkt(tun_rx_ring_t *ring, lbuf_t *b, data_recv_md_t *md, uint32_t *iid)
 {
-    uint8_t ttl = 0, tos = 0;
-    int afi;
     struct udphdr *udph;
     lisp_data_hdr_t *lisph;
     vxlan_gpe_hdr_t *vxlanh;
     int port;
 
-    if (sock_data_recv(sock, b, &afi, &ttl, &tos) != GOOD) {
-        return(BAD);
-    }
-
-    if (afi == AF_INET){
-        /* With input RAW UDP sockets in IPv4, we get the whole external
-         * IPv4 packet */
-        lbuf_reset_ip(b);
-        pkt_pull_ip(b);
-        lbuf_reset_udp(b);
+    if (ring->dgram){
+        /* With input datagram sockets we only get the UDP payload */
+        if (lbuf_size(b) < sizeof(lisp_data_hdr_t)){
+            return (ERR_NOT_ENCAP);
+        }
+        port = ring->data_port;
     }else{
-        /* With input RAW UDP sockets in IPv6, we get the whole external
-         * UDP packet */
-        lbuf_reset_udp(b);
-    }
+        if (md->afi == AF_INET){
+            /* With input RAW UDP sockets in IPv4, we get the whole external
+             * IPv4 packet */
+            lbuf_reset_ip(b);
+            pkt_pull_ip(b);
+            lbuf_reset_udp(b);
+        }else{
+            /* With input RAW UDP sockets in IPv6, we get the whole external
+             * UDP packet */
+            lbuf_reset_udp(b);
+        }
 
-    udph = pkt_pull_udp(b);
-    if (ntohs(udplen(udph)) < 16){//8 udp header + 8 lisp header
-        return (ERR_NOT_ENCAP);
+        udph = pkt_pull_udp(b);
+        if (ntohs(udplen(udph)) < 16){//8 udp header + 8 lisp header
+            return (ERR_NOT_ENCAP);
+        }
+        port = ntohs(udpdport(udph));
     }
 
     /* FILTER UDP: with input RAW UDP sockets, we receive all UDP packets,
-     * we only want LISP data ones */
-    switch (ntohs(udpdport(udph))){
+     * we only want LISP data ones. Only the destination port identifies them:
+     * the source port may be selected by the hash of the inner flow */
+    switch (port){
     case LISP_DATA_PORT:
         lisph = lisp_data_pull_hdr(b);
         if (LDHDR_LSB_BIT(lisph)){
@@ -73,8 +327,6 @@ tun_read_and_decap_pkt(int sock, lbuf_t *b, uint32_t *iid)
         }else{
             *iid = 0;
         }
-
-        port = LISP_DATA_PORT;
         break;
     case VXLAN_GPE_DATA_PORT:
 
@@ -82,7 +334,6 @@ tun_read_and_decap_pkt(int sock, lbuf_t *b, uint32_t *iid)
         if (VXLAN_HDR_VNI_BIT(vxlanh)){
             *iid = vxlan_gpe_hdr_get_vni(vxlanh);
         }
-        port = VXLAN_GPE_DATA_PORT;
         break;
     default:
         return (ERR_NOT_ENCAP);
@@ -93,7 +344,7 @@ tun_read_and_decap_pkt(int sock, lbuf_t *b, uint32_t *iid)
 
     /* UPDATE IP TOS and TTL. Checksum is also updated for IPv4
      * NOTE: we always assume an IP payload*/
-    ip_hdr_set_ttl_and_tos(lbuf_data(b), ttl, tos);
+    ip_hdr_set_ttl_and_tos(lbuf_data(b), md->ttl, md->tos);
 
     OOR_LOG(LDBG_3, "INPUT (%d): %s",port, ip_src_and_dst_to_char(lbuf_l3(b),
             "Inner IP: %s -> %s"));
@@ -101,20 +352,177 @@ tun_read_and_decap_pkt(int sock, lbuf_t *b, uint32_t *iid)
     return(GOOD);
 }
 
+int
+tun_read_and_decap_pkt(int sock, lbuf_t *b, uint32_t *iid)
+{
+    data_recv_md_t md;
+
+    md.ttl = md.tos = 0;
+    if (sock_data_recv(sock, b, &md.afi, &md.ttl, &md.tos) != GOOD) {
+        return(BAD);
+    }
+
+    return (tun_decap_pkt(&rx_ring, b, &md, iid));
+}
+
+/* Split a buffer of datagrams coalesced with UDP GRO into the packets of the
+ * rx ring, starting at position 'npkts'. All the datagrams have 'gso_size'
+ * bytes except the last one, which may be shorter. The packets reference the
+ * memory of the buffer. Returns the new number of packets of the ring */
+static int
+tun_split_gro_buffer(tun_rx_ring_t *ring, lbuf_t *b, int gso_size, int npkts)
+{
+    uint8_t *data = lbuf_data(b);
+    int off, len;
+
+    for (off = 0; off < lbuf_size(b) && npkts < ring->max_pkts; off += gso_size) {
+        len = lbuf_size(b) - off < gso_size ? lbuf_size(b) - off : gso_size;
+        lbuf_use_stack(&ring->pkts[npkts], data + off, len);
+        lbuf_set_size(&ring->pkts[npkts], len);
+        npkts++;
+    }
+
+    return (npkts);
+}
+
+/* Decapsulate the packets contained in the first 'nbufs' buffers of the rx
+ * ring. The result of the decapsulation of each packet is stored in
+ * ring->status. Returns the number of packets */
+static int
+tun_decap_batch(tun_rx_ring_t *ring, int nbufs)
+{
+    int npkts, i, first;
+
+    npkts = 0;
+    for (i = 0; i < nbufs; i++) {
+        ring->stats.bytes += lbuf_size(&ring->bufs[i]);
+        first = npkts;
+        if (ring->md[i].gso_size
+                && ring->md[i].gso_size < lbuf_size(&ring->bufs[i])) {
+            npkts = tun_split_gro_buffer(ring, &ring->bufs[i],
+                    ring->md[i].gso_size, npkts);
+        } else {
+            ring->pkts[npkts++] = ring->bufs[i];
+        }
+        for (; first < npkts; first++) {
+            ring->status[first] = tun_decap_pkt(ring, &ring->pkts[first],
+                    &ring->md[i], &ring->iid[first]);
+            if (ring->status[first] == ERR_NOT_ENCAP) {
+                ring->stats.not_encap++;
+            }
+        }
+    }
+    ring->stats.pkts += npkts;
+
+    return (npkts);
+}
+
+/* Receive a batch of buffers in the rx ring and decapsulate the packets they
+ * contain. Returns the number of packets received */
+static int
+tun_read_and_decap_batch(tun_rx_ring_t *ring, int sock, uint32_t headroom)
+{
+    int nbufs, i;
+
+    for (i = 0; i < ring->size; i++) {
+        lbuf_use_stack(&ring->bufs[i], ring->mem + i * ring->buf_len,
+                ring->buf_len);
+        lbuf_reserve(&ring->bufs[i], headroom);
+    }
+
+    nbufs = sock_data_recv_batch(sock, ring->bufs, ring->md, ring->size);
+
+    return (tun_decap_batch(ring, nbufs));
+}
+
+/* Write to the tun interface the packets of the rx ring that were
+ * decapsulated */
+static void
+tun_input_write_pkts(tun_rx_ring_t *ring, int npkts)
+{
+    lbuf_t *b;
+    struct iovec iov[2];
+    int i, vnet_hdr_len, ret;
+
+    vnet_hdr_len = tun_get_vnet_hdr_len();
+    /* With io_uring, all the writes are submitted with a single syscall */
+    if (tun_uring_write_pkts(ring->pkts, ring->status, npkts,
+            vnet_hdr_len ? tun_empty_vnet_hdr : NULL, vnet_hdr_len) == GOOD) {
+        return;
+    }
+    for (i = 0; i < npkts; i++) {
+        if (ring->status[i] != GOOD) {
+            continue;
+        }
+        b = &ring->pkts[i];
+        /* XXX Destination packet should be checked it belongs to this xTR */
+        if (vnet_hdr_len) {
+            /* With offloads, packets written to the tun interface are
+             * preceded by a virtio header. The packets of a GRO buffer are
+             * contiguous, so an empty one is provided separately */
+            iov[0].iov_base = tun_empty_vnet_hdr;
+            iov[0].iov_len = vnet_hdr_len;
+            iov[1].iov_base = lbuf_l3(b);
+            iov[1].iov_len = lbuf_size(b);
+            ret = writev(tun_receive_fd, iov, 2);
+        } else {
+            ret = write(tun_receive_fd, lbuf_l3(b), lbuf_size(b));
+        }
+        if (ret < 0) {
+            OOR_LOG(LDBG_2, "lisp_input: write error: %s\n ", strerror(errno));
+        }
+    }
+}
+
+/* Re-encapsulate the packets of the rx ring that were decapsulated. They are
+ * sent before returning */
+static void
+tun_input_forward_pkts(tun_rx_ring_t *ring, int npkts)
+{
+    packet_tuple_t tpl;
+    lbuf_t *b;
+    int i;
+
+    for (i = 0; i < npkts; i++) {
+        if (ring->status[i] != GOOD) {
+            continue;
+        }
+        b = &ring->pkts[i];
+        tpl.iid = ring->iid[i];
+
+        OOR_LOG(LDBG_3, "Forwarding packet to OUPUT for re-encapsulation");
+
+        lbuf_point_to_l3(b);
+        lbuf_reset_ip(b);
+
+        if (pkt_parse_5_tuple(b, &tpl) != GOOD) {
+            continue;
+        }
+        if (ring->out) {
+            tun_output_ctx(ring->out, b, &tpl);
+        } else {
+            tun_output(b, &tpl);
+        }
+    }
+
+    if (ring->out) {
+        tun_output_ctx_flush(ring->out);
+    } else {
+        tun_output_flush();
+    }
+}
+
 int
 tun_process_input_packet(sock_t *sl)
 {
-    uint32_t iid;
-    lbuf_use_stack(&pkt_buf, &pkt_recv_buf, MAX_IP_PKT_LEN);
+    int npkts;
 
-    if (tun_read_and_decap_pkt(sl->fd, &pkt_buf, &iid) != GOOD) {
+    npkts = tun_read_and_decap_batch(&rx_ring, sl->fd, 0);
+    if (npkts == 0) {
         return (BAD);
     }
 
-    /* XXX Destination packet should be checked it belongs to this xTR */
-    if ((write(tun_receive_fd, lbuf_l3(&pkt_buf), lbuf_size(&pkt_buf))) < 0) {
-        OOR_LOG(LDBG_2, "lisp_input: write error: %s\n ", strerror(errno));
-    }
+    tun_input_write_pkts(&rx_ring, npkts);
 
     return (GOOD);
 }
@@ -122,26 +530,385 @@ tun_process_input_packet(sock_t *sl)
 int
 tun_rtr_process_input_packet(struct sock *sl)
 {
-    packet_tuple_t tpl;
-    lbuf_use_stack(&pkt_buf, &pkt_recv_buf, MAX_IP_PKT_LEN);
+    int npkts;
+
     /* Reserve space in case the received packet was IPv6. In this case the IPv6 header is
      * not provided */
-    lbuf_reserve(&pkt_buf,LBUF_STACK_OFFSET);
+    npkts = tun_read_and_decap_batch(&rx_ring, sl->fd, LBUF_STACK_OFFSET);
+    if (npkts == 0) {
+        return (BAD);
+    }
+
+    tun_input_forward_pkts(&rx_ring, npkts);
+
+    return(GOOD);
+}
+
+/* Addresses of the interfaces of the RLOCs <lisp_addr_t *>. The list doesn't
+ * own them */
+static glist_t *
+tun_input_local_addrs()
+{
+    glist_t *addrs = glist_new();
+    glist_entry_t *it;
+    iface_t *iface;
+
+    glist_for_each_entry(it, interface_list) {
+        iface = (iface_t *)glist_entry_data(it);
+        if (iface->ipv4_address && !lisp_addr_is_no_addr(iface->ipv4_address)) {
+            glist_add_tail(iface->ipv4_address, addrs);
+        }
+        if (iface->ipv6_address && !lisp_addr_is_no_addr(iface->ipv6_address)) {
+            glist_add_tail(iface->ipv6_address, addrs);
+        }
+    }
+    return (addrs);
+}
+
+/* Open the packet socket backend, a memory mapped ring where the kernel
+ * places the data packets sent to 'data_port' and to the addresses of the
+ * RLOCs. Returns the socket to be polled */
+int
+tun_input_ring_init(int data_port)
+{
+    int afis[2] = {AF_INET, AF_INET6};
+    glist_t *addrs;
+    int i, sock;
+
+    addrs = tun_input_local_addrs();
+    data_ring = pkt_ring_open(data_port, addrs);
+    glist_destroy(addrs);
+    if (!data_ring) {
+        return (ERR_SOCKET);
+    }
+    data_ring_port = data_port;
+
+    /* The kernel still delivers the data packets to the UDP layer. They are
+     * discarded by the sockets bound to the data port without queueing them */
+    for (i = 0; i < 2; i++) {
+        sock = open_udp_datagram_socket(afis[i]);
+        if (sock == ERR_SOCKET) {
+            continue;
+        }
+        if (bind_socket(sock, afis[i], NULL, data_port) != GOOD) {
+            close(sock);
+            continue;
+        }
+        socket_attach_drop_filter(sock);
+        ring_dummy_socks[i] = sock;
+    }
+
+    return (data_ring->sock);
+}
+
+/* Update the filter of the packet ring after a change of the addresses of
+ * the RLOCs. The kernel swaps the filters atomically, so it can be done while
+ * the ring is processed by another thread */
+void
+tun_input_ring_update_addrs()
+{
+    glist_t *addrs;
+
+    if (!data_ring) {
+        return;
+    }
+    addrs = tun_input_local_addrs();
+    socket_attach_pkt_data_filter(data_ring->sock, data_ring_port, addrs);
+    glist_destroy(addrs);
+}
+
+/* Decapsulate in place the packet at position 'i' of the rx ring, that
+ * starts at the outer IP header. Returns BAD if it is not an IP packet */
+static int
+tun_decap_ip_pkt(tun_rx_ring_t *ring, int i)
+{
+    lbuf_t *b = &ring->pkts[i];
+    data_recv_md_t md;
+    int ttl, tos;
 
-    if (tun_read_and_decap_pkt(sl->fd, &pkt_buf, &(tpl.iid)) != GOOD) {
+    if (ip_hdr_ttl_and_tos(lbuf_data(b), &ttl, &tos) != GOOD) {
         return (BAD);
     }
+    md.ttl = ttl;
+    md.tos = tos;
+    md.gso_size = 0;
+    if (((struct iphdr *)lbuf_data(b))->version == 4) {
+        md.afi = AF_INET;
+    } else {
+        /* Like IPv6 raw sockets, start at the UDP header */
+        md.afi = AF_INET6;
+        lbuf_pull(b, sizeof(struct ip6_hdr));
+    }
+
+    ring->stats.bytes += lbuf_size(b);
+    ring->status[i] = tun_decap_pkt(ring, b, &md, &ring->iid[i]);
+    if (ring->status[i] == ERR_NOT_ENCAP) {
+        ring->stats.not_encap++;
+    }
+    ring->stats.pkts++;
+
+    return (GOOD);
+}
+
+/* Decapsulate in place the packets of a block of the packet ring and process
+ * them with 'process_pkts', in groups of up to the size of the rx ring */
+static void
+tun_ring_process_block(struct tpacket_block_desc *bd,
+        void (*process_pkts)(tun_rx_ring_t *, int))
+{
+    struct tpacket3_hdr *hdr, *next;
+    struct sockaddr_ll *sll;
+    lbuf_t *b;
+    int i, npkts = 0;
+
+    next = (struct tpacket3_hdr *)((uint8_t *)bd + bd->hdr.bh1.offset_to_first_pkt);
+    for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+        /* The headers of the frame may be overwritten while processing it */
+        hdr = next;
+        next = (struct tpacket3_hdr *)((uint8_t *)hdr + hdr->tp_next_offset);
+
+        sll = (struct sockaddr_ll *)((uint8_t *)hdr
+                + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+        /* Packets seen in promiscuous mode are not for this host */
+        if (sll->sll_pkttype == PACKET_OUTGOING
+                || sll->sll_pkttype == PACKET_OTHERHOST
+                || hdr->tp_snaplen != hdr->tp_len) {
+            continue;
+        }
+
+        b = &rx_ring.pkts[npkts];
+        lbuf_use_stack(b, hdr, hdr->tp_net + hdr->tp_snaplen);
+        lbuf_reserve(b, hdr->tp_net);
+        lbuf_set_size(b, hdr->tp_snaplen);
+
+        if (tun_decap_ip_pkt(&rx_ring, npkts) != GOOD) {
+            continue;
+        }
+
+        if (++npkts == rx_ring.max_pkts) {
+            process_pkts(&rx_ring, npkts);
+            npkts = 0;
+        }
+    }
+
+    if (npkts > 0) {
+        process_pkts(&rx_ring, npkts);
+    }
+}
+
+/* Process all the blocks of the packet ring filled by the kernel and give
+ * them back to it */
+static int
+tun_ring_read(void (*process_pkts)(tun_rx_ring_t *, int))
+{
+    struct tpacket_block_desc *bd;
+    int nblocks = 0;
+
+    for (;;) {
+        bd = pkt_ring_block(data_ring, data_ring->cur_block);
+        if (!(bd->hdr.bh1.block_status & TP_STATUS_USER)) {
+            break;
+        }
+        __sync_synchronize();
+
+        tun_ring_process_block(bd, process_pkts);
+
+        __sync_synchronize();
+        bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+        data_ring->cur_block = (data_ring->cur_block + 1) % data_ring->block_nr;
+        nblocks++;
+    }
+
+    return (nblocks > 0 ? GOOD : BAD);
+}
+
+int
+tun_ring_process_input_packet(sock_t *sl)
+{
+    return (tun_ring_read(tun_input_write_pkts));
+}
+
+int
+tun_rtr_ring_process_input_packet(sock_t *sl)
+{
+    return (tun_ring_read(tun_input_forward_pkts));
+}
+
+/* Process packets received by another backend, starting at the outer IP
+ * header. They are decapsulated in place and written to the tun interface,
+ * or re-encapsulated when 'rtr' is set, before returning */
+void
+tun_input_process_ip_pkts(lbuf_t *pkts, int count, int rtr)
+{
+    void (*process_pkts)(tun_rx_ring_t *, int);
+    int i, npkts = 0;
+
+    process_pkts = rtr ? tun_input_forward_pkts : tun_input_write_pkts;
+    for (i = 0; i < count; i++) {
+        rx_ring.pkts[npkts] = pkts[i];
+        if (tun_decap_ip_pkt(&rx_ring, npkts) != GOOD) {
+            continue;
+        }
+        if (++npkts == rx_ring.max_pkts) {
+            process_pkts(&rx_ring, npkts);
+            npkts = 0;
+        }
+    }
+
+    if (npkts > 0) {
+        process_pkts(&rx_ring, npkts);
+    }
+}
+
+/* Process buffers received from the data sockets by another reader, with
+ * their metadata. They are decapsulated in place and written to the tun
+ * interface, or re-encapsulated when 'rtr' is set, before returning */
+void
+tun_input_process_bufs(lbuf_t *bufs, data_recv_md_t *md, int nbufs, int rtr)
+{
+    int i, n, npkts;
+
+    while (nbufs > 0) {
+        n = nbufs < rx_ring.size ? nbufs : rx_ring.size;
+        for (i = 0; i < n; i++) {
+            rx_ring.bufs[i] = bufs[i];
+            rx_ring.md[i] = md[i];
+        }
+        npkts = tun_decap_batch(&rx_ring, n);
+        if (rtr) {
+            tun_input_forward_pkts(&rx_ring, npkts);
+        } else {
+            tun_input_write_pkts(&rx_ring, npkts);
+        }
+        bufs += n;
+        md += n;
+        nbufs -= n;
+    }
+}
+
+static void *
+tun_rtr_worker(void *arg)
+{
+    tun_rtr_worker_t *w = (tun_rtr_worker_t *)arg;
+    struct pollfd pfds[3];
+    int i, npkts, ret;
+
+    for (i = 0; i < w->nsocks; i++) {
+        pfds[i].fd = w->socks[i];
+        pfds[i].events = POLLIN;
+    }
+    pfds[w->nsocks].fd = tun_output_ctx_miss_fd(w->ring.out);
+    pfds[w->nsocks].events = POLLIN;
+
+    while (rtr_workers_running) {
+        ret = poll(pfds, w->nsocks + 1, TUN_RTR_WORKER_POLL_TIMEOUT);
+        if (ret < 0 && errno != EINTR) {
+            OOR_LOG(LERR, "tun_rtr_worker: poll error: %s", strerror(errno));
+            break;
+        }
+        if (ret <= 0) {
+            continue;
+        }
+        /* Flows resolved by the main loop */
+        if (pfds[w->nsocks].revents & POLLIN) {
+            tun_output_ctx_process_misses(w->ring.out);
+        }
+        for (i = 0; i < w->nsocks; i++) {
+            if (!(pfds[i].revents & POLLIN)) {
+                continue;
+            }
+            npkts = tun_read_and_decap_batch(&w->ring, w->socks[i],
+                    LBUF_STACK_OFFSET);
+            if (npkts > 0) {
+                tun_input_forward_pkts(&w->ring, npkts);
+            }
+        }
+    }
+
+    return (NULL);
+}
+
+static void
+tun_rtr_worker_uninit(tun_rtr_worker_t *w)
+{
+    int i;
+
+    for (i = 0; i < w->nsocks; i++) {
+        close(w->socks[i]);
+    }
+    if (w->ring.out) {
+        tun_output_worker_ctx_del(w->ring.out);
+    }
+    tun_rx_ring_uninit(&w->ring);
+}
 
-    OOR_LOG(LDBG_3, "Forwarding packet to OUPUT for re-encapsulation");
+/* Start 'nworkers' threads that decapsulate and re-encapsulate the data
+ * packets of the RTR. Each one has its own datagram sockets bound to the data
+ * port of each afi, so the kernel spreads the flows among them, and its own
+ * flow table and output sockets. Flow table misses are resolved by the main
+ * loop. The main loop should not open data input sockets */
+int
+tun_input_rtr_workers_start(int nworkers, int data_port)
+{
+    tun_rtr_worker_t *w;
+    int afis[2] = {AF_INET, AF_INET6};
+    int i, j, sock;
 
-    lbuf_point_to_l3(&pkt_buf);
-    lbuf_reset_ip(&pkt_buf);
+    rtr_workers = xzalloc(nworkers * sizeof(tun_rtr_worker_t));
+    rtr_workers_running = TRUE;
+
+    for (i = 0; i < nworkers; i++) {
+        w = &rtr_workers[num_rtr_workers];
+        tun_rx_ring_init(&w->ring, rx_ring.size, TRUE, FALSE, data_port);
+        for (j = 0; j < 2; j++) {
+            if ((afis[j] == AF_INET && default_rloc_afi == AF_INET6)
+                    || (afis[j] == AF_INET6 && default_rloc_afi == AF_INET)) {
+                continue;
+            }
+            sock = open_data_reuseport_input_socket(afis[j], data_port);
+            if (sock != ERR_SOCKET) {
+                w->socks[w->nsocks++] = sock;
+            }
+        }
+        w->ring.out = tun_output_worker_ctx_new(rx_ring.size);
+        if (w->nsocks == 0 || !w->ring.out) {
+            tun_rtr_worker_uninit(w);
+            break;
+        }
+        if (pthread_create(&w->thread, NULL, tun_rtr_worker, w) != 0) {
+            OOR_LOG(LERR, "tun_input_rtr_workers_start: Couldn't create worker "
+                    "thread: %s", strerror(errno));
+            tun_rtr_worker_uninit(w);
+            break;
+        }
+        num_rtr_workers++;
+    }
 
-    if (pkt_parse_5_tuple(&pkt_buf, &tpl) != GOOD) {
+    if (num_rtr_workers == 0) {
+        free(rtr_workers);
+        rtr_workers = NULL;
         return (BAD);
     }
-    tun_output(&pkt_buf, &tpl);
 
-    return(GOOD);
+    OOR_LOG(LDBG_1, "Started %d RTR data plane workers", num_rtr_workers);
+    return (GOOD);
 }
 
+static void
+tun_input_rtr_workers_stop()
+{
+    int i;
+
+    if (!rtr_workers) {
+        return;
+    }
+
+    rtr_workers_running = FALSE;
+    for (i = 0; i < num_rtr_workers; i++) {
+        pthread_join(rtr_workers[i].thread, NULL);
+        tun_rtr_worker_uninit(&rtr_workers[i]);
+    }
+    free(rtr_workers);
+    rtr_workers = NULL;
+    num_rtr_workers = 0;
+}
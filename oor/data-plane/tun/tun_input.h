@@ -30,8 +30,20 @@
 #include "../../defs.h"
 #include "../../lib/sockets.h"
 #include "../../lib/cksum.h"
+#include "../data-plane.h"
 
+void tun_input_init(int batch_size, int udp_gro, int data_port);
+void tun_input_uninit();
+void tun_input_log_stats();
+int tun_read_and_decap_pkt(int sock, lbuf_t *b, uint32_t *iid);
 int tun_process_input_packet(struct sock *sl);
 int tun_rtr_process_input_packet(struct sock *sl);
+int tun_input_ring_init(int data_port);
+void tun_input_ring_update_addrs();
+int tun_ring_process_input_packet(struct sock *sl);
+int tun_rtr_ring_process_input_packet(struct sock *sl);
+void tun_input_process_ip_pkts(lbuf_t *pkts, int count, int rtr);
+void tun_input_process_bufs(lbuf_t *bufs, data_recv_md_t *md, int nbufs, int rtr);
+int tun_input_rtr_workers_start(int nworkers, int data_port);
 
 #endif /*TUN_IFACE_LIST_H_*/
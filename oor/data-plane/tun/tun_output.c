@@ -19,45 +19,939 @@
 
 
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #include "tun_output.h"
 #include "tun.h"
+#include "../data-plane.h"
 #include "../encapsulations/vxlan-gpe.h"
 #include "../../fwd_policies/fwd_policy.h"
 #include "../../liblisp/liblisp.h"
+#include "../../lib/mem_util.h"
 #include "../../lib/packets.h"
 #include "../../lib/sockets.h"
 #include "../../control/oor_control.h"
 #include "../../lib/ttable.h"
 #include "../../lib/oor_log.h"
 #include "../../lib/sockets-util.h"
+#include "../../lib/spsc_queue.h"
 
 
-/* static buffer to receive packets */
-static uint8_t pkt_recv_buf[TUN_RECEIVE_SIZE];
-static lbuf_t pkt_buf;
-ttable_t ttable;
+/* Maximum number of output sockets with packets pending to be sent */
+#define TUN_MAX_TX_QUEUES   8
 
+/* Position of the flags byte in the TCP header and the CWR flag */
+#define TCP_FLAGS_OFFSET    13
+#define TCP_CWR_FLAG        0x80
 
+/* Number of segments of GSO packets that can be queued before flushing */
+#define TUN_GSO_MAX_SEGS    128
+
+/* Room for the encapsulation header and the IP and TCP headers of a segment
+ * of a GSO packet */
+#define TUN_GSO_HDR_SIZE    (16 + 60 + 60)
+
+/* Number of connected UDP sockets of a context used to send encapsulated
+ * packets with UDP segmentation offload */
+#define TUN_UDP_SOCKS       32
+
+/* Time a worker waits for packets before checking if it should finish (ms) */
+#define TUN_WORKER_POLL_TIMEOUT 1000
+
+/* Packets of a worker of the RTR waiting for the resolution of a flow table
+ * miss by the main loop. Each one holds a packet of up to MAX_IP_PKT_LEN
+ * bytes, including the headroom of the encapsulation */
+#define TUN_MAX_PARKED      64
+
+/* Number of raw sockets of a worker of the RTR, one per source RLOC */
+#define TUN_RAW_SOCKS       8
+
+/* Maximum number of contexts detached from the control: the workers of the
+ * RTR, the ones of the tun queues and the main context */
+#define TUN_MAX_MISS_CTXS   (DPLANE_MAX_RTR_WORKERS + DPLANE_MAX_TUN_QUEUES + 1)
+
+/* Connected UDP socket from a source RLOC and port toward a destination
+ * RLOC and port, with the encapsulated packets waiting to be sent through
+ * it */
+typedef struct tun_udp_sock_ {
+    ip_addr_t src;
+    ip_addr_t dst;
+    int sport;
+    int port;
+    udp_gso_queue_t queue;
+} tun_udp_sock_t;
+
+/* Raw socket bound to a source RLOC */
+typedef struct tun_raw_sock_ {
+    ip_addr_t src;
+    int sock;
+} tun_raw_sock_t;
+
+/* Flow table miss of a worker resolved by the main loop. The request and its
+ * answer are the same object */
+typedef struct tun_miss_ {
+    packet_tuple_t *tpl;
+    fwd_info_t *fi;
+} tun_miss_t;
+
+/* Copy of a packet waiting for the forwarding information of its flow */
+typedef struct tun_parked_pkt_ {
+    lbuf_t b;
+    packet_tuple_t tpl;
+    uint8_t used;
+    uint8_t sent;
+} tun_parked_pkt_t;
+
+/* Headers of the segments of a TCP GSO packet. 'hdr' has the IP and TCP
+ * headers of a segment of 'mss' bytes in the middle of the packet, with their
+ * checksums but without the payload in the TCP one. The headers of each
+ * segment are obtained updating them incrementally */
+typedef struct tun_gso_hdr_ {
+    uint8_t hdr[TUN_GSO_HDR_SIZE];
+    const uint8_t *payload;
+    int afi;
+    int ip_hlen;
+    int tcp_hlen;
+    int hdr_len;
+    int payload_len;
+    int mss;
+    uint32_t seq;
+    uint16_t ip_id;
+    /* Flags word of the TCP header of the GSO packet */
+    uint16_t flags;
+} tun_gso_hdr_t;
+
+/* State of one instance of the output pipeline. The main loop uses its own
+ * context and each worker thread, reading from a queue of the tun interface,
+ * has a private one */
+struct tun_output_ctx_ {
+    ttable_t ttable;
+    /* Buffers to receive a batch of packets from the tun interface */
+    uint8_t *pkt_recv_mem;
+    lbuf_t *pkt_bufs;
+    int pkt_bufs_size;
+    /* Queues of encapsulated packets waiting to be sent. Each queue in use is
+     * associated to one output socket during a batch. They are emptied when
+     * the batch finishes */
+    raw_pkt_queue_t *tx_queues[TUN_MAX_TX_QUEUES];
+    int tx_queues_used;
+    /* Size of the virtio header preceding the packets read from the tun
+     * interface. 0 if offloads are disabled */
+    int vnet_hdr_len;
+    int pkt_buf_len;
+    /* Buffers of the segments of GSO packets. When they are sent through the
+     * connected UDP sockets, only their headers are built, in 'seg_hdr_mem',
+     * and their payload is sent from the GSO packet */
+    uint8_t *seg_mem;
+    lbuf_t *seg_bufs;
+    uint8_t *seg_hdr_mem;
+    int segs_used;
+    /* Encapsulated packets are sent through connected UDP sockets with UDP
+     * segmentation offload instead of through the raw sockets. When all the
+     * sockets are in use, the oldest one is replaced */
+    uint8_t udp_gso;
+    tun_udp_sock_t *udp_socks;
+    int udp_socks_used;
+    int udp_socks_next;
+    /* Only used by the workers of the tun queues */
+    int fd;
+    pthread_t thread;
+    /* Workers don't access the control. Their flow table misses are resolved
+     * by the main loop through lock free queues, and their packets are parked
+     * meanwhile. 'miss_fd' is signaled with the answers */
+    spsc_queue_t *miss_reqs;
+    spsc_queue_t *miss_replies;
+    int miss_fd;
+    tun_parked_pkt_t *parked;
+    uint8_t *parked_mem;
+    /* Raw sockets of the context, bound to the source RLOCs. When NULL, the
+     * ones of the interfaces are used */
+    tun_raw_sock_t *raw_socks;
+    int raw_socks_used;
+    int raw_socks_next;
+    /* Only used by the main context. See tun_output_set_xmit */
+    tun_xmit_fct xmit;
+    tun_xmit_flush_fct xmit_flush;
+};
+
+static tun_output_ctx_t main_ctx;
+static tun_output_ctx_t *workers;
+static int num_workers;
+static volatile int workers_running;
+
+/* Contexts whose flow table misses are resolved by the main loop, and the
+ * event used by them to wake it up. The workers of the RTR and the main
+ * context when it is used by the data plane thread */
+static tun_output_ctx_t *miss_ctxs[TUN_MAX_MISS_CTXS];
+static int num_miss_ctxs;
+static int miss_event_fd = ERR_SOCKET;
+static sock_t *miss_sock;
+static sock_t *main_miss_sock;
+
+
+static void tun_output_ctx_init(tun_output_ctx_t *ctx, int batch_size);
+static void tun_output_ctx_uninit(tun_output_ctx_t *ctx);
+static int tun_output_ctx_read(tun_output_ctx_t *ctx, int fd);
 static int tun_output_multicast(lbuf_t *b, packet_tuple_t *tuple);
-static int tun_output_unicast(lbuf_t *b, packet_tuple_t *tuple);
-static int tun_forward_native(lbuf_t *b, lisp_addr_t *dst);
+static fwd_info_t *tun_output_lookup(tun_output_ctx_t *ctx,
+        packet_tuple_t *tuple);
+static int tun_output_encap_and_send(tun_output_ctx_t *ctx, lbuf_t *b,
+        packet_tuple_t *tuple, fwd_info_t *fi);
+static int tun_output_unicast(tun_output_ctx_t *ctx, lbuf_t *b,
+        packet_tuple_t *tuple);
+static int tun_output_gso(tun_output_ctx_t *ctx, lbuf_t *b,
+        struct virtio_net_hdr *vh, packet_tuple_t *tpl);
+static int tun_forward_native(tun_output_ctx_t *ctx, lbuf_t *b,
+        lisp_addr_t *dst);
+static int tun_send_raw_packet(tun_output_ctx_t *ctx, int sock, lbuf_t *b,
+        ip_addr_t *dst);
+static udp_gso_queue_t *tun_get_udp_queue(tun_output_ctx_t *ctx,
+        fwd_info_t *fi, packet_tuple_t *tuple);
+static int tun_send_udp_gso(udp_gso_queue_t *q, lbuf_t *b, fwd_info_t *fi);
+static void *tun_output_worker(void *arg);
+static int tun_encap_src_port(packet_tuple_t *tuple, int dport);
+static int tun_output_ctx_detach(tun_output_ctx_t *ctx);
+static void tun_output_ctx_attach(tun_output_ctx_t *ctx);
+static int tun_output_miss_recv(sock_t *sl);
+static int tun_output_park(tun_output_ctx_t *ctx, lbuf_t *b,
+        packet_tuple_t *tuple);
+static int tun_get_raw_sock(tun_output_ctx_t *ctx, lisp_addr_t *srloc);
+static void tun_fwd_info_prepare(fwd_info_t *fi, packet_tuple_t *tuple);
 static inline int is_lisp_packet(packet_tuple_t *tpl);
 
+static void
+tun_output_ctx_init(tun_output_ctx_t *ctx, int batch_size)
+{
+    int i;
+
+    ttable_init(&ctx->ttable, dplane_conf.flow_cache_size,
+            dplane_conf.flow_cache_evict == DPLANE_FLOW_EVICT_CLOCK ?
+                    TTABLE_EVICT_CLOCK : TTABLE_EVICT_LRU,
+            dplane_conf.flow_cache_tcp_close, dplane_conf.flowlet_gap);
+
+    /* With offloads, packets of up to 64 KB are received */
+    ctx->vnet_hdr_len = tun_get_vnet_hdr_len();
+    ctx->pkt_buf_len = ctx->vnet_hdr_len ? TUN_GSO_RECEIVE_SIZE : TUN_RECEIVE_SIZE;
+
+    ctx->pkt_bufs_size = batch_size;
+    ctx->pkt_recv_mem = xmalloc(batch_size * ctx->pkt_buf_len);
+    ctx->pkt_bufs = xzalloc(batch_size * sizeof(lbuf_t));
+
+    if (ctx->vnet_hdr_len) {
+        ctx->seg_mem = xmalloc(TUN_GSO_MAX_SEGS * TUN_RECEIVE_SIZE);
+        ctx->seg_bufs = xzalloc(TUN_GSO_MAX_SEGS * sizeof(lbuf_t));
+        ctx->seg_hdr_mem = xmalloc(TUN_GSO_MAX_SEGS * TUN_GSO_HDR_SIZE);
+    }
+
+    for (i = 0; i < TUN_MAX_TX_QUEUES; i++) {
+        ctx->tx_queues[i] = raw_pkt_queue_new(batch_size);
+    }
+    ctx->tx_queues_used = 0;
+
+    if (dplane_conf.udp_gso) {
+        if (udp_gso_supported()) {
+            ctx->udp_gso = TRUE;
+            ctx->udp_socks = xzalloc(TUN_UDP_SOCKS * sizeof(tun_udp_sock_t));
+        } else {
+            OOR_LOG(LWRN, "UDP segmentation offload not supported by the "
+                    "kernel. Sending encapsulated packets through raw sockets");
+        }
+    }
+}
+
+static void
+tun_output_ctx_uninit(tun_output_ctx_t *ctx)
+{
+    int i;
+
+    tun_output_ctx_flush(ctx);
+    for (i = 0; i < TUN_MAX_TX_QUEUES; i++) {
+        raw_pkt_queue_del(ctx->tx_queues[i]);
+        ctx->tx_queues[i] = NULL;
+    }
+    for (i = 0; i < ctx->udp_socks_used; i++) {
+        close(ctx->udp_socks[i].queue.sock);
+    }
+    free(ctx->udp_socks);
+    ctx->udp_socks = NULL;
+    ctx->udp_socks_used = 0;
+    for (i = 0; i < ctx->raw_socks_used; i++) {
+        close(ctx->raw_socks[i].sock);
+    }
+    free(ctx->raw_socks);
+    ctx->raw_socks = NULL;
+    ctx->raw_socks_used = 0;
+    free(ctx->pkt_recv_mem);
+    free(ctx->pkt_bufs);
+    free(ctx->seg_mem);
+    free(ctx->seg_bufs);
+    free(ctx->seg_hdr_mem);
+    ctx->pkt_recv_mem = NULL;
+    ctx->pkt_bufs = NULL;
+    ctx->seg_mem = NULL;
+    ctx->seg_bufs = NULL;
+    ctx->seg_hdr_mem = NULL;
+
+    ttable_uninit(&ctx->ttable);
+}
+
 void
-tun_output_init()
+tun_output_init(int batch_size)
 {
-    ttable_init(&ttable);
+    tun_output_ctx_init(&main_ctx, batch_size);
 }
 
 void
 tun_output_uninit()
 {
-    ttable_uninit(&ttable);
+    tun_output_workers_stop();
+    tun_output_ctx_uninit(&main_ctx);
+}
+
+static void
+tun_output_add_stats(ttable_stats_t *total, uint64_t *used, tun_output_ctx_t *ctx)
+{
+    total->hits += ctx->ttable.stats.hits;
+    total->misses += ctx->ttable.stats.misses;
+    total->inserts += ctx->ttable.stats.inserts;
+    total->evictions += ctx->ttable.stats.evictions;
+    total->expirations += ctx->ttable.stats.expirations;
+    total->tcp_closes += ctx->ttable.stats.tcp_closes;
+    total->flowlets += ctx->ttable.stats.flowlets;
+    *used += ctx->ttable.used;
+}
+
+/* Log the counters of the flow tables of all the contexts */
+void
+tun_output_log_stats()
+{
+    ttable_stats_t total;
+    uint64_t used = 0, size;
+    int i, nctxs = 1;
+
+    /* The counters of the workers are read without synchronization */
+    memset(&total, 0, sizeof(ttable_stats_t));
+    tun_output_add_stats(&total, &used, &main_ctx);
+    for (i = 0; i < num_workers; i++) {
+        tun_output_add_stats(&total, &used, &workers[i]);
+        nctxs++;
+    }
+    for (i = 0; i < num_miss_ctxs; i++) {
+        if (miss_ctxs[i] != &main_ctx) {
+            tun_output_add_stats(&total, &used, miss_ctxs[i]);
+            nctxs++;
+        }
+    }
+    size = (uint64_t)ttable_size(&main_ctx.ttable) * nctxs;
+
+    OOR_LOG(LDBG_1, "Flow cache: %llu hits, %llu misses, %llu flows inserted, "
+            "%llu evicted, %llu expired, %llu closed by TCP, %llu new "
+            "flowlets",
+            (unsigned long long)total.hits, (unsigned long long)total.misses,
+            (unsigned long long)total.inserts,
+            (unsigned long long)total.evictions,
+            (unsigned long long)total.expirations,
+            (unsigned long long)total.tcp_closes,
+            (unsigned long long)total.flowlets);
+    OOR_LOG(LDBG_1, "Flow cache: %llu of %llu flows used in %d tables",
+            (unsigned long long)used, (unsigned long long)size, nctxs);
+}
+
+/* Start one worker thread for each of the tun queues. Each worker reads,
+ * encapsulates and sends the packets of its queue with its own flow table
+ * and output queues. Like the workers of the RTR, it doesn't access the
+ * control: its flow table misses are resolved by the main loop */
+int
+tun_output_workers_start(int *fds, int nfds, int batch_size)
+{
+    int i;
+
+    workers = xzalloc(nfds * sizeof(tun_output_ctx_t));
+    workers_running = TRUE;
+
+    for (i = 0; i < nfds; i++) {
+        tun_output_ctx_init(&workers[i], batch_size);
+        workers[i].fd = fds[i];
+        if (tun_output_ctx_detach(&workers[i]) != GOOD) {
+            tun_output_ctx_uninit(&workers[i]);
+            break;
+        }
+        if (pthread_create(&workers[i].thread, NULL, tun_output_worker,
+                &workers[i]) != 0) {
+            OOR_LOG(LERR, "tun_output_workers_start: Couldn't create worker "
+                    "thread: %s", strerror(errno));
+            tun_output_ctx_attach(&workers[i]);
+            tun_output_ctx_uninit(&workers[i]);
+            break;
+        }
+        num_workers++;
+    }
+
+    if (num_workers == 0) {
+        free(workers);
+        workers = NULL;
+        return (BAD);
+    }
+
+    OOR_LOG(LDBG_1, "Started %d data plane workers", num_workers);
+    return (GOOD);
+}
+
+void
+tun_output_workers_stop()
+{
+    int i;
+
+    if (!workers) {
+        return;
+    }
+
+    workers_running = FALSE;
+    for (i = 0; i < num_workers; i++) {
+        pthread_join(workers[i].thread, NULL);
+        tun_output_ctx_attach(&workers[i]);
+        tun_output_ctx_uninit(&workers[i]);
+    }
+    free(workers);
+    workers = NULL;
+    num_workers = 0;
+}
+
+static void *
+tun_output_worker(void *arg)
+{
+    tun_output_ctx_t *ctx = (tun_output_ctx_t *)arg;
+    struct pollfd pfds[2];
+    int ret;
+
+    pfds[0].fd = ctx->fd;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = ctx->miss_fd;
+    pfds[1].events = POLLIN;
+
+    while (workers_running) {
+        ret = poll(pfds, 2, TUN_WORKER_POLL_TIMEOUT);
+        if (ret < 0 && errno != EINTR) {
+            OOR_LOG(LERR, "tun_output_worker: poll error: %s", strerror(errno));
+            break;
+        }
+        if (ret <= 0) {
+            continue;
+        }
+        /* Parked packets are sent before the new ones of their flows */
+        if (pfds[1].revents & POLLIN) {
+            tun_output_ctx_process_misses(ctx);
+        }
+        if (pfds[0].revents & POLLIN) {
+            tun_output_ctx_read(ctx, ctx->fd);
+        }
+    }
+
+    return (NULL);
+}
+
+static void
+tun_miss_del(tun_miss_t *m)
+{
+    pkt_tuple_del(m->tpl);
+    if (m->fi) {
+        fwd_info_del(m->fi, (fwd_info_data_del)fwd_entry_del);
+    }
+    free(m);
+}
+
+/* Make the flow table misses of the context be resolved by the main loop
+ * through lock free queues instead of accessing the control. The context
+ * uses its own raw sockets from then on */
+static int
+tun_output_ctx_detach(tun_output_ctx_t *ctx)
+{
+    if (num_miss_ctxs == TUN_MAX_MISS_CTXS) {
+        return (BAD);
+    }
+    if (miss_event_fd == ERR_SOCKET) {
+        miss_event_fd = eventfd(0, EFD_NONBLOCK);
+        if (miss_event_fd < 0) {
+            OOR_LOG(LERR, "tun_output_ctx_detach: eventfd: %s",
+                    strerror(errno));
+            miss_event_fd = ERR_SOCKET;
+            return (BAD);
+        }
+        miss_sock = sockmstr_register_read_listener(smaster,
+                tun_output_miss_recv, NULL, miss_event_fd);
+    }
+
+    ctx->miss_fd = eventfd(0, EFD_NONBLOCK);
+    if (ctx->miss_fd < 0) {
+        OOR_LOG(LERR, "tun_output_ctx_detach: eventfd: %s", strerror(errno));
+        ctx->miss_fd = ERR_SOCKET;
+        return (BAD);
+    }
+    /* There are at most as many misses being resolved as parked packets */
+    ctx->miss_reqs = spsc_queue_new(TUN_MAX_PARKED);
+    ctx->miss_replies = spsc_queue_new(TUN_MAX_PARKED);
+    ctx->parked = xzalloc(TUN_MAX_PARKED * sizeof(tun_parked_pkt_t));
+    ctx->parked_mem = xmalloc(TUN_MAX_PARKED * MAX_IP_PKT_LEN);
+    ctx->raw_socks = xzalloc(TUN_RAW_SOCKS * sizeof(tun_raw_sock_t));
+    miss_ctxs[num_miss_ctxs++] = ctx;
+
+    return (GOOD);
+}
+
+/* Undo tun_output_ctx_detach. Should be called once the thread using the
+ * context has finished */
+static void
+tun_output_ctx_attach(tun_output_ctx_t *ctx)
+{
+    tun_miss_t *m;
+    int i;
+
+    for (i = 0; i < num_miss_ctxs; i++) {
+        if (miss_ctxs[i] == ctx) {
+            miss_ctxs[i] = miss_ctxs[--num_miss_ctxs];
+            break;
+        }
+    }
+    if (num_miss_ctxs == 0 && miss_sock) {
+        /* Closes the event */
+        sockmstr_unregister_read_listenedr(smaster, miss_sock);
+        miss_sock = NULL;
+        miss_event_fd = ERR_SOCKET;
+    }
+
+    while ((m = spsc_queue_pop(ctx->miss_reqs)) != NULL) {
+        tun_miss_del(m);
+    }
+    while ((m = spsc_queue_pop(ctx->miss_replies)) != NULL) {
+        tun_miss_del(m);
+    }
+    spsc_queue_del(ctx->miss_reqs);
+    spsc_queue_del(ctx->miss_replies);
+    ctx->miss_reqs = NULL;
+    ctx->miss_replies = NULL;
+    if (ctx->miss_fd != ERR_SOCKET) {
+        close(ctx->miss_fd);
+        ctx->miss_fd = ERR_SOCKET;
+    }
+    free(ctx->parked);
+    free(ctx->parked_mem);
+    ctx->parked = NULL;
+    ctx->parked_mem = NULL;
+    for (i = 0; i < ctx->raw_socks_used; i++) {
+        close(ctx->raw_socks[i].sock);
+    }
+    free(ctx->raw_socks);
+    ctx->raw_socks = NULL;
+    ctx->raw_socks_used = 0;
+}
+
+/* Create the output context of a worker thread of the RTR. It doesn't access
+ * the control: the forwarding information of the flows it doesn't know is
+ * obtained by the main loop. The caller should be the only user of the
+ * context */
+tun_output_ctx_t *
+tun_output_worker_ctx_new(int batch_size)
+{
+    tun_output_ctx_t *ctx;
+
+    ctx = xzalloc(sizeof(tun_output_ctx_t));
+    tun_output_ctx_init(ctx, batch_size);
+    if (tun_output_ctx_detach(ctx) != GOOD) {
+        tun_output_ctx_uninit(ctx);
+        free(ctx);
+        return (NULL);
+    }
+
+    return (ctx);
+}
+
+/* Should be called once the worker using the context has finished */
+void
+tun_output_worker_ctx_del(tun_output_ctx_t *ctx)
+{
+    tun_output_ctx_attach(ctx);
+    tun_output_ctx_uninit(ctx);
+    free(ctx);
+}
+
+static int
+tun_output_main_misses_recv(sock_t *sl)
+{
+    tun_output_ctx_process_misses(&main_ctx);
+    return (GOOD);
+}
+
+/* Detach the main context from the control, so that it can be used by a
+ * thread other than the main loop. The answers to its flow table misses are
+ * received by 'm' */
+int
+tun_output_ctrl_detach(sockmstr_t *m)
+{
+    if (tun_output_ctx_detach(&main_ctx) != GOOD) {
+        return (BAD);
+    }
+    main_miss_sock = sockmstr_register_read_listener(m,
+            tun_output_main_misses_recv, NULL, main_ctx.miss_fd);
+    if (!main_miss_sock) {
+        tun_output_ctx_attach(&main_ctx);
+        return (BAD);
+    }
+    return (GOOD);
+}
+
+void
+tun_output_ctrl_attach(sockmstr_t *m)
+{
+    if (!main_miss_sock) {
+        return;
+    }
+    /* Closes the event of the context */
+    sockmstr_unregister_read_listenedr(m, main_miss_sock);
+    main_miss_sock = NULL;
+    main_ctx.miss_fd = ERR_SOCKET;
+    tun_output_ctx_attach(&main_ctx);
+}
+
+/* Descriptor signaled when the main loop has resolved flow table misses of
+ * the context */
+int
+tun_output_ctx_miss_fd(tun_output_ctx_t *ctx)
+{
+    return (ctx->miss_fd);
+}
+
+/* Obtain from the control the forwarding information of the flow table
+ * misses of the workers, and return it to them */
+static int
+tun_output_miss_recv(sock_t *sl)
+{
+    tun_output_ctx_t *ctx;
+    tun_miss_t *m;
+    eventfd_t cnt;
+    uint32_t iid;
+    int i, nreplies;
+
+    eventfd_read(sl->fd, &cnt);
+
+    for (i = 0; i < num_miss_ctxs; i++) {
+        ctx = miss_ctxs[i];
+        nreplies = 0;
+        while ((m = spsc_queue_pop(ctx->miss_reqs)) != NULL) {
+            iid = m->tpl->iid;
+            m->fi = (fwd_info_t *)ctrl_get_forwarding_info(m->tpl);
+            m->tpl->iid = iid;
+            if (m->fi) {
+                tun_fwd_info_prepare(m->fi, m->tpl);
+            }
+            /* The queue of answers is as big as the one of requests */
+            if (spsc_queue_push(ctx->miss_replies, m) != GOOD) {
+                tun_miss_del(m);
+                continue;
+            }
+            nreplies++;
+        }
+        if (nreplies > 0) {
+            eventfd_write(ctx->miss_fd, 1);
+        }
+    }
+
+    return (GOOD);
+}
+
+/* Keep a copy of the packet until the main loop provides the forwarding
+ * information of its flow. It is requested with the first packet of the
+ * flow. Packets that don't fit are dropped */
+static int
+tun_output_park(tun_output_ctx_t *ctx, lbuf_t *b, packet_tuple_t *tuple)
+{
+    tun_parked_pkt_t *p = NULL;
+    tun_miss_t *m;
+    int i, requested = FALSE;
+
+    if (lbuf_size(b) > MAX_IP_PKT_LEN - LBUF_STACK_OFFSET) {
+        return (BAD);
+    }
+
+    for (i = 0; i < TUN_MAX_PARKED; i++) {
+        if (!ctx->parked[i].used) {
+            if (!p) {
+                p = &ctx->parked[i];
+            }
+        } else if (pkt_tuple_cmp(&ctx->parked[i].tpl, tuple)) {
+            requested = TRUE;
+        }
+    }
+    if (!p) {
+        OOR_LOG(LDBG_3, "tun_output_park: No room to park packet. Dropped");
+        return (BAD);
+    }
+
+    if (!requested) {
+        m = xzalloc(sizeof(tun_miss_t));
+        m->tpl = pkt_tuple_clone(tuple);
+        if (spsc_queue_push(ctx->miss_reqs, m) != GOOD) {
+            tun_miss_del(m);
+            return (BAD);
+        }
+        eventfd_write(miss_event_fd, 1);
+    }
+
+    lbuf_use_stack(&p->b, ctx->parked_mem + (p - ctx->parked) * MAX_IP_PKT_LEN,
+            MAX_IP_PKT_LEN);
+    lbuf_reserve(&p->b, LBUF_STACK_OFFSET);
+    lbuf_put(&p->b, lbuf_data(b), lbuf_size(b));
+    lbuf_reset_l3(&p->b);
+    lbuf_reset_ip(&p->b);
+    p->tpl = *tuple;
+    p->used = TRUE;
+    p->sent = FALSE;
+
+    return (GOOD);
+}
+
+/* Insert in the flow table of the context the forwarding information obtained
+ * by the main loop, and send the packets parked waiting for it */
+void
+tun_output_ctx_process_misses(tun_output_ctx_t *ctx)
+{
+    tun_parked_pkt_t *p;
+    tun_miss_t *m;
+    eventfd_t cnt;
+    int i;
+
+    eventfd_read(ctx->miss_fd, &cnt);
+
+    while ((m = spsc_queue_pop(ctx->miss_replies)) != NULL) {
+        for (i = 0; i < TUN_MAX_PARKED; i++) {
+            p = &ctx->parked[i];
+            if (!p->used || p->sent || !pkt_tuple_cmp(&p->tpl, m->tpl)) {
+                continue;
+            }
+            if (m->fi) {
+                tun_output_encap_and_send(ctx, &p->b, &p->tpl, m->fi);
+            }
+            p->sent = TRUE;
+        }
+        if (m->fi) {
+            ttable_insert(&ctx->ttable, m->tpl, m->fi);
+        }
+        pkt_tuple_del(m->tpl);
+        free(m);
+    }
+
+    /* The buffers of the parked packets can be reused once sent */
+    tun_output_ctx_flush(ctx);
+    for (i = 0; i < TUN_MAX_PARKED; i++) {
+        if (ctx->parked[i].sent) {
+            ctx->parked[i].used = FALSE;
+            ctx->parked[i].sent = FALSE;
+        }
+    }
 }
 
+void
+tun_output_ctx_flush(tun_output_ctx_t *ctx)
+{
+    int i;
+
+    for (i = 0; i < ctx->tx_queues_used; i++) {
+        raw_pkt_queue_flush(ctx->tx_queues[i]);
+        ctx->tx_queues[i]->sock = ERR_SOCKET;
+    }
+    ctx->tx_queues_used = 0;
+    for (i = 0; i < ctx->udp_socks_used; i++) {
+        udp_gso_queue_flush(&ctx->udp_socks[i].queue);
+    }
+    ctx->segs_used = 0;
+    if (ctx->xmit_flush) {
+        ctx->xmit_flush();
+    }
+}
+
+/* Send the encapsulated packets of the main loop with 'xmit' when it takes
+ * them, instead of through the sockets. The workers always use the sockets.
+ * NULL restores the default */
+void
+tun_output_set_xmit(tun_xmit_fct xmit, tun_xmit_flush_fct flush)
+{
+    main_ctx.xmit = xmit;
+    main_ctx.xmit_flush = flush;
+}
+
+/* Send all the packets queued during the current batch */
+void
+tun_output_flush()
+{
+    tun_output_ctx_flush(&main_ctx);
+}
+
+/* Queue the packet in the queue of the output socket. The buffer of the packet
+ * should not be reused until the context is flushed */
 static int
-tun_forward_native(lbuf_t *b, lisp_addr_t *dst)
+tun_send_raw_packet(tun_output_ctx_t *ctx, int sock, lbuf_t *b, ip_addr_t *dst)
+{
+    raw_pkt_queue_t **tx_queues = ctx->tx_queues;
+    int i;
+
+    for (i = 0; i < ctx->tx_queues_used; i++) {
+        if (tx_queues[i]->sock == sock) {
+            return (raw_pkt_queue_add(tx_queues[i], lbuf_data(b),
+                    lbuf_size(b), dst));
+        }
+    }
+
+    if (ctx->tx_queues_used == TUN_MAX_TX_QUEUES) {
+        return (send_raw_packet(sock, lbuf_data(b), lbuf_size(b), dst));
+    }
+
+    tx_queues[ctx->tx_queues_used]->sock = sock;
+    return (raw_pkt_queue_add(tx_queues[ctx->tx_queues_used++], lbuf_data(b),
+            lbuf_size(b), dst));
+}
+
+/* Returns TRUE if the encapsulated packets toward RLOCs of the afi are sent
+ * with a zero UDP checksum */
+static inline int
+tun_zero_udp_csum(int afi)
+{
+    return (afi == AF_INET ? dplane_conf.zero_udp_csum_v4
+            : dplane_conf.zero_udp_csum_v6);
+}
+
+/* Obtain the connected UDP socket of the encapsulated packets of the flow,
+ * opening it if needed. Its source port is the one of the flow, so that the
+ * flows keep being spread among the paths of the underlay (see
+ * tun_encap_src_port) */
+static udp_gso_queue_t *
+tun_get_udp_queue(tun_output_ctx_t *ctx, fwd_info_t *fi, packet_tuple_t *tuple)
+{
+    fwd_entry_t *fe = fi->fwd_info;
+    lisp_addr_t *srloc = fe->srloc;
+    lisp_addr_t *drloc = fe->drloc;
+    struct udphdr *uh;
+    tun_udp_sock_t *us;
+    int i, sock, sport, port;
+
+    port = fi->encap == ENCP_VXLAN_GPE ? VXLAN_GPE_DATA_PORT : LISP_DATA_PORT;
+    /* Same port as the prebuilt outer header of the flow */
+    if (fe->outer_hdr.len) {
+        uh = (struct udphdr *)(fe->outer_hdr.hdr + fe->outer_hdr.ip_len);
+        sport = ntohs(udpsport(uh));
+    } else {
+        sport = tun_encap_src_port(tuple, port);
+    }
+
+    for (i = 0; i < ctx->udp_socks_used; i++) {
+        us = &ctx->udp_socks[i];
+        if (us->sport == sport && us->port == port
+                && ip_addr_cmp(&us->dst, lisp_addr_ip(drloc)) == 0
+                && ip_addr_cmp(&us->src, lisp_addr_ip(srloc)) == 0) {
+            return (&us->queue);
+        }
+    }
+
+    /* The data port belongs to the sockets receiving the encapsulated
+     * packets: a socket connected to the RLOC and bound to it would take
+     * the packets of the peer. Without a range of source ports, the
+     * socket uses an ephemeral one */
+    sock = open_udp_connected_socket(srloc, drloc, sport == port ? 0 : sport,
+            port);
+    if (sock == ERR_SOCKET) {
+        return (NULL);
+    }
+    /* The sockets keep the UDP checksum: the kernel refuses to segment the
+     * datagrams of sockets without it (UDP_SEGMENT fails with EINVAL) */
+
+    if (ctx->udp_socks_used < TUN_UDP_SOCKS) {
+        us = &ctx->udp_socks[ctx->udp_socks_used++];
+    } else {
+        us = &ctx->udp_socks[ctx->udp_socks_next];
+        ctx->udp_socks_next = (ctx->udp_socks_next + 1) % TUN_UDP_SOCKS;
+        udp_gso_queue_flush(&us->queue);
+        close(us->queue.sock);
+    }
+    ip_addr_copy(&us->src, lisp_addr_ip(srloc));
+    ip_addr_copy(&us->dst, lisp_addr_ip(drloc));
+    us->sport = sport;
+    us->port = port;
+    udp_gso_queue_init(&us->queue, sock, lisp_addr_ip_afi(drloc));
+
+    return (&us->queue);
+}
+
+/* Obtain the raw socket of the context bound to the source RLOC, opening it
+ * if needed */
+static int
+tun_get_raw_sock(tun_output_ctx_t *ctx, lisp_addr_t *srloc)
+{
+    tun_raw_sock_t *rs;
+    int i, sock, afi;
+
+    for (i = 0; i < ctx->raw_socks_used; i++) {
+        if (ip_addr_cmp(&ctx->raw_socks[i].src, lisp_addr_ip(srloc)) == 0) {
+            return (ctx->raw_socks[i].sock);
+        }
+    }
+
+    afi = lisp_addr_ip_afi(srloc);
+    sock = open_ip_raw_socket(afi);
+    if (sock == ERR_SOCKET) {
+        return (ERR_SOCKET);
+    }
+    if (bind_socket(sock, afi, srloc, 0) != GOOD) {
+        close(sock);
+        return (ERR_SOCKET);
+    }
+
+    if (ctx->raw_socks_used < TUN_RAW_SOCKS) {
+        rs = &ctx->raw_socks[ctx->raw_socks_used++];
+    } else {
+        rs = &ctx->raw_socks[ctx->raw_socks_next];
+        ctx->raw_socks_next = (ctx->raw_socks_next + 1) % TUN_RAW_SOCKS;
+        /* Packets already queued in the replaced socket */
+        for (i = 0; i < ctx->tx_queues_used; i++) {
+            if (ctx->tx_queues[i]->sock == rs->sock) {
+                raw_pkt_queue_flush(ctx->tx_queues[i]);
+            }
+        }
+        close(rs->sock);
+    }
+    ip_addr_copy(&rs->src, lisp_addr_ip(srloc));
+    rs->sock = sock;
+
+    return (sock);
+}
+
+/* Push the LISP or VXLAN-GPE header and queue the packet in the connected UDP
+ * socket of its RLOCs 'q'. The kernel builds the outer UDP and IP headers, and
+ * consecutive packets of the same size are sent with a single syscall. The
+ * buffer of the packet should not be reused until the context is flushed */
+static int
+tun_send_udp_gso(udp_gso_queue_t *q, lbuf_t *b, fwd_info_t *fi)
+{
+    fwd_entry_t *fe = fi->fwd_info;
+    int ttl = 0, tos = 0;
+
+    ip_hdr_ttl_and_tos(lbuf_data(b), &ttl, &tos);
+
+    switch (fi->encap){
+    case ENCP_LISP:
+        lisp_data_push_hdr(b, fe->iid);
+        break;
+    case ENCP_VXLAN_GPE:
+        vxlan_gpe_data_push_hdr(b, fe->iid,
+                ((struct iphdr *)lbuf_data(b))->version == 4 ? NP_IPv4 : NP_IPv6);
+        break;
+    }
+
+    return (udp_gso_queue_add(q, lbuf_data(b), lbuf_size(b), ttl, tos));
+}
+
+static int
+tun_forward_native(tun_output_ctx_t *ctx, lbuf_t *b, lisp_addr_t *dst)
 {
     int ret, sock, afi;
 
@@ -72,7 +966,7 @@ tun_forward_native(lbuf_t *b, lisp_addr_t *dst)
         return (BAD);
     }
 
-    ret = send_raw_packet(sock, lbuf_data(b), lbuf_size(b), lisp_addr_ip(dst));
+    ret = tun_send_raw_packet(ctx, sock, b, lisp_addr_ip(dst));
     return (ret);
 }
 
@@ -177,11 +1071,59 @@ tun_output_multicast(lbuf_t *b, packet_tuple_t *tuple)
     return (GOOD);
 }
 
+/* Source port of the encapsulated packets of a flow. When a range is
+ * configured, it is selected with the hash of the inner flow, so that the
+ * flows between two RLOCs are spread among the paths of the underlay and the
+ * receive queues of the decapsulating router (RFC 6830 5.3) */
 static int
-tun_output_unicast(lbuf_t *b, packet_tuple_t *tuple)
+tun_encap_src_port(packet_tuple_t *tuple, int dport)
+{
+    uint32_t range;
+
+    if (dplane_conf.encap_sport_min == 0) {
+        return (dport);
+    }
+    range = dplane_conf.encap_sport_max - dplane_conf.encap_sport_min + 1;
+    return (dplane_conf.encap_sport_min + pkt_tuple_hash(tuple) % range);
+}
+
+/* Complete the forwarding information of a flow obtained from the control
+ * before caching it: output socket of the source RLOC and outer headers of
+ * its encapsulated packets */
+static void
+tun_fwd_info_prepare(fwd_info_t *fi, packet_tuple_t *tuple)
+{
+    fwd_entry_t *fe = fi->fwd_info;
+    int dport, sport;
+
+    if (!fe || !fe->srloc || !fe->drloc) {
+        return;
+    }
+    fe->out_sock = get_out_socket_ptr_from_address(fe->srloc);
+
+    dport = fi->encap == ENCP_VXLAN_GPE ? VXLAN_GPE_DATA_PORT : LISP_DATA_PORT;
+    sport = tun_encap_src_port(tuple, dport);
+
+    switch (fi->encap){
+    case ENCP_LISP:
+        lisp_data_outer_hdr_init(&fe->outer_hdr, sport, dport, fe->srloc,
+                fe->drloc, fe->iid);
+        break;
+    case ENCP_VXLAN_GPE:
+        vxlan_gpe_data_outer_hdr_init(&fe->outer_hdr, sport, dport,
+                fe->srloc, fe->drloc, fe->iid,
+                lisp_addr_ip_afi(&tuple->dst_addr) == AF_INET ? NP_IPv4 : NP_IPv6);
+        break;
+    }
+    fe->outer_hdr.zero_udp_csum = tun_zero_udp_csum(lisp_addr_ip_afi(fe->drloc));
+}
+
+/* Obtain the forwarding information of the flow of the tuple. On a miss of
+ * the flow table, it is requested to the control plane */
+static fwd_info_t *
+tun_output_lookup(tun_output_ctx_t *ctx, packet_tuple_t *tuple)
 {
     fwd_info_t *fi;
-    fwd_entry_t *fe;
     uint32_t iid = tuple->iid;
 
     /* XXX Since OOR doesn't support same local prefixes with different IIDs when
@@ -189,22 +1131,34 @@ tun_output_unicast(lbuf_t *b, packet_tuple_t *tuple)
      * The actual IID to be used on the encapsulation processed is already stored
      * in the forwarding entry, which is obtained on a ttable miss.*/
 
-    fi = ttable_lookup(&ttable, tuple);
+    fi = ttable_lookup(&ctx->ttable, tuple);
     if (!fi) {
+        /* Resolved by the main loop */
+        if (ctx->miss_reqs) {
+            return (NULL);
+        }
         fi = (fwd_info_t *)ctrl_get_forwarding_info(tuple);
         if (fi == NULL){
-            return (BAD);
-        }
-        fe = fi->fwd_info;
-        if (fe && fe->srloc && fe->drloc)  {
-            fe->out_sock = get_out_socket_ptr_from_address(fe->srloc);
+            return (NULL);
         }
         tuple->iid = iid;
-        ttable_insert(&ttable, pkt_tuple_clone(tuple), fi);
-    }else{
-        fe = fi->fwd_info;
+        tun_fwd_info_prepare(fi, tuple);
+        ttable_insert(&ctx->ttable, tuple, fi);
     }
 
+    return (fi);
+}
+
+/* Encapsulate and send the packet according to the forwarding information of
+ * its flow */
+static int
+tun_output_encap_and_send(tun_output_ctx_t *ctx, lbuf_t *b,
+        packet_tuple_t *tuple, fwd_info_t *fi)
+{
+    fwd_entry_t *fe = fi->fwd_info;
+    udp_gso_queue_t *q;
+    int sock;
+
     /* Packets with no/negative map cache entry AND no PETR
      * OR packets with missing src or dst RLOCs*/
     if (!fe || !fe->srloc || !fe->drloc) {
@@ -215,7 +1169,7 @@ tun_output_unicast(lbuf_t *b, packet_tuple_t *tuple)
             OOR_LOG(LDBG_3, "tun_output_unicast: Packet dropped");
             return (GOOD);
         case ACT_NATIVE_FWD:
-            return(tun_forward_native(b, &tuple->dst_addr));
+            return(tun_forward_native(ctx, b, &tuple->dst_addr));
         }
     }
 
@@ -223,23 +1177,344 @@ tun_output_unicast(lbuf_t *b, packet_tuple_t *tuple)
             lisp_addr_to_char(fe->srloc),
             lisp_addr_to_char(fe->drloc));
 
+    /* The packet is sent through the raw socket if the data plane doesn't
+     * take it */
+    if (ctx->xmit && fe->outer_hdr.len) {
+        pkt_push_outer_hdr(b, &fe->outer_hdr);
+        if (ctx->xmit(b, fe->srloc, fe->drloc) == GOOD) {
+            return (GOOD);
+        }
+    } else {
+        /* If the connected socket can not be opened, the packet is sent
+         * through the raw socket */
+        if (ctx->udp_gso) {
+            q = tun_get_udp_queue(ctx, fi, tuple);
+            if (q) {
+                return (tun_send_udp_gso(q, b, fi));
+            }
+        }
+
+        if (fe->outer_hdr.len) {
+            pkt_push_outer_hdr(b, &fe->outer_hdr);
+        } else {
+            switch (fi->encap){
+            case ENCP_LISP:
+                lisp_data_encap(b, LISP_DATA_PORT, LISP_DATA_PORT, fe->srloc, fe->drloc, fe->iid);
+                break;
+            case ENCP_VXLAN_GPE:
+                vxlan_gpe_data_encap(b, VXLAN_GPE_DATA_PORT, VXLAN_GPE_DATA_PORT, fe->srloc, fe->drloc, fe->iid);
+                break;
+            }
+        }
+    }
+
+    sock = *(fe->out_sock);
+    if (ctx->raw_socks) {
+        sock = tun_get_raw_sock(ctx, fe->srloc);
+        if (sock == ERR_SOCKET) {
+            sock = *(fe->out_sock);
+        }
+    }
+
+    return(tun_send_raw_packet(ctx, sock, b, lisp_addr_ip(fe->drloc)));
+
+}
+
+static int
+tun_output_unicast(tun_output_ctx_t *ctx, lbuf_t *b, packet_tuple_t *tuple)
+{
+    fwd_info_t *fi;
+
+    fi = tun_output_lookup(ctx, tuple);
+    if (!fi) {
+        if (ctx->miss_reqs) {
+            return (tun_output_park(ctx, b, tuple));
+        }
+        return (BAD);
+    }
+
+    return (tun_output_encap_and_send(ctx, b, tuple, fi));
+}
+
+/* Complete the checksum of a packet whose transport checksum was left to the
+ * device (VIRTIO_NET_HDR_F_NEEDS_CSUM). The checksum field already contains
+ * the sum of the pseudo-header */
+static void
+tun_complete_csum(lbuf_t *b, struct virtio_net_hdr *vh)
+{
+    uint8_t *start;
+    uint16_t csum;
+
+    if (vh->csum_start + vh->csum_offset + sizeof(uint16_t) > lbuf_size(b)) {
+        return;
+    }
+
+    start = (uint8_t *)lbuf_data(b) + vh->csum_start;
+    csum = ip_checksum((uint16_t *)start, lbuf_size(b) - vh->csum_start);
+    /* A zero UDP checksum means no checksum */
+    if (csum == 0) {
+        csum = 0xffff;
+    }
+    *(uint16_t *)(start + vh->csum_offset) = csum;
+}
+
+/* Prepare the headers of the segments of a TCP super-packet received from the
+ * tun interface */
+static int
+tun_gso_hdr_init(tun_gso_hdr_t *g, lbuf_t *b, struct virtio_net_hdr *vh)
+{
+    uint8_t *pkt = lbuf_data(b);
+    struct iphdr *iph;
+    struct ip6_hdr *ip6h;
+    struct tcphdr *tcph;
+
+    switch (vh->gso_type & ~VIRTIO_NET_HDR_GSO_ECN){
+    case VIRTIO_NET_HDR_GSO_TCPV4:
+        g->afi = AF_INET;
+        g->ip_hlen = ((struct iphdr *)pkt)->ihl * 4;
+        g->ip_id = ntohs(((struct iphdr *)pkt)->id);
+        break;
+    case VIRTIO_NET_HDR_GSO_TCPV6:
+        g->afi = AF_INET6;
+        g->ip_hlen = sizeof(struct ip6_hdr);
+        if (((struct ip6_hdr *)pkt)->ip6_nxt != IPPROTO_TCP){
+            OOR_LOG(LDBG_2, "tun_output_gso: IPv6 extension headers not supported");
+            return (BAD);
+        }
+        break;
+    default:
+        OOR_LOG(LDBG_2, "tun_output_gso: Unsupported GSO type %d", vh->gso_type);
+        return (BAD);
+    }
+
+    tcph = (struct tcphdr *)(pkt + g->ip_hlen);
+    g->tcp_hlen = tcph->doff * 4;
+    g->hdr_len = g->ip_hlen + g->tcp_hlen;
+    g->payload_len = lbuf_size(b) - g->hdr_len;
+    g->payload = pkt + g->hdr_len;
+    g->mss = vh->gso_size;
+    if (g->mss == 0 || g->payload_len <= 0
+            || LBUF_STACK_OFFSET + g->hdr_len + g->mss > TUN_RECEIVE_SIZE){
+        OOR_LOG(LDBG_2, "tun_output_gso: Malformed GSO packet. Discarding");
+        return (BAD);
+    }
+    g->seq = ntohl(tcph->seq);
+    g->flags = *(uint16_t *)((uint8_t *)tcph + TCP_FLAGS_OFFSET - 1);
+
+    memcpy(g->hdr, pkt, g->hdr_len);
+    if (g->afi == AF_INET){
+        iph = (struct iphdr *)g->hdr;
+        iph->tot_len = htons(g->hdr_len + g->mss);
+        iph->check = 0;
+        iph->check = ip_checksum((uint16_t *)iph, g->ip_hlen);
+    }else{
+        ip6h = (struct ip6_hdr *)g->hdr;
+        ip6h->ip6_plen = htons(g->tcp_hlen + g->mss);
+    }
+
+    /* CWR is only kept in the first segment, FIN and PSH in the last one */
+    tcph = (struct tcphdr *)(g->hdr + g->ip_hlen);
+    ((uint8_t *)tcph)[TCP_FLAGS_OFFSET] &= ~TCP_CWR_FLAG;
+    tcph->fin = 0;
+    tcph->psh = 0;
+    tcph->check = 0;
+    tcph->check = tcp_checksum(tcph, g->tcp_hlen, g->hdr, g->afi);
+    tcph->check = cksum_update16(tcph->check, htons(g->tcp_hlen),
+            htons(g->tcp_hlen + g->mss));
+
+    return (GOOD);
+}
+
+/* Write at 'dst' the IP and TCP headers of the segment with the 'seg_len'
+ * bytes at 'off' of the payload of the GSO packet. The fields that differ
+ * from the template are updated incrementally in the checksums, and the sum
+ * of the payload is added to the TCP one */
+static void
+tun_gso_seg_hdr(tun_gso_hdr_t *g, uint8_t *dst, int off, int seg_len)
+{
+    struct iphdr *iph;
+    struct ip6_hdr *ip6h;
+    struct tcphdr *tcph;
+    uint16_t *flags;
+    uint16_t new16, mask;
+    uint32_t new32;
+
+    memcpy(dst, g->hdr, g->hdr_len);
+    tcph = (struct tcphdr *)(dst + g->ip_hlen);
+
+    if (g->afi == AF_INET){
+        iph = (struct iphdr *)dst;
+        if (off > 0){
+            new16 = htons(g->ip_id + off / g->mss);
+            iph->check = cksum_update16(iph->check, iph->id, new16);
+            iph->id = new16;
+        }
+        if (seg_len != g->mss){
+            new16 = htons(g->hdr_len + seg_len);
+            iph->check = cksum_update16(iph->check, iph->tot_len, new16);
+            iph->tot_len = new16;
+        }
+    }else if (seg_len != g->mss){
+        ip6h = (struct ip6_hdr *)dst;
+        ip6h->ip6_plen = htons(g->tcp_hlen + seg_len);
+    }
+
+    if (off > 0){
+        new32 = htonl(g->seq + off);
+        tcph->check = cksum_update32(tcph->check, tcph->seq, new32);
+        tcph->seq = new32;
+    }
+
+    /* Flags removed from the template that this segment keeps */
+    mask = 0;
+    if (off == 0){
+        mask |= htons(TCP_CWR_FLAG);
+    }
+    if (off + seg_len == g->payload_len){
+        mask |= htons(TH_FIN | TH_PUSH);
+    }
+    flags = (uint16_t *)((uint8_t *)tcph + TCP_FLAGS_OFFSET - 1);
+    new16 = *flags | (g->flags & mask);
+    if (new16 != *flags){
+        tcph->check = cksum_update16(tcph->check, *flags, new16);
+        *flags = new16;
+    }
+
+    /* Length of the pseudo-header */
+    if (seg_len != g->mss){
+        tcph->check = cksum_update16(tcph->check, htons(g->tcp_hlen + g->mss),
+                htons(g->tcp_hlen + seg_len));
+    }
+
+    tcph->check = cksum_finish((uint16_t)~tcph->check
+            + cksum_partial(g->payload + off, seg_len, 0));
+}
+
+/* Send the segments of a GSO packet through the connected UDP socket 'q' of
+ * its RLOCs. The encapsulation header is built once and each segment is
+ * passed to the kernel as its headers, followed by its payload in the GSO
+ * packet, so that it is not copied. The kernel builds the outer headers and
+ * splits the segments (UDP_SEGMENT) */
+static int
+tun_output_gso_udp(tun_output_ctx_t *ctx, udp_gso_queue_t *q, lbuf_t *b,
+        tun_gso_hdr_t *g, fwd_info_t *fi)
+{
+    fwd_entry_t *fe = fi->fwd_info;
+    uint8_t encap[16];
+    uint8_t *hdr;
+    lbuf_t eb;
+    int ttl = 0, tos = 0, encap_len, seg_len, off;
+
+    ip_hdr_ttl_and_tos(lbuf_data(b), &ttl, &tos);
+
+    lbuf_use_stack(&eb, encap, sizeof(encap));
+    lbuf_reserve(&eb, sizeof(encap));
     switch (fi->encap){
     case ENCP_LISP:
-        lisp_data_encap(b, LISP_DATA_PORT, LISP_DATA_PORT, fe->srloc, fe->drloc, fe->iid);
+        lisp_data_push_hdr(&eb, fe->iid);
         break;
     case ENCP_VXLAN_GPE:
-        vxlan_gpe_data_encap(b, VXLAN_GPE_DATA_PORT, VXLAN_GPE_DATA_PORT, fe->srloc, fe->drloc, fe->iid);
+        vxlan_gpe_data_push_hdr(&eb, fe->iid,
+                g->afi == AF_INET ? NP_IPv4 : NP_IPv6);
         break;
     }
+    encap_len = lbuf_size(&eb);
+
+    for (off = 0; off < g->payload_len; off += g->mss){
+        seg_len = g->payload_len - off < g->mss ? g->payload_len - off : g->mss;
 
+        /* The headers can only be reused once they have been sent */
+        if (ctx->segs_used == TUN_GSO_MAX_SEGS){
+            tun_output_ctx_flush(ctx);
+        }
+        hdr = ctx->seg_hdr_mem + ctx->segs_used * TUN_GSO_HDR_SIZE;
+        ctx->segs_used++;
 
-    return(send_raw_packet(*(fe->out_sock), lbuf_data(b), lbuf_size(b),
-               lisp_addr_ip(fe->drloc)));
+        memcpy(hdr, lbuf_data(&eb), encap_len);
+        tun_gso_seg_hdr(g, hdr + encap_len, off, seg_len);
+        udp_gso_queue_add2(q, hdr, encap_len + g->hdr_len,
+                g->payload + off, seg_len, ttl, tos);
+    }
 
+    return (GOOD);
+}
+
+/* Split a TCP super-packet received from the tun interface into segments of
+ * vh->gso_size bytes. The forwarding information is obtained once for all
+ * the segments. With UDP segmentation offload they are encapsulated at once.
+ * Otherwise they are copied, encapsulated and queued one by one */
+static int
+tun_output_gso(tun_output_ctx_t *ctx, lbuf_t *b, struct virtio_net_hdr *vh,
+        packet_tuple_t *tpl)
+{
+    tun_gso_hdr_t g;
+    fwd_info_t *fi = NULL;
+    fwd_entry_t *fe;
+    udp_gso_queue_t *q;
+    lbuf_t *seg;
+    int seg_len, off;
+    int park = FALSE;
+
+    if (tun_gso_hdr_init(&g, b, vh) != GOOD){
+        return (BAD);
+    }
+
+    /* Packets that can not be encapsulated using the flow table follow the
+     * normal path segment by segment. On a miss of a context whose misses
+     * are resolved by the main loop, the segments are parked waiting for
+     * the forwarding information */
+    if (!is_lisp_packet(tpl) && !ip_addr_is_multicast(lisp_addr_ip(&tpl->dst_addr))){
+        fi = tun_output_lookup(ctx, tpl);
+        if (!fi){
+            if (!ctx->miss_reqs){
+                return (BAD);
+            }
+            park = TRUE;
+        }
+    }
+
+    /* Same choice as tun_output_encap_and_send */
+    fe = fi ? fi->fwd_info : NULL;
+    if (fe && fe->srloc && fe->drloc && ctx->udp_gso
+            && !(ctx->xmit && fe->outer_hdr.len)){
+        q = tun_get_udp_queue(ctx, fi, tpl);
+        if (q){
+            return (tun_output_gso_udp(ctx, q, b, &g, fi));
+        }
+    }
+
+    for (off = 0; off < g.payload_len; off += g.mss){
+        seg_len = g.payload_len - off < g.mss ? g.payload_len - off : g.mss;
+
+        /* Segments can only be reused once the packets referencing them
+         * have been sent */
+        if (ctx->segs_used == TUN_GSO_MAX_SEGS){
+            tun_output_ctx_flush(ctx);
+        }
+        seg = &ctx->seg_bufs[ctx->segs_used];
+        lbuf_use_stack(seg, ctx->seg_mem + ctx->segs_used * TUN_RECEIVE_SIZE,
+                TUN_RECEIVE_SIZE);
+        ctx->segs_used++;
+        lbuf_reserve(seg, LBUF_STACK_OFFSET);
+
+        tun_gso_seg_hdr(&g, lbuf_put_uninit(seg, g.hdr_len), off, seg_len);
+        lbuf_put(seg, (void *)(g.payload + off), seg_len);
+
+        lbuf_reset_ip(seg);
+        if (fi){
+            tun_output_encap_and_send(ctx, seg, tpl, fi);
+        }else if (park){
+            tun_output_park(ctx, seg, tpl);
+        }else{
+            tun_output_ctx(ctx, seg, tpl);
+        }
+    }
+
+    return (GOOD);
 }
 
 int
-tun_output(lbuf_t *b, packet_tuple_t *tpl)
+tun_output_ctx(tun_output_ctx_t *ctx, lbuf_t *b, packet_tuple_t *tpl)
 {
     OOR_LOG(LDBG_3,"OUTPUT: Received EID %s -> %s, Proto: %d, Port: %d -> %d ",
             lisp_addr_to_char(&tpl->src_addr), lisp_addr_to_char(&tpl->dst_addr),
@@ -248,33 +1523,103 @@ tun_output(lbuf_t *b, packet_tuple_t *tpl)
     /* If already LISP packet, do not encapsulate again */
     if (is_lisp_packet(tpl)) {
         OOR_LOG(LDBG_3,"OUTPUT: Is a lisp packet, do not encapsulate again");
-        return (tun_forward_native(b, &tpl->dst_addr));
+        return (tun_forward_native(ctx, b, &tpl->dst_addr));
     }
     if (ip_addr_is_multicast(lisp_addr_ip(&tpl->dst_addr))) {
         tun_output_multicast(b, tpl);
     } else {
-        tun_output_unicast(b, tpl);
+        tun_output_unicast(ctx, b, tpl);
     }
     return(GOOD);
 }
 
 int
-tun_output_recv(sock_t *sl)
+tun_output(lbuf_t *b, packet_tuple_t *tpl)
+{
+    return (tun_output_ctx(&main_ctx, b, tpl));
+}
+
+/* Encapsulate a packet read from the tun interface and queue it to be sent.
+ * With offloads, it starts with the virtio header */
+static void
+tun_output_ctx_pkt(tun_output_ctx_t *ctx, lbuf_t *b)
 {
     packet_tuple_t tpl;
+    struct virtio_net_hdr *vh;
 
-    lbuf_use_stack(&pkt_buf, &pkt_recv_buf, TUN_RECEIVE_SIZE);
-    lbuf_reserve(&pkt_buf, LBUF_STACK_OFFSET);
+    vh = NULL;
+    if (ctx->vnet_hdr_len) {
+        if (lbuf_size(b) < ctx->vnet_hdr_len) {
+            return;
+        }
+        vh = lbuf_pull(b, ctx->vnet_hdr_len);
+    }
 
-    if (sock_recv(sl->fd, &pkt_buf) != GOOD) {
-        OOR_LOG(LWRN, "OUTPUT: Error while reading from tun!");
-        return (BAD);
+    lbuf_reset_ip(b);
+    tpl.iid = 0;
+    if (pkt_parse_5_tuple(b, &tpl) != GOOD) {
+        return;
     }
-    lbuf_reset_ip(&pkt_buf);
-    if (pkt_parse_5_tuple(&pkt_buf, &tpl) != GOOD) {
-        return (BAD);
+
+    if (vh && vh->gso_type != VIRTIO_NET_HDR_GSO_NONE) {
+        tun_output_gso(ctx, b, vh, &tpl);
+        return;
     }
-    tpl.iid = 0;
-    tun_output(&pkt_buf, &tpl);
-    return (GOOD);
+    if (vh && (vh->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM)) {
+        tun_complete_csum(b, vh);
+    }
+    tun_output_ctx(ctx, b, &tpl);
+}
+
+/* Read up to a batch of packets from the tun interface, encapsulate them and
+ * send them with one syscall per output socket */
+static int
+tun_output_ctx_read(tun_output_ctx_t *ctx, int fd)
+{
+    lbuf_t *b;
+    int i, nread;
+
+    for (i = 0; i < ctx->pkt_bufs_size; i++) {
+        b = &ctx->pkt_bufs[i];
+        lbuf_use_stack(b, ctx->pkt_recv_mem + i * ctx->pkt_buf_len,
+                ctx->pkt_buf_len);
+        lbuf_reserve(b, LBUF_STACK_OFFSET);
+
+        nread = read(fd, lbuf_data(b), lbuf_tailroom(b));
+        if (nread < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            /* No more packets pending in the tun interface */
+            break;
+        }
+        if (nread <= 0) {
+            OOR_LOG(LWRN, "OUTPUT: Error while reading from tun!");
+            break;
+        }
+        lbuf_set_size(b, nread);
+
+        tun_output_ctx_pkt(ctx, b);
+    }
+
+    tun_output_ctx_flush(ctx);
+
+    /* BAD when there was nothing to read */
+    return (i == 0 ? BAD : GOOD);
+}
+
+/* Encapsulate and send packets read from the tun interface by another
+ * reader. The buffers can be reused when it returns */
+void
+tun_output_process_bufs(lbuf_t *bufs, int nbufs)
+{
+    int i;
+
+    for (i = 0; i < nbufs; i++) {
+        tun_output_ctx_pkt(&main_ctx, &bufs[i]);
+    }
+    tun_output_ctx_flush(&main_ctx);
+}
+
+int
+tun_output_recv(sock_t *sl)
+{
+    return (tun_output_ctx_read(&main_ctx, sl->fd));
 }
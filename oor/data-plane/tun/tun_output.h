@@ -34,9 +34,33 @@
 #include "../../lib/cksum.h"
 
 
+/* State of one instance of the output pipeline */
+typedef struct tun_output_ctx_ tun_output_ctx_t;
+
+/* Transmission of the encapsulated packets of the main loop by another data
+ * plane, without the sockets of their source RLOCs. The first function
+ * returns GOOD if it takes the packet. The second one sends the packets taken
+ * during a batch */
+typedef int (*tun_xmit_fct)(lbuf_t *b, lisp_addr_t *srloc, lisp_addr_t *drloc);
+typedef void (*tun_xmit_flush_fct)();
+
 int tun_output_recv(sock_t *sl);
 int tun_output(lbuf_t *, packet_tuple_t *);
-void tun_output_init();
+void tun_output_init(int batch_size);
 void tun_output_uninit();
+void tun_output_flush();
+void tun_output_log_stats();
+void tun_output_process_bufs(lbuf_t *bufs, int nbufs);
+int tun_output_workers_start(int *fds, int nfds, int batch_size);
+void tun_output_workers_stop();
+tun_output_ctx_t *tun_output_worker_ctx_new(int batch_size);
+void tun_output_worker_ctx_del(tun_output_ctx_t *ctx);
+int tun_output_ctx(tun_output_ctx_t *ctx, lbuf_t *b, packet_tuple_t *tpl);
+void tun_output_ctx_flush(tun_output_ctx_t *ctx);
+int tun_output_ctx_miss_fd(tun_output_ctx_t *ctx);
+void tun_output_ctx_process_misses(tun_output_ctx_t *ctx);
+int tun_output_ctrl_detach(sockmstr_t *m);
+void tun_output_ctrl_attach(sockmstr_t *m);
+void tun_output_set_xmit(tun_xmit_fct xmit, tun_xmit_flush_fct flush);
 
 #endif /*TUN_OUTPUT_H_*/
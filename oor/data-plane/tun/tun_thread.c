@@ -0,0 +1,131 @@
+/*
+ *
+ * Copyright (C) 2011, 2015 Cisco Systems, Inc.
+ * Copyright (C) 2015 CBA research group, Technical University of Catalonia.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "tun_thread.h"
+#include "tun_output.h"
+#include "../../lib/oor_log.h"
+
+/* Thread serving the tun interface and the data sockets with its own socket
+ * master, so that the processing of control messages, netlink events, timers
+ * and the API doesn't delay the forwarding of packets. It never accesses the
+ * control: the flow table misses of the output are resolved by the main loop
+ * and the answers are received through an event of its socket master */
+
+static sockmstr_t *dp_master;
+static sock_t *stop_sock;
+static pthread_t dp_thread;
+static volatile int dp_running;
+
+
+static int
+tun_thread_stop_recv(sock_t *sl)
+{
+    eventfd_t cnt;
+
+    eventfd_read(sl->fd, &cnt);
+    dp_running = FALSE;
+    return (GOOD);
+}
+
+static void *
+tun_thread_run(void *arg)
+{
+    while (dp_running) {
+        sockmstr_wait_on_all_read(dp_master);
+        sockmstr_process_all(dp_master);
+    }
+
+    return (NULL);
+}
+
+/* Create the socket master of the data plane thread. The descriptors served
+ * by the thread should be registered in it before tun_thread_start */
+sockmstr_t *
+tun_thread_init()
+{
+    int fd;
+
+    dp_master = sockmstr_create();
+    if (!dp_master) {
+        return (NULL);
+    }
+
+    fd = eventfd(0, EFD_NONBLOCK);
+    if (fd < 0) {
+        OOR_LOG(LERR, "tun_thread_init: eventfd: %s", strerror(errno));
+        goto err;
+    }
+    stop_sock = sockmstr_register_read_listener(dp_master,
+            tun_thread_stop_recv, NULL, fd);
+    if (!stop_sock) {
+        close(fd);
+        goto err;
+    }
+
+    if (tun_output_ctrl_detach(dp_master) != GOOD) {
+        goto err;
+    }
+
+    return (dp_master);
+err:
+    sockmstr_destroy(dp_master);
+    dp_master = NULL;
+    stop_sock = NULL;
+    return (NULL);
+}
+
+int
+tun_thread_start()
+{
+    dp_running = TRUE;
+    if (pthread_create(&dp_thread, NULL, tun_thread_run, NULL) != 0) {
+        OOR_LOG(LERR, "tun_thread_start: Couldn't create the data plane "
+                "thread: %s", strerror(errno));
+        dp_running = FALSE;
+        return (BAD);
+    }
+
+    OOR_LOG(LDBG_1, "Started the data plane thread");
+    return (GOOD);
+}
+
+/* Stop the thread and close the descriptors registered in its socket
+ * master */
+void
+tun_thread_stop()
+{
+    if (!dp_master) {
+        return;
+    }
+
+    if (dp_running) {
+        eventfd_write(stop_sock->fd, 1);
+        pthread_join(dp_thread, NULL);
+    }
+    tun_output_ctrl_attach(dp_master);
+    sockmstr_destroy(dp_master);
+    dp_master = NULL;
+    stop_sock = NULL;
+}
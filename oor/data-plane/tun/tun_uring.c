@@ -0,0 +1,548 @@
+/*
+ *
+ * Copyright (C) 2011, 2015 Cisco Systems, Inc.
+ * Copyright (C) 2015 CBA research group, Technical University of Catalonia.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * io_uring driven I/O of the tun data plane. The tun interface and the data
+ * input sockets are read with multishot requests that pick their buffers
+ * from rings of buffers registered with the kernel: a single request keeps
+ * delivering packets, in order, without a syscall per packet. Completions are
+ * processed in batches when the ring descriptor becomes readable. The
+ * decapsulated packets are written to the tun interface with a chain of
+ * linked requests submitted with one syscall.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "tun.h"
+#include "tun_input.h"
+#include "tun_output.h"
+#include "tun_uring.h"
+#include "../../oor_external.h"
+#include "../../lib/mem_util.h"
+#include "../../lib/oor_log.h"
+#include "../../lib/packets.h"
+#include "../../lib/uring.h"
+
+/* Submission and completion entries of the receive ring. It only holds the
+ * multishot requests, but each of them generates many completions */
+#define TUN_URING_ENTRIES       16
+#define TUN_URING_CQ_ENTRIES    4096
+/* Submission entries of the ring used to write to the tun interface */
+#define TUN_URING_TX_ENTRIES    DPLANE_MAX_RX_BATCH
+
+/* Buffer groups and number of buffers of each one */
+#define TUN_URING_DATA_BGID     0
+#define TUN_URING_TUN_BGID      1
+#define TUN_URING_DATA_BUFS     1024
+#define TUN_URING_GRO_BUFS      64
+#define TUN_URING_TUN_BUFS      512
+#define TUN_URING_TUN_GSO_BUFS  64
+
+/* Multishot receives place the source address and the ancillary data before
+ * the payload of each datagram. Room for the cmsgs of sock_data_parse_cmsg */
+#define TUN_URING_CONTROL_LEN   64
+#define TUN_URING_MSG_HDR_LEN   (sizeof(struct io_uring_recvmsg_out) \
+        + sizeof(union sockunion) + TUN_URING_CONTROL_LEN)
+
+/* Type of request in the upper half of the user data of the entries. The
+ * lower half holds the index of the data socket */
+enum {
+    TUN_URING_DATA_RECV = 1,
+    TUN_URING_TUN_READ,
+    TUN_URING_TUN_WRITE
+};
+#define TUN_URING_UDATA(type_, idx_)    (((uint64_t)(type_) << 32) | (idx_))
+
+typedef struct tun_uring_ {
+    uring_t *rx;
+    sock_t *rx_sock;
+    uring_buf_ring_t *data_br;
+    uring_buf_ring_t *tun_br;
+    int data_socks[2];
+    int nsocks;
+    struct msghdr data_msg;
+    int tun_fd;
+    uint8_t rtr;
+    /* Used if the kernel doesn't support a multishot request */
+    int (*data_cb)(sock_t *);
+    int sock_flags;
+    /* Buffers received in the current batch. They are given back to the
+     * kernel once processed */
+    lbuf_t *data_bufs;
+    data_recv_md_t *data_md;
+    uint16_t *data_bids;
+    int ndata;
+    int data_batch;
+    lbuf_t *tun_bufs;
+    uint16_t *tun_bids;
+    int ntun;
+    int tun_batch;
+    /* Multishot requests finished by the kernel, to be posted again */
+    uint8_t rearm_data[2];
+    uint8_t rearm_tun;
+    /* Writes to the tun interface */
+    uring_t *tx;
+    struct iovec *tx_iov;
+} tun_uring_t;
+
+static tun_uring_t *uring;
+
+static int tun_uring_process(sock_t *sl);
+
+
+static int
+tun_uring_post_data_recv(int i)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_get_sqe(uring->rx);
+    if (!sqe) {
+        return (BAD);
+    }
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = uring->data_socks[i];
+    sqe->addr = (uint64_t)(unsigned long)&uring->data_msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = TUN_URING_DATA_BGID;
+    sqe->user_data = TUN_URING_UDATA(TUN_URING_DATA_RECV, i);
+
+    return (GOOD);
+}
+
+static int
+tun_uring_post_tun_read()
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_get_sqe(uring->rx);
+    if (!sqe) {
+        return (BAD);
+    }
+    sqe->opcode = URING_OP_READ_MULTISHOT;
+    sqe->fd = uring->tun_fd;
+    sqe->off = (uint64_t)-1;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = TUN_URING_TUN_BGID;
+    sqe->user_data = TUN_URING_UDATA(TUN_URING_TUN_READ, 0);
+
+    return (GOOD);
+}
+
+static void
+tun_uring_free(tun_uring_t *u)
+{
+    if (u->rx_sock) {
+        /* Closes the descriptor of the ring */
+        sockmstr_unregister_read_listenedr(smaster, u->rx_sock);
+        u->rx->fd = ERR_SOCKET;
+    }
+    if (u->rx) {
+        uring_buf_ring_del(u->rx, u->data_br);
+        uring_buf_ring_del(u->rx, u->tun_br);
+    }
+    uring_del(u->rx);
+    uring_del(u->tx);
+    free(u->data_bufs);
+    free(u->data_md);
+    free(u->data_bids);
+    free(u->tun_bufs);
+    free(u->tun_bids);
+    free(u->tx_iov);
+    free(u);
+}
+
+/* Read the data sockets and the tun interface ('tun_fd', -1 if it is read by
+ * other means) through io_uring, and write to the tun interface with it when
+ * not in RTR mode. Returns BAD if io_uring can not be used. In that case, the
+ * caller should register the descriptors in the socket master */
+int
+tun_uring_init(int *data_socks, int nsocks, int tun_fd, int rtr,
+        int batch_size, int udp_gro, int (*data_cb)(sock_t *), int sock_flags)
+{
+    tun_uring_t *u;
+    int i, nbufs, buf_len;
+
+    u = xzalloc(sizeof(tun_uring_t));
+    u->rx = uring_new(TUN_URING_ENTRIES, TUN_URING_CQ_ENTRIES);
+    if (!u->rx) {
+        free(u);
+        return (BAD);
+    }
+
+    if (nsocks > 0) {
+        nbufs = udp_gro ? TUN_URING_GRO_BUFS : TUN_URING_DATA_BUFS;
+        buf_len = TUN_URING_MSG_HDR_LEN + (udp_gro ? 65535 : MAX_IP_PKT_LEN);
+        u->data_br = uring_buf_ring_new(u->rx, TUN_URING_DATA_BGID, nbufs,
+                buf_len, 0);
+        if (!u->data_br) {
+            tun_uring_free(u);
+            return (BAD);
+        }
+        /* Leave buffers to the kernel while a batch is processed */
+        u->data_batch = batch_size < nbufs / 2 ? batch_size : nbufs / 2;
+    }
+
+    if (tun_fd >= 0) {
+        if (tun_get_vnet_hdr_len()) {
+            nbufs = TUN_URING_TUN_GSO_BUFS;
+            buf_len = TUN_GSO_RECEIVE_SIZE;
+        } else {
+            nbufs = TUN_URING_TUN_BUFS;
+            buf_len = TUN_RECEIVE_SIZE;
+        }
+        u->tun_br = uring_buf_ring_new(u->rx, TUN_URING_TUN_BGID, nbufs,
+                buf_len, LBUF_STACK_OFFSET);
+        if (!u->tun_br) {
+            tun_uring_free(u);
+            return (BAD);
+        }
+        u->tun_batch = batch_size < nbufs / 2 ? batch_size : nbufs / 2;
+    }
+
+    if (!rtr) {
+        u->tx = uring_new(TUN_URING_TX_ENTRIES, 2 * TUN_URING_TX_ENTRIES);
+        if (!u->tx) {
+            tun_uring_free(u);
+            return (BAD);
+        }
+        u->tx_iov = xzalloc(2 * TUN_URING_TX_ENTRIES * sizeof(struct iovec));
+    }
+
+    for (i = 0; i < nsocks; i++) {
+        u->data_socks[i] = data_socks[i];
+    }
+    u->nsocks = nsocks;
+    u->tun_fd = tun_fd;
+    u->rtr = rtr;
+    u->data_cb = data_cb;
+    u->sock_flags = sock_flags;
+    u->data_msg.msg_namelen = sizeof(union sockunion);
+    u->data_msg.msg_controllen = TUN_URING_CONTROL_LEN;
+    u->data_bufs = xzalloc(u->data_batch * sizeof(lbuf_t));
+    u->data_md = xzalloc(u->data_batch * sizeof(data_recv_md_t));
+    u->data_bids = xzalloc(u->data_batch * sizeof(uint16_t));
+    u->tun_bufs = xzalloc(u->tun_batch * sizeof(lbuf_t));
+    u->tun_bids = xzalloc(u->tun_batch * sizeof(uint16_t));
+    uring = u;
+
+    for (i = 0; i < nsocks; i++) {
+        tun_uring_post_data_recv(i);
+    }
+    if (tun_fd >= 0) {
+        tun_uring_post_tun_read();
+    }
+    if (uring_submit(u->rx, 0) < 0) {
+        uring = NULL;
+        tun_uring_free(u);
+        return (BAD);
+    }
+
+    u->rx_sock = sockmstr_register_read_listener(smaster, tun_uring_process,
+            NULL, u->rx->fd);
+    if (!u->rx_sock) {
+        uring = NULL;
+        tun_uring_free(u);
+        return (BAD);
+    }
+
+    OOR_LOG(LDBG_1, "Data plane: io_uring used to read %d data sockets%s%s",
+            nsocks, tun_fd >= 0 ? ", to read the tun interface" : "",
+            u->tx ? " and to write to the tun interface" : "");
+
+    return (GOOD);
+}
+
+void
+tun_uring_uninit()
+{
+    if (uring) {
+        tun_uring_free(uring);
+        uring = NULL;
+    }
+}
+
+/* Decapsulate the datagrams of the batch and give back their buffers */
+static void
+tun_uring_flush_data()
+{
+    int i;
+
+    if (uring->ndata == 0) {
+        return;
+    }
+    tun_input_process_bufs(uring->data_bufs, uring->data_md, uring->ndata,
+            uring->rtr);
+    for (i = 0; i < uring->ndata; i++) {
+        uring_buf_ring_add(uring->data_br, uring->data_bids[i]);
+    }
+    uring_buf_ring_publish(uring->data_br);
+    uring->ndata = 0;
+}
+
+/* Encapsulate the packets of the tun interface of the batch and give back
+ * their buffers */
+static void
+tun_uring_flush_tun()
+{
+    int i;
+
+    if (uring->ntun == 0) {
+        return;
+    }
+    tun_output_process_bufs(uring->tun_bufs, uring->ntun);
+    for (i = 0; i < uring->ntun; i++) {
+        uring_buf_ring_add(uring->tun_br, uring->tun_bids[i]);
+    }
+    uring_buf_ring_publish(uring->tun_br);
+    uring->ntun = 0;
+}
+
+static void
+tun_uring_data_cqe(struct io_uring_cqe *cqe, int idx)
+{
+    struct io_uring_recvmsg_out *out;
+    struct msghdr msg;
+    uint8_t *buf, *payload;
+    uint16_t bid;
+    lbuf_t *b;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        uring->rearm_data[idx] = TRUE;
+    }
+
+    if (cqe->res < 0) {
+        if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+            OOR_LOG(LWRN, "Data plane: multishot receive not supported by the "
+                    "kernel. Reading data socket %d without io_uring",
+                    uring->data_socks[idx]);
+            uring->rearm_data[idx] = FALSE;
+            sockmstr_register_read_listener_flags(smaster, uring->data_cb,
+                    NULL, uring->data_socks[idx], uring->sock_flags);
+        } else if (cqe->res != -ENOBUFS) {
+            OOR_LOG(LDBG_2, "Data plane: receive error: %s",
+                    strerror(-cqe->res));
+        }
+        return;
+    }
+    if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+        return;
+    }
+
+    bid = uring_cqe_bid(cqe);
+    buf = uring_buf(uring->data_br, bid);
+    out = (struct io_uring_recvmsg_out *)buf;
+    if (out->flags & (MSG_TRUNC | MSG_CTRUNC)) {
+        uring_buf_ring_add(uring->data_br, bid);
+        return;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = buf + sizeof(struct io_uring_recvmsg_out);
+    msg.msg_namelen = out->namelen;
+    msg.msg_control = (uint8_t *)msg.msg_name + uring->data_msg.msg_namelen;
+    msg.msg_controllen = out->controllen;
+    payload = (uint8_t *)msg.msg_control + uring->data_msg.msg_controllen;
+
+    /* The room of the address and the cmsgs is the headroom of the packet */
+    b = &uring->data_bufs[uring->ndata];
+    lbuf_use_stack(b, buf, uring->data_br->buf_len);
+    lbuf_reserve(b, payload - buf);
+    lbuf_set_size(b, out->payloadlen);
+    sock_data_parse_cmsg(&msg, (union sockunion *)msg.msg_name,
+            &uring->data_md[uring->ndata]);
+    uring->data_bids[uring->ndata++] = bid;
+}
+
+static void
+tun_uring_tun_cqe(struct io_uring_cqe *cqe)
+{
+    uint16_t bid;
+    lbuf_t *b;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        uring->rearm_tun = TRUE;
+    }
+
+    if (cqe->res < 0) {
+        if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+            OOR_LOG(LWRN, "Data plane: multishot read not supported by the "
+                    "kernel. Reading the tun interface without io_uring");
+            uring->rearm_tun = FALSE;
+            sockmstr_register_read_listener_flags(smaster, tun_output_recv,
+                    NULL, uring->tun_fd, uring->sock_flags);
+        } else if (cqe->res != -ENOBUFS) {
+            OOR_LOG(LWRN, "OUTPUT: Error while reading from tun: %s",
+                    strerror(-cqe->res));
+        }
+        return;
+    }
+    if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+        return;
+    }
+
+    bid = uring_cqe_bid(cqe);
+    b = &uring->tun_bufs[uring->ntun];
+    lbuf_use_stack(b, uring_buf(uring->tun_br, bid), uring->tun_br->buf_len);
+    lbuf_reserve(b, uring->tun_br->headroom);
+    lbuf_set_size(b, cqe->res);
+    uring->tun_bids[uring->ntun++] = bid;
+}
+
+/* Process the completions of the multishot requests */
+static int
+tun_uring_process(sock_t *sl)
+{
+    struct io_uring_cqe *cqe;
+    int i, ncqes = 0;
+
+    while ((cqe = uring_peek_cqe(uring->rx)) != NULL) {
+        switch (cqe->user_data >> 32) {
+        case TUN_URING_DATA_RECV:
+            tun_uring_data_cqe(cqe, (int)(cqe->user_data & 0xffffffff));
+            break;
+        case TUN_URING_TUN_READ:
+            tun_uring_tun_cqe(cqe);
+            break;
+        default:
+            break;
+        }
+        uring_cqe_seen(uring->rx);
+        ncqes++;
+
+        if (uring->ndata == uring->data_batch) {
+            tun_uring_flush_data();
+        }
+        if (uring->ntun == uring->tun_batch) {
+            tun_uring_flush_tun();
+        }
+    }
+    tun_uring_flush_data();
+    tun_uring_flush_tun();
+    if (uring->data_br) {
+        /* Buffers of discarded datagrams */
+        uring_buf_ring_publish(uring->data_br);
+    }
+
+    /* Requests finished by the kernel, usually because it ran out of
+     * buffers */
+    for (i = 0; i < uring->nsocks; i++) {
+        if (uring->rearm_data[i]) {
+            uring->rearm_data[i] = FALSE;
+            tun_uring_post_data_recv(i);
+        }
+    }
+    if (uring->rearm_tun) {
+        uring->rearm_tun = FALSE;
+        tun_uring_post_tun_read();
+    }
+    uring_submit(uring->rx, 0);
+
+    return (ncqes > 0 ? GOOD : BAD);
+}
+
+/* Wait for the completion of the 'nsub' writes submitted to the tun
+ * interface. Their buffers can be reused afterwards */
+static void
+tun_uring_tx_wait(struct io_uring_sqe *last, int nsub)
+{
+    struct io_uring_cqe *cqe;
+    int done = 0;
+
+    /* Ends the chain of linked writes */
+    last->flags &= ~IOSQE_IO_HARDLINK;
+    uring_submit(uring->tx, nsub);
+
+    while (done < nsub) {
+        cqe = uring_peek_cqe(uring->tx);
+        if (!cqe) {
+            if (uring_submit(uring->tx, nsub - done) < 0) {
+                break;
+            }
+            continue;
+        }
+        if (cqe->res < 0) {
+            OOR_LOG(LDBG_2, "lisp_input: write error: %s\n ", strerror(-cqe->res));
+        }
+        uring_cqe_seen(uring->tx);
+        done++;
+    }
+}
+
+/* Write to the tun interface the packets with status GOOD. The writes are
+ * linked so they are done in order, and submitted with a single syscall.
+ * Returns BAD if io_uring is not used to write to the tun interface */
+int
+tun_uring_write_pkts(lbuf_t *pkts, int *status, int npkts, uint8_t *vnet_hdr,
+        int vnet_hdr_len)
+{
+    struct io_uring_sqe *sqe, *last = NULL;
+    struct iovec *iov;
+    lbuf_t *b;
+    int i, nsub = 0;
+
+    if (!uring || !uring->tx) {
+        return (BAD);
+    }
+
+    for (i = 0; i < npkts; i++) {
+        if (status[i] != GOOD) {
+            continue;
+        }
+        if (nsub == TUN_URING_TX_ENTRIES) {
+            tun_uring_tx_wait(last, nsub);
+            nsub = 0;
+        }
+        sqe = uring_get_sqe(uring->tx);
+        if (!sqe) {
+            break;
+        }
+        b = &pkts[i];
+        sqe->fd = tun_receive_fd;
+        if (vnet_hdr_len) {
+            /* The packets of a GRO buffer are contiguous, so the empty
+             * virtio header is provided separately */
+            iov = &uring->tx_iov[2 * nsub];
+            iov[0].iov_base = vnet_hdr;
+            iov[0].iov_len = vnet_hdr_len;
+            iov[1].iov_base = lbuf_l3(b);
+            iov[1].iov_len = lbuf_size(b);
+            sqe->opcode = IORING_OP_WRITEV;
+            sqe->addr = (uint64_t)(unsigned long)iov;
+            sqe->len = 2;
+        } else {
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->addr = (uint64_t)(unsigned long)lbuf_l3(b);
+            sqe->len = lbuf_size(b);
+        }
+        sqe->flags = IOSQE_IO_HARDLINK;
+        sqe->user_data = TUN_URING_UDATA(TUN_URING_TUN_WRITE, 0);
+        last = sqe;
+        nsub++;
+    }
+
+    if (nsub > 0) {
+        tun_uring_tx_wait(last, nsub);
+    }
+
+    return (GOOD);
+}
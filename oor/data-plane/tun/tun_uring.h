@@ -0,0 +1,32 @@
+/*
+ *
+ * Copyright (C) 2011, 2015 Cisco Systems, Inc.
+ * Copyright (C) 2015 CBA research group, Technical University of Catalonia.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef TUN_URING_H_
+#define TUN_URING_H_
+
+#include "../../lib/lbuf.h"
+#include "../../lib/sockets.h"
+
+int tun_uring_init(int *data_socks, int nsocks, int tun_fd, int rtr,
+        int batch_size, int udp_gro, int (*data_cb)(sock_t *), int sock_flags);
+void tun_uring_uninit();
+int tun_uring_write_pkts(lbuf_t *pkts, int *status, int npkts,
+        uint8_t *vnet_hdr, int vnet_hdr_len);
+
+#endif /* TUN_URING_H_ */
@@ -42,7 +42,10 @@ static int vpnapi_forward_native(lbuf_t *b, lisp_addr_t *dst);
 void
 vpnapi_output_init()
 {
-    ttable_init(&ttable);
+    ttable_init(&ttable, dplane_conf.flow_cache_size,
+            dplane_conf.flow_cache_evict == DPLANE_FLOW_EVICT_CLOCK ?
+                    TTABLE_EVICT_CLOCK : TTABLE_EVICT_LRU,
+            dplane_conf.flow_cache_tcp_close, dplane_conf.flowlet_gap);
 }
 
 void
@@ -113,7 +116,7 @@ vpnapi_output_unicast(lbuf_t *b, packet_tuple_t *tuple)
             }
         }
         tuple->iid = iid;
-        ttable_insert(&ttable, pkt_tuple_clone(tuple), fi);
+        ttable_insert(&ttable, tuple, fi);
     }else{
         fe = fi->fwd_info;
     }
@@ -173,10 +176,10 @@ vpnapi_output_recv(struct sock *sl)
     }
     lbuf_reset_ip(&pkt_buf);
 
+    tpl.iid = 0;
     if (pkt_parse_5_tuple(&pkt_buf, &tpl) != GOOD) {
         return (BAD);
     }
-    tpl.iid = 0;
     vpnapi_output(&pkt_buf, &tpl);
     return (GOOD);
 }
@@ -0,0 +1,519 @@
+/*
+ *
+ * Copyright (C) 2011, 2015 Cisco Systems, Inc.
+ * Copyright (C) 2015 CBA research group, Technical University of Catalonia.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * AF_XDP data plane. The encapsulated packets received by the RLOC interfaces
+ * are redirected by an XDP program to AF_XDP sockets and decapsulated in the
+ * frames of their UMEM, without going through the network stack. The
+ * encapsulated packets leaving through those interfaces are sent through the
+ * tx ring of the sockets, with the next hop resolved by the kernel. The
+ * re-encapsulated packets of the RTR are sent in their rx frame. Everything
+ * else, including the tun interface, the encapsulation of the output packets,
+ * the forwarding lookups and the packets whose next hop is not resolved yet,
+ * is done by the tun data plane and the sockets of the kernel.
+ */
+
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/ethernet.h>
+#include <linux/if_link.h>
+
+#include "xdp.h"
+#include "../tun/tun.h"
+#include "../tun/tun_input.h"
+#include "../tun/tun_output.h"
+#include "../../iface_list.h"
+#include "../../iface_mgmt.h"
+#include "../../oor_external.h"
+#include "../../lib/mem_util.h"
+#include "../../lib/oor_log.h"
+#include "../../lib/packets.h"
+
+
+int xdp_configure_data_plane(oor_dev_type_e dev_type, oor_encap_t encap_type, ...);
+void xdp_uninit_data_plane();
+int xdp_add_datap_iface_addr(iface_t *iface, int afi);
+int xdp_add_eid_prefix(oor_dev_type_e dev_type, lisp_addr_t *eid_prefix);
+int xdp_remove_eid_prefix(oor_dev_type_e dev_type, lisp_addr_t *eid_prefix);
+int xdp_process_input_packet(sock_t *sl);
+int xdp_rtr_process_input_packet(sock_t *sl);
+int xdp_updated_route(int command, iface_t *iface, lisp_addr_t *src_pref,
+        lisp_addr_t *dst_pref, lisp_addr_t *gateway);
+int xdp_updated_addr(iface_t *iface, lisp_addr_t *old_addr, lisp_addr_t *new_addr);
+int xdp_updated_link(iface_t *iface, int old_iface_index, int new_iface_index,
+        int status);
+
+static int xdp_iface_attach(xdp_dplane_data_t *data, iface_t *iface);
+static void xdp_iface_detach(xdp_iface_t *xi);
+static xdp_iface_t *xdp_iface_find(xdp_dplane_data_t *data, iface_t *iface);
+static void xdp_addr_map_set(xdp_dplane_data_t *data, lisp_addr_t *addr, int add);
+static int xdp_xmit(lbuf_t *b, lisp_addr_t *srloc, lisp_addr_t *drloc);
+static void xdp_xmit_flush();
+
+data_plane_struct_t dplane_xdp = {
+        .datap_init = xdp_configure_data_plane,
+        .datap_uninit = xdp_uninit_data_plane,
+        .datap_add_iface_addr = xdp_add_datap_iface_addr,
+        .datap_add_eid_prefix = xdp_add_eid_prefix,
+        .datap_remove_eid_prefix = xdp_remove_eid_prefix,
+        .datap_input_packet = xdp_process_input_packet,
+        .datap_rtr_input_packet = xdp_rtr_process_input_packet,
+        .datap_output_packet = tun_output_recv,
+        .datap_updated_route = xdp_updated_route,
+        .datap_updated_addr = xdp_updated_addr,
+        .datap_update_link = xdp_updated_link,
+        .datap_data = NULL
+};
+
+
+int
+xdp_configure_data_plane(oor_dev_type_e dev_type, oor_encap_t encap_type, ...)
+{
+    xdp_dplane_data_t *data;
+    glist_entry_t *iface_it;
+    iface_t *iface;
+
+    /* The data sockets opened by the tun data plane get the packets of the
+     * interfaces where the XDP program can not be attached */
+    if (dplane_tun.datap_init(dev_type, encap_type) != GOOD){
+        return (BAD);
+    }
+
+    data = xzalloc(sizeof(xdp_dplane_data_t));
+    data->ifaces = glist_new();
+    data->data_port = encap_type == ENCP_VXLAN_GPE ? VXLAN_GPE_DATA_PORT : LISP_DATA_PORT;
+    data->rtr = (dev_type == RTR_MODE);
+    data->batch_size = dplane_conf.rx_batch_size;
+    if (data->batch_size < 1){
+        data->batch_size = 1;
+    }else if (data->batch_size > DPLANE_MAX_RX_BATCH){
+        data->batch_size = DPLANE_MAX_RX_BATCH;
+    }
+    data->pkts = xzalloc(data->batch_size * sizeof(lbuf_t));
+    data->neighs = xzalloc(XDP_NEIGH_CACHE_SIZE * sizeof(xdp_neigh_t));
+    dplane_xdp.datap_data = (void *)data;
+
+    /* Without the map of local addresses the programs can not be loaded */
+    data->addr_map_fd = xdp_addr_map_create();
+    if (data->addr_map_fd >= 0){
+        glist_for_each_entry(iface_it, interface_list){
+            iface = (iface_t *)glist_entry_data(iface_it);
+            xdp_addr_map_set(data, iface->ipv4_address, TRUE);
+            xdp_addr_map_set(data, iface->ipv6_address, TRUE);
+        }
+        glist_for_each_entry(iface_it, interface_list){
+            iface = (iface_t *)glist_entry_data(iface_it);
+            xdp_iface_attach(data, iface);
+        }
+    }
+
+    if (glist_size(data->ifaces) == 0){
+        OOR_LOG(LWRN, "AF_XDP data plane: No interface could be attached. "
+                "Packets are received through the kernel");
+    }
+    tun_output_set_xmit(xdp_xmit, xdp_xmit_flush);
+
+    return (GOOD);
+}
+
+void
+xdp_uninit_data_plane()
+{
+    xdp_dplane_data_t *data = (xdp_dplane_data_t *)dplane_xdp.datap_data;
+    glist_entry_t *it;
+
+    if (data){
+        tun_output_set_xmit(NULL, NULL);
+        glist_for_each_entry(it, data->ifaces){
+            xdp_iface_detach((xdp_iface_t *)glist_entry_data(it));
+        }
+        glist_destroy(data->ifaces);
+        if (data->addr_map_fd >= 0){
+            close(data->addr_map_fd);
+        }
+        free(data->pkts);
+        free(data->neighs);
+        free(data);
+        dplane_xdp.datap_data = NULL;
+    }
+    dplane_tun.datap_uninit();
+}
+
+int
+xdp_add_datap_iface_addr(iface_t *iface, int afi)
+{
+    xdp_dplane_data_t *data = (xdp_dplane_data_t *)dplane_xdp.datap_data;
+
+    dplane_tun.datap_add_iface_addr(iface, afi);
+
+    if (!data || data->addr_map_fd < 0){
+        return (GOOD);
+    }
+    xdp_addr_map_set(data, iface_address(iface, afi), TRUE);
+    /* Interfaces added after the init process */
+    if (!xdp_iface_find(data, iface)){
+        xdp_iface_attach(data, iface);
+    }
+
+    return (GOOD);
+}
+
+int
+xdp_add_eid_prefix(oor_dev_type_e dev_type, lisp_addr_t *eid_prefix)
+{
+    return (dplane_tun.datap_add_eid_prefix(dev_type, eid_prefix));
+}
+
+int
+xdp_remove_eid_prefix(oor_dev_type_e dev_type, lisp_addr_t *eid_prefix)
+{
+    return (dplane_tun.datap_remove_eid_prefix(dev_type, eid_prefix));
+}
+
+/* The next hops are resolved again after a change of the routes, addresses
+ * or links */
+static void
+xdp_neigh_flush(xdp_dplane_data_t *data)
+{
+    if (data){
+        memset(data->neighs, 0, XDP_NEIGH_CACHE_SIZE * sizeof(xdp_neigh_t));
+    }
+}
+
+int
+xdp_updated_route(int command, iface_t *iface, lisp_addr_t *src_pref,
+        lisp_addr_t *dst_pref, lisp_addr_t *gateway)
+{
+    xdp_neigh_flush((xdp_dplane_data_t *)dplane_xdp.datap_data);
+    return (dplane_tun.datap_updated_route(command, iface, src_pref, dst_pref,
+            gateway));
+}
+
+int
+xdp_updated_addr(iface_t *iface, lisp_addr_t *old_addr, lisp_addr_t *new_addr)
+{
+    xdp_dplane_data_t *data = (xdp_dplane_data_t *)dplane_xdp.datap_data;
+
+    if (data && lisp_addr_cmp(old_addr, new_addr) != 0){
+        xdp_addr_map_set(data, old_addr, FALSE);
+        xdp_addr_map_set(data, new_addr, TRUE);
+    }
+    xdp_neigh_flush(data);
+
+    return (dplane_tun.datap_updated_addr(iface, old_addr, new_addr));
+}
+
+int
+xdp_updated_link(iface_t *iface, int old_iface_index, int new_iface_index,
+        int status)
+{
+    xdp_dplane_data_t *data = (xdp_dplane_data_t *)dplane_xdp.datap_data;
+    xdp_iface_t *xi;
+    int ret;
+
+    ret = dplane_tun.datap_update_link(iface, old_iface_index, new_iface_index,
+            status);
+    xdp_neigh_flush(data);
+
+    /* The program and the sockets are bound to the index of the interface */
+    if (data && data->addr_map_fd >= 0 && old_iface_index != new_iface_index){
+        xi = xdp_iface_find(data, iface);
+        if (xi){
+            glist_remove_obj(xi, data->ifaces);
+            xdp_iface_detach(xi);
+        }
+        xdp_iface_attach(data, iface);
+    }
+
+    return (ret);
+}
+
+/* Decapsulate the packets of the rx ring of the socket and give their frames
+ * back to the kernel */
+static int
+xdp_read(xsk_t *x, int rtr)
+{
+    xdp_dplane_data_t *data = (xdp_dplane_data_t *)dplane_xdp.datap_data;
+    struct xdp_desc *desc;
+    uint64_t frame;
+    uint32_t idx;
+    lbuf_t *b;
+    int npkts, i;
+
+    npkts = xsk_rx_peek(x, data->batch_size, &idx);
+    if (npkts == 0){
+        return (BAD);
+    }
+
+    /* The XDP program only redirects untagged packets with the outer IP and
+     * UDP headers. The headroom of the frame is used for the re-encapsulation */
+    for (i = 0; i < npkts; i++){
+        desc = xsk_rx_desc(x, idx + i);
+        frame = xsk_frame_addr(desc->addr);
+        b = &data->pkts[i];
+        lbuf_use_stack(b, x->umem + frame, XSK_FRAME_SIZE);
+        lbuf_reserve(b, desc->addr - frame + ETHER_HDR_LEN);
+        lbuf_set_size(b, desc->len - ETHER_HDR_LEN);
+    }
+
+    /* The re-encapsulated packets are sent before releasing their frames */
+    data->rx_xsk = x;
+    tun_input_process_ip_pkts(data->pkts, npkts, rtr);
+    data->rx_xsk = NULL;
+    xsk_rx_release(x, idx, npkts);
+
+    return (GOOD);
+}
+
+int
+xdp_process_input_packet(sock_t *sl)
+{
+    return (xdp_read((xsk_t *)sl->arg, FALSE));
+}
+
+int
+xdp_rtr_process_input_packet(sock_t *sl)
+{
+    return (xdp_read((xsk_t *)sl->arg, TRUE));
+}
+
+/* Next hop of the packets from 'srloc' to 'drloc'. NULL if it is not resolved
+ * yet */
+static xdp_neigh_t *
+xdp_neigh_get(xdp_dplane_data_t *data, lisp_addr_t *srloc, lisp_addr_t *drloc)
+{
+    ip_addr_t *src = lisp_addr_ip(srloc);
+    ip_addr_t *dst = lisp_addr_ip(drloc);
+    xdp_neigh_t *set, *n;
+    time_t now = time(NULL);
+    uint32_t hash;
+    int i;
+
+    hash = pkt_hash_words(ip_addr_get_addr(dst), ip_addr_get_size(dst) / 4, 0);
+    set = &data->neighs[(hash % XDP_NEIGH_CACHE_SIZE) & ~1];
+
+    n = NULL;
+    for (i = 0; i < 2; i++){
+        if (ip_addr_afi(&set[i].dst) == ip_addr_afi(dst)
+                && ip_addr_cmp(&set[i].dst, dst) == 0
+                && ip_addr_cmp(&set[i].src, src) == 0){
+            n = &set[i];
+            break;
+        }
+    }
+    if (!n){
+        /* The entry that expires first is replaced */
+        n = set[0].expires <= set[1].expires ? &set[0] : &set[1];
+        n->expires = 0;
+    }
+
+    if (n->expires <= now){
+        ip_addr_copy(&n->src, src);
+        ip_addr_copy(&n->dst, dst);
+        n->resolved = xdp_neigh_resolve(ip_addr_afi(dst), ip_addr_get_addr(src),
+                ip_addr_get_addr(dst), &n->ifindex, n->mac) == GOOD;
+        n->expires = now + (n->resolved ? XDP_NEIGH_TIMEOUT : XDP_NEIGH_RETRY);
+        OOR_LOG(LDBG_3, "AF_XDP data plane: Next hop of %s %s", ip_addr_to_char(dst),
+                n->resolved ? "resolved" : "not resolved");
+    }
+
+    return (n->resolved ? n : NULL);
+}
+
+/* Send an encapsulated packet through the tx ring of a socket of its output
+ * interface. The Ethernet header is pushed in place when the packet is in an
+ * rx frame of the socket, using the headroom left by the decapsulation.
+ * Otherwise the packet is copied to a tx frame. Returns BAD if it should be
+ * sent by the kernel */
+static int
+xdp_xmit(lbuf_t *b, lisp_addr_t *srloc, lisp_addr_t *drloc)
+{
+    xdp_dplane_data_t *data = (xdp_dplane_data_t *)dplane_xdp.datap_data;
+    struct ether_header *eth;
+    xdp_neigh_t *n;
+    xdp_iface_t *xi = NULL;
+    glist_entry_t *it;
+    uint64_t addr;
+    xsk_t *x;
+    int len = lbuf_size(b);
+
+    n = xdp_neigh_get(data, srloc, drloc);
+    if (!n){
+        return (BAD);
+    }
+    glist_for_each_entry(it, data->ifaces){
+        if (((xdp_iface_t *)glist_entry_data(it))->ifindex == n->ifindex){
+            xi = (xdp_iface_t *)glist_entry_data(it);
+            break;
+        }
+    }
+    if (!xi || !xi->tx_xsk || len > xi->mtu
+            || len + ETHER_HDR_LEN > XSK_FRAME_SIZE){
+        return (BAD);
+    }
+
+    x = xi->tx_xsk;
+    if (data->rx_xsk && data->rx_xsk->ifindex == xi->ifindex){
+        x = data->rx_xsk;
+    }
+
+    if (xsk_rx_frame_sendable(x, lbuf_data(b)) && lbuf_headroom(b) >= ETHER_HDR_LEN){
+        eth = lbuf_push_uninit(b, ETHER_HDR_LEN);
+        addr = (uint8_t *)eth - x->umem;
+    }else{
+        eth = (struct ether_header *)xsk_tx_alloc(x, &addr);
+        if (!eth){
+            return (BAD);
+        }
+        memcpy((uint8_t *)eth + ETHER_HDR_LEN, lbuf_data(b), len);
+    }
+    memcpy(eth->ether_dhost, n->mac, ETH_ALEN);
+    memcpy(eth->ether_shost, xi->mac, ETH_ALEN);
+    eth->ether_type = htons(lisp_addr_ip_afi(drloc) == AF_INET ? ETHERTYPE_IP
+            : ETHERTYPE_IPV6);
+    xsk_tx_add(x, addr, ETHER_HDR_LEN + len);
+
+    return (GOOD);
+}
+
+/* Give to the kernel the packets added to the tx rings during the batch */
+static void
+xdp_xmit_flush()
+{
+    xdp_dplane_data_t *data = (xdp_dplane_data_t *)dplane_xdp.datap_data;
+    glist_entry_t *it;
+    xdp_iface_t *xi;
+    int q;
+
+    glist_for_each_entry(it, data->ifaces){
+        xi = (xdp_iface_t *)glist_entry_data(it);
+        for (q = 0; q < xi->nqueues; q++){
+            if (xi->xsks[q]){
+                xsk_tx_kick(xi->xsks[q]);
+            }
+        }
+    }
+}
+
+/* Add ('add' TRUE) or remove an address of the RLOCs of the map of local
+ * addresses */
+static void
+xdp_addr_map_set(xdp_dplane_data_t *data, lisp_addr_t *addr, int add)
+{
+    if (data->addr_map_fd < 0 || !addr || lisp_addr_is_no_addr(addr)){
+        return;
+    }
+    xdp_addr_map_update(data->addr_map_fd, lisp_addr_ip_afi(addr),
+            ip_addr_get_addr(lisp_addr_ip(addr)), add);
+}
+
+static xdp_iface_t *
+xdp_iface_find(xdp_dplane_data_t *data, iface_t *iface)
+{
+    glist_entry_t *it;
+    xdp_iface_t *xi;
+
+    glist_for_each_entry(it, data->ifaces){
+        xi = (xdp_iface_t *)glist_entry_data(it);
+        if (xi->iface == iface){
+            return (xi);
+        }
+    }
+    return (NULL);
+}
+
+/* Attach the XDP program to the interface and open a socket for each of its
+ * receive queues. The packets of the queues without socket are passed to the
+ * kernel */
+static int
+xdp_iface_attach(xdp_dplane_data_t *data, iface_t *iface)
+{
+    xdp_iface_t *xi;
+    xsk_t *x;
+    int q, nsocks = 0;
+
+    if (iface->iface_index == 0){
+        return (BAD);
+    }
+
+    xi = xzalloc(sizeof(xdp_iface_t));
+    xi->iface = iface;
+    xi->ifindex = iface->iface_index;
+    xi->nqueues = xsk_iface_queues(iface->iface_name);
+    xi->mtu = xsk_iface_mtu(iface->iface_name);
+    iface_mac_address(iface->iface_name, xi->mac);
+    xi->prog = xdp_prog_attach(xi->ifindex, data->data_port, xi->nqueues,
+            data->addr_map_fd);
+    if (!xi->prog){
+        OOR_LOG(LWRN, "AF_XDP data plane: Interface %s not attached",
+                iface->iface_name);
+        free(xi);
+        return (BAD);
+    }
+
+    for (q = 0; q < xi->nqueues; q++){
+        x = xsk_open(xi->ifindex, q);
+        if (!x){
+            continue;
+        }
+        if (xdp_prog_add_xsk(xi->prog, x) != GOOD){
+            xsk_close(x);
+            continue;
+        }
+        xi->socks[q] = sockmstr_register_read_listener(smaster,
+                data->rtr ? xdp_rtr_process_input_packet : xdp_process_input_packet,
+                x, x->sock);
+        xi->xsks[q] = x;
+        if (!xi->tx_xsk){
+            xi->tx_xsk = x;
+        }
+        nsocks++;
+    }
+
+    OOR_LOG(LDBG_1, "AF_XDP data plane: Interface %s attached in %s mode with "
+            "%d of %d queues", iface->iface_name,
+            xi->prog->attach_flags & XDP_FLAGS_SKB_MODE ? "generic" : "native",
+            nsocks, xi->nqueues);
+
+    glist_add(xi, data->ifaces);
+
+    return (GOOD);
+}
+
+static void
+xdp_iface_detach(xdp_iface_t *xi)
+{
+    int q;
+
+    /* Stop the redirection before closing the sockets */
+    xdp_prog_detach(xi->prog);
+    for (q = 0; q < xi->nqueues; q++){
+        if (!xi->xsks[q]){
+            continue;
+        }
+        if (xi->socks[q]){
+            /* Closes the socket */
+            sockmstr_unregister_read_listenedr(smaster, xi->socks[q]);
+            xi->xsks[q]->sock = ERR_SOCKET;
+        }
+        xsk_close(xi->xsks[q]);
+    }
+    free(xi);
+}
@@ -0,0 +1,83 @@
+/*
+ *
+ * Copyright (C) 2011, 2015 Cisco Systems, Inc.
+ * Copyright (C) 2015 CBA research group, Technical University of Catalonia.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef XDP_H_
+#define XDP_H_
+
+#include <time.h>
+#include <net/ethernet.h>
+
+#include "xdp_sock.h"
+#include "../data-plane.h"
+#include "../../lib/generic_list.h"
+#include "../../lib/lbuf.h"
+#include "../../lib/sockets.h"
+
+/* Entries of the cache of next hops toward the RLOCs. Each destination can
+ * be in two of them */
+#define XDP_NEIGH_CACHE_SIZE    256
+/* Time a next hop is used before asking the kernel again. The unresolved ones
+ * are asked again after XDP_NEIGH_RETRY, meanwhile their packets are sent by
+ * the kernel, which resolves them (s) */
+#define XDP_NEIGH_TIMEOUT       30
+#define XDP_NEIGH_RETRY         1
+
+/* Output interface and link layer address of the next hop of the packets
+ * from 'src' to 'dst' */
+typedef struct xdp_neigh_ {
+    ip_addr_t src;
+    ip_addr_t dst;
+    int ifindex;
+    uint8_t mac[ETH_ALEN];
+    uint8_t resolved;
+    time_t expires;
+} xdp_neigh_t;
+
+/* Interface of the RLOCs with the XDP program and an AF_XDP socket per
+ * receive queue. The encapsulated packets leaving through it are sent with
+ * 'tx_xsk', or with the socket of the packet when it is re-encapsulated */
+typedef struct xdp_iface_ {
+    iface_t *iface;
+    int ifindex;
+    uint8_t mac[ETH_ALEN];
+    int mtu;
+    xdp_prog_t *prog;
+    int nqueues;
+    xsk_t *xsks[XSK_MAX_QUEUES];
+    sock_t *socks[XSK_MAX_QUEUES];
+    xsk_t *tx_xsk;
+} xdp_iface_t;
+
+typedef struct xdp_dplane_data_ {
+    glist_t *ifaces; //<xdp_iface_t *>
+    /* Local addresses whose data packets are redirected */
+    int addr_map_fd;
+    int data_port;
+    int rtr;
+    /* Packets of the rx ring of a socket processed per wakeup */
+    int batch_size;
+    lbuf_t *pkts;
+    /* Socket whose packets are being processed */
+    xsk_t *rx_xsk;
+    xdp_neigh_t *neighs;
+} xdp_dplane_data_t;
+
+extern data_plane_struct_t dplane_xdp;
+
+#endif /* XDP_H_ */
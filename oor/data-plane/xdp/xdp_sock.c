@@ -0,0 +1,880 @@
+/*
+ *
+ * Copyright (C) 2011, 2015 Cisco Systems, Inc.
+ * Copyright (C) 2015 CBA research group, Technical University of Catalonia.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/ethtool.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/neighbour.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sockios.h>
+
+#include "xdp_sock.h"
+#include "../../defs.h"
+#include "../../lib/mem_util.h"
+#include "../../lib/oor_log.h"
+
+#ifndef AF_XDP
+#define AF_XDP  44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/* States of the neighbors whose link layer address can be used */
+#define XDP_NUD_VALID   (NUD_PERMANENT | NUD_NOARP | NUD_REACHABLE | NUD_PROBE \
+        | NUD_STALE | NUD_DELAY)
+
+/* Maximum number of sendto calls to send the packets of the tx ring */
+#define XSK_TX_MAX_KICKS    (XSK_TX_RING_SIZE / 16)
+
+/* eBPF instructions of the XDP program */
+#define XDP_INSN(code, dst, src, off, imm) \
+    ((struct bpf_insn){ (code), (dst), (src), (off), (imm) })
+#define XDP_LDX(size, dst, src, off) \
+    XDP_INSN(BPF_LDX | BPF_MEM | (size), (dst), (src), (off), 0)
+#define XDP_MOV_REG(dst, src) \
+    XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_X, (dst), (src), 0, 0)
+#define XDP_MOV_IMM(dst, imm) \
+    XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_K, (dst), 0, 0, (imm))
+#define XDP_ALU_IMM(op, dst, imm) \
+    XDP_INSN(BPF_ALU64 | (op) | BPF_K, (dst), 0, 0, (imm))
+#define XDP_JMP_REG(op, dst, src, off) \
+    XDP_INSN(BPF_JMP | (op) | BPF_X, (dst), (src), (off), 0)
+#define XDP_JMP_IMM(op, dst, imm, off) \
+    XDP_INSN(BPF_JMP | (op) | BPF_K, (dst), 0, (off), (imm))
+#define XDP_ST_IMM(size, dst, off, imm) \
+    XDP_INSN(BPF_ST | BPF_MEM | (size), (dst), 0, (off), (imm))
+#define XDP_STX(size, dst, src, off) \
+    XDP_INSN(BPF_STX | BPF_MEM | (size), (dst), (src), (off), 0)
+#define XDP_LD_MAP_FD(dst, fd) \
+    XDP_INSN(BPF_LD | BPF_DW | BPF_IMM, (dst), BPF_PSEUDO_MAP_FD, 0, (fd)), \
+    XDP_INSN(0, 0, 0, 0, 0)
+#define XDP_CALL(func) \
+    XDP_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, (func))
+#define XDP_EXIT() \
+    XDP_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+static int
+sys_bpf(int cmd, union bpf_attr *attr)
+{
+    return (syscall(__NR_bpf, cmd, attr, sizeof(union bpf_attr)));
+}
+
+/* Program redirecting to 'map_fd' the packets without VLAN tag sent to UDP
+ * 'port' and to one of the addresses of 'addr_map_fd'. The packets routed
+ * through the host to other RLOCs, IPv4 packets with options, fragments and
+ * IPv6 packets with extension headers are passed to the kernel */
+static int
+xdp_prog_load(int map_fd, int addr_map_fd, int port)
+{
+    struct bpf_insn prog[] = {
+        XDP_MOV_REG(BPF_REG_6, BPF_REG_1),                      /* ctx */
+        XDP_LDX(BPF_W, BPF_REG_2, BPF_REG_6, 0),                /* data */
+        XDP_LDX(BPF_W, BPF_REG_3, BPF_REG_6, 4),                /* data_end */
+        XDP_MOV_REG(BPF_REG_4, BPF_REG_2),
+        XDP_ALU_IMM(BPF_ADD, BPF_REG_4, ETH_HLEN + 20 + 8),
+        XDP_JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3, 44),
+        XDP_LDX(BPF_H, BPF_REG_5, BPF_REG_2, 12),               /* Ethertype */
+        XDP_JMP_IMM(BPF_JEQ, BPF_REG_5, htons(ETH_P_IP), 17),
+        XDP_JMP_IMM(BPF_JNE, BPF_REG_5, htons(ETH_P_IPV6), 41),
+        XDP_MOV_REG(BPF_REG_4, BPF_REG_2),
+        XDP_ALU_IMM(BPF_ADD, BPF_REG_4, ETH_HLEN + 40 + 8),
+        XDP_JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3, 38),
+        XDP_LDX(BPF_B, BPF_REG_5, BPF_REG_2, ETH_HLEN + 6),     /* IPv6 next header */
+        XDP_JMP_IMM(BPF_JNE, BPF_REG_5, IPPROTO_UDP, 36),
+        XDP_LDX(BPF_H, BPF_REG_5, BPF_REG_2, ETH_HLEN + 42),    /* UDP dst port */
+        XDP_JMP_IMM(BPF_JNE, BPF_REG_5, htons(port), 34),
+        /* Key: IPv6 dst */
+        XDP_LDX(BPF_W, BPF_REG_5, BPF_REG_2, ETH_HLEN + 24),
+        XDP_STX(BPF_W, BPF_REG_10, BPF_REG_5, -16),
+        XDP_LDX(BPF_W, BPF_REG_5, BPF_REG_2, ETH_HLEN + 28),
+        XDP_STX(BPF_W, BPF_REG_10, BPF_REG_5, -12),
+        XDP_LDX(BPF_W, BPF_REG_5, BPF_REG_2, ETH_HLEN + 32),
+        XDP_STX(BPF_W, BPF_REG_10, BPF_REG_5, -8),
+        XDP_LDX(BPF_W, BPF_REG_5, BPF_REG_2, ETH_HLEN + 36),
+        XDP_STX(BPF_W, BPF_REG_10, BPF_REG_5, -4),
+        XDP_INSN(BPF_JMP | BPF_JA, 0, 0, 13, 0),
+        XDP_LDX(BPF_B, BPF_REG_5, BPF_REG_2, ETH_HLEN),         /* IPv4 version and hdr len */
+        XDP_JMP_IMM(BPF_JNE, BPF_REG_5, 0x45, 23),
+        XDP_LDX(BPF_B, BPF_REG_5, BPF_REG_2, ETH_HLEN + 9),     /* IPv4 protocol */
+        XDP_JMP_IMM(BPF_JNE, BPF_REG_5, IPPROTO_UDP, 21),
+        XDP_LDX(BPF_H, BPF_REG_5, BPF_REG_2, ETH_HLEN + 6),     /* Fragment offset */
+        XDP_ALU_IMM(BPF_AND, BPF_REG_5, htons(0x3fff)),
+        XDP_JMP_IMM(BPF_JNE, BPF_REG_5, 0, 18),
+        XDP_LDX(BPF_H, BPF_REG_5, BPF_REG_2, ETH_HLEN + 22),    /* UDP dst port */
+        XDP_JMP_IMM(BPF_JNE, BPF_REG_5, htons(port), 16),
+        /* Key: IPv4 dst mapped to IPv6 */
+        XDP_ST_IMM(BPF_DW, BPF_REG_10, -16, 0),
+        XDP_ST_IMM(BPF_W, BPF_REG_10, -8, htonl(0xffff)),
+        XDP_LDX(BPF_W, BPF_REG_5, BPF_REG_2, ETH_HLEN + 16),
+        XDP_STX(BPF_W, BPF_REG_10, BPF_REG_5, -4),
+        /* The packet is passed if the dst is not a local address */
+        XDP_MOV_REG(BPF_REG_2, BPF_REG_10),
+        XDP_ALU_IMM(BPF_ADD, BPF_REG_2, -16),
+        XDP_LD_MAP_FD(BPF_REG_1, addr_map_fd),
+        XDP_CALL(BPF_FUNC_map_lookup_elem),
+        XDP_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 6),
+        XDP_LDX(BPF_W, BPF_REG_2, BPF_REG_6, 16),               /* rx_queue_index */
+        XDP_LD_MAP_FD(BPF_REG_1, map_fd),
+        /* The packet is passed if the queue has no socket */
+        XDP_MOV_IMM(BPF_REG_3, XDP_PASS),
+        XDP_CALL(BPF_FUNC_redirect_map),
+        XDP_EXIT(),
+        XDP_MOV_IMM(BPF_REG_0, XDP_PASS),
+        XDP_EXIT()
+    };
+    char log[4096];
+    union bpf_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uint64_t)(unsigned long)prog;
+    attr.insn_cnt = sizeof(prog) / sizeof(struct bpf_insn);
+    attr.license = (uint64_t)(unsigned long)"GPL";
+    attr.log_buf = (uint64_t)(unsigned long)log;
+    attr.log_size = sizeof(log);
+    attr.log_level = 1;
+    log[0] = '\0';
+
+    fd = sys_bpf(BPF_PROG_LOAD, &attr);
+    if (fd < 0) {
+        OOR_LOG(LERR, "xdp_prog_load: BPF_PROG_LOAD: %s", strerror(errno));
+        OOR_LOG(LDBG_1, "xdp_prog_load: verifier log: %s", log);
+    }
+
+    return (fd);
+}
+
+/* Attach (or detach with 'prog_fd' -1) the XDP program of an interface */
+static int
+xdp_link_set(int ifindex, int prog_fd, uint32_t flags)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct ifinfomsg ifi;
+        char attrs[64];
+    } req;
+    char rcvbuf[1024];
+    struct nlmsghdr *nlh;
+    struct nlmsgerr *err;
+    struct rtattr *nest, *rta;
+    int sock, len, ret = BAD;
+
+    sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+    if (sock < 0) {
+        OOR_LOG(LERR, "xdp_link_set: socket: %s", strerror(errno));
+        return (BAD);
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req.nlh.nlmsg_type = RTM_SETLINK;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    req.ifi.ifi_family = AF_UNSPEC;
+    req.ifi.ifi_index = ifindex;
+
+    nest = (struct rtattr *)((char *)&req + NLMSG_ALIGN(req.nlh.nlmsg_len));
+    nest->rta_type = IFLA_XDP | NLA_F_NESTED;
+    nest->rta_len = RTA_LENGTH(0);
+
+    rta = (struct rtattr *)((char *)nest + nest->rta_len);
+    rta->rta_type = IFLA_XDP_FD;
+    rta->rta_len = RTA_LENGTH(sizeof(int));
+    memcpy(RTA_DATA(rta), &prog_fd, sizeof(int));
+    nest->rta_len += RTA_ALIGN(rta->rta_len);
+
+    rta = (struct rtattr *)((char *)nest + nest->rta_len);
+    rta->rta_type = IFLA_XDP_FLAGS;
+    rta->rta_len = RTA_LENGTH(sizeof(uint32_t));
+    memcpy(RTA_DATA(rta), &flags, sizeof(uint32_t));
+    nest->rta_len += RTA_ALIGN(rta->rta_len);
+
+    req.nlh.nlmsg_len = NLMSG_ALIGN(req.nlh.nlmsg_len) + nest->rta_len;
+
+    if (send(sock, &req, req.nlh.nlmsg_len, 0) < 0) {
+        OOR_LOG(LERR, "xdp_link_set: send: %s", strerror(errno));
+        close(sock);
+        return (BAD);
+    }
+
+    len = recv(sock, rcvbuf, sizeof(rcvbuf), 0);
+    nlh = (struct nlmsghdr *)rcvbuf;
+    if (len >= (int)NLMSG_LENGTH(sizeof(struct nlmsgerr))
+            && nlh->nlmsg_type == NLMSG_ERROR) {
+        err = (struct nlmsgerr *)NLMSG_DATA(nlh);
+        if (err->error == 0) {
+            ret = GOOD;
+        } else {
+            errno = -err->error;
+        }
+    }
+    close(sock);
+
+    return (ret);
+}
+
+/* Append an attribute to the netlink message */
+static void
+xdp_nl_add_attr(struct nlmsghdr *nlh, int type, const void *data, int len)
+{
+    struct rtattr *rta;
+
+    rta = (struct rtattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+/* Send a request to the kernel and receive its answer in 'buf'. Returns NULL
+ * on error */
+static struct nlmsghdr *
+xdp_nl_request(int sock, struct nlmsghdr *req, char *buf, int buf_len)
+{
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+    int len;
+
+    if (send(sock, req, req->nlmsg_len, 0) < 0) {
+        return (NULL);
+    }
+    len = recv(sock, buf, buf_len, 0);
+    if (len < 0 || !NLMSG_OK(nlh, (uint32_t)len)
+            || nlh->nlmsg_type == NLMSG_ERROR) {
+        return (NULL);
+    }
+
+    return (nlh);
+}
+
+/* Obtain from the kernel the output interface of the packets from 'src' to
+ * 'dst' and the link layer address of their next hop. The route lookup
+ * follows the rules of the source address. Returns BAD if there is no route
+ * or the neighbor is not resolved yet */
+int
+xdp_neigh_resolve(int afi, const void *src, const void *dst, int *ifindex,
+        uint8_t *mac)
+{
+    char req[256], buf[1024];
+    struct nlmsghdr *nlh = (struct nlmsghdr *)req;
+    struct nlmsghdr *ans;
+    struct rtmsg *rtm;
+    struct ndmsg *ndm;
+    struct rtattr *rta;
+    uint8_t nexthop[sizeof(struct in6_addr)];
+    int sock, addr_len, attrs_len, ret = BAD;
+
+    addr_len = afi == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+    sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+    if (sock < 0) {
+        OOR_LOG(LERR, "xdp_neigh_resolve: socket: %s", strerror(errno));
+        return (BAD);
+    }
+
+    /* Route toward the destination */
+    memset(req, 0, sizeof(req));
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+    nlh->nlmsg_type = RTM_GETROUTE;
+    nlh->nlmsg_flags = NLM_F_REQUEST;
+    rtm = (struct rtmsg *)NLMSG_DATA(nlh);
+    rtm->rtm_family = afi;
+    rtm->rtm_dst_len = addr_len * 8;
+    rtm->rtm_src_len = addr_len * 8;
+    xdp_nl_add_attr(nlh, RTA_DST, dst, addr_len);
+    xdp_nl_add_attr(nlh, RTA_SRC, src, addr_len);
+    ans = xdp_nl_request(sock, nlh, buf, sizeof(buf));
+    if (!ans || ans->nlmsg_type != RTM_NEWROUTE) {
+        goto out;
+    }
+    rtm = (struct rtmsg *)NLMSG_DATA(ans);
+    if (rtm->rtm_type != RTN_UNICAST) {
+        goto out;
+    }
+    *ifindex = 0;
+    memcpy(nexthop, dst, addr_len);
+    attrs_len = RTM_PAYLOAD(ans);
+    for (rta = RTM_RTA(rtm); RTA_OK(rta, attrs_len);
+            rta = RTA_NEXT(rta, attrs_len)) {
+        if (rta->rta_type == RTA_OIF) {
+            memcpy(ifindex, RTA_DATA(rta), sizeof(int));
+        } else if (rta->rta_type == RTA_GATEWAY
+                && RTA_PAYLOAD(rta) == addr_len) {
+            memcpy(nexthop, RTA_DATA(rta), addr_len);
+        }
+    }
+    if (*ifindex == 0) {
+        goto out;
+    }
+
+    /* Neighbor entry of the next hop */
+    memset(req, 0, sizeof(req));
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg));
+    nlh->nlmsg_type = RTM_GETNEIGH;
+    nlh->nlmsg_flags = NLM_F_REQUEST;
+    ndm = (struct ndmsg *)NLMSG_DATA(nlh);
+    ndm->ndm_family = afi;
+    ndm->ndm_ifindex = *ifindex;
+    xdp_nl_add_attr(nlh, NDA_DST, nexthop, addr_len);
+    ans = xdp_nl_request(sock, nlh, buf, sizeof(buf));
+    if (!ans || ans->nlmsg_type != RTM_NEWNEIGH) {
+        goto out;
+    }
+    ndm = (struct ndmsg *)NLMSG_DATA(ans);
+    if (!(ndm->ndm_state & XDP_NUD_VALID)) {
+        goto out;
+    }
+    attrs_len = NLMSG_PAYLOAD(ans, sizeof(struct ndmsg));
+    for (rta = (struct rtattr *)((char *)ndm + NLMSG_ALIGN(sizeof(struct ndmsg)));
+            RTA_OK(rta, attrs_len); rta = RTA_NEXT(rta, attrs_len)) {
+        if (rta->rta_type == NDA_LLADDR && RTA_PAYLOAD(rta) == ETH_ALEN) {
+            memcpy(mac, RTA_DATA(rta), ETH_ALEN);
+            ret = GOOD;
+        }
+    }
+
+out:
+    close(sock);
+    return (ret);
+}
+
+/* Create the map of the local addresses whose data packets are redirected
+ * by the XDP programs */
+int
+xdp_addr_map_create()
+{
+    union bpf_attr attr;
+    int map_fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_HASH;
+    attr.key_size = sizeof(struct in6_addr);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = XDP_MAX_ADDRS;
+    map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+    if (map_fd < 0) {
+        OOR_LOG(LERR, "xdp_addr_map_create: BPF_MAP_CREATE: %s", strerror(errno));
+    }
+    return (map_fd);
+}
+
+/* Key of an address in the map. IPv4 addresses are mapped to IPv6 */
+static void
+xdp_addr_key(int afi, const void *addr, struct in6_addr *key)
+{
+    if (afi == AF_INET) {
+        memset(key, 0, sizeof(struct in6_addr));
+        key->s6_addr[10] = 0xff;
+        key->s6_addr[11] = 0xff;
+        memcpy(&key->s6_addr[12], addr, sizeof(struct in_addr));
+    } else {
+        memcpy(key, addr, sizeof(struct in6_addr));
+    }
+}
+
+/* Add ('add' TRUE) or remove a local address of the map */
+int
+xdp_addr_map_update(int map_fd, int afi, const void *addr, int add)
+{
+    union bpf_attr attr;
+    struct in6_addr key;
+    uint32_t value = 1;
+
+    xdp_addr_key(afi, addr, &key);
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map_fd;
+    attr.key = (uint64_t)(unsigned long)&key;
+    if (add) {
+        attr.value = (uint64_t)(unsigned long)&value;
+        attr.flags = BPF_ANY;
+        if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+            OOR_LOG(LERR, "xdp_addr_map_update: BPF_MAP_UPDATE_ELEM: %s",
+                    strerror(errno));
+            return (BAD);
+        }
+    } else if (sys_bpf(BPF_MAP_DELETE_ELEM, &attr) < 0 && errno != ENOENT) {
+        OOR_LOG(LERR, "xdp_addr_map_update: BPF_MAP_DELETE_ELEM: %s",
+                strerror(errno));
+        return (BAD);
+    }
+
+    return (GOOD);
+}
+
+/* Load the XDP program redirecting the data packets sent to 'port' and to the
+ * addresses of 'addr_map_fd', and attach it to the interface. The native
+ * mode of the driver is preferred, falling back to the generic (SKB) mode
+ * available in any interface */
+xdp_prog_t *
+xdp_prog_attach(int ifindex, int port, int nqueues, int addr_map_fd)
+{
+    union bpf_attr attr;
+    xdp_prog_t *p;
+    int map_fd, prog_fd;
+    uint32_t flags;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = nqueues;
+    map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+    if (map_fd < 0) {
+        OOR_LOG(LERR, "xdp_prog_attach: BPF_MAP_CREATE: %s", strerror(errno));
+        return (NULL);
+    }
+
+    prog_fd = xdp_prog_load(map_fd, addr_map_fd, port);
+    if (prog_fd < 0) {
+        close(map_fd);
+        return (NULL);
+    }
+
+    /* Don't replace programs attached by other applications */
+    flags = XDP_FLAGS_UPDATE_IF_NOEXIST | XDP_FLAGS_DRV_MODE;
+    if (xdp_link_set(ifindex, prog_fd, flags) != GOOD) {
+        OOR_LOG(LDBG_1, "xdp_prog_attach: Native XDP not available in "
+                "interface %d (%s). Using generic mode", ifindex, strerror(errno));
+        flags = XDP_FLAGS_UPDATE_IF_NOEXIST | XDP_FLAGS_SKB_MODE;
+        if (xdp_link_set(ifindex, prog_fd, flags) != GOOD) {
+            OOR_LOG(LERR, "xdp_prog_attach: Couldn't attach XDP program to "
+                    "interface %d: %s", ifindex, strerror(errno));
+            close(prog_fd);
+            close(map_fd);
+            return (NULL);
+        }
+    }
+
+    p = xzalloc(sizeof(xdp_prog_t));
+    p->ifindex = ifindex;
+    p->prog_fd = prog_fd;
+    p->map_fd = map_fd;
+    p->attach_flags = flags;
+
+    return (p);
+}
+
+void
+xdp_prog_detach(xdp_prog_t *p)
+{
+    if (!p) {
+        return;
+    }
+    xdp_link_set(p->ifindex, -1, p->attach_flags & XDP_FLAGS_MODES);
+    close(p->prog_fd);
+    close(p->map_fd);
+    free(p);
+}
+
+/* Redirect to the socket the packets received in its queue */
+int
+xdp_prog_add_xsk(xdp_prog_t *p, xsk_t *x)
+{
+    union bpf_attr attr;
+    uint32_t key = x->queue;
+    uint32_t value = x->sock;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = p->map_fd;
+    attr.key = (uint64_t)(unsigned long)&key;
+    attr.value = (uint64_t)(unsigned long)&value;
+    attr.flags = BPF_ANY;
+    if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+        OOR_LOG(LERR, "xdp_prog_add_xsk: BPF_MAP_UPDATE_ELEM: %s", strerror(errno));
+        return (BAD);
+    }
+
+    return (GOOD);
+}
+
+/* Map a ring of the socket. 'desc_size' is the size of its entries */
+static int
+xsk_ring_map(int sock, xsk_ring_t *r, struct xdp_ring_offset *off,
+        uint32_t size, size_t desc_size, uint64_t pgoff)
+{
+    uint8_t *map;
+
+    r->map_len = off->desc + size * desc_size;
+    map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, sock, pgoff);
+    if (map == MAP_FAILED) {
+        OOR_LOG(LERR, "xsk_ring_map: mmap: %s", strerror(errno));
+        r->map = NULL;
+        return (BAD);
+    }
+
+    r->map = map;
+    r->producer = (uint32_t *)(map + off->producer);
+    r->consumer = (uint32_t *)(map + off->consumer);
+    r->flags = (uint32_t *)(map + off->flags);
+    r->descs = map + off->desc;
+    r->mask = size - 1;
+
+    return (GOOD);
+}
+
+/* Create an AF_XDP socket with its UMEM, bound to a queue of an interface */
+xsk_t *
+xsk_open(int ifindex, int queue)
+{
+    struct xdp_umem_reg umem_reg;
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp;
+    socklen_t optlen;
+    uint64_t addr;
+    xsk_t *x;
+    int size, i;
+
+    x = xzalloc(sizeof(xsk_t));
+    x->ifindex = ifindex;
+    x->queue = queue;
+
+    x->sock = socket(AF_XDP, SOCK_RAW, 0);
+    if (x->sock < 0) {
+        OOR_LOG(LERR, "xsk_open: socket: %s", strerror(errno));
+        free(x);
+        return (NULL);
+    }
+
+    x->umem_len = (size_t)XSK_NUM_FRAMES * XSK_FRAME_SIZE;
+    x->umem = mmap(NULL, x->umem_len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (x->umem == MAP_FAILED) {
+        OOR_LOG(LERR, "xsk_open: mmap: %s", strerror(errno));
+        x->umem = NULL;
+        goto err;
+    }
+
+    memset(&umem_reg, 0, sizeof(umem_reg));
+    umem_reg.addr = (uint64_t)(unsigned long)x->umem;
+    umem_reg.len = x->umem_len;
+    umem_reg.chunk_size = XSK_FRAME_SIZE;
+    umem_reg.headroom = XSK_FRAME_HEADROOM;
+    if (setsockopt(x->sock, SOL_XDP, XDP_UMEM_REG, &umem_reg,
+            sizeof(umem_reg)) < 0) {
+        OOR_LOG(LERR, "xsk_open: setsockopt XDP_UMEM_REG: %s", strerror(errno));
+        goto err;
+    }
+
+    size = XSK_FILL_RING_SIZE;
+    if (setsockopt(x->sock, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) < 0) {
+        OOR_LOG(LERR, "xsk_open: setsockopt XDP_UMEM_FILL_RING: %s", strerror(errno));
+        goto err;
+    }
+    size = XSK_COMP_RING_SIZE;
+    if (setsockopt(x->sock, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size,
+            sizeof(size)) < 0) {
+        OOR_LOG(LERR, "xsk_open: setsockopt XDP_UMEM_COMPLETION_RING: %s",
+                strerror(errno));
+        goto err;
+    }
+    size = XSK_RX_RING_SIZE;
+    if (setsockopt(x->sock, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) < 0) {
+        OOR_LOG(LERR, "xsk_open: setsockopt XDP_RX_RING: %s", strerror(errno));
+        goto err;
+    }
+    size = XSK_TX_RING_SIZE;
+    if (setsockopt(x->sock, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) < 0) {
+        OOR_LOG(LERR, "xsk_open: setsockopt XDP_TX_RING: %s", strerror(errno));
+        goto err;
+    }
+
+    optlen = sizeof(off);
+    if (getsockopt(x->sock, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0) {
+        OOR_LOG(LERR, "xsk_open: getsockopt XDP_MMAP_OFFSETS: %s", strerror(errno));
+        goto err;
+    }
+
+    if (xsk_ring_map(x->sock, &x->rx, &off.rx, XSK_RX_RING_SIZE,
+            sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) != GOOD
+            || xsk_ring_map(x->sock, &x->fill, &off.fr, XSK_FILL_RING_SIZE,
+                    sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) != GOOD
+            || xsk_ring_map(x->sock, &x->tx, &off.tx, XSK_TX_RING_SIZE,
+                    sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) != GOOD
+            || xsk_ring_map(x->sock, &x->comp, &off.cr, XSK_COMP_RING_SIZE,
+                    sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) != GOOD) {
+        goto err;
+    }
+
+    /* The rx frames are available to the kernel */
+    for (i = 0; i < XSK_RX_FRAMES; i++) {
+        addr = (uint64_t)i * XSK_FRAME_SIZE;
+        ((uint64_t *)x->fill.descs)[i & x->fill.mask] = addr;
+    }
+    __sync_synchronize();
+    *x->fill.producer = XSK_RX_FRAMES;
+    for (i = XSK_RX_FRAMES; i < XSK_NUM_FRAMES; i++) {
+        x->tx_frames[x->tx_nframes++] = (uint64_t)i * XSK_FRAME_SIZE;
+    }
+
+    /* The kernel selects the zero copy mode when the driver supports it */
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = ifindex;
+    sxdp.sxdp_queue_id = queue;
+#ifdef XDP_USE_NEED_WAKEUP
+    sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP;
+#endif
+    if (bind(x->sock, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+        OOR_LOG(LERR, "xsk_open: bind to queue %d of interface %d: %s",
+                queue, ifindex, strerror(errno));
+        goto err;
+    }
+
+    return (x);
+err:
+    xsk_close(x);
+    return (NULL);
+}
+
+void
+xsk_close(xsk_t *x)
+{
+    if (!x) {
+        return;
+    }
+    if (x->rx.map) {
+        munmap(x->rx.map, x->rx.map_len);
+    }
+    if (x->fill.map) {
+        munmap(x->fill.map, x->fill.map_len);
+    }
+    if (x->tx.map) {
+        munmap(x->tx.map, x->tx.map_len);
+    }
+    if (x->comp.map) {
+        munmap(x->comp.map, x->comp.map_len);
+    }
+    /* The socket may have been closed when removing it from the socket
+     * master */
+    if (x->sock != ERR_SOCKET) {
+        close(x->sock);
+    }
+    if (x->umem) {
+        munmap(x->umem, x->umem_len);
+    }
+    free(x);
+}
+
+/* Get up to 'max' packets of the rx ring. 'idx' is set to the first one.
+ * Returns the number of packets available */
+int
+xsk_rx_peek(xsk_t *x, int max, uint32_t *idx)
+{
+    uint32_t n;
+
+    *idx = *x->rx.consumer;
+    n = *x->rx.producer - *idx;
+    __sync_synchronize();
+
+    return (n > max ? max : n);
+}
+
+/* Release the 'n' packets starting at 'idx' obtained with xsk_rx_peek. Their
+ * frames are given back to the kernel through the fill ring, except the ones
+ * being sent. There is always room for them, as the fill ring can hold all the
+ * rx frames */
+void
+xsk_rx_release(xsk_t *x, uint32_t idx, int n)
+{
+    uint64_t *fill_descs = (uint64_t *)x->fill.descs;
+    uint64_t frame;
+    uint32_t prod;
+    int i;
+
+    prod = *x->fill.producer;
+    for (i = 0; i < n; i++) {
+        frame = xsk_frame_addr(xsk_rx_desc(x, idx + i)->addr);
+        if (x->rx_sent[frame / XSK_FRAME_SIZE]) {
+            x->rx_sent[frame / XSK_FRAME_SIZE] = FALSE;
+            continue;
+        }
+        fill_descs[prod++ & x->fill.mask] = frame;
+    }
+    __sync_synchronize();
+    *x->fill.producer = prod;
+    *x->rx.consumer = idx + n;
+
+#ifdef XDP_RING_NEED_WAKEUP
+    /* Drivers in zero copy mode may stop when they run out of frames */
+    if (*x->fill.flags & XDP_RING_NEED_WAKEUP) {
+        recvfrom(x->sock, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+#endif
+}
+
+/* Get the frames whose transmission has been completed by the kernel. The rx
+ * ones go back to the fill ring */
+static void
+xsk_tx_reclaim(xsk_t *x)
+{
+    uint64_t *comp_descs = (uint64_t *)x->comp.descs;
+    uint64_t *fill_descs = (uint64_t *)x->fill.descs;
+    uint64_t frame;
+    uint32_t cons, prod, fill_prod;
+
+    cons = *x->comp.consumer;
+    prod = *x->comp.producer;
+    __sync_synchronize();
+    if (cons == prod) {
+        return;
+    }
+
+    fill_prod = *x->fill.producer;
+    for (; cons != prod; cons++) {
+        frame = xsk_frame_addr(comp_descs[cons & x->comp.mask]);
+        if (frame < (uint64_t)XSK_RX_FRAMES * XSK_FRAME_SIZE) {
+            fill_descs[fill_prod++ & x->fill.mask] = frame;
+        } else {
+            x->tx_frames[x->tx_nframes++] = frame;
+        }
+    }
+    __sync_synchronize();
+    *x->fill.producer = fill_prod;
+    *x->comp.consumer = cons;
+}
+
+/* Get a free frame to send a packet. 'frame' is set to its address in the
+ * UMEM. Returns NULL if all of them are being sent */
+uint8_t *
+xsk_tx_alloc(xsk_t *x, uint64_t *frame)
+{
+    if (x->tx_nframes == 0) {
+        xsk_tx_reclaim(x);
+        if (x->tx_nframes == 0) {
+            return (NULL);
+        }
+    }
+    *frame = x->tx_frames[--x->tx_nframes];
+
+    return (x->umem + *frame);
+}
+
+/* Add to the tx ring the packet of 'len' bytes at 'addr' of the UMEM, in a
+ * frame obtained with xsk_tx_alloc or in a received one. It is sent with the
+ * next kick. There is always room, as the tx ring can hold all the frames */
+void
+xsk_tx_add(xsk_t *x, uint64_t addr, uint32_t len)
+{
+    struct xdp_desc *desc;
+    uint64_t frame = xsk_frame_addr(addr);
+
+    if (frame < (uint64_t)XSK_RX_FRAMES * XSK_FRAME_SIZE) {
+        x->rx_sent[frame / XSK_FRAME_SIZE] = TRUE;
+    }
+    desc = &((struct xdp_desc *)x->tx.descs)[x->tx_prod++ & x->tx.mask];
+    desc->addr = addr;
+    desc->len = len;
+    desc->options = 0;
+}
+
+/* Give the packets added to the tx ring to the kernel and get the frames
+ * already sent. In copy mode, each sendto only sends a few packets and
+ * returns EAGAIN if there are more */
+void
+xsk_tx_kick(xsk_t *x)
+{
+    int i;
+
+    if (*x->tx.producer != x->tx_prod) {
+        __sync_synchronize();
+        *x->tx.producer = x->tx_prod;
+    }
+
+    for (i = 0; i < XSK_TX_MAX_KICKS && *x->tx.consumer != x->tx_prod; i++) {
+#ifdef XDP_RING_NEED_WAKEUP
+        if (!(*x->tx.flags & XDP_RING_NEED_WAKEUP)) {
+            break;
+        }
+#endif
+        if (sendto(x->sock, NULL, 0, MSG_DONTWAIT, NULL, 0) >= 0) {
+            break;
+        }
+        if (errno != EAGAIN) {
+            if (errno != EBUSY && errno != ENOBUFS) {
+                OOR_LOG(LDBG_2, "xsk_tx_kick: sendto: %s", strerror(errno));
+            }
+            break;
+        }
+    }
+
+    xsk_tx_reclaim(x);
+}
+
+/* Number of receive queues of an interface, as reported by ethtool. Devices
+ * without channels have a single queue */
+int
+xsk_iface_queues(const char *iface_name)
+{
+    struct ethtool_channels ch;
+    struct ifreq ifr;
+    int sock, queues = 1;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return (queues);
+    }
+
+    memset(&ch, 0, sizeof(ch));
+    memset(&ifr, 0, sizeof(ifr));
+    ch.cmd = ETHTOOL_GCHANNELS;
+    strncpy(ifr.ifr_name, iface_name, IFNAMSIZ - 1);
+    ifr.ifr_data = (void *)&ch;
+    if (ioctl(sock, SIOCETHTOOL, &ifr) == 0) {
+        queues = ch.rx_count + ch.combined_count;
+        if (queues < 1) {
+            queues = 1;
+        }
+    }
+    close(sock);
+
+    return (queues > XSK_MAX_QUEUES ? XSK_MAX_QUEUES : queues);
+}
+
+/* MTU of an interface. The one of Ethernet if it can not be obtained */
+int
+xsk_iface_mtu(const char *iface_name)
+{
+    struct ifreq ifr;
+    int sock, mtu = ETH_DATA_LEN;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return (mtu);
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, iface_name, IFNAMSIZ - 1);
+    if (ioctl(sock, SIOCGIFMTU, &ifr) == 0) {
+        mtu = ifr.ifr_mtu;
+    }
+    close(sock);
+
+    return (mtu);
+}
@@ -0,0 +1,136 @@
+/*
+ *
+ * Copyright (C) 2011, 2015 Cisco Systems, Inc.
+ * Copyright (C) 2015 CBA research group, Technical University of Catalonia.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef XDP_SOCK_H_
+#define XDP_SOCK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/if_xdp.h>
+
+/* Geometry of the UMEM of an AF_XDP socket. The first XSK_RX_FRAMES frames
+ * are filled by the kernel after XSK_FRAME_HEADROOM bytes, which leave room to
+ * re-encapsulate the packets in place. The rest are used to send packets. A
+ * received frame may also be sent as is, so the tx and completion rings can
+ * hold all the frames and the fill ring all the rx ones */
+#define XSK_NUM_FRAMES          4096
+#define XSK_FRAME_SIZE          2048
+#define XSK_FRAME_HEADROOM      64
+#define XSK_RX_FRAMES           2048
+#define XSK_TX_FRAMES           (XSK_NUM_FRAMES - XSK_RX_FRAMES)
+#define XSK_RX_RING_SIZE        2048
+#define XSK_FILL_RING_SIZE      XSK_RX_FRAMES
+#define XSK_TX_RING_SIZE        XSK_NUM_FRAMES
+#define XSK_COMP_RING_SIZE      XSK_NUM_FRAMES
+
+/* Maximum number of receive queues of an interface served by OOR */
+#define XSK_MAX_QUEUES          16
+
+/* Maximum number of local addresses whose packets are redirected */
+#define XDP_MAX_ADDRS           64
+
+/* Single producer / single consumer ring shared with the kernel */
+typedef struct xsk_ring_ {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *descs;
+    uint32_t mask;
+    void *map;
+    size_t map_len;
+} xsk_ring_t;
+
+/* AF_XDP socket bound to a queue of an interface, with its own UMEM */
+typedef struct xsk_ {
+    int sock;
+    int ifindex;
+    int queue;
+    uint8_t *umem;
+    size_t umem_len;
+    xsk_ring_t rx;
+    xsk_ring_t fill;
+    xsk_ring_t tx;
+    xsk_ring_t comp;
+    /* Descriptors added to the tx ring but not yet given to the kernel */
+    uint32_t tx_prod;
+    /* Free frames to send packets */
+    uint64_t tx_frames[XSK_TX_FRAMES];
+    int tx_nframes;
+    /* Received frames being sent. They are given back to the fill ring when
+     * the kernel completes their transmission, not when they are released */
+    uint8_t rx_sent[XSK_RX_FRAMES];
+} xsk_t;
+
+/* XDP program attached to an interface. It redirects the UDP packets sent to
+ * the data port and to a local address to the AF_XDP socket of the receive
+ * queue, found in the XSKMAP 'map_fd'. Other packets follow the kernel path */
+typedef struct xdp_prog_ {
+    int ifindex;
+    int prog_fd;
+    int map_fd;
+    uint32_t attach_flags;
+} xdp_prog_t;
+
+int xdp_addr_map_create();
+int xdp_addr_map_update(int map_fd, int afi, const void *addr, int add);
+xdp_prog_t *xdp_prog_attach(int ifindex, int port, int nqueues, int addr_map_fd);
+void xdp_prog_detach(xdp_prog_t *p);
+int xdp_prog_add_xsk(xdp_prog_t *p, xsk_t *x);
+
+xsk_t *xsk_open(int ifindex, int queue);
+void xsk_close(xsk_t *x);
+int xsk_rx_peek(xsk_t *x, int max, uint32_t *idx);
+void xsk_rx_release(xsk_t *x, uint32_t idx, int n);
+int xsk_iface_queues(const char *iface_name);
+int xsk_iface_mtu(const char *iface_name);
+uint8_t *xsk_tx_alloc(xsk_t *x, uint64_t *frame);
+void xsk_tx_add(xsk_t *x, uint64_t addr, uint32_t len);
+void xsk_tx_kick(xsk_t *x);
+int xdp_neigh_resolve(int afi, const void *src, const void *dst, int *ifindex,
+        uint8_t *mac);
+
+static inline struct xdp_desc *
+xsk_rx_desc(xsk_t *x, uint32_t idx)
+{
+    return (&((struct xdp_desc *)x->rx.descs)[idx & x->rx.mask]);
+}
+
+/* Start of the frame that holds the packet of a rx descriptor */
+static inline uint64_t
+xsk_frame_addr(uint64_t addr)
+{
+    return (addr & ~((uint64_t)XSK_FRAME_SIZE - 1));
+}
+
+/* Returns TRUE if 'p' is in an rx frame of the socket that is not being sent
+ * yet. The packet of the frame can be sent in place */
+static inline int
+xsk_rx_frame_sendable(xsk_t *x, const void *p)
+{
+    size_t off;
+
+    if ((const uint8_t *)p < x->umem) {
+        return (0);
+    }
+    off = (const uint8_t *)p - x->umem;
+    return (off < (size_t)XSK_RX_FRAMES * XSK_FRAME_SIZE
+            && !x->rx_sent[off / XSK_FRAME_SIZE]);
+}
+
+#endif /* XDP_SOCK_H_ */
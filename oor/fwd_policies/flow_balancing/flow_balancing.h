@@ -45,4 +45,12 @@ typedef struct balancing_locators_vecs_ {
     int locators_vec_length;
 } balancing_locators_vecs;
 
+/* Shared with the other policies that select the locators by their priority
+ * and weight */
+void *fb_dev_parm_new_init(oor_ctrl_dev_t *ctrl_dev,
+        fwd_policy_dev_parm *dev_parm_inf);
+void fb_dev_parm_del(void *dev_parm);
+void fb_locators_classify_in_4_6(mapping_t *mapping,glist_t *loc_loct_addr,
+        glist_t *ipv4_loct_list,glist_t *ipv6_loct_list);
+
 #endif /* FLOW_BALANCING_H_ */
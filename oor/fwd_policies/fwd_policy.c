@@ -19,9 +19,15 @@
 
 #include "fwd_policy.h"
 #include "../lib/oor_log.h"
+#include "../lib/packets.h"
 
-static fwd_policy_class *fwd_policy_libs[1] = {
+uint32_t fwd_gen;
+uint32_t fwd_map_gen[FWD_GEN_MAP_SLOTS];
+
+static fwd_policy_class *fwd_policy_libs[3] = {
         &fwd_policy_flow_balancing,
+        &fwd_policy_maglev,
+        &fwd_policy_latency,
 };
 
 void policy_loct_parm_del(fwd_policy_loct_parm *pol_loct);
@@ -32,6 +38,12 @@ fwd_policy_class_find(char *lib)
 	if (strcmp(lib,"flow_balancing") == 0){
 		return(fwd_policy_libs[0]);
 	}
+	if (strcmp(lib,"maglev") == 0){
+		return(fwd_policy_libs[1]);
+	}
+	if (strcmp(lib,"latency") == 0){
+		return(fwd_policy_libs[2]);
+	}
 	OOR_LOG(LERR, "The forward policy library \"%s\" has not been found",lib);
 	return (NULL);
 }
@@ -93,7 +105,11 @@ policy_loct_parm_del(fwd_policy_loct_parm *pol_loct)
 fwd_info_t *
 fwd_info_new()
 {
-    return (xzalloc(sizeof(fwd_info_t)));
+    fwd_info_t *fwd_info = xzalloc(sizeof(fwd_info_t));
+
+    fwd_info->gen = __atomic_load_n(&fwd_gen, __ATOMIC_ACQUIRE);
+    fwd_info->map_gen = __atomic_load_n(&fwd_map_gen[0], __ATOMIC_ACQUIRE);
+    return (fwd_info);
 }
 
 void
@@ -102,3 +118,44 @@ fwd_info_del(fwd_info_t * fwd_info,fwd_info_data_del del_fn)
     del_fn(fwd_info->fwd_info);
     free(fwd_info);
 }
+
+/* Counter of the mappings with the EID */
+static uint32_t
+fwd_gen_map_slot(lisp_addr_t *eid)
+{
+    uint32_t buf[16];
+    uint32_t len;
+
+    len = lisp_addr_size_to_write(eid);
+    if (len == 0 || len > sizeof(buf)) {
+        return (1);
+    }
+    memset(buf, 0, sizeof(buf));
+    lisp_addr_write(buf, eid);
+    return (1 + pkt_hash_words(buf, (len + 3) / 4, 0) % (FWD_GEN_MAP_SLOTS - 1));
+}
+
+/* Record that the forwarding information was obtained from the mapping of
+ * the EID */
+void
+fwd_info_set_map_gen(fwd_info_t *fwd_info, lisp_addr_t *eid)
+{
+    fwd_info->map_gen_slot = fwd_gen_map_slot(eid);
+    fwd_info->map_gen = __atomic_load_n(&fwd_map_gen[fwd_info->map_gen_slot],
+            __ATOMIC_ACQUIRE);
+}
+
+/* Invalidate all the forwarding information cached by the data plane */
+void
+fwd_gen_invalidate_all()
+{
+    __atomic_add_fetch(&fwd_gen, 1, __ATOMIC_RELEASE);
+}
+
+/* Invalidate the forwarding information obtained from the mapping of the
+ * EID */
+void
+fwd_gen_invalidate_map(lisp_addr_t *eid)
+{
+    __atomic_add_fetch(&fwd_map_gen[fwd_gen_map_slot(eid)], 1, __ATOMIC_RELEASE);
+}
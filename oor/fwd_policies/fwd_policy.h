@@ -61,8 +61,25 @@ typedef struct fwd_info_{
     uint8_t temporal;
     lisp_action_e neg_map_reply_act;
     oor_encap_t encap;
+    /* Generations of the forwarding state when the information was obtained.
+     * See fwd_info_valid */
+    uint32_t gen;
+    uint32_t map_gen;
+    uint32_t map_gen_slot;
 }fwd_info_t;
 
+/* The forwarding information cached by the data plane is validated against
+ * generation counters incremented by the control whenever the state it was
+ * derived from changes: a global one for the local mappings, the RLOCs and
+ * the PeTRs, and one for the mapping of the destination EID. The mappings
+ * are spread among a fixed set of counters by the hash of their EID, so that
+ * the counters are never released while the data plane may read them. Slot
+ * 0 is used by the information not derived from a mapping */
+#define FWD_GEN_MAP_SLOTS   4096
+
+extern uint32_t fwd_gen;
+extern uint32_t fwd_map_gen[FWD_GEN_MAP_SLOTS];
+
 
 /* functions to manipulate routing */
 typedef struct fwd_policy_class {
@@ -78,10 +95,15 @@ typedef struct fwd_policy_class {
     void (*policy_get_fwd_info)(void *dev_parm, void *src_map_parm, void *dst_map_parm,
             packet_tuple_t *tuple, fwd_info_t *fdw_info);
     lisp_addr_t *(*get_fwd_ip_addr)(lisp_addr_t *addr, glist_t *locl_rlocs_addr);
+    /* Optional. Called when the RTT of a locator of the map cache entry has
+     * been measured. Returns TRUE if its forwarding information changed */
+    int (*updated_map_cache_rtt)(void *dev_parm, mcache_entry_t *mce);
 } fwd_policy_class;
 
 
 extern fwd_policy_class fwd_policy_flow_balancing;
+extern fwd_policy_class fwd_policy_maglev;
+extern fwd_policy_class fwd_policy_latency;
 
 fwd_policy_dev_parm *fwd_policy_dev_parm_new();
 void fwd_policy_dev_parm_del(fwd_policy_dev_parm *pol_dev);
@@ -93,5 +115,18 @@ void fwd_policy_loct_parm_del(fwd_policy_loct_parm *pol_loct);
 fwd_policy_class *fwd_policy_class_find(char *lib);
 fwd_info_t *fwd_info_new();
 void fwd_info_del(fwd_info_t * fwd_info,fwd_info_data_del del_fn);
+void fwd_info_set_map_gen(fwd_info_t *fwd_info, lisp_addr_t *eid);
+void fwd_gen_invalidate_all();
+void fwd_gen_invalidate_map(lisp_addr_t *eid);
+
+/* Returns TRUE while the state the information was obtained from doesn't
+ * change. Read by the data plane threads */
+static inline int
+fwd_info_valid(fwd_info_t *fwd_info)
+{
+    return (__atomic_load_n(&fwd_gen, __ATOMIC_ACQUIRE) == fwd_info->gen
+            && __atomic_load_n(&fwd_map_gen[fwd_info->map_gen_slot],
+                    __ATOMIC_ACQUIRE) == fwd_info->map_gen);
+}
 
 #endif /* ROUTING_POLICY_H_ */
@@ -0,0 +1,595 @@
+/*
+ *
+ * Copyright (C) 2011, 2015 Cisco Systems, Inc.
+ * Copyright (C) 2015 CBA research group, Technical University of Catalonia.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "maglev.h"
+#include "../flow_balancing/flow_balancing.h"
+#include "../flow_balancing/fb_addr_func.h"
+#include "../../lib/oor_log.h"
+#include "../../lib/packets.h"
+#include "../../liblisp/liblisp.h"
+
+/* Entry of the lookup table not assigned to any locator yet */
+#define MAGLEV_EMPTY    0xFF
+
+int mle_maglev_tables_new_init(void *dev_parm, map_local_entry_t *mle,
+        fwd_policy_map_parm *map_parm, fwd_info_del_fct fwd_del_fct);
+int mce_maglev_tables_new_init(void *dev_parm, mcache_entry_t *mce,
+        routing_info_del_fct del_fct);
+int mce_latency_tables_new_init(void *dev_parm, mcache_entry_t *mce,
+        routing_info_del_fct del_fct);
+static void *maglev_tables_new_init(void *dev_parm, mapping_t *map,
+        uint8_t is_mce, int rtt_aware);
+void maglev_tables_del(void *tables);
+int mle_maglev_tables_calculate(void *dev_parm, map_local_entry_t *mle);
+int mce_maglev_tables_calculate(void *dev_parm, mcache_entry_t *mce);
+static int maglev_tables_calculate(void *dev_parm, maglev_tables_t *mt,
+        mapping_t *map, uint8_t is_mce);
+static void maglev_tables_reset(maglev_tables_t *mt);
+static void maglev_tables_dump(maglev_tables_t *mt, mapping_t *map,
+        int log_level);
+static int maglev_select_best_priority_locators(glist_t *loct_list,
+        locator_t **selected_locators, uint8_t is_mce, int *priority);
+static void maglev_table_build(maglev_table_t *table, locator_t **locators,
+        int num_locators, int priority);
+static void maglev_table_reset(maglev_table_t *table);
+static inline locator_t *maglev_table_lookup(maglev_table_t *table,
+        uint32_t hash);
+static int maglev_table_update_preferred(maglev_table_t *table);
+int mce_latency_tables_update(void *dev_parm, mcache_entry_t *mce);
+void maglev_get_fw_entry(void *fwd_dev_parm, void *src_map_parm,
+        void *dst_map_parm, packet_tuple_t *tuple, fwd_info_t *fwd_info);
+
+fwd_policy_class  fwd_policy_maglev = {
+        .new_dev_policy_inf = fb_dev_parm_new_init,
+        .del_dev_policy_inf = fb_dev_parm_del,
+        .init_map_loc_policy_inf = mle_maglev_tables_new_init,
+        .del_map_loc_policy_inf = maglev_tables_del,
+        .init_map_cache_policy_inf = mce_maglev_tables_new_init,
+        .del_map_cache_policy_inf = maglev_tables_del,
+        .updated_map_loc_inf = mle_maglev_tables_calculate,
+        .updated_map_cache_inf = mce_maglev_tables_calculate,
+        .policy_get_fwd_info = maglev_get_fw_entry,
+        .get_fwd_ip_addr = fb_addr_get_fwd_ip_addr
+};
+
+/* Maglev tables whose destination locator is the one with the lowest RTT
+ * among the ones with the best priority, once they have been probed */
+fwd_policy_class  fwd_policy_latency = {
+        .new_dev_policy_inf = fb_dev_parm_new_init,
+        .del_dev_policy_inf = fb_dev_parm_del,
+        .init_map_loc_policy_inf = mle_maglev_tables_new_init,
+        .del_map_loc_policy_inf = maglev_tables_del,
+        .init_map_cache_policy_inf = mce_latency_tables_new_init,
+        .del_map_cache_policy_inf = maglev_tables_del,
+        .updated_map_loc_inf = mle_maglev_tables_calculate,
+        .updated_map_cache_inf = mce_maglev_tables_calculate,
+        .policy_get_fwd_info = maglev_get_fw_entry,
+        .get_fwd_ip_addr = fb_addr_get_fwd_ip_addr,
+        .updated_map_cache_rtt = mce_latency_tables_update
+};
+
+
+int
+mle_maglev_tables_new_init(void *dev_parm, map_local_entry_t *mle,
+        fwd_policy_map_parm *map_parm, fwd_info_del_fct fwd_del_fct)
+{
+    void *fwd_inf = maglev_tables_new_init(dev_parm, map_local_entry_mapping(mle),
+            FALSE, FALSE);
+    if (!fwd_inf){
+        return (BAD);
+    }
+    map_local_entry_set_fwd_info(mle, fwd_inf, fwd_del_fct);
+    return (GOOD);
+}
+
+int
+mce_maglev_tables_new_init(void *dev_parm, mcache_entry_t *mce,
+        routing_info_del_fct del_fct)
+{
+    void *routing_inf = maglev_tables_new_init(dev_parm, mcache_entry_mapping(mce),
+            TRUE, FALSE);
+    if (!routing_inf){
+        return (BAD);
+    }
+    mcache_entry_set_routing_info(mce, routing_inf, del_fct);
+    return (GOOD);
+}
+
+int
+mce_latency_tables_new_init(void *dev_parm, mcache_entry_t *mce,
+        routing_info_del_fct del_fct)
+{
+    void *routing_inf = maglev_tables_new_init(dev_parm, mcache_entry_mapping(mce),
+            TRUE, TRUE);
+    if (!routing_inf){
+        return (BAD);
+    }
+    mcache_entry_set_routing_info(mce, routing_inf, del_fct);
+    return (GOOD);
+}
+
+static void *
+maglev_tables_new_init(void *dev_parm, mapping_t *map, uint8_t is_mce,
+        int rtt_aware)
+{
+    maglev_tables_t *mt;
+
+    mt = xzalloc(sizeof(maglev_tables_t));
+    mt->rtt_aware = rtt_aware;
+
+    if (maglev_tables_calculate(dev_parm, mt, map, is_mce) != GOOD){
+        maglev_tables_del(mt);
+        OOR_LOG(LDBG_2,"maglev_tables_new_init: Error calculating maglev tables");
+        return (NULL);
+    }
+
+    return ((void *)mt);
+}
+
+void
+maglev_tables_del(void *tables)
+{
+    maglev_tables_t *mt = (maglev_tables_t *)tables;
+
+    maglev_tables_reset(mt);
+    lisp_addr_del(mt->v4.preferred_addr);
+    lisp_addr_del(mt->v6.preferred_addr);
+    free(mt);
+}
+
+static void
+maglev_table_reset(maglev_table_t *table)
+{
+    free(table->locators);
+    free(table->entries);
+    table->locators = NULL;
+    table->entries = NULL;
+    table->num_locators = 0;
+    table->priority = UNUSED_RLOC_PRIORITY;
+    table->preferred = NULL;
+}
+
+static void
+maglev_tables_reset(maglev_tables_t *mt)
+{
+    maglev_table_reset(&mt->v4);
+    maglev_table_reset(&mt->v6);
+    maglev_table_reset(&mt->mixed);
+    mt->all = NULL;
+}
+
+int
+mle_maglev_tables_calculate(void *dev_parm, map_local_entry_t *mle)
+{
+    return (maglev_tables_calculate(dev_parm, map_local_entry_fwd_info(mle),
+            map_local_entry_mapping(mle), FALSE));
+}
+
+int
+mce_maglev_tables_calculate(void *dev_parm, mcache_entry_t *mce)
+{
+    return (maglev_tables_calculate(dev_parm, mcache_entry_routing_info(mce),
+            mcache_entry_mapping(mce), TRUE));
+}
+
+/* Print the share of the lookup table of each locator */
+static void
+maglev_table_dump(maglev_table_t *table, char *name, int log_level)
+{
+    int count[MAGLEV_MAX_LOCATORS];
+    char str[3000];
+    size_t str_size = sizeof(str);
+    int ctr;
+
+    memset(count, 0, sizeof(count));
+    for (ctr = 0; table->entries && ctr < MAGLEV_TABLE_SIZE; ctr++) {
+        count[table->entries[ctr]]++;
+    }
+
+    snprintf(str, str_size, "  %s locators table (%d locators):  ", name,
+            table->num_locators);
+    for (ctr = 0; ctr < table->num_locators; ctr++) {
+        if (strlen(str) > 2900) {
+            snprintf(str + strlen(str),str_size - strlen(str), " ...");
+            break;
+        }
+        snprintf(str + strlen(str),str_size - strlen(str), " %s (%d)%s  ",
+                lisp_addr_to_char(locator_addr(table->locators[ctr])),
+                count[ctr], table->locators[ctr] == table->preferred ?
+                        " preferred" : "");
+    }
+    OOR_LOG(log_level, "%s", str);
+}
+
+static void
+maglev_tables_dump(maglev_tables_t *mt, mapping_t *map, int log_level)
+{
+    if (!is_loggable(log_level)) {
+        return;
+    }
+    OOR_LOG(log_level, "Maglev tables for %s (entries of %d per locator): ",
+            lisp_addr_to_char(mapping_eid(map)), MAGLEV_TABLE_SIZE);
+    maglev_table_dump(&mt->v4, "IPv4", log_level);
+    maglev_table_dump(&mt->v6, "IPv6", log_level);
+    if (mt->all != NULL) {
+        maglev_table_dump(mt->all, "IPv4 & IPv6", log_level);
+    }
+}
+
+/* Fill 'selected_locators' with the active locators with the best priority
+ * of the list and return their number */
+static int
+maglev_select_best_priority_locators(glist_t *loct_list,
+        locator_t **selected_locators, uint8_t is_mce, int *priority)
+{
+    glist_entry_t *it_loct;
+    locator_t *locator;
+    int min_priority = UNUSED_RLOC_PRIORITY;
+    int pos = 0;
+
+    glist_for_each_entry(it_loct,loct_list){
+        locator = (locator_t *)glist_entry_data(it_loct);
+        /* Only use locators with status UP  */
+        if (locator_state(locator) == DOWN
+                || locator_priority(locator) == UNUSED_RLOC_PRIORITY ) {
+            continue;
+        }
+        /* For local mappings, the locator should be local */
+        if (!is_mce && locator_L_bit(locator) == 0){
+            continue;
+        }
+        if (locator_priority(locator) < min_priority) {
+            pos = 0;
+            min_priority = locator_priority(locator);
+        }
+        if (locator_priority(locator) == min_priority
+                && pos < MAGLEV_MAX_LOCATORS / 2) {
+            selected_locators[pos] = locator;
+            pos++;
+        }
+    }
+
+    *priority = min_priority;
+    return (pos);
+}
+
+/* Hash of the address of the locator. It doesn't depend on the rest of the
+ * locators, so their positions in the table are kept when others change */
+static uint32_t
+maglev_locator_hash(locator_t *locator, uint32_t seed)
+{
+    lisp_addr_t *addr = locator_addr(locator);
+    uint32_t buf[16];
+    uint32_t len;
+
+    len = lisp_addr_size_to_write(addr);
+    if (len == 0 || len > sizeof(buf)) {
+        return (seed);
+    }
+    memset(buf, 0, sizeof(buf));
+    lisp_addr_write(buf, addr);
+    return (pkt_hash_words(buf, (len + 3) / 4, seed));
+}
+
+/*
+ * Fill the lookup table with the locators. Each locator walks the table
+ * following its own permutation (an offset and a step derived from its
+ * address) and takes the first free entry it finds. The locators take turns
+ * in proportion to their weight, so that the number of entries of each one
+ * is proportional to it. If all the weights are 0, the load is balanced
+ * evenly.
+ */
+static void
+maglev_table_build(maglev_table_t *table, locator_t **locators,
+        int num_locators, int priority)
+{
+    uint32_t offset[MAGLEV_MAX_LOCATORS];
+    uint32_t skip[MAGLEV_MAX_LOCATORS];
+    uint32_t next[MAGLEV_MAX_LOCATORS];
+    int weight[MAGLEV_MAX_LOCATORS];
+    int credit[MAGLEV_MAX_LOCATORS];
+    int total_weight = 0, max_weight = 0;
+    int ctr, n = 0, filled = 0;
+    uint32_t pos;
+
+    for (ctr = 0; ctr < num_locators; ctr++) {
+        total_weight += locator_weight(locators[ctr]);
+    }
+
+    table->locators = xmalloc(num_locators * sizeof(locator_t *));
+    for (ctr = 0; ctr < num_locators; ctr++) {
+        /* As in the balancing vectors, the locators with weight 0 are not
+         * used unless all of them have weight 0 */
+        if (total_weight != 0 && locator_weight(locators[ctr]) == 0) {
+            continue;
+        }
+        table->locators[n] = locators[ctr];
+        weight[n] = total_weight != 0 ? locator_weight(locators[ctr]) : 1;
+        if (weight[n] > max_weight) {
+            max_weight = weight[n];
+        }
+        offset[n] = maglev_locator_hash(locators[ctr], 0) % MAGLEV_TABLE_SIZE;
+        skip[n] = maglev_locator_hash(locators[ctr], 1)
+                % (MAGLEV_TABLE_SIZE - 1) + 1;
+        next[n] = 0;
+        credit[n] = 0;
+        n++;
+    }
+    table->num_locators = n;
+    table->priority = priority;
+    table->entries = xmalloc(MAGLEV_TABLE_SIZE);
+    memset(table->entries, MAGLEV_EMPTY, MAGLEV_TABLE_SIZE);
+
+    while (filled < MAGLEV_TABLE_SIZE) {
+        for (ctr = 0; ctr < n && filled < MAGLEV_TABLE_SIZE; ctr++) {
+            credit[ctr] += weight[ctr];
+            if (credit[ctr] < max_weight) {
+                continue;
+            }
+            credit[ctr] -= max_weight;
+            /* The step is coprime with the size of the table, so the
+             * permutation visits all the entries */
+            do {
+                pos = (offset[ctr] + next[ctr] * skip[ctr]) % MAGLEV_TABLE_SIZE;
+                next[ctr]++;
+            } while (table->entries[pos] != MAGLEV_EMPTY);
+            table->entries[pos] = ctr;
+            filled++;
+        }
+    }
+}
+
+static inline locator_t *
+maglev_table_lookup(maglev_table_t *table, uint32_t hash)
+{
+    if (table->preferred != NULL) {
+        return (table->preferred);
+    }
+    return (table->locators[table->entries[hash % MAGLEV_TABLE_SIZE]]);
+}
+
+/* Cost of a locator for the latency policy: its smoothed RTT, increased
+ * with the fraction of probes lost. 0 if it has not been probed yet */
+static uint64_t
+maglev_locator_cost(locator_t *locator)
+{
+    return ((uint64_t)locator_srtt(locator)
+            * (LOCATOR_LOSS_SCALE + 2 * (uint64_t)locator_loss(locator))
+            / LOCATOR_LOSS_SCALE);
+}
+
+/* Select the locator of the table with the lowest cost. The current one is
+ * kept unless the new one is clearly better. Returns TRUE if it changed */
+static int
+maglev_table_update_preferred(maglev_table_t *table)
+{
+    locator_t *best = NULL;
+    uint64_t cost, best_cost = 0, cur_cost, margin;
+    int ctr;
+
+    for (ctr = 0; ctr < table->num_locators; ctr++) {
+        cost = maglev_locator_cost(table->locators[ctr]);
+        if (cost != 0 && (best == NULL || cost < best_cost)) {
+            best = table->locators[ctr];
+            best_cost = cost;
+        }
+    }
+
+    if (best != NULL && table->preferred != NULL && best != table->preferred) {
+        cur_cost = maglev_locator_cost(table->preferred);
+        margin = cur_cost / MAGLEV_RTT_HYST_DIV;
+        if (margin < MAGLEV_RTT_HYST_MIN) {
+            margin = MAGLEV_RTT_HYST_MIN;
+        }
+        if (best_cost + margin > cur_cost) {
+            best = table->preferred;
+        }
+    }
+
+    if (best == table->preferred) {
+        return (FALSE);
+    }
+    table->preferred = best;
+    lisp_addr_del(table->preferred_addr);
+    table->preferred_addr = best ? lisp_addr_clone(locator_addr(best)) : NULL;
+    return (TRUE);
+}
+
+/* The preferred locator of the rebuilt table is the one with the address of
+ * the previous one, if it is still used */
+static void
+maglev_table_keep_preferred(maglev_table_t *table)
+{
+    int ctr;
+
+    if (table->preferred_addr == NULL) {
+        return;
+    }
+    for (ctr = 0; ctr < table->num_locators; ctr++) {
+        if (lisp_addr_cmp(locator_addr(table->locators[ctr]),
+                table->preferred_addr) == 0) {
+            table->preferred = table->locators[ctr];
+            return;
+        }
+    }
+}
+
+/*
+ * Calculate the lookup tables used to distribute the load from the priority
+ * and weight of the locators of the mapping
+ */
+static int
+maglev_tables_calculate(void *dev_parm, maglev_tables_t *mt, mapping_t *map,
+        uint8_t is_mce)
+{
+    locator_t *locators[3][MAGLEV_MAX_LOCATORS];
+    int num_locators[2], priority[2];
+    glist_t *ipv4_loct_list  = glist_new();
+    glist_t *ipv6_loct_list  = glist_new();
+    fb_dev_parm *fw_dev_parm = (fb_dev_parm *)dev_parm;
+
+    maglev_tables_reset(mt);
+
+    fb_locators_classify_in_4_6(map,fw_dev_parm->loc_loct,ipv4_loct_list,ipv6_loct_list);
+
+    num_locators[0] = maglev_select_best_priority_locators(ipv4_loct_list,
+            locators[0], is_mce, &priority[0]);
+    if (num_locators[0] > 0) {
+        maglev_table_build(&mt->v4, locators[0], num_locators[0], priority[0]);
+    }
+    num_locators[1] = maglev_select_best_priority_locators(ipv6_loct_list,
+            locators[1], is_mce, &priority[1]);
+    if (num_locators[1] > 0) {
+        maglev_table_build(&mt->v6, locators[1], num_locators[1], priority[1]);
+    }
+
+    if (num_locators[0] > 0 && num_locators[1] > 0) {
+        if (priority[0] < priority[1]) {
+            /* Only IPv4 locators are involved (due to priority reasons) */
+            mt->all = &mt->v4;
+        } else if (priority[0] > priority[1]) {
+            /* Only IPv6 locators are involved (due to priority reasons) */
+            mt->all = &mt->v6;
+        } else {
+            /* IPv4 and IPv6 locators are involved */
+            memcpy(locators[2], locators[0], num_locators[0] * sizeof(locator_t *));
+            memcpy(locators[2] + num_locators[0], locators[1],
+                    num_locators[1] * sizeof(locator_t *));
+            maglev_table_build(&mt->mixed, locators[2],
+                    num_locators[0] + num_locators[1], priority[0]);
+            mt->all = &mt->mixed;
+        }
+    }
+
+    if (mt->rtt_aware) {
+        maglev_table_keep_preferred(&mt->v4);
+        maglev_table_keep_preferred(&mt->v6);
+        maglev_table_update_preferred(&mt->v4);
+        maglev_table_update_preferred(&mt->v6);
+    }
+
+    maglev_tables_dump(mt, map, LDBG_1);
+
+    glist_destroy(ipv4_loct_list);
+    glist_destroy(ipv6_loct_list);
+
+    return (GOOD);
+}
+
+/* Reevaluate the preferred locators of the map cache entry after the RTT of
+ * one of its locators has been measured */
+int
+mce_latency_tables_update(void *dev_parm, mcache_entry_t *mce)
+{
+    maglev_tables_t *mt = mcache_entry_routing_info(mce);
+    int changed;
+
+    if (mt == NULL || !mt->rtt_aware) {
+        return (FALSE);
+    }
+    changed = maglev_table_update_preferred(&mt->v4);
+    changed |= maglev_table_update_preferred(&mt->v6);
+    if (changed) {
+        OOR_LOG(LDBG_1, "Preferred locators of %s changed by their RTT",
+                lisp_addr_to_char(mapping_eid(mcache_entry_mapping(mce))));
+        maglev_tables_dump(mt, mcache_entry_mapping(mce), LDBG_1);
+    }
+    return (changed);
+}
+
+/*************************** Forward Select Function *************************/
+
+/* Select the source and destination RLOC with the lookup tables. The
+ * destination RLOC is selected according to the AFI of the selected source
+ * RLOC */
+
+void
+maglev_get_fw_entry(void *fwd_dev_parm, void *src_map_parm, void *dst_map_parm,
+        packet_tuple_t *tuple, fwd_info_t *fwd_info)
+{
+    fwd_entry_t *fwd_entry;
+    fb_dev_parm *dev_parm = (fb_dev_parm *)fwd_dev_parm;
+    maglev_tables_t *src_mt = (maglev_tables_t *)src_map_parm;
+    maglev_tables_t *dst_mt = (maglev_tables_t *)dst_map_parm;
+    maglev_table_t *src_table;
+    maglev_table_t *dst_table;
+    locator_t *src_loct;
+    locator_t *dst_loct;
+    lisp_addr_t *src_ip_addr;
+    lisp_addr_t *dst_ip_addr;
+    uint32_t hash;
+
+    if (src_mt->all != NULL && dst_mt->all != NULL) {
+        src_table = src_mt->all;
+    } else if (src_mt->v6.num_locators > 0 && dst_mt->v6.num_locators > 0) {
+        src_table = &src_mt->v6;
+    } else if (src_mt->v4.num_locators > 0 && dst_mt->v4.num_locators > 0) {
+        src_table = &src_mt->v4;
+    } else {
+        if (src_mt->v4.num_locators == 0 && src_mt->v6.num_locators == 0) {
+            OOR_LOG(LDBG_3, "maglev_get_fw_entry: No SRC locators "
+                    "available");
+        }else if (dst_mt->v4.num_locators == 0 && dst_mt->v6.num_locators == 0) {
+            OOR_LOG(LDBG_3, "maglev_get_fw_entry: No DST locators "
+                    "available");
+        } else {
+            OOR_LOG(LDBG_3, "maglev_get_fw_entry: Source and "
+                    "destination RLOCs are not compatible");
+        }
+        return;
+    }
+
+    hash = pkt_tuple_hash(tuple);
+
+    src_loct = maglev_table_lookup(src_table, hash);
+    src_ip_addr = fb_addr_get_fwd_ip_addr(locator_addr(src_loct),dev_parm->loc_loct);
+
+    /* decide dst afi based on src afi*/
+    switch (lisp_addr_ip_afi(src_ip_addr)) {
+    case (AF_INET):
+        dst_table = &dst_mt->v4;
+        break;
+    case (AF_INET6):
+        dst_table = &dst_mt->v6;
+        break;
+    default:
+        OOR_LOG(LDBG_2, "maglev_get_fw_entry: Unknown IP AFI %d",
+                lisp_addr_ip_afi(src_ip_addr));
+        return;
+    }
+    if (dst_table->num_locators == 0) {
+        OOR_LOG(LDBG_3, "maglev_get_fw_entry: No DST locators with the AFI "
+                "of the SRC locator");
+        return;
+    }
+
+    dst_loct = maglev_table_lookup(dst_table, hash);
+    dst_ip_addr = fb_addr_get_fwd_ip_addr(locator_addr(dst_loct),dev_parm->loc_loct);
+
+    fwd_entry = fwd_entry_new_init(src_ip_addr, dst_ip_addr, tuple->iid, NULL);
+    fwd_info->fwd_info = fwd_entry;
+
+    OOR_LOG(LDBG_3, "maglev_get_fw_entry: EID: %s -> %s, protocol: %d, "
+            "port: %d -> %d\n  --> RLOC: %s -> %s",
+            lisp_addr_to_char(&(tuple->src_addr)),
+            lisp_addr_to_char(&(tuple->dst_addr)), tuple->protocol,
+            tuple->src_port, tuple->dst_port,
+            lisp_addr_to_char(src_ip_addr),
+            lisp_addr_to_char(dst_ip_addr));
+}
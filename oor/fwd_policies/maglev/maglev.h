@@ -0,0 +1,80 @@
+/*
+ *
+ * Copyright (C) 2011, 2015 Cisco Systems, Inc.
+ * Copyright (C) 2015 CBA research group, Technical University of Catalonia.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef MAGLEV_H_
+#define MAGLEV_H_
+
+#include "../fwd_policy.h"
+
+/* Number of entries of the lookup tables. A prime much larger than the
+ * number of locators of a mapping, so that the share of the flows of each
+ * locator is close to its weight */
+#define MAGLEV_TABLE_SIZE       1021
+
+/* Maximum number of locators of each lookup table */
+#define MAGLEV_MAX_LOCATORS     64
+
+/* Latency policy: the preferred locator only changes when another one has
+ * a cost lower by at least 1/MAGLEV_RTT_HYST_DIV of its cost and by at least
+ * MAGLEV_RTT_HYST_MIN us, so that the flows don't flap between locators
+ * with similar RTTs */
+#define MAGLEV_RTT_HYST_DIV     8
+#define MAGLEV_RTT_HYST_MIN     2000
+
+/*
+ * Maglev lookup table of the locators with the best priority of a mapping.
+ * Each entry is the position in 'locators' of the locator of the flows whose
+ * hash selects it. The entries are filled following a permutation of the
+ * table derived from the address of each locator, so when a locator is added
+ * or removed, only the entries of that locator (and a few others) change and
+ * the rest of the flows keep their locator.
+ */
+typedef struct maglev_table_ {
+    locator_t **locators;
+    int num_locators;
+    int priority;
+    uint8_t *entries;
+    /* Latency policy: locator used by all the flows instead of the table.
+     * NULL while none of the locators has been probed */
+    locator_t *preferred;
+    /* Address of the preferred locator. Kept when the table is rebuilt, as
+     * the locators of the mapping may have been replaced */
+    lisp_addr_t *preferred_addr;
+} maglev_table_t;
+
+/*
+ * Lookup tables of a mapping. As with the flow balancing vectors, the
+ * source locator is selected among all the locators and the destination
+ * one among the locators with the same AFI.
+ *  v4: If we just have IPv4 RLOCs
+ *  v6: If we just have IPv6 RLOCs
+ *  all: If we have IPv4 & IPv6 RLOCs. Points to v4 or v6 when the locators
+ *    of one of them have a better priority
+ */
+typedef struct maglev_tables_ {
+    maglev_table_t v4;
+    maglev_table_t v6;
+    maglev_table_t mixed;
+    maglev_table_t *all;
+    /* Select the destination locator by the RTT of the RLOC probes (latency
+     * policy) */
+    int rtt_aware;
+} maglev_tables_t;
+
+#endif /* MAGLEV_H_ */
@@ -22,96 +22,215 @@
 #include "../liblisp/lisp_messages.h"
 
 #include <arpa/inet.h>
+#include <string.h>
 #include <netinet/in.h>
 #include <netinet/ip6.h>
 #include <netinet/ip.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CKSUM_X86
+#endif
 
-uint16_t
-ip_checksum(uint16_t *buffer, int size)
+static uint32_t cksum_partial_generic(const void *buf, int len, uint32_t sum);
+
+/* Implementation selected by cksum_init */
+static uint32_t (*cksum_partial_impl)(const void *buf, int len, uint32_t sum)
+        = cksum_partial_generic;
+
+
+static inline uint32_t
+cksum_fold64(uint64_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return ((uint32_t)sum);
+}
+
+/* Sum 32 bit words in a 64 bit accumulator. As 2^16 = 1 in one's complement
+ * arithmetic, folding the result gives the sum of the 16 bit words */
+static uint32_t
+cksum_partial_generic(const void *buf, int len, uint32_t sum)
+{
+    const uint8_t *p = buf;
+    uint64_t acc = sum;
+    uint32_t w32;
+    uint16_t w16;
+
+    while (len >= 4) {
+        memcpy(&w32, p, sizeof(w32));
+        acc += w32;
+        p += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        memcpy(&w16, p, sizeof(w16));
+        acc += w16;
+        p += 2;
+        len -= 2;
+    }
+    /* Add the padding if the length is odd */
+    if (len) {
+        acc += *p;
+    }
+
+    return (cksum_fold64(acc));
+}
+
+#ifdef CKSUM_X86
+/* The vector paths add the 32 bit words in 64 bit lanes with two
+ * independent accumulators, 32 (SSE2) or 64 (AVX2) bytes per iteration */
+__attribute__((target("sse2")))
+static uint32_t
+cksum_partial_sse2(const void *buf, int len, uint32_t sum)
+{
+    const uint8_t *p = buf;
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero, acc1 = zero, v;
+    uint64_t lanes[2];
+    int i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        v = _mm_loadu_si128((const __m128i *)(p + i));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+        v = _mm_loadu_si128((const __m128i *)(p + i + 16));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+    }
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+
+    return (cksum_partial_generic(p + i, len - i,
+            cksum_fold64((uint64_t)sum + lanes[0] + lanes[1])));
+}
+
+__attribute__((target("avx2")))
+static uint32_t
+cksum_partial_avx2(const void *buf, int len, uint32_t sum)
 {
-    uint32_t cksum = 0;
+    const uint8_t *p = buf;
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero, acc1 = zero, v;
+    uint64_t lanes[4];
+    int i;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+        v = _mm256_loadu_si256((const __m256i *)(p + i));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
+        v = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
+    }
+    _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(acc0, acc1));
+
+    return (cksum_partial_sse2(p + i, len - i, cksum_fold64((uint64_t)sum
+            + lanes[0] + lanes[1] + lanes[2] + lanes[3])));
+}
+#endif
 
-    while (size > 1) {
-        cksum += *buffer++;
-        size -= sizeof(uint16_t);
+/* Select the fastest implementation supported by the CPU */
+void
+cksum_init()
+{
+#ifdef CKSUM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        cksum_partial_impl = cksum_partial_avx2;
+        OOR_LOG(LDBG_1, "Checksums computed with AVX2");
+        return;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        cksum_partial_impl = cksum_partial_sse2;
+        OOR_LOG(LDBG_1, "Checksums computed with SSE2");
+        return;
     }
+#endif
+    OOR_LOG(LDBG_1, "Checksums computed with the generic implementation");
+}
 
-    if (size) {
-        cksum += *(uint8_t *) buffer;
+uint32_t
+cksum_partial(const void *buf, int len, uint32_t sum)
+{
+    return (cksum_partial_impl(buf, len, sum));
+}
+
+uint16_t
+cksum_finish(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
     }
 
-    cksum = (cksum >> 16) + (cksum & 0xffff);
-    cksum += (cksum >> 16);
+    return ((uint16_t) (~sum));
+}
+
+/* Update the checksum 'cksum' when the 16 bit word 'old' covered by it is
+ * replaced by 'new' (RFC 1624, eqn. 3). The values are in network order */
+uint16_t
+cksum_update16(uint16_t cksum, uint16_t old, uint16_t new)
+{
+    uint32_t sum;
+
+    sum = (uint16_t)~cksum + (uint16_t)~old + new;
+    return (cksum_finish(sum));
+}
+
+/* Same as cksum_update16 for a 32 bit word, such as an IPv4 address */
+uint16_t
+cksum_update32(uint16_t cksum, uint32_t old, uint32_t new)
+{
+    uint32_t sum;
+
+    sum = (uint16_t)~cksum + (uint16_t)~(old >> 16) + (uint16_t)~(old & 0xFFFF)
+            + (new >> 16) + (new & 0xFFFF);
+    return (cksum_finish(sum));
+}
 
-    return ((uint16_t) (~cksum));
+uint16_t
+ip_checksum(uint16_t *buffer, int size)
+{
+    return (cksum_finish(cksum_partial(buffer, size, 0)));
 }
 
 /*
  *
- *  Calculate the IPv4 UDP checksum (calculated with the whole packet).
+ *  Calculate the IPv4 UDP or TCP checksum (calculated with the whole packet).
  *
  *  Parameters:
  *
- *  buff    -   pointer to the UDP header
- *  len -   the UDP packet length.
+ *  buff    -   pointer to the UDP or TCP header
+ *  len -   the UDP or TCP packet length.
  *  src -   the IP source address (in network format).
  *  dest    -   the IP destination address (in network format).
+ *  proto   -   the transport protocol of the pseudo-header
  *
  *  Returns:        The result of the checksum
  *
  */
 
-uint16_t
-udp_ipv4_checksum(const void *b, unsigned int len,
-        in_addr_t src, in_addr_t dst)
+static uint16_t
+l4_ipv4_checksum(const void *b, unsigned int len,
+        in_addr_t src, in_addr_t dst, int proto)
 {
+    uint32_t sum;
 
-    const uint16_t *buf = b;
-    uint16_t *ip_src = (void *) &src;
-    uint16_t *ip_dst = (void *) &dst;
-    uint32_t length = len;
-    uint32_t sum = 0;
-
-    while (len > 1) {
-        sum += *buf++;
-        if (sum & 0x80000000)
-            sum = (sum & 0xFFFF) + (sum >> 16);
-        len -= 2;
-    }
-
-    /* Add the padding if the packet length is odd */
-
-    if (len & 1)
-        sum += *((uint8_t *) buf);
+    sum = cksum_partial(b, len, 0);
 
     /* Add the pseudo-header */
+    sum += (src >> 16) + (src & 0xFFFF);
+    sum += (dst >> 16) + (dst & 0xFFFF);
+    sum += htons(proto);
+    sum += htons(len);
 
-    sum += *(ip_src++);
-    sum += *ip_src;
-
-    sum += *(ip_dst++);
-    sum += *ip_dst;
-
-    sum += htons(IPPROTO_UDP);
-    sum += htons(length);
-
-    /* Add the carries */
-
-    while (sum >> 16)
-        sum = (sum & 0xFFFF) + (sum >> 16);
-
-    /* Return the one's complement of sum */
-
-    return ((uint16_t) (~sum));
+    return (cksum_finish(sum));
 }
 
-uint16_t
-udp_ipv6_checksum(const struct ip6_hdr *ip6, const struct udphdr *up,
-        unsigned int len)
+static uint16_t
+l4_ipv6_checksum(const struct ip6_hdr *ip6, const void *up,
+        unsigned int len, int proto)
 {
-    size_t i;
-    register const u_int16_t *sp;
     uint32_t sum;
     union {
         struct {
@@ -129,44 +248,46 @@ udp_ipv6_checksum(const struct ip6_hdr *ip6, const struct udphdr *up,
     phu.ph.ph_src = ip6->ip6_src;
     phu.ph.ph_dst = ip6->ip6_dst;
     phu.ph.ph_len = htonl(len);
-    phu.ph.ph_nxt = IPPROTO_UDP;
-
-    sum = 0;
-    for (i = 0; i < sizeof(phu.pa) / sizeof(phu.pa[0]); i++)
-        sum += phu.pa[i];
+    phu.ph.ph_nxt = proto;
 
-    sp = (const u_int16_t *) up;
+    sum = cksum_partial(&phu, sizeof(phu), 0);
+    sum = cksum_partial(up, len, sum);
 
-    for (i = 0; i < (len & ~1); i += 2)
-        sum += *sp++;
-
-    if (len & 1)
-        sum += htons((*(const u_int8_t *) sp) << 8);
-
-    while (sum > 0xffff)
-        sum = (sum & 0xffff) + (sum >> 16);
-    sum = ~sum & 0xffff;
-
-    return (sum);
+    return (cksum_finish(sum));
 }
 
-/*
- *  upd_checksum
- *
- *  Calculate the IPv4 or IPv6 UDP checksum  */
-uint16_t
-udp_checksum(struct udphdr *udph, int udp_len, void *iphdr, int afi)
+static uint16_t
+l4_checksum(void *l4h, int l4_len, void *iphdr, int afi, int proto)
 {
     switch (afi) {
     case AF_INET:
-        return (udp_ipv4_checksum(udph, udp_len,
+        return (l4_ipv4_checksum(l4h, l4_len,
                 ((struct ip *) iphdr)->ip_src.s_addr,
-                ((struct ip *) iphdr)->ip_dst.s_addr));
+                ((struct ip *) iphdr)->ip_dst.s_addr, proto));
     case AF_INET6:
-        return (udp_ipv6_checksum(iphdr, udph, udp_len));
+        return (l4_ipv6_checksum(iphdr, l4h, l4_len, proto));
     default:
-        OOR_LOG(LDBG_2, "udp_checksum: Unknown AFI");
+        OOR_LOG(LDBG_2, "l4_checksum: Unknown AFI");
         return (~0);
     }
 }
 
+/*
+ *  upd_checksum
+ *
+ *  Calculate the IPv4 or IPv6 UDP checksum  */
+uint16_t
+udp_checksum(struct udphdr *udph, int udp_len, void *iphdr, int afi)
+{
+    return (l4_checksum(udph, udp_len, iphdr, afi, IPPROTO_UDP));
+}
+
+/*
+ *  tcp_checksum
+ *
+ *  Calculate the IPv4 or IPv6 TCP checksum  */
+uint16_t
+tcp_checksum(struct tcphdr *tcph, int tcp_len, void *iphdr, int afi)
+{
+    return (l4_checksum(tcph, tcp_len, iphdr, afi, IPPROTO_TCP));
+}
@@ -21,13 +21,26 @@
 #define CKSUM_H_
 
 #include <sys/types.h>
+#include <netinet/tcp.h>
 #include <netinet/udp.h>
 #include "../defs.h"
 
+/* Select the implementation of the checksums for the CPU. Should be called
+ * at startup. Until then, the generic one is used */
+void cksum_init();
 uint16_t ip_checksum(uint16_t *buffer, int size);
+/* Add the 16 bit words of 'buf' to the partial sum 'sum', as they are in
+ * memory. The result should be passed to cksum_finish */
+uint32_t cksum_partial(const void *buf, int len, uint32_t sum);
+/* Fold a partial sum to 16 bits and return its one's complement */
+uint16_t cksum_finish(uint32_t sum);
+uint16_t cksum_update16(uint16_t cksum, uint16_t old, uint16_t new);
+uint16_t cksum_update32(uint16_t cksum, uint32_t old, uint32_t new);
 
 /* Calculate the IPv4 or IPv6 UDP checksum */
 uint16_t udp_checksum(struct udphdr *udph, int udp_len, void *iphdr, int afi);
+/* Calculate the IPv4 or IPv6 TCP checksum */
+uint16_t tcp_checksum(struct tcphdr *tcph, int tcp_len, void *iphdr, int afi);
 
 
 #endif /* CKSUM_H_ */
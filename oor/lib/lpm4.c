@@ -0,0 +1,280 @@
+/*
+ *
+ * Copyright (C) 2011, 2015 Cisco Systems, Inc.
+ * Copyright (C) 2015 CBA research group, Technical University of Catalonia.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "lpm4.h"
+#include "mem_util.h"
+#include "oor_log.h"
+#include "../defs.h"
+
+/* Groups of tbl8 and prefixes allocated when the table is created */
+#define LPM4_INIT_GROUPS    64
+#define LPM4_INIT_IDS       1024
+
+static inline uint32_t
+lpm4_entry(uint32_t id, uint8_t plen)
+{
+    return (LPM4_VALID | ((uint32_t)plen << LPM4_PLEN_SHIFT) | id);
+}
+
+static inline uint8_t
+lpm4_entry_plen(uint32_t e)
+{
+    return ((e >> LPM4_PLEN_SHIFT) & LPM4_PLEN_MASK);
+}
+
+/* First address of the prefix */
+static inline uint32_t
+lpm4_mask(uint32_t addr, uint8_t plen)
+{
+    return (plen == 0 ? 0 : addr & (0xffffffff << (32 - plen)));
+}
+
+/* Resize an array to 'new_size' elements of 'elem' bytes */
+static void *
+lpm4_grow(void *array, uint32_t new_size, size_t elem)
+{
+    return (xrealloc(array, (size_t)new_size * elem));
+}
+
+static int
+lpm4_id_alloc(lpm4_t *lpm, void *data, uint32_t *id)
+{
+    uint32_t size;
+
+    if (lpm->data_nfree > 0) {
+        *id = lpm->data_free[--lpm->data_nfree];
+    } else {
+        if (lpm->data_used == lpm->data_size) {
+            if (lpm->data_size == LPM4_MAX_IDS) {
+                return (BAD);
+            }
+            size = lpm->data_size ? lpm->data_size * 2 : LPM4_INIT_IDS;
+            lpm->data = lpm4_grow(lpm->data, size, sizeof(void *));
+            lpm->data_free = lpm4_grow(lpm->data_free, size, sizeof(uint32_t));
+            lpm->data_size = size;
+        }
+        *id = lpm->data_used++;
+    }
+    lpm->data[*id] = data;
+    return (GOOD);
+}
+
+static void
+lpm4_id_free(lpm4_t *lpm, uint32_t id)
+{
+    lpm->data[id] = NULL;
+    lpm->data_free[lpm->data_nfree++] = id;
+}
+
+/* Group of tbl8 with all its entries set to 'e' */
+static int
+lpm4_tbl8_alloc(lpm4_t *lpm, uint32_t e, uint32_t *group)
+{
+    uint32_t size, *tbl;
+    int i;
+
+    if (lpm->tbl8_nfree > 0) {
+        *group = lpm->tbl8_free[--lpm->tbl8_nfree];
+    } else {
+        if (lpm->tbl8_used == lpm->tbl8_size) {
+            if (lpm->tbl8_size == LPM4_MAX_IDS) {
+                return (BAD);
+            }
+            size = lpm->tbl8_size ? lpm->tbl8_size * 2 : LPM4_INIT_GROUPS;
+            lpm->tbl8 = lpm4_grow(lpm->tbl8, size,
+                    LPM4_TBL8_GROUP * sizeof(uint32_t));
+            lpm->tbl8_free = lpm4_grow(lpm->tbl8_free, size, sizeof(uint32_t));
+            lpm->tbl8_size = size;
+        }
+        *group = lpm->tbl8_used++;
+    }
+
+    tbl = &lpm->tbl8[*group * LPM4_TBL8_GROUP];
+    for (i = 0; i < LPM4_TBL8_GROUP; i++) {
+        tbl[i] = e;
+    }
+    return (GOOD);
+}
+
+/* Set the entries not covered by a longer prefix */
+static void
+lpm4_fill(uint32_t *tbl, uint32_t n, uint32_t e, uint8_t plen)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        if (!(tbl[i] & LPM4_VALID) || lpm4_entry_plen(tbl[i]) <= plen) {
+            tbl[i] = e;
+        }
+    }
+}
+
+/* Replace the entries of a prefix */
+static void
+lpm4_replace(uint32_t *tbl, uint32_t n, uint8_t plen, uint32_t e)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        if ((tbl[i] & LPM4_VALID) && lpm4_entry_plen(tbl[i]) == plen) {
+            tbl[i] = e;
+        }
+    }
+}
+
+/* Free the group of tbl8 of an entry of tbl24 once its addresses are only
+ * covered by prefixes up to /24, which are the same for all of them */
+static void
+lpm4_tbl8_collapse(lpm4_t *lpm, uint32_t i24)
+{
+    uint32_t group = lpm->tbl24[i24] & LPM4_ID_MASK;
+    uint32_t *tbl = &lpm->tbl8[group * LPM4_TBL8_GROUP];
+    int i;
+
+    for (i = 0; i < LPM4_TBL8_GROUP; i++) {
+        if ((tbl[i] & LPM4_VALID) && lpm4_entry_plen(tbl[i]) > 24) {
+            return;
+        }
+    }
+    lpm->tbl24[i24] = tbl[0];
+    lpm->tbl8_free[lpm->tbl8_nfree++] = group;
+}
+
+lpm4_t *
+lpm4_new()
+{
+    lpm4_t *lpm = xzalloc(sizeof(lpm4_t));
+
+    lpm->tbl24 = mmap(NULL, LPM4_TBL24_SIZE * sizeof(uint32_t),
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (lpm->tbl24 == MAP_FAILED) {
+        OOR_LOG(LWRN, "lpm4_new: Couldn't allocate the IPv4 LPM table: %s",
+                strerror(errno));
+        free(lpm);
+        return (NULL);
+    }
+    return (lpm);
+}
+
+void
+lpm4_del(lpm4_t *lpm)
+{
+    if (!lpm) {
+        return;
+    }
+    munmap(lpm->tbl24, LPM4_TBL24_SIZE * sizeof(uint32_t));
+    free(lpm->tbl8);
+    free(lpm->tbl8_free);
+    free(lpm->data);
+    free(lpm->data_free);
+    free(lpm);
+}
+
+/* Add a prefix, in host byte order, with its data. Returns in 'id' the id
+ * assigned to the prefix, required to remove it */
+int
+lpm4_add(lpm4_t *lpm, uint32_t addr, uint8_t plen, void *data, uint32_t *id)
+{
+    uint32_t i24, n, e, group;
+
+    if (plen > 32) {
+        return (BAD);
+    }
+    if (lpm4_id_alloc(lpm, data, id) != GOOD) {
+        OOR_LOG(LDBG_1, "lpm4_add: No more prefixes fit in the table");
+        return (BAD);
+    }
+    addr = lpm4_mask(addr, plen);
+    e = lpm4_entry(*id, plen);
+
+    if (plen <= 24) {
+        n = 1 << (24 - plen);
+        for (i24 = addr >> 8; n > 0; i24++, n--) {
+            if (lpm->tbl24[i24] & LPM4_TBL8) {
+                group = lpm->tbl24[i24] & LPM4_ID_MASK;
+                lpm4_fill(&lpm->tbl8[group * LPM4_TBL8_GROUP],
+                        LPM4_TBL8_GROUP, e, plen);
+            } else {
+                lpm4_fill(&lpm->tbl24[i24], 1, e, plen);
+            }
+        }
+    } else {
+        i24 = addr >> 8;
+        if (!(lpm->tbl24[i24] & LPM4_TBL8)) {
+            if (lpm4_tbl8_alloc(lpm, lpm->tbl24[i24], &group) != GOOD) {
+                OOR_LOG(LDBG_1, "lpm4_add: No more tbl8 groups fit in the "
+                        "table");
+                lpm4_id_free(lpm, *id);
+                return (BAD);
+            }
+            lpm->tbl24[i24] = LPM4_VALID | LPM4_TBL8 | group;
+        }
+        group = lpm->tbl24[i24] & LPM4_ID_MASK;
+        lpm4_fill(&lpm->tbl8[group * LPM4_TBL8_GROUP + (addr & 0xff)],
+                1 << (32 - plen), e, plen);
+    }
+
+    lpm->n_prefixes++;
+    return (GOOD);
+}
+
+/* Remove the prefix with the id returned when it was added. Its addresses
+ * are assigned to the longest prefix shorter than it that contains it, whose
+ * id is 'parent_id', or to none if it is -1 */
+void
+lpm4_remove(lpm4_t *lpm, uint32_t addr, uint8_t plen, uint32_t id,
+        int parent_id, uint8_t parent_plen)
+{
+    uint32_t i24, n, e, group;
+
+    if (plen > 32 || id >= lpm->data_used) {
+        return;
+    }
+    addr = lpm4_mask(addr, plen);
+    e = parent_id < 0 ? 0 : lpm4_entry(parent_id, parent_plen);
+
+    if (plen <= 24) {
+        n = 1 << (24 - plen);
+        for (i24 = addr >> 8; n > 0; i24++, n--) {
+            if (lpm->tbl24[i24] & LPM4_TBL8) {
+                group = lpm->tbl24[i24] & LPM4_ID_MASK;
+                lpm4_replace(&lpm->tbl8[group * LPM4_TBL8_GROUP],
+                        LPM4_TBL8_GROUP, plen, e);
+                lpm4_tbl8_collapse(lpm, i24);
+            } else {
+                lpm4_replace(&lpm->tbl24[i24], 1, plen, e);
+            }
+        }
+    } else {
+        i24 = addr >> 8;
+        if (lpm->tbl24[i24] & LPM4_TBL8) {
+            group = lpm->tbl24[i24] & LPM4_ID_MASK;
+            lpm4_replace(&lpm->tbl8[group * LPM4_TBL8_GROUP + (addr & 0xff)],
+                    1 << (32 - plen), plen, e);
+            lpm4_tbl8_collapse(lpm, i24);
+        }
+    }
+
+    lpm4_id_free(lpm, id);
+    lpm->n_prefixes--;
+}
@@ -0,0 +1,93 @@
+/*
+ *
+ * Copyright (C) 2011, 2015 Cisco Systems, Inc.
+ * Copyright (C) 2015 CBA research group, Technical University of Catalonia.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+#ifndef LPM4_H_
+#define LPM4_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Entries of tbl24 indexed by the first 24 bits of an address */
+#define LPM4_TBL24_SIZE     (1 << 24)
+/* Entries of a group of tbl8, indexed by the last 8 bits of an address */
+#define LPM4_TBL8_GROUP     256
+/* Maximum number of prefixes and of groups of tbl8 of a table */
+#define LPM4_MAX_IDS        (1 << 24)
+
+/* An entry holds the length of the longest prefix that covers its addresses
+ * and the id of the prefix, or the number of its group of tbl8 */
+#define LPM4_VALID          0x80000000
+#define LPM4_TBL8           0x40000000
+#define LPM4_PLEN_SHIFT     24
+#define LPM4_PLEN_MASK      0x3f
+#define LPM4_ID_MASK        0x00ffffff
+
+/*
+ * DIR-24-8 longest prefix match table of IPv4 prefixes. Each prefix up to
+ * /24 fills the entries of tbl24 it covers. The entries of tbl24 with
+ * longer prefixes point to a group of tbl8 with the 256 addresses of their
+ * /24. A lookup reads one entry, or two for the addresses covered by the
+ * prefixes longer than /24, and then the data of the prefix.
+ * The table doesn't keep the prefixes: the caller provides the one that
+ * covers the addresses of a prefix when it is removed
+ */
+typedef struct lpm4_ {
+    /* Mapped when created. Its pages are only populated as they are used */
+    uint32_t *tbl24;
+    uint32_t *tbl8;
+    uint32_t tbl8_size;
+    uint32_t tbl8_used;
+    uint32_t *tbl8_free;
+    uint32_t tbl8_nfree;
+    /* Data of each prefix, indexed by its id */
+    void **data;
+    uint32_t data_size;
+    uint32_t data_used;
+    uint32_t *data_free;
+    uint32_t data_nfree;
+    uint32_t n_prefixes;
+} lpm4_t;
+
+lpm4_t *lpm4_new();
+void lpm4_del(lpm4_t *lpm);
+int lpm4_add(lpm4_t *lpm, uint32_t addr, uint8_t plen, void *data,
+        uint32_t *id);
+void lpm4_remove(lpm4_t *lpm, uint32_t addr, uint8_t plen, uint32_t id,
+        int parent_id, uint8_t parent_plen);
+static inline void *lpm4_lookup(lpm4_t *lpm, uint32_t addr);
+
+
+/* Data of the longest prefix that contains the address, in host byte order.
+ * NULL if there is none */
+static inline void *
+lpm4_lookup(lpm4_t *lpm, uint32_t addr)
+{
+    uint32_t e = lpm->tbl24[addr >> 8];
+
+    if (e & LPM4_TBL8) {
+        e = lpm->tbl8[(e & LPM4_ID_MASK) * LPM4_TBL8_GROUP + (addr & 0xff)];
+    }
+    if (!(e & LPM4_VALID)) {
+        return (NULL);
+    }
+    return (lpm->data[e & LPM4_ID_MASK]);
+}
+
+#endif /* LPM4_H_ */
@@ -52,8 +52,30 @@ void mdb_for_each_entry_cb(mdb_t *mdb, void (*callback)(void *, void *),
 static int _add_iid_entry(mdb_t *db, void *entry, lcaf_addr_t *iidaddr);
 static void *_rm_iid_entry(mdb_t *db, lcaf_addr_t *iidaddr);
 static patricia_node_t *_find_iid_node(mdb_t *db, lcaf_addr_t *iidaddr, uint8_t exact);
+static void _lpm4_add_ippref(patricia_node_t *root, ip_prefix_t *ippref);
+static void *_rm_ippref(patricia_node_t *root, ip_prefix_t *ippref);
+static void _lpm4_release(patricia_node_t *root);
 
 
+/*
+ * Return the head node of the tree holding the IP tree of the afi
+ */
+static patricia_node_t *
+get_ip_root_from_afi(mdb_t *db, uint16_t afi)
+{
+    switch (afi) {
+    case AF_INET:
+        return (db->AF4_ip_db->head);
+    case AF_INET6:
+        return (db->AF6_ip_db->head);
+    default:
+        OOR_LOG(LDBG_1, "get_ip_root_from_afi: AFI %u not recognized!", afi);
+        break;
+    }
+
+    return (NULL);
+}
+
 /*
  * Return map cache data base
  */
@@ -76,8 +98,8 @@ get_ip_pt_from_afi(mdb_t *db, uint16_t afi)
 }
 
 
-static patricia_tree_t *
-get_iid_pt_from_lcaf(mdb_t *db, lcaf_addr_t *iidaddr)
+static patricia_node_t *
+get_iid_root_from_lcaf(mdb_t *db, lcaf_addr_t *iidaddr)
 {
     patricia_tree_t *pt;
     int_htable *ht;
@@ -106,7 +128,18 @@ get_iid_pt_from_lcaf(mdb_t *db, lcaf_addr_t *iidaddr)
     if (!pt){
         return (NULL);
     }
-    return (pt->head->data);
+    return (pt->head);
+}
+
+static patricia_tree_t *
+get_iid_pt_from_lcaf(mdb_t *db, lcaf_addr_t *iidaddr)
+{
+    patricia_node_t *root = get_iid_root_from_lcaf(db, iidaddr);
+
+    if (!root){
+        return (NULL);
+    }
+    return (root->data);
 }
 
 
@@ -226,6 +259,9 @@ _add_ippref_entry(mdb_t *db, void *entry, ip_prefix_t *ippref)
                 ip_prefix_to_char(ippref));
         return (BAD);
     }
+    if (ip_prefix_afi(ippref) == AF_INET) {
+        _lpm4_add_ippref(db->AF4_ip_db->head, ippref);
+    }
 
     OOR_LOG(LDBG_3, "_add_ippref_entry: Added map cache data for %s",
             ip_prefix_to_char(ippref));
@@ -297,6 +333,10 @@ _add_iid_entry(mdb_t *db, void *entry, lcaf_addr_t *iidaddr)
                 lcaf_addr_to_char(iidaddr));
         return (BAD);
     }
+    if (afi == AF_INET) {
+        _lpm4_add_ippref(get_iid_root_from_lcaf(db, iidaddr),
+                lisp_addr_get_ippref(ip_pref));
+    }
 
     OOR_LOG(LDBG_3, "_add_iid_entry: Added map cache data for %s",
             lcaf_addr_to_char(iidaddr));
@@ -307,10 +347,10 @@ static void *
 _rm_iid_entry(mdb_t *db, lcaf_addr_t *iidaddr)
 {
     lisp_addr_t *ip_pref;
-    patricia_tree_t *pt;
+    patricia_node_t *root;
 
-    pt = get_iid_pt_from_lcaf(db, iidaddr);
-    if (!pt){
+    root = get_iid_root_from_lcaf(db, iidaddr);
+    if (!root){
         OOR_LOG(LDBG_3, "_rm_iid_entry: Attempting to remove (%s) in the "
                 "map-cache but it doesn't exist",
                 lcaf_addr_to_char(iidaddr));
@@ -321,7 +361,7 @@ _rm_iid_entry(mdb_t *db, lcaf_addr_t *iidaddr)
         return (NULL);
     }
 
-    return (pt_remove_ippref(pt, lisp_addr_get_ippref(ip_pref)));
+    return (_rm_ippref(root, lisp_addr_get_ippref(ip_pref)));
 }
 
 static patricia_node_t *
@@ -450,6 +490,187 @@ _get_local_db_for_addr(mdb_t *db, lisp_addr_t *addr)
     return (NULL);
 }
 
+/*
+ * Compiled IPv4 LPM tables
+ *
+ * The IPv4 trees of the mdb with MDB_LPM4_MIN_NODES nodes are compiled to a
+ * lpm4_t table, which is updated with each prefix added or removed. The
+ * table is stored in the user1 field of the head node of the tree holding
+ * the IP tree, and the id of each prefix in the table, plus one, in the
+ * user1 field of its node
+ */
+
+static inline uint32_t
+_lpm4_addr(ip_addr_t *ip)
+{
+    return (ntohl(ip_addr_get_v4(ip)->s_addr));
+}
+
+/* LPM table used to look up the address. NULL if its tree is not compiled or
+ * if it is a prefix shorter than 32 bits: the table only answers host
+ * lookups, and the best match of a prefix can't be more specific than it */
+static lpm4_t *
+_get_lpm4_for_addr(mdb_t *db, lisp_addr_t *laddr, ip_addr_t **ip)
+{
+    patricia_node_t *root;
+    lcaf_addr_t *lcaf;
+    lisp_addr_t *addr;
+
+    switch (lisp_addr_lafi(laddr)) {
+    case LM_AFI_IP:
+    case LM_AFI_IPPREF:
+        if (lisp_addr_ip_afi(laddr) != AF_INET) {
+            return (NULL);
+        }
+        root = db->AF4_ip_db->head;
+        addr = laddr;
+        break;
+    case LM_AFI_LCAF:
+        lcaf = lisp_addr_get_lcaf(laddr);
+        if (lcaf_addr_get_type(lcaf) != LCAF_IID) {
+            return (NULL);
+        }
+        addr = lcaf_get_ip_addr(lcaf);
+        if (!addr){
+            addr = lcaf_get_ip_pref_addr(lcaf);
+        }
+        if (!addr || lisp_addr_ip_afi(addr) != AF_INET) {
+            return (NULL);
+        }
+        root = get_iid_root_from_lcaf(db, lcaf);
+        if (!root) {
+            return (NULL);
+        }
+        break;
+    default:
+        return (NULL);
+    }
+
+    if (lisp_addr_is_ip_pref(addr) && lisp_addr_get_plen(addr) != 32) {
+        return (NULL);
+    }
+
+    *ip = lisp_addr_ip_get_addr(addr);
+    return (root->user1);
+}
+
+static void
+_lpm4_build(patricia_node_t *root)
+{
+    patricia_tree_t *pt = root->data;
+    patricia_node_t *node;
+    lpm4_t *lpm;
+    uint32_t id;
+
+    lpm = lpm4_new();
+    if (!lpm) {
+        return;
+    }
+    PATRICIA_WALK(pt->head, node) {
+        if (lpm4_add(lpm, ntohl(node->prefix->add.sin.s_addr),
+                node->prefix->bitlen, node->data, &id) != GOOD) {
+            lpm4_del(lpm);
+            return;
+        }
+        node->user1 = (void *)(uintptr_t)(id + 1);
+    } PATRICIA_WALK_END;
+
+    root->user1 = lpm;
+    OOR_LOG(LDBG_2, "_lpm4_build: Compiled IPv4 LPM table of %u prefixes",
+            lpm->n_prefixes);
+}
+
+static void
+_lpm4_release(patricia_node_t *root)
+{
+    if (!root->user1) {
+        return;
+    }
+    OOR_LOG(LDBG_2, "_lpm4_release: Released IPv4 LPM table");
+    lpm4_del(root->user1);
+    root->user1 = NULL;
+}
+
+/* Add to the LPM table of the root the prefix just added to its tree. The
+ * tree is compiled once it has enough nodes */
+static void
+_lpm4_add_ippref(patricia_node_t *root, ip_prefix_t *ippref)
+{
+    patricia_tree_t *pt = root->data;
+    lpm4_t *lpm = root->user1;
+    patricia_node_t *node;
+    uint32_t id;
+
+    if (!lpm) {
+        if (pt->num_active_node >= MDB_LPM4_MIN_NODES) {
+            _lpm4_build(root);
+        }
+        return;
+    }
+
+    node = pt_find_ip_node_exact(pt, ip_prefix_addr(ippref),
+            ip_prefix_get_plen(ippref));
+    /* The prefix was already in the tree and the table */
+    if (!node || node->user1) {
+        return;
+    }
+    if (lpm4_add(lpm, _lpm4_addr(ip_prefix_addr(ippref)),
+            ip_prefix_get_plen(ippref), node->data, &id) != GOOD) {
+        _lpm4_release(root);
+        return;
+    }
+    node->user1 = (void *)(uintptr_t)(id + 1);
+}
+
+/* Remove a prefix from the IP tree of the root and from its LPM table. Its
+ * addresses are assigned to the longest prefix of the tree that contains it */
+static void *
+_rm_ippref(patricia_node_t *root, ip_prefix_t *ippref)
+{
+    patricia_tree_t *pt;
+    patricia_node_t *node, *parent;
+    prefix_t *prefix;
+    uintptr_t id = 0;
+    lpm4_t *lpm;
+    void *data;
+
+    if (!root) {
+        return (NULL);
+    }
+    pt = root->data;
+    lpm = root->user1;
+
+    /* The node may be kept as a glue node of the tree */
+    node = pt_find_ip_node_exact(pt, ip_prefix_addr(ippref),
+            ip_prefix_get_plen(ippref));
+    if (node) {
+        id = (uintptr_t)node->user1;
+        node->user1 = NULL;
+    }
+    data = pt_remove_ippref(pt, ippref);
+    if (!lpm || id == 0) {
+        return (data);
+    }
+
+    prefix = pt_make_ip_prefix(ip_prefix_addr(ippref),
+            ip_prefix_get_plen(ippref));
+    parent = patricia_search_best(pt, prefix);
+    Deref_Prefix(prefix);
+    if (parent && parent->user1) {
+        lpm4_remove(lpm, _lpm4_addr(ip_prefix_addr(ippref)),
+                ip_prefix_get_plen(ippref), id - 1,
+                (uintptr_t)parent->user1 - 1, parent->prefix->bitlen);
+    } else {
+        lpm4_remove(lpm, _lpm4_addr(ip_prefix_addr(ippref)),
+                ip_prefix_get_plen(ippref), id - 1, -1, 0);
+    }
+
+    if (pt->num_active_node < MDB_LPM4_MIN_NODES / 2) {
+        _lpm4_release(root);
+    }
+    return (data);
+}
+
 mdb_t *
 mdb_new()
 {
@@ -494,6 +715,7 @@ mdb_del(mdb_t *db, mdb_del_fct del_fct)
 {
     patricia_node_t *node;
     void *value;
+    _lpm4_release(db->AF4_ip_db->head);
     Destroy_Patricia(db->AF4_ip_db->head->data, del_fct);
     Destroy_Patricia(db->AF4_ip_db, NULL);
 
@@ -502,6 +724,7 @@ mdb_del(mdb_t *db, mdb_del_fct del_fct)
 
     /* Remove IID db */
     int_htable_foreach_value(db->AF4_iid_db, value){
+        _lpm4_release(((patricia_tree_t *)value)->head);
         Destroy_Patricia(((patricia_tree_t *)value)->head->data, del_fct);
         Destroy_Patricia(value, NULL);
     }int_htable_foreach_value_end;
@@ -574,13 +797,13 @@ mdb_remove_entry(mdb_t *db, lisp_addr_t *laddr)
         taddr = lisp_addr_clone(laddr);
         lisp_addr_ip_to_ippref(taddr);
         ippref = lisp_addr_get_ippref(taddr);
-        ret = pt_remove_ippref(get_ip_pt_from_afi(db, ip_prefix_afi(ippref)), ippref);
+        ret = _rm_ippref(get_ip_root_from_afi(db, ip_prefix_afi(ippref)), ippref);
         lisp_addr_del(taddr);
         break;
     case LM_AFI_IPPREF:
         ippref = lisp_addr_get_ippref(laddr);
-        ret = pt_remove_ippref(
-                get_ip_pt_from_afi(db, ip_prefix_afi(ippref)), ippref);
+        ret = _rm_ippref(get_ip_root_from_afi(db, ip_prefix_afi(ippref)),
+                ippref);
         break;
     case LM_AFI_LCAF:
         ret = _del_lcaf_entry(db, lisp_addr_get_lcaf(laddr));
@@ -601,6 +824,13 @@ void *
 mdb_lookup_entry(mdb_t *db, lisp_addr_t *laddr)
 {
     patricia_node_t *node;
+    ip_addr_t *ip;
+    lpm4_t *lpm;
+
+    lpm = _get_lpm4_for_addr(db, laddr, &ip);
+    if (lpm){
+        return(lpm4_lookup(lpm, ntohl(ip_addr_get_v4(ip)->s_addr)));
+    }
 
     node = _find_node(db, laddr, NOT_EXACT);
     if (node){
@@ -27,6 +27,7 @@
 #define MAPPING_DB_H_
 
 #include "int_table.h"
+#include "lpm4.h"
 #include "../elibs/patricia/patricia.h"
 #include "../liblisp/lisp_address.h"
 
@@ -34,6 +35,12 @@
 #define NOT_EXACT 0
 #define EXACT 1
 
+/* Nodes of an IPv4 patricia tree from which its longest prefix matches are
+ * looked up in a compiled DIR-24-8 table (lpm4_t). It takes 64 MB of address
+ * space, populated as the prefixes cover it. The table is released when the
+ * tree shrinks below half of them */
+#define MDB_LPM4_MIN_NODES  1024
+
 /*
  *  Patricia tree based databases
  *  for IP/IP-prefix and multicast addresses
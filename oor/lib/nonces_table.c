@@ -26,6 +26,7 @@
 
 int nonce_list_cmp_nonce(void *nonce1, void *nonce2);
 void nonce_list_free_nonce(void *nonce);
+static uint64_t nonce_time_us();
 
 
 htable_nonces_t *
@@ -43,9 +44,10 @@ htable_nonces_insert(htable_nonces_t *nonces_ht, uint64_t nonce,
 {
     khiter_t k;
     int ret;
-    uint64_t *nonce_val;
-    nonce_val = xmalloc(sizeof(uint64_t));
-    *nonce_val = nonce;
+    nonce_entry_t *nonce_val;
+    nonce_val = xmalloc(sizeof(nonce_entry_t));
+    nonce_val->nonce = nonce;
+    nonce_val->sent = nonce_time_us();
     glist_add(nonce_val,nonces_lst->nonces_list);
     k = kh_put(nonces,nonces_ht->ht,nonce,&ret);
     kh_value(nonces_ht->ht, k) = nonces_lst;
@@ -105,12 +107,12 @@ htable_nonces_reset_nonces_lst(htable_nonces_t *nonces_ht,nonces_list_t *nonces_
 {
     glist_t *nonces = nonces_lst->nonces_list;
     glist_entry_t *nonce_it, *aux_nonce_it;
-    uint64_t *nonce;
+    nonce_entry_t *nonce;
     khiter_t k;
 
     glist_for_each_entry_safe(nonce_it,aux_nonce_it,nonces){
-        nonce = (uint64_t *)glist_entry_data(nonce_it);
-        k = kh_get(nonces,nonces_ht->ht, *nonce);
+        nonce = (nonce_entry_t *)glist_entry_data(nonce_it);
+        k = kh_get(nonces,nonces_ht->ht, nonce->nonce);
         if (k == kh_end(nonces_ht->ht)){
             continue;
         }
@@ -199,6 +201,34 @@ nonces_list_size(nonces_list_t *nonces_lst)
     return (glist_size(nonces_lst->nonces_list));
 }
 
+static uint64_t
+nonce_time_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+/* Microseconds since the message with the nonce of the list was sent. -1 if
+ * the nonce is not in the list */
+int64_t
+nonces_list_elapsed(nonces_list_t *nonces_lst, uint64_t nonce)
+{
+    glist_entry_t *nonce_it;
+    nonce_entry_t *entry;
+
+    glist_for_each_entry(nonce_it,nonces_lst->nonces_list){
+        entry = (nonce_entry_t *)glist_entry_data(nonce_it);
+        if (entry->nonce == nonce) {
+            return (nonce_time_us() - entry->sent);
+        }
+    }
+    return (-1);
+}
+
+/* The nonce is the first field of nonce_entry_t, so the entries can be
+ * compared with a plain nonce */
 int
 nonce_list_cmp_nonce(void *nonce1, void *nonce2)
 {
@@ -209,7 +239,7 @@ nonce_list_cmp_nonce(void *nonce1, void *nonce2)
 void
 nonce_list_free_nonce(void *nonce)
 {
-    free((uint64_t *)nonce);
+    free((nonce_entry_t *)nonce);
 }
 
 
@@ -24,8 +24,16 @@
 #include "../elibs/khash/khash.h"
 #include "timers.h"
 
+/* Nonce of a message and the time it was sent, used to measure the time
+ * until its answer arrives */
+typedef struct nonce_entry_ {
+    uint64_t nonce;
+    /* Microseconds of the monotonic clock */
+    uint64_t sent;
+} nonce_entry_t;
+
 typedef struct {
-    glist_t *nonces_list; //<uint64_t>
+    glist_t *nonces_list; //<nonce_entry_t>
     oor_timer_t *timer;
 } nonces_list_t;
 
@@ -51,6 +59,7 @@ oor_timer_t *nonces_list_timer(nonces_list_t * nonces_lst);
 nonces_list_t *nonces_list_new_init(oor_timer_t *timer);
 void nonces_list_free(nonces_list_t *nonces_lst);
 int nonces_list_size(nonces_list_t *nonces_lst);
+int64_t nonces_list_elapsed(nonces_list_t *nonces_lst, uint64_t nonce);
 
 
 #endif /* NONCES_TABLE_H_ */
@@ -202,8 +202,135 @@ pkt_push_udp_and_ip(lbuf_t *b, uint16_t sp, uint16_t dp, ip_addr_t *sip,
     return(GOOD);
 }
 
+/* Build the outer headers of the packets sent from 'sip':'sp' to 'dip':'dp'
+ * with the encapsulation header 'encap_hdr' */
+int
+pkt_outer_hdr_init(pkt_outer_hdr_t *oh, ip_addr_t *sip, ip_addr_t *dip,
+        uint16_t sp, uint16_t dp, void *encap_hdr, int encap_len)
+{
+    struct ip *iph;
+    struct ip6_hdr *ip6h;
+    struct udphdr *uh;
+
+    if (ip_addr_afi(sip) != ip_addr_afi(dip)
+            || encap_len > PKT_OUTER_ENCAP_MAX_LEN) {
+        return (BAD);
+    }
+
+    memset(oh, 0, sizeof(pkt_outer_hdr_t));
+    oh->afi = ip_addr_afi(sip);
+    switch (oh->afi) {
+    case AF_INET:
+        oh->ip_len = sizeof(struct ip);
+        iph = (struct ip *)oh->hdr;
+        iph->ip_hl = 5;
+        iph->ip_v = IPVERSION;
+        /* Do not fragment flag. See 5.4.1 in LISP RFC (6830) */
+        iph->ip_off = htons(IP_DF);
+        iph->ip_p = IPPROTO_UDP;
+        iph->ip_src.s_addr = ip_addr_get_v4(sip)->s_addr;
+        iph->ip_dst.s_addr = ip_addr_get_v4(dip)->s_addr;
+        /* The TOS, length, ID and TTL words are added for each packet */
+        oh->ip_sum = cksum_partial(&iph->ip_off, sizeof(iph->ip_off), 0);
+        oh->ip_sum = cksum_partial(&iph->ip_src, 2 * sizeof(struct in_addr),
+                oh->ip_sum);
+        oh->udp_sum = cksum_partial(&iph->ip_src, 2 * sizeof(struct in_addr), 0);
+        break;
+    case AF_INET6:
+        oh->ip_len = sizeof(struct ip6_hdr);
+        ip6h = (struct ip6_hdr *)oh->hdr;
+        ip6h->ip6_vfc = (IP6VERSION << 4);
+        ip6h->ip6_nxt = IPPROTO_UDP;
+        memcpy(ip6h->ip6_src.s6_addr, ip_addr_get_v6(sip), sizeof(struct in6_addr));
+        memcpy(ip6h->ip6_dst.s6_addr, ip_addr_get_v6(dip), sizeof(struct in6_addr));
+        oh->udp_sum = cksum_partial(&ip6h->ip6_src, 2 * sizeof(struct in6_addr), 0);
+        break;
+    default:
+        return (BAD);
+    }
+    oh->udp_sum += htons(IPPROTO_UDP);
+
+    uh = (struct udphdr *)(oh->hdr + oh->ip_len);
+    udpsport(uh) = htons(sp);
+    udpdport(uh) = htons(dp);
+    memcpy(CO(uh, UDP_HDR_LEN), encap_hdr, encap_len);
+    oh->udp_sum = cksum_partial(uh, UDP_HDR_LEN + encap_len, oh->udp_sum);
+    oh->len = oh->ip_len + UDP_HDR_LEN + encap_len;
+
+    return (GOOD);
+}
+
+/* Encapsulate the IP packet of the buffer with the headers of the template.
+ * The TTL and TOS of the inner packet are copied to the outer header */
+int
+pkt_push_outer_hdr(lbuf_t *b, pkt_outer_hdr_t *oh)
+{
+    struct ip *iph;
+    struct ip6_hdr *ip6h;
+    struct udphdr *uh;
+    uint16_t *w;
+    uint32_t sum;
+    uint16_t udp_len;
+    int ttl = 0, tos = 0;
+
+    ip_hdr_ttl_and_tos(lbuf_data(b), &ttl, &tos);
+    /* See ip_hdr_set_ttl_and_tos */
+    if (ttl == 0) {
+        ttl = 255;
+    }
+
+    /* The payload is summed before being covered by the headers */
+    sum = 0;
+    if (!oh->zero_udp_csum) {
+        sum = cksum_partial(lbuf_data(b), lbuf_size(b), oh->udp_sum);
+    }
+
+    udp_len = htons(lbuf_size(b) + oh->len - oh->ip_len);
+    uh = lbuf_push_uninit(b, oh->len - oh->ip_len);
+    memcpy(uh, oh->hdr + oh->ip_len, oh->len - oh->ip_len);
+    lbuf_reset_udp(b);
+    udplen(uh) = udp_len;
+    if (oh->zero_udp_csum) {
+        udpsum(uh) = 0;
+    } else {
+        /* The length is both in the pseudo header and in the UDP header */
+        sum += udp_len;
+        sum += udp_len;
+        udpsum(uh) = cksum_finish(sum);
+        if (udpsum(uh) == 0) {
+            udpsum(uh) = 0xFFFF;
+        }
+    }
+
+    switch (oh->afi) {
+    case AF_INET:
+        iph = lbuf_push_uninit(b, oh->ip_len);
+        memcpy(iph, oh->hdr, oh->ip_len);
+        iph->ip_tos = tos;
+        iph->ip_len = htons(lbuf_size(b));
+        iph->ip_id = htons(get_IP_ID());
+        iph->ip_ttl = ttl;
+        w = (uint16_t *)iph;
+        iph->ip_sum = cksum_finish(oh->ip_sum + w[0] + w[1] + w[2] + w[4]);
+        break;
+    case AF_INET6:
+        ip6h = lbuf_push_uninit(b, oh->ip_len);
+        memcpy(ip6h, oh->hdr, oh->ip_len);
+        ip6h->ip6_plen = udp_len;
+        ip6h->ip6_hops = ttl;
+        IPV6_SET_TC(ip6h, tos);
+        break;
+    default:
+        return (BAD);
+    }
+    lbuf_reset_ip(b);
+
+    return (GOOD);
+}
+
 /* Fill the tuple with the 5 tuples of a packet:
- * (SRC IP, DST IP, PROTOCOL, SRC PORT, DST PORT) */
+ * (SRC IP, DST IP, PROTOCOL, SRC PORT, DST PORT)
+ * The flow key also includes the IID of the tuple */
 int
 pkt_parse_5_tuple(lbuf_t *b, packet_tuple_t *tuple)
 {
@@ -211,6 +338,7 @@ pkt_parse_5_tuple(lbuf_t *b, packet_tuple_t *tuple)
     struct ip6_hdr *ip6h = NULL;
     struct udphdr *udp = NULL;
     struct tcphdr *tcp = NULL;
+    pkt_flow_key_t *key = &tuple->key;
     lbuf_t packet = *b;
 
     iph = lbuf_ip(&packet);
@@ -223,6 +351,10 @@ pkt_parse_5_tuple(lbuf_t *b, packet_tuple_t *tuple)
         lisp_addr_ip_init(&tuple->src_addr, &iph->saddr, AF_INET);
         lisp_addr_ip_init(&tuple->dst_addr, &iph->daddr, AF_INET);
         tuple->protocol = iph->protocol;
+        memset(key, 0, sizeof(pkt_flow_key4_t));
+        key->h.afi = AF_INET;
+        key->v4.src_addr = iph->saddr;
+        key->v4.dst_addr = iph->daddr;
         lbuf_pull(&packet, iph->ihl * 4);
         break;
     case 6:
@@ -231,6 +363,10 @@ pkt_parse_5_tuple(lbuf_t *b, packet_tuple_t *tuple)
         lisp_addr_ip_init(&tuple->dst_addr, &ip6h->ip6_dst, AF_INET6);
         /* XXX: assuming no extra headers */
         tuple->protocol = ip6h->ip6_nxt;
+        memset(key, 0, sizeof(pkt_flow_key6_t));
+        key->h.afi = AF_INET6;
+        memcpy(key->v6.src_addr, &ip6h->ip6_src, sizeof(struct in6_addr));
+        memcpy(key->v6.dst_addr, &ip6h->ip6_dst, sizeof(struct in6_addr));
         lbuf_pull(&packet, sizeof(struct ip6_hdr));
         break;
     default:
@@ -242,74 +378,102 @@ pkt_parse_5_tuple(lbuf_t *b, packet_tuple_t *tuple)
         udp = lbuf_data(&packet);
         tuple->src_port = ntohs(udpsport(udp));
         tuple->dst_port = ntohs(udpdport(udp));
+        tuple->tcp_flags = 0;
     } else if (tuple->protocol == IPPROTO_TCP) {
         tcp = lbuf_data(&packet);
         tuple->src_port = ntohs(tcpsport(tcp));
         tuple->dst_port = ntohs(tcpdport(tcp));
+        tuple->tcp_flags = tcpflags(tcp);
     } else {
         /* If protocol is not TCP or UDP, ports of the tuple set to 0 */
         tuple->src_port = 0;
         tuple->dst_port = 0;
+        tuple->tcp_flags = 0;
     }
+    tuple->flowlet = 0;
+
+    key->h.protocol = tuple->protocol;
+    key->h.src_port = tuple->src_port;
+    key->h.dst_port = tuple->dst_port;
+    key->h.iid = tuple->iid;
+    key->h.hash = pkt_flow_hash(key->w, pkt_flow_key_len(key) / 8);
+
     return (GOOD);
 }
 
 
-/* Calculate the hash of the 5 tuples of a packet */
+/* Secrets of the flow hash (from wyhash) */
+#define PKT_HASH_S0     0xa0761d6478bd642fULL
+#define PKT_HASH_S1     0xe7037ed1a0b428dbULL
+#define PKT_HASH_S2     0x8ebc6af09c88c6e3ULL
+
+/* Multiply and fold the 128 bit product */
+static inline uint64_t
+pkt_hash_mum(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)a * b;
+
+    return ((uint64_t)r ^ (uint64_t)(r >> 64));
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), lo, hi;
+
+    hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl);
+    lo = t + (rm1 << 32);
+    hi += (lo < t);
+    return (lo ^ hi);
+#endif
+}
+
+/* Hash of the 64 bit words of a flow key. It follows the structure of
+ * wyhash: two words are mixed with each 64x64->128 bit multiplication, which
+ * takes much less than the rounds of lookup3 for the few words of a key */
+uint32_t
+pkt_flow_hash(const uint64_t *words, int nwords)
+{
+    uint64_t seed = PKT_HASH_S0;
+    int i;
+
+    for (i = 0; i + 1 < nwords; i += 2) {
+        seed = pkt_hash_mum(words[i] ^ PKT_HASH_S1, words[i + 1] ^ seed);
+    }
+    if (i < nwords) {
+        seed = pkt_hash_mum(words[i] ^ PKT_HASH_S2, seed ^ PKT_HASH_S1);
+    }
+    seed = pkt_hash_mum(seed ^ PKT_HASH_S2, (uint64_t)nwords ^ PKT_HASH_S1);
+
+    return ((uint32_t)(seed ^ (seed >> 32)));
+}
+
+/* Hash of the 5 tuples and the IID of a packet. Computed when it is
+ * parsed. The number of the flowlet is mixed in, so that each flowlet of a
+ * flow can be sent through different locators */
 uint32_t
 pkt_tuple_hash(packet_tuple_t *tuple)
 {
-    int hash = 0;
-    int len = 0;
-    int port = tuple->src_port;
-    uint32_t *tuples = NULL;
+    uint64_t h;
 
-    port = port + ((int)tuple->dst_port << 16);
-    switch (lisp_addr_ip_afi(&tuple->src_addr)){
-    case AF_INET:
-        /* 1 integer src_addr
-         * + 1 integer dst_adr
-         * + 1 integer (ports)
-         * + 1 integer protocol
-         * + 1 iid*/
-        len = 5;
-        tuples = xmalloc(len * sizeof(uint32_t));
-        lisp_addr_copy_to(&tuples[0], &tuple->src_addr);
-        lisp_addr_copy_to(&tuples[1], &tuple->dst_addr);
-        tuples[2] = port;
-        tuples[3] = tuple->protocol;
-        tuples[4] = tuple->iid;
-        break;
-    case AF_INET6:
-        /* 4 integer src_addr
-         * + 4 integer dst_adr
-         * + 1 integer (ports)
-         * + 1 integer protocol
-         * + 1 iid */
-        len = 11;
-        tuples = xmalloc(len * sizeof(uint32_t));
-        lisp_addr_copy_to(&tuples[0], &tuple->src_addr);
-        lisp_addr_copy_to(&tuples[4], &tuple->dst_addr);
-        tuples[8] = port;
-        tuples[9] = tuple->protocol;
-        tuples[10] = tuple->iid;
-        break;
+    if (tuple->flowlet == 0) {
+        return (tuple->key.h.hash);
     }
+    h = pkt_hash_mum(tuple->key.h.hash ^ PKT_HASH_S1,
+            tuple->flowlet ^ PKT_HASH_S2);
+    return ((uint32_t)(h ^ (h >> 32)));
+}
 
-    /* XXX: why 2013 used as initial value? */
-    hash = hashword(tuples, len, 2013);
-    free(tuples);
-    return (hash);
+/* Jenkins' lookup3 hash of an array of 32 bit words */
+uint32_t
+pkt_hash_words(const uint32_t *words, int len, uint32_t initval)
+{
+    return (hashword(words, len, initval));
 }
 
 int
 pkt_tuple_cmp(packet_tuple_t *t1, packet_tuple_t *t2)
 {
-    return(t1->src_port == t2->src_port
-           && t1->dst_port == t2->dst_port
-           && (lisp_addr_cmp(&t1->src_addr, &t2->src_addr) == 0)
-           && (lisp_addr_cmp(&t1->dst_addr, &t2->dst_addr) == 0)
-           && t1->iid == t2->iid);
+    return (pkt_flow_key_cmp(&t1->key, &t2->key));
 }
 
 packet_tuple_t *
@@ -319,9 +483,12 @@ pkt_tuple_clone(packet_tuple_t *tpl)
     cpy->src_port = tpl->src_port;
     cpy->dst_port = tpl->dst_port;
     cpy->protocol = tpl->protocol;
+    cpy->tcp_flags = tpl->tcp_flags;
+    cpy->flowlet = tpl->flowlet;
     lisp_addr_copy(&cpy->src_addr, &tpl->src_addr);
     lisp_addr_copy(&cpy->dst_addr, &tpl->dst_addr);
     cpy->iid = tpl->iid;
+    cpy->key = tpl->key;
     return(cpy);
 }
 
@@ -377,8 +544,13 @@ int
 ip_hdr_set_ttl_and_tos(struct iphdr *iph, int ttl, int tos)
 {
     struct ip6_hdr *ip6h;
+    uint16_t *w, old_w0, old_w4;
 
     if (iph->version == 4) {
+        w = (uint16_t *)iph;
+        old_w0 = w[0];
+        old_w4 = w[4];
+
         /*XXX It seems that there is a bug in uClibc that causes ttl=0 in
          * OpenWRT. This is a quick workaround */
         if (ttl != 0) {
@@ -387,13 +559,11 @@ ip_hdr_set_ttl_and_tos(struct iphdr *iph, int ttl, int tos)
 
         iph->tos = tos;
 
-        /* We need to recompute the checksum since we have changed the TTL
-         * and TOS header fields.
-         *
-         * New checksum must be computed with the checksum header field
-         * with 0s */
-        iph->check = 0;
-        iph->check = ip_checksum((uint16_t*) iph, sizeof(struct iphdr));
+        /* We need to update the checksum since we have changed the TTL
+         * and TOS header fields. Only the words holding them are folded
+         * into the old checksum (RFC 1624) */
+        iph->check = cksum_update16(iph->check, old_w0, w[0]);
+        iph->check = cksum_update16(iph->check, old_w4, w[4]);
 
     } else if (iph->version == 6) {
         ip6h = (struct ip6_hdr *) iph;
@@ -38,6 +38,8 @@
 #define MAX_IP_PKT_LEN          4096
 #define MAX_IP_HDR_LEN          40  /* without options or IPv6 hdr extensions */
 #define UDP_HDR_LEN             8
+/* Longest encapsulation header (LISP or VXLAN-GPE) of a header template */
+#define PKT_OUTER_ENCAP_MAX_LEN 8
 
 #ifdef BSD
 #define udpsport(x) x->uh_sport
@@ -58,8 +60,44 @@
 #define tcpsport(x) x->source
 #define tcpdport(x) x->dest
 #endif
-
-
+/* Flags byte of the TCP header (TH_FIN, TH_SYN, TH_RST ...) */
+#define tcpflags(x) (((uint8_t *)(x))[13])
+
+
+
+/* Fixed layout copy of the 5 tuple of a flow used by the data plane to
+ * identify it. Filled by pkt_parse_5_tuple. Two keys of the same afi are
+ * compared with memcmp on the length of its variant */
+typedef struct pkt_flow_hdr_ {
+    uint8_t afi;
+    uint8_t protocol;
+    uint16_t pad;
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint32_t iid;
+    /* Hash of the whole key, computed with this field set to 0 */
+    uint32_t hash;
+} pkt_flow_hdr_t;
+
+typedef struct pkt_flow_key4_ {
+    pkt_flow_hdr_t h;
+    uint32_t src_addr;
+    uint32_t dst_addr;
+} pkt_flow_key4_t;
+
+typedef struct pkt_flow_key6_ {
+    pkt_flow_hdr_t h;
+    uint8_t src_addr[16];
+    uint8_t dst_addr[16];
+} pkt_flow_key6_t;
+
+typedef union pkt_flow_key_ {
+    pkt_flow_hdr_t h;
+    pkt_flow_key4_t v4;
+    pkt_flow_key6_t v6;
+    /* The key is hashed in 64 bit words */
+    uint64_t w[sizeof(pkt_flow_key6_t) / 8];
+} pkt_flow_key_t;
 
 /* shared between data and control */
 typedef struct packet_tuple {
@@ -68,10 +106,37 @@ typedef struct packet_tuple {
     uint16_t                        src_port;
     uint16_t                        dst_port;
     uint8_t                         protocol;
+    /* Flags of the TCP header. 0 for other protocols. Not part of the key */
+    uint8_t                         tcp_flags;
+    /* Set before parsing the packet to include it in the key */
     uint32_t                        iid;
+    /* Number of the flowlet of the flow set by the flow cache when the flow
+     * is resumed after being idle. Not part of the key, it changes the hash
+     * used to select the locators */
+    uint32_t                        flowlet;
+    pkt_flow_key_t                  key;
 } packet_tuple_t;
 
 
+/* Prebuilt outer IP, UDP and encapsulation headers of the packets sent
+ * between two RLOCs. Only the fields that depend on each packet (lengths,
+ * TTL, TOS, IP ID and checksums) are written when it is encapsulated. The
+ * checksums are completed from the partial sums of the fixed fields */
+typedef struct pkt_outer_hdr_ {
+    uint8_t hdr[MAX_IP_HDR_LEN + UDP_HDR_LEN + PKT_OUTER_ENCAP_MAX_LEN];
+    int len;
+    int ip_len;
+    int afi;
+    /* Sum of the words of the IPv4 header that don't change */
+    uint32_t ip_sum;
+    /* Sum of the pseudo header without the length, the UDP ports and the
+     * encapsulation header */
+    uint32_t udp_sum;
+    /* The UDP checksum is left to 0 instead of covering the whole packet
+     * (RFC 6935 and 6936 for IPv6) */
+    int zero_udp_csum;
+} pkt_outer_hdr_t;
+
 
 /*
  * Generate IP header. Returns the poninter to the transport header
@@ -101,16 +166,35 @@ void *pkt_push_udp(lbuf_t *, uint16_t , uint16_t);
 void *pkt_push_ip(lbuf_t *, ip_addr_t *, ip_addr_t *, int proto);
 int pkt_push_udp_and_ip(lbuf_t *, uint16_t, uint16_t, ip_addr_t *,
         ip_addr_t *);
+int pkt_outer_hdr_init(pkt_outer_hdr_t *oh, ip_addr_t *sip, ip_addr_t *dip,
+        uint16_t sp, uint16_t dp, void *encap_hdr, int encap_len);
+int pkt_push_outer_hdr(lbuf_t *b, pkt_outer_hdr_t *oh);
 int ip_hdr_set_ttl_and_tos(struct iphdr *, int ttl, int tos);
 int ip_hdr_ttl_and_tos(struct iphdr *, int *ttl, int *tos);
 
 int pkt_parse_5_tuple(lbuf_t *b, packet_tuple_t *tuple);
+uint32_t pkt_flow_hash(const uint64_t *words, int nwords);
 uint32_t pkt_tuple_hash(packet_tuple_t *tuple);
+uint32_t pkt_hash_words(const uint32_t *words, int len, uint32_t initval);
 int pkt_tuple_cmp(packet_tuple_t *t1, packet_tuple_t *t2);
 packet_tuple_t *pkt_tuple_clone(packet_tuple_t *);
 void pkt_tuple_del(packet_tuple_t *tpl);
 char *pkt_tuple_to_char(packet_tuple_t *tpl);
 
+static inline int
+pkt_flow_key_len(pkt_flow_key_t *key)
+{
+    return (key->h.afi == AF_INET ? sizeof(pkt_flow_key4_t)
+            : sizeof(pkt_flow_key6_t));
+}
+
+static inline int
+pkt_flow_key_cmp(pkt_flow_key_t *k1, pkt_flow_key_t *k2)
+{
+    return (k1->h.afi == k2->h.afi
+            && memcmp(k1, k2, pkt_flow_key_len(k1)) == 0);
+}
+
 char * ip_src_and_dst_to_char(struct iphdr *iph, char *fmt);
 
 void pkt_add_uint32_in_3bytes (uint8_t *pkt, uint32_t val);
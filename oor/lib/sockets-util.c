@@ -17,15 +17,25 @@
  *
  */
 
+/* Define _GNU_SOURCE in order to use sendmmsg */
+#define _GNU_SOURCE 1
 #include <errno.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <net/ethernet.h>
+#include <sys/mman.h>
+#include <linux/filter.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 
+#include "mem_util.h"
 #include "oor_log.h"
 #include "sockets-util.h"
 
+/* Minimum UDP length of a data packet: UDP header and LISP or VXLAN-GPE
+ * header */
+#define DATA_FILTER_MIN_UDP_LEN     16
+
 int
 open_ip_raw_socket(int afi)
 {
@@ -213,6 +223,250 @@ socket_conf_req_ttl_tos(int sock, int afi)
     return (GOOD);
 }
 
+/* Attach a socket filter to a raw UDP socket so the kernel only delivers the
+ * datagrams sent to 'port' that are long enough to be data packets. IPv4 raw
+ * sockets get the packets from the IP header and IPv6 ones from the UDP
+ * header */
+int
+socket_attach_data_filter(int sock, int afi, int port)
+{
+    struct sock_filter filter4[] = {
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),         /* X = IP hdr len */
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2),          /* UDP dst port */
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 3),
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 4),          /* UDP length */
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, DATA_FILTER_MIN_UDP_LEN, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+        BPF_STMT(BPF_RET | BPF_K, 0)
+    };
+    struct sock_filter filter6[] = {
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 2),          /* UDP dst port */
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 3),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 4),          /* UDP length */
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, DATA_FILTER_MIN_UDP_LEN, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+        BPF_STMT(BPF_RET | BPF_K, 0)
+    };
+    struct sock_fprog prog;
+
+    switch (afi) {
+    case AF_INET:
+        prog.filter = filter4;
+        prog.len = sizeof(filter4) / sizeof(struct sock_filter);
+        break;
+    case AF_INET6:
+        prog.filter = filter6;
+        prog.len = sizeof(filter6) / sizeof(struct sock_filter);
+        break;
+    default:
+        return (BAD);
+    }
+
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+        OOR_LOG(LWRN, "socket_attach_data_filter: setsockopt SO_ATTACH_FILTER: %s",
+                strerror(errno));
+        return (BAD);
+    }
+
+    return (GOOD);
+}
+
+/* Targets of the jumps of the packet socket filter, resolved once it is
+ * built. Jumps within the filter never skip so many instructions */
+#define PKT_FILTER_IPV6     0xfd
+#define PKT_FILTER_DROP     0xfe
+#define PKT_FILTER_ACCEPT   0xff
+#define PKT_FILTER_MAX_LEN  (23 + 9 * PKT_RING_MAX_ADDRS)
+
+static inline void
+pkt_filter_set(struct sock_filter *insn, uint16_t code, uint32_t k, uint8_t jt,
+        uint8_t jf)
+{
+    insn->code = code;
+    insn->jt = jt;
+    insn->jf = jf;
+    insn->k = k;
+}
+
+/* Attach a socket filter to a packet socket, that gets IPv4 and IPv6 packets
+ * from the IP header, so the kernel only delivers the data packets sent to
+ * 'port' and to one of the local addresses <lisp_addr_t *>. The packets the
+ * host forwards to other routers are not accepted, nor fragments and IPv6
+ * packets with extension headers. It replaces the previous filter */
+int
+socket_attach_pkt_data_filter(int sock, int port, glist_t *addrs)
+{
+    struct sock_filter f[PKT_FILTER_MAX_LEN];
+    struct sock_fprog prog;
+    glist_entry_t *it;
+    lisp_addr_t *addr;
+    uint32_t *w;
+    int len = 0, n4 = 0, n6 = 0, ja, ipv6, drop, target, i;
+
+    /* IPv4 */
+    pkt_filter_set(&f[len++], BPF_LD | BPF_B | BPF_ABS, 0, 0, 0);
+    pkt_filter_set(&f[len++], BPF_ALU | BPF_RSH | BPF_K, 4, 0, 0);
+    pkt_filter_set(&f[len++], BPF_JMP | BPF_JEQ | BPF_K, 4, 0, PKT_FILTER_IPV6);
+    pkt_filter_set(&f[len++], BPF_LD | BPF_B | BPF_ABS, 9, 0, 0);
+    pkt_filter_set(&f[len++], BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0,
+            PKT_FILTER_DROP);
+    pkt_filter_set(&f[len++], BPF_LD | BPF_H | BPF_ABS, 6, 0, 0);
+    pkt_filter_set(&f[len++], BPF_JMP | BPF_JSET | BPF_K, 0x3fff,
+            PKT_FILTER_DROP, 0);
+    pkt_filter_set(&f[len++], BPF_LDX | BPF_B | BPF_MSH, 0, 0, 0);
+    pkt_filter_set(&f[len++], BPF_LD | BPF_H | BPF_IND, 2, 0, 0);
+    pkt_filter_set(&f[len++], BPF_JMP | BPF_JEQ | BPF_K, port, 0,
+            PKT_FILTER_DROP);
+    pkt_filter_set(&f[len++], BPF_LD | BPF_H | BPF_IND, 4, 0, 0);
+    pkt_filter_set(&f[len++], BPF_JMP | BPF_JGE | BPF_K,
+            DATA_FILTER_MIN_UDP_LEN, 0, PKT_FILTER_DROP);
+    pkt_filter_set(&f[len++], BPF_LD | BPF_W | BPF_ABS, 16, 0, 0);
+    glist_for_each_entry(it, addrs) {
+        addr = (lisp_addr_t *)glist_entry_data(it);
+        if (lisp_addr_ip_afi(addr) != AF_INET || n4 == PKT_RING_MAX_ADDRS) {
+            continue;
+        }
+        w = (uint32_t *)ip_addr_get_addr(lisp_addr_ip(addr));
+        pkt_filter_set(&f[len++], BPF_JMP | BPF_JEQ | BPF_K, ntohl(w[0]),
+                PKT_FILTER_ACCEPT, 0);
+        n4++;
+    }
+    ja = len;
+    pkt_filter_set(&f[len++], BPF_JMP | BPF_JA, 0, 0, 0);
+
+    /* IPv6 */
+    ipv6 = len;
+    pkt_filter_set(&f[len++], BPF_JMP | BPF_JEQ | BPF_K, 6, 0, PKT_FILTER_DROP);
+    pkt_filter_set(&f[len++], BPF_LD | BPF_B | BPF_ABS, 6, 0, 0);
+    pkt_filter_set(&f[len++], BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0,
+            PKT_FILTER_DROP);
+    pkt_filter_set(&f[len++], BPF_LD | BPF_H | BPF_ABS, 42, 0, 0);
+    pkt_filter_set(&f[len++], BPF_JMP | BPF_JEQ | BPF_K, port, 0,
+            PKT_FILTER_DROP);
+    pkt_filter_set(&f[len++], BPF_LD | BPF_H | BPF_ABS, 44, 0, 0);
+    pkt_filter_set(&f[len++], BPF_JMP | BPF_JGE | BPF_K,
+            DATA_FILTER_MIN_UDP_LEN, 0, PKT_FILTER_DROP);
+    glist_for_each_entry(it, addrs) {
+        addr = (lisp_addr_t *)glist_entry_data(it);
+        if (lisp_addr_ip_afi(addr) != AF_INET6 || n6 == PKT_RING_MAX_ADDRS) {
+            continue;
+        }
+        /* Compared a word at a time */
+        w = (uint32_t *)ip_addr_get_addr(lisp_addr_ip(addr));
+        for (i = 0; i < 4; i++) {
+            pkt_filter_set(&f[len++], BPF_LD | BPF_W | BPF_ABS, 24 + 4 * i,
+                    0, 0);
+            pkt_filter_set(&f[len++], BPF_JMP | BPF_JEQ | BPF_K, ntohl(w[i]),
+                    i == 3 ? PKT_FILTER_ACCEPT : 0, 6 - 2 * i);
+        }
+        n6++;
+    }
+
+    drop = len;
+    pkt_filter_set(&f[len++], BPF_RET | BPF_K, 0, 0, 0);
+    pkt_filter_set(&f[len++], BPF_RET | BPF_K, 0xffffffff, 0, 0);
+
+    f[ja].k = drop - (ja + 1);
+    for (i = 0; i < len; i++) {
+        if (BPF_CLASS(f[i].code) != BPF_JMP || BPF_OP(f[i].code) == BPF_JA) {
+            continue;
+        }
+        if (f[i].jt >= PKT_FILTER_IPV6) {
+            target = f[i].jt == PKT_FILTER_IPV6 ? ipv6
+                    : drop + f[i].jt - PKT_FILTER_DROP;
+            f[i].jt = target - (i + 1);
+        }
+        if (f[i].jf >= PKT_FILTER_IPV6) {
+            target = f[i].jf == PKT_FILTER_IPV6 ? ipv6
+                    : drop + f[i].jf - PKT_FILTER_DROP;
+            f[i].jf = target - (i + 1);
+        }
+    }
+
+    if (n4 + n6 < glist_size(addrs)) {
+        OOR_LOG(LWRN, "socket_attach_pkt_data_filter: Only %d addresses of each "
+                "afi are accepted", PKT_RING_MAX_ADDRS);
+    }
+
+    prog.filter = f;
+    prog.len = len;
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+        OOR_LOG(LWRN, "socket_attach_pkt_data_filter: setsockopt "
+                "SO_ATTACH_FILTER: %s", strerror(errno));
+        return (BAD);
+    }
+
+    return (GOOD);
+}
+
+/* Attach a socket filter that discards all the packets of the socket */
+int
+socket_attach_drop_filter(int sock)
+{
+    struct sock_filter filter[] = {
+        BPF_STMT(BPF_RET | BPF_K, 0)
+    };
+    struct sock_fprog prog;
+
+    prog.filter = filter;
+    prog.len = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+        OOR_LOG(LWRN, "socket_attach_drop_filter: setsockopt SO_ATTACH_FILTER: %s",
+                strerror(errno));
+        return (BAD);
+    }
+    return (GOOD);
+}
+
+/* Request the kernel to coalesce the datagrams of the same flow received by
+ * the socket (UDP GRO). The size of the coalesced datagrams is provided with
+ * each buffer as ancillary data */
+int
+socket_conf_udp_gro(int sock)
+{
+    const int on = 1;
+
+    if (setsockopt(sock, IPPROTO_UDP, UDP_GRO, &on, sizeof(on)) < 0) {
+        OOR_LOG(LWRN, "socket_conf_udp_gro: setsockopt UDP_GRO: %s", strerror(errno));
+        return (BAD);
+    }
+    return (GOOD);
+}
+
+/* Allow several sockets to be bound to the same port. The kernel spreads the
+ * received datagrams among them according to the hash of their flow. It
+ * should be set before binding the socket */
+int
+socket_conf_reuseport(int sock)
+{
+    const int on = 1;
+
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        OOR_LOG(LWRN, "socket_conf_reuseport: setsockopt SO_REUSEPORT: %s",
+                strerror(errno));
+        return (BAD);
+    }
+    return (GOOD);
+}
+
+/* Accept IPv6 datagrams with a zero UDP checksum, as sent by the tunnel
+ * routers that don't compute it (RFC 6830). They are always accepted with
+ * IPv4 */
+int
+socket_conf_udp_no_check_rx(int sock, int afi)
+{
+    const int on = 1;
+
+    if (afi != AF_INET6) {
+        return (GOOD);
+    }
+    if (setsockopt(sock, IPPROTO_UDP, UDP_NO_CHECK6_RX, &on, sizeof(on)) < 0) {
+        OOR_LOG(LDBG_1, "socket_conf_udp_no_check_rx: setsockopt UDP_NO_CHECK6_RX: %s",
+                strerror(errno));
+        return (BAD);
+    }
+    return (GOOD);
+}
 
 /*
  * Bind a socket to a specific address and port if specified
@@ -276,38 +530,45 @@ bind_socket(int sock, int afi, lisp_addr_t *src_addr, int src_port)
 }
 
 
+/* Fills 'ss' with the socket address of 'dip'. Returns the length of the
+ * address or 0 if the afi is not supported */
+static int
+ip_addr_to_sockaddr(ip_addr_t *dip, struct sockaddr_storage *ss)
+{
+    struct sockaddr_in *sa4;
+    struct sockaddr_in6 *sa6;
+
+    switch (ip_addr_afi(dip)) {
+    case AF_INET:
+        sa4 = (struct sockaddr_in *)ss;
+        memset(sa4, 0, sizeof(struct sockaddr_in));
+        sa4->sin_family = AF_INET;
+        ip_addr_copy_to(&sa4->sin_addr, dip);
+        return (sizeof(struct sockaddr_in));
+    case AF_INET6:
+        sa6 = (struct sockaddr_in6 *)ss;
+        memset(sa6, 0, sizeof(struct sockaddr_in6));
+        sa6->sin6_family = AF_INET6;
+        ip_addr_copy_to(&sa6->sin6_addr, dip);
+        return (sizeof(struct sockaddr_in6));
+    default:
+        return (0);
+    }
+}
+
 /* Sends a raw packet out the socket file descriptor 'sfd'  */
 int
 send_raw_packet(int socket, const void *pkt, int plen, ip_addr_t *dip)
 {
-    struct sockaddr *saddr = NULL;
+    struct sockaddr_storage ss;
     int slen, nbytes;
 
-    struct sockaddr_in sa4;
-    struct sockaddr_in6 sa6;
-
-
     /* build sock addr */
-    switch (ip_addr_afi(dip)) {
-    case AF_INET:
-        memset(&sa4, 0, sizeof(sa4));
-        sa4.sin_family = AF_INET;
-        ip_addr_copy_to(&sa4.sin_addr, dip);
-        slen = sizeof(struct sockaddr_in);
-        saddr = (struct sockaddr *)&sa4;
-        break;
-    case AF_INET6:
-        memset(&sa6, 0, sizeof(sa6));
-        sa6.sin6_family = AF_INET6;
-        ip_addr_copy_to(&sa6.sin6_addr, dip);
-        slen = sizeof(struct sockaddr_in6);
-        saddr = (struct sockaddr *)&sa6;
-        break;
-    default:
-	return(BAD);
+    if ((slen = ip_addr_to_sockaddr(dip, &ss)) == 0) {
+        return(BAD);
     }
 
-    nbytes = sendto(socket, pkt, plen, 0, saddr, slen);
+    nbytes = sendto(socket, pkt, plen, 0, (struct sockaddr *)&ss, slen);
     if (nbytes != plen) {
         OOR_LOG(LDBG_2, "send_raw_packet: send packet to %s using fail descriptor %d failed -> %s", ip_addr_to_char(dip),
                 socket, strerror(errno));
@@ -317,6 +578,103 @@ send_raw_packet(int socket, const void *pkt, int plen, ip_addr_t *dip)
     return (GOOD);
 }
 
+raw_pkt_queue_t *
+raw_pkt_queue_new(int size)
+{
+    raw_pkt_queue_t *q;
+
+    q = xzalloc(sizeof(raw_pkt_queue_t));
+    q->sock = ERR_SOCKET;
+    q->size = size;
+    q->msgs = xzalloc(size * sizeof(struct mmsghdr));
+    q->iov = xzalloc(size * sizeof(struct iovec));
+    q->dst = xzalloc(size * sizeof(struct sockaddr_storage));
+
+    return (q);
+}
+
+void
+raw_pkt_queue_del(raw_pkt_queue_t *q)
+{
+    if (!q) {
+        return;
+    }
+    free(q->msgs);
+    free(q->iov);
+    free(q->dst);
+    free(q);
+}
+
+/* Queues a raw packet to be sent out the socket of the queue. The packet is
+ * not copied, so its memory must remain valid until the queue is flushed.
+ * The queue is flushed when it becomes full */
+int
+raw_pkt_queue_add(raw_pkt_queue_t *q, const void *pkt, int plen, ip_addr_t *dip)
+{
+    struct msghdr *msg;
+    int slen;
+
+    if (q->size == 1) {
+        return (send_raw_packet(q->sock, pkt, plen, dip));
+    }
+
+    if ((slen = ip_addr_to_sockaddr(dip, &q->dst[q->len])) == 0) {
+        return (BAD);
+    }
+
+    q->iov[q->len].iov_base = (void *)pkt;
+    q->iov[q->len].iov_len = plen;
+    msg = &q->msgs[q->len].msg_hdr;
+    msg->msg_name = &q->dst[q->len];
+    msg->msg_namelen = slen;
+    msg->msg_iov = &q->iov[q->len];
+    msg->msg_iovlen = 1;
+    q->len++;
+
+    if (q->len == q->size) {
+        return (raw_pkt_queue_flush(q));
+    }
+
+    return (GOOD);
+}
+
+/* Sends all the packets of the queue with the minimum number of syscalls.
+ * A packet that can not be sent is dropped and the rest are still sent. The
+ * remaining packets are only dropped when the socket has no room for them */
+int
+raw_pkt_queue_flush(raw_pkt_queue_t *q)
+{
+    int sent = 0, ret, res = GOOD;
+
+    while (sent < q->len) {
+        ret = sendmmsg(q->sock, &q->msgs[sent], q->len - sent, 0);
+        if (ret > 0) {
+            sent += ret;
+            continue;
+        }
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        res = BAD;
+        if (ret == 0 || errno == EAGAIN || errno == EWOULDBLOCK
+                || errno == ENOBUFS) {
+            OOR_LOG(LDBG_2, "raw_pkt_queue_flush: send of %d packets using "
+                    "descriptor %d failed -> %s. Dropped", q->len - sent,
+                    q->sock, strerror(errno));
+            break;
+        }
+        /* The error is reported by the first packet not sent, usually due
+         * to its destination */
+        OOR_LOG(LDBG_2, "raw_pkt_queue_flush: send of packet %d using "
+                "descriptor %d failed -> %s. Dropped", sent, q->sock,
+                strerror(errno));
+        sent++;
+    }
+
+    q->len = 0;
+    return (res);
+}
+
 int
 send_datagram_packet (int sock, const void *packet, int packet_length,
         lisp_addr_t *addr_dest, int port_dest)
@@ -355,6 +713,333 @@ send_datagram_packet (int sock, const void *packet, int packet_length,
     return (GOOD);
 }
 
+/* Returns TRUE if the kernel supports UDP segmentation offload (UDP_SEGMENT) */
+int
+udp_gso_supported()
+{
+    socklen_t optlen;
+    int sock, gso_size, ret;
+
+    if ((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+        return (FALSE);
+    }
+    /* Old kernels don't know the option */
+    optlen = sizeof(gso_size);
+    ret = getsockopt(sock, IPPROTO_UDP, UDP_SEGMENT, &gso_size, &optlen);
+    close(sock);
+
+    return (ret == 0 ? TRUE : FALSE);
+}
+
+/* Opens a UDP socket bound to 'src_addr' and 'src_port' and connected to
+ * 'dst_addr' and 'dst_port'. With a 'src_port' of 0 the source port is
+ * ephemeral. Otherwise, the port can be shared by several sockets toward
+ * different destinations */
+int
+open_udp_connected_socket(lisp_addr_t *src_addr, lisp_addr_t *dst_addr,
+        int src_port, int dst_port)
+{
+    struct sockaddr_storage ss;
+    int sock, slen, afi;
+    int tr = 1;
+
+    afi = lisp_addr_ip_afi(dst_addr);
+    if ((slen = ip_addr_to_sockaddr(lisp_addr_ip(dst_addr), &ss)) == 0) {
+        return (ERR_SOCKET);
+    }
+    if (afi == AF_INET) {
+        ((struct sockaddr_in *)&ss)->sin_port = htons(dst_port);
+    } else {
+        ((struct sockaddr_in6 *)&ss)->sin6_port = htons(dst_port);
+    }
+
+    if ((sock = socket(afi, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+        OOR_LOG(LDBG_1, "open_udp_connected_socket: socket: %s", strerror(errno));
+        return (ERR_SOCKET);
+    }
+
+    if (src_port != 0 && setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &tr,
+            sizeof(int)) == -1) {
+        OOR_LOG(LDBG_1, "open_udp_connected_socket: setsockopt SO_REUSEADDR: %s",
+                strerror(errno));
+        close(sock);
+        return (ERR_SOCKET);
+    }
+
+    if (bind_socket(sock, afi, src_addr, src_port) != GOOD) {
+        close(sock);
+        return (ERR_SOCKET);
+    }
+
+    if (connect(sock, (struct sockaddr *)&ss, slen) < 0) {
+        OOR_LOG(LDBG_1, "open_udp_connected_socket: connect to %s: %s",
+                lisp_addr_to_char(dst_addr), strerror(errno));
+        close(sock);
+        return (ERR_SOCKET);
+    }
+
+    return (sock);
+}
+
+void
+udp_gso_queue_init(udp_gso_queue_t *q, int sock, int afi)
+{
+    memset(q, 0, sizeof(udp_gso_queue_t));
+    q->sock = sock;
+    q->afi = afi;
+}
+
+/* Sends the 'iovlen' buffers with the outer TTL and TOS of the queue. If
+ * 'gso_size' is not 0, the kernel splits them in datagrams of 'gso_size'
+ * bytes. Otherwise they form a single datagram */
+static int
+udp_gso_sendmsg(udp_gso_queue_t *q, struct iovec *iov, int iovlen,
+        int gso_size)
+{
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    union {
+        char buf[CMSG_SPACE(sizeof(uint16_t)) + 2 * CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    int ctrl_len = 0;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&ctrl, 0, sizeof(ctrl));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovlen;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (gso_size) {
+        cmsg->cmsg_level = IPPROTO_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        *(uint16_t *)CMSG_DATA(cmsg) = gso_size;
+        ctrl_len += CMSG_SPACE(sizeof(uint16_t));
+        cmsg = CMSG_NXTHDR(&msg, cmsg);
+    }
+
+    cmsg->cmsg_level = q->afi == AF_INET ? IPPROTO_IP : IPPROTO_IPV6;
+    cmsg->cmsg_type = q->afi == AF_INET ? IP_TTL : IPV6_HOPLIMIT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    *(int *)CMSG_DATA(cmsg) = q->ttl;
+    ctrl_len += CMSG_SPACE(sizeof(int));
+    cmsg = CMSG_NXTHDR(&msg, cmsg);
+
+    cmsg->cmsg_level = q->afi == AF_INET ? IPPROTO_IP : IPPROTO_IPV6;
+    cmsg->cmsg_type = q->afi == AF_INET ? IP_TOS : IPV6_TCLASS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    *(int *)CMSG_DATA(cmsg) = q->tos;
+    ctrl_len += CMSG_SPACE(sizeof(int));
+
+    msg.msg_controllen = ctrl_len;
+
+    if (sendmsg(q->sock, &msg, 0) < 0) {
+        return (BAD);
+    }
+    return (GOOD);
+}
+
+/* Queues a datagram to be sent through the socket of the queue. The payload is
+ * not copied, so its memory must remain valid until the queue is flushed. The
+ * queue is flushed first if the datagram can not be sent in the same send as
+ * the ones already queued */
+int
+udp_gso_queue_add(udp_gso_queue_t *q, const void *pkt, int plen, int ttl,
+        int tos)
+{
+    return (udp_gso_queue_add2(q, pkt, plen, NULL, 0, ttl, tos));
+}
+
+/* Same as udp_gso_queue_add for a datagram made of 'hdr' followed by
+ * 'payload', which are not copied either. 'payload' may be NULL */
+int
+udp_gso_queue_add2(udp_gso_queue_t *q, const void *hdr, int hlen,
+        const void *payload, int plen, int ttl, int tos)
+{
+    int ret = GOOD;
+    int dlen = hlen + plen;
+
+    if (q->len > 0 && (ttl != q->ttl || tos != q->tos || dlen > q->gso_size
+            || q->last_len < q->gso_size
+            || q->len == UDP_GSO_MAX_SEGS
+            || q->bytes + dlen > UDP_GSO_MAX_BYTES)) {
+        ret = udp_gso_queue_flush(q);
+    }
+
+    if (q->len == 0) {
+        q->ttl = ttl;
+        q->tos = tos;
+        q->gso_size = dlen;
+    }
+    q->iov[q->iovlen].iov_base = (void *)hdr;
+    q->iov[q->iovlen].iov_len = hlen;
+    q->iovlen++;
+    q->bufs[q->len] = 1;
+    if (payload) {
+        q->iov[q->iovlen].iov_base = (void *)payload;
+        q->iov[q->iovlen].iov_len = plen;
+        q->iovlen++;
+        q->bufs[q->len] = 2;
+    }
+    q->len++;
+    q->bytes += dlen;
+    q->last_len = dlen;
+
+    return (ret);
+}
+
+static void
+udp_gso_queue_reset(udp_gso_queue_t *q)
+{
+    q->len = 0;
+    q->iovlen = 0;
+    q->bytes = 0;
+}
+
+/* Sends the queued datagrams. When the kernel or the output device can not
+ * segment them, they are sent one by one from then on */
+int
+udp_gso_queue_flush(udp_gso_queue_t *q)
+{
+    struct iovec *iov;
+    int i, ret = GOOD;
+
+    if (q->len == 0) {
+        return (GOOD);
+    }
+
+    if (q->len > 1 && !q->no_gso) {
+        if (udp_gso_sendmsg(q, q->iov, q->iovlen, q->gso_size) == GOOD) {
+            udp_gso_queue_reset(q);
+            return (GOOD);
+        }
+        if (errno != EIO && errno != EINVAL) {
+            OOR_LOG(LDBG_2, "udp_gso_queue_flush: send of %d datagrams using "
+                    "descriptor %d failed -> %s", q->len, q->sock,
+                    strerror(errno));
+            udp_gso_queue_reset(q);
+            return (BAD);
+        }
+        OOR_LOG(LDBG_1, "udp_gso_queue_flush: UDP segmentation failed on "
+                "descriptor %d (%s). Sending datagrams one by one", q->sock,
+                strerror(errno));
+        q->no_gso = TRUE;
+    }
+
+    iov = q->iov;
+    for (i = 0; i < q->len; i++) {
+        if (udp_gso_sendmsg(q, iov, q->bufs[i], 0) != GOOD) {
+            OOR_LOG(LDBG_2, "udp_gso_queue_flush: send using descriptor %d "
+                    "failed -> %s", q->sock, strerror(errno));
+            ret = BAD;
+        }
+        iov += q->bufs[i];
+    }
+    udp_gso_queue_reset(q);
+    return (ret);
+}
+
+/* Opens a packet socket with a memory mapped receive ring (TPACKET_V3) that
+ * gets the data packets sent to 'port' and to one of the local addresses
+ * <lisp_addr_t *> through any interface of the host, starting at the IP
+ * header */
+pkt_ring_t *
+pkt_ring_open(int port, glist_t *addrs)
+{
+    struct tpacket_req3 req;
+    struct sockaddr_ll sll;
+    pkt_ring_t *r;
+    uint8_t *map;
+    int sock, version = TPACKET_V3;
+#ifdef PACKET_IGNORE_OUTGOING
+    int on = 1;
+#endif
+
+    /* Packets are not received until the socket is bound, once the filter
+     * and the ring are ready */
+    if ((sock = socket(AF_PACKET, SOCK_DGRAM, 0)) < 0) {
+        OOR_LOG(LERR, "pkt_ring_open: socket: %s", strerror(errno));
+        return (NULL);
+    }
+
+    if (setsockopt(sock, SOL_PACKET, PACKET_VERSION, &version,
+            sizeof(version)) < 0) {
+        OOR_LOG(LERR, "pkt_ring_open: setsockopt PACKET_VERSION: %s",
+                strerror(errno));
+        close(sock);
+        return (NULL);
+    }
+
+    if (socket_attach_pkt_data_filter(sock, port, addrs) != GOOD) {
+        close(sock);
+        return (NULL);
+    }
+
+#ifdef PACKET_IGNORE_OUTGOING
+    /* Outgoing packets are also discarded while processing the ring. This
+     * avoids copying them in old kernels */
+    setsockopt(sock, SOL_PACKET, PACKET_IGNORE_OUTGOING, &on, sizeof(on));
+#endif
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = PKT_RING_BLOCK_SIZE;
+    req.tp_block_nr = PKT_RING_BLOCK_NR;
+    req.tp_frame_size = PKT_RING_FRAME_SIZE;
+    req.tp_frame_nr = (PKT_RING_BLOCK_SIZE / PKT_RING_FRAME_SIZE) * PKT_RING_BLOCK_NR;
+    req.tp_retire_blk_tov = PKT_RING_BLOCK_TIMEOUT;
+    if (setsockopt(sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        OOR_LOG(LERR, "pkt_ring_open: setsockopt PACKET_RX_RING: %s",
+                strerror(errno));
+        close(sock);
+        return (NULL);
+    }
+
+    map = mmap(NULL, PKT_RING_BLOCK_SIZE * PKT_RING_BLOCK_NR,
+            PROT_READ | PROT_WRITE, MAP_SHARED, sock, 0);
+    if (map == MAP_FAILED) {
+        OOR_LOG(LERR, "pkt_ring_open: mmap: %s", strerror(errno));
+        close(sock);
+        return (NULL);
+    }
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = 0;
+    if (bind(sock, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+        OOR_LOG(LERR, "pkt_ring_open: bind: %s", strerror(errno));
+        munmap(map, PKT_RING_BLOCK_SIZE * PKT_RING_BLOCK_NR);
+        close(sock);
+        return (NULL);
+    }
+
+    r = xzalloc(sizeof(pkt_ring_t));
+    r->sock = sock;
+    r->map = map;
+    r->map_len = PKT_RING_BLOCK_SIZE * PKT_RING_BLOCK_NR;
+    r->block_size = PKT_RING_BLOCK_SIZE;
+    r->block_nr = PKT_RING_BLOCK_NR;
+
+    OOR_LOG(LDBG_1, "pkt_ring_open: Created packet ring of %d blocks of %d "
+            "bytes for port %d", r->block_nr, r->block_size, port);
+
+    return (r);
+}
+
+void
+pkt_ring_close(pkt_ring_t *r)
+{
+    if (!r) {
+        return;
+    }
+    munmap(r->map, r->map_len);
+    close(r->sock);
+    free(r);
+}
+
 
 
 
@@ -21,19 +21,123 @@
 #ifndef SOCKETS_UTIL_H_
 #define SOCKETS_UTIL_H_
 
+#include <sys/socket.h>
+#include <netinet/udp.h>
+#include <linux/if_packet.h>
 #include "../liblisp/lisp_address.h"
 
+/* UDP segmentation and receive offload options (Linux 4.18 and 5.0) */
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO     104
+#endif
+/* Zero UDP checksum option (RFC 6935, 6936) */
+#ifndef UDP_NO_CHECK6_RX
+#define UDP_NO_CHECK6_RX 102
+#endif
+
+/* Queue of raw packets waiting to be sent with a single syscall through
+ * the same socket */
+typedef struct raw_pkt_queue_ {
+    int sock;
+    int len;
+    int size;
+    struct mmsghdr *msgs;
+    struct iovec *iov;
+    struct sockaddr_storage *dst;
+} raw_pkt_queue_t;
+
+/* Maximum number of datagrams and of bytes passed to the kernel with a single
+ * send using UDP segmentation offload */
+#define UDP_GSO_MAX_SEGS    64
+#define UDP_GSO_MAX_BYTES   65000
+
+/* Queue of datagrams of the same size waiting to be sent through a connected
+ * UDP socket. They are passed to the kernel with a single sendmsg and the
+ * kernel splits them (UDP_SEGMENT). Only the last datagram of the queue can
+ * be shorter than the others. A datagram is made of one or two buffers */
+typedef struct udp_gso_queue_ {
+    int sock;
+    int afi;
+    int ttl;
+    int tos;
+    int gso_size;
+    int len;
+    int bytes;
+    int last_len;
+    /* Segmentation failed, datagrams are sent one by one */
+    uint8_t no_gso;
+    struct iovec iov[2 * UDP_GSO_MAX_SEGS];
+    int iovlen;
+    /* Number of buffers of each datagram */
+    uint8_t bufs[UDP_GSO_MAX_SEGS];
+} udp_gso_queue_t;
+
+/* Geometry of the memory mapped ring of packet sockets. Packets are handed
+ * to user space one block at a time, when it is full or after a timeout */
+#define PKT_RING_BLOCK_SIZE     (1 << 20)
+#define PKT_RING_BLOCK_NR       8
+#define PKT_RING_FRAME_SIZE     2048
+#define PKT_RING_BLOCK_TIMEOUT  10  /* ms */
+/* Maximum number of local addresses of each afi accepted by the filter of
+ * the ring */
+#define PKT_RING_MAX_ADDRS      16
+
+/* Receive ring of a packet socket (TPACKET_V3) */
+typedef struct pkt_ring_ {
+    int sock;
+    uint8_t *map;
+    size_t map_len;
+    int block_size;
+    int block_nr;
+    /* Next block to be processed */
+    int cur_block;
+} pkt_ring_t;
+
 int open_ip_raw_socket(int afi);
 int open_udp_raw_socket(int afi);
 int opent_netlink_socket();
 
 int open_udp_datagram_socket(int afi);
+int udp_gso_supported();
+int open_udp_connected_socket(lisp_addr_t *src_addr, lisp_addr_t *dst_addr,
+        int src_port, int dst_port);
 int socket_bindtodevice(int sock, char *device);
 int socket_conf_req_ttl_tos(int sock, int afi);
+int socket_conf_udp_gro(int sock);
+int socket_conf_reuseport(int sock);
+int socket_conf_udp_no_check_rx(int sock, int afi);
+int socket_attach_data_filter(int sock, int afi, int port);
+int socket_attach_pkt_data_filter(int sock, int port, glist_t *addrs);
+int socket_attach_drop_filter(int sock);
 
 int bind_socket(int sock,int afi, lisp_addr_t *src_addr, int src_port);
 int send_raw_packet(int, const void *, int, ip_addr_t *);
 int send_datagram_packet (int sock, const void *packet, int packet_length,
         lisp_addr_t *addr_dest, int port_dest);
 
+raw_pkt_queue_t *raw_pkt_queue_new(int size);
+void raw_pkt_queue_del(raw_pkt_queue_t *q);
+int raw_pkt_queue_add(raw_pkt_queue_t *q, const void *pkt, int plen,
+        ip_addr_t *dip);
+int raw_pkt_queue_flush(raw_pkt_queue_t *q);
+
+pkt_ring_t *pkt_ring_open(int port, glist_t *addrs);
+void pkt_ring_close(pkt_ring_t *r);
+
+static inline struct tpacket_block_desc *
+pkt_ring_block(pkt_ring_t *r, int i)
+{
+    return ((struct tpacket_block_desc *)(r->map + i * r->block_size));
+}
+
+void udp_gso_queue_init(udp_gso_queue_t *q, int sock, int afi);
+int udp_gso_queue_add(udp_gso_queue_t *q, const void *pkt, int plen, int ttl,
+        int tos);
+int udp_gso_queue_add2(udp_gso_queue_t *q, const void *hdr, int hlen,
+        const void *payload, int plen, int ttl, int tos);
+int udp_gso_queue_flush(udp_gso_queue_t *q);
+
 #endif /* SOCKETS_UTIL_H_ */
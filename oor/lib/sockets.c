@@ -25,12 +25,14 @@
 #endif
 
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/socket.h>
 
 #include "oor_log.h"
 #include "sockets.h"
 #include "sockets-util.h"
 #include "../iface_list.h"
+#include "../data-plane/data-plane.h"
 #include "../liblisp/liblisp.h"
 
 inline fwd_entry_t *
@@ -64,6 +66,13 @@ sockmstr_create()
 {
     sockmstr_t *sm;
     sm = xzalloc(sizeof(sockmstr_t));
+    sm->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (sm->epoll_fd == -1) {
+        OOR_LOG(LCRIT, "sockmstr_create: epoll_create error: %s",
+                strerror(errno));
+        free(sm);
+        return (NULL);
+    }
     return (sm);
 }
 
@@ -77,7 +86,9 @@ sock_list_remove_all(sock_list_t *lst)
     sk = lst->head;
     while(sk) {
         next = sk->next;
-        close(sk->fd);
+        if (!(sk->flags & SOCK_NOT_OWNED)) {
+            close(sk->fd);
+        }
         free(sk);
         sk = next;
     }
@@ -85,6 +96,50 @@ sock_list_remove_all(sock_list_t *lst)
 
 
 
+static void
+sockmstr_pending_add(sockmstr_t *m, sock_t *sock)
+{
+    if (sock->pending) {
+        return;
+    }
+    sock->pending = TRUE;
+    sock->pending_next = NULL;
+    if (m->pending_tail) {
+        m->pending_tail->pending_next = sock;
+    } else {
+        m->pending_head = sock;
+    }
+    m->pending_tail = sock;
+    m->num_pending++;
+}
+
+static void
+sockmstr_pending_remove(sockmstr_t *m, sock_t *sock)
+{
+    sock_t *prev = NULL, *it;
+
+    if (!sock->pending) {
+        return;
+    }
+    for (it = m->pending_head; it != NULL; prev = it, it = it->pending_next) {
+        if (it != sock) {
+            continue;
+        }
+        if (prev) {
+            prev->pending_next = it->pending_next;
+        } else {
+            m->pending_head = it->pending_next;
+        }
+        if (m->pending_tail == it) {
+            m->pending_tail = prev;
+        }
+        break;
+    }
+    sock->pending = FALSE;
+    sock->pending_next = NULL;
+    m->num_pending--;
+}
+
 static inline void
 sock_list_add(sock_list_t *lst, sock_t *sock)
 {
@@ -98,45 +153,27 @@ sock_list_add(sock_list_t *lst, sock_t *sock)
 
     lst->tail = sock;
     lst->count++;
-    if (sock->fd > lst->maxfd) {
-        lst->maxfd = sock->fd;
-    }
-
 }
 
 static inline void
 sock_list_remove(sock_list_t *lst, struct sock *sock)
 {
-    int fd;
     if (sock->prev == NULL){
         lst->head = sock->next;
-        if (sock->next != NULL){
-            sock->next->prev = NULL;
-        }
     }else{
         sock->prev->next = sock->next;
-        if (sock->next != NULL){
-            sock->next->prev = sock->prev;
-        }
     }
-    fd = sock->fd;
-    close(sock->fd);
+    if (sock->next == NULL){
+        lst->tail = sock->prev;
+    }else{
+        sock->next->prev = sock->prev;
+    }
+    if (!(sock->flags & SOCK_NOT_OWNED)) {
+        close(sock->fd);
+    }
     free(sock);
 
     lst->count--;
-
-    if (fd == lst->maxfd){
-        sock= lst->head;
-        if (sock == NULL){
-            lst->maxfd = 0;
-        }
-        while (sock != NULL){
-            if (sock->fd > lst->maxfd) {
-                lst->maxfd = sock->fd;
-            }
-            sock = sock->next;
-        }
-    }
 }
 
 
@@ -147,6 +184,7 @@ sockmstr_destroy(sockmstr_t *sm)
         return;
     }
     sock_list_remove_all(&sm->read);
+    close(sm->epoll_fd);
     free(sm);
     OOR_LOG(LDBG_1,"Sockets closed");
 }
@@ -209,13 +247,40 @@ sockmstr_register_get_by_bind_port (sockmstr_t *m, int afi, uint16_t port)
 sock_t *
 sockmstr_register_read_listener(sockmstr_t *m,int (*func)(struct sock *),
         void *arg, int fd)
+{
+    return (sockmstr_register_read_listener_flags(m, func, arg, fd, 0));
+}
+
+sock_t *
+sockmstr_register_read_listener_flags(sockmstr_t *m,
+        int (*func)(struct sock *), void *arg, int fd, int flags)
 {
     struct sock *sock;
+    struct epoll_event ev;
+
     sock = xzalloc(sizeof(struct sock));
     sock->recv_cb = func;
     sock->type = SOCK_READ;
     sock->arg = arg;
     sock->fd = fd;
+    sock->flags = flags;
+
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.events = EPOLLIN;
+    ev.data.ptr = sock;
+    if (flags & SOCK_EDGE_TRIGGERED) {
+        /* The callback reads until EAGAIN */
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        ev.events |= EPOLLET;
+    }
+
+    if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        OOR_LOG(LERR, "sockmstr_register_read_listener: Couldn't register "
+                "socket %d: %s", fd, strerror(errno));
+        free(sock);
+        return (NULL);
+    }
+
     sock_list_add(&m->read, sock);
     return (sock);
 }
@@ -230,54 +295,101 @@ sock_fd(struct sock * sock)
 int
 sockmstr_unregister_read_listenedr(sockmstr_t *m, struct sock *sock)
 {
-   sock_list_remove(&m->read, sock);
-   return (GOOD);
+    int i;
+
+    epoll_ctl(m->epoll_fd, EPOLL_CTL_DEL, sock->fd, NULL);
+
+    /* The socket could be pending to be processed in this iteration */
+    for (i = 0; i < m->num_events; i++) {
+        if (m->events[i].data.ptr == sock) {
+            m->events[i].data.ptr = NULL;
+        }
+    }
+    if (m->serving == sock) {
+        m->serving = NULL;
+    }
+    sockmstr_pending_remove(m, sock);
+
+    sock_list_remove(&m->read, sock);
+    return (GOOD);
 }
 
 
+/* Serve an edge triggered socket. It is kept in the pending list if it may
+ * still have data after SOCKMSTR_MAX_EDGE_CALLS calls to its callback, as no
+ * new event will be reported until it is drained */
 static void
-sock_process_fd(struct sock_list *lst, fd_set *fdset)
+sockmstr_serve_edge(sockmstr_t *m, struct sock *sock)
 {
-    struct sock *sit;
-
-    for (sit = lst->head; sit; sit = sit->next) {
-        if (FD_ISSET(sit->fd, fdset))
-            (*sit->recv_cb)(sit);
+    int n;
+
+    m->serving = sock;
+    for (n = 0; n < SOCKMSTR_MAX_EDGE_CALLS; n++) {
+        if ((*sock->recv_cb)(sock) != GOOD || m->serving == NULL) {
+            /* Drained or unregistered by its callback */
+            if (m->serving != NULL) {
+                sockmstr_pending_remove(m, sock);
+            }
+            m->serving = NULL;
+            return;
+        }
     }
+    m->serving = NULL;
+    sockmstr_pending_add(m, sock);
 }
 
+/* Process the sockets returned by the last sockmstr_wait_on_all_read. Only
+ * the ready sockets are visited. The sockets left with data in the previous
+ * pass are served after them */
 void
 sockmstr_process_all(sockmstr_t *m)
 {
-    struct timeval tv;
-
-    tv.tv_sec = 0;
-    tv.tv_usec = DEFAULT_SELECT_TIMEOUT;
+    struct sock *sock;
+    int i, npending = m->num_pending;
 
-    while (1) {
-        if (select(m->read.maxfd + 1, &m->readfds, NULL, NULL, &tv) == -1) {
-            if (errno == EINTR) {
-                continue;
-            } else {
-                OOR_LOG(LDBG_2, "sock_process_all: select error: %s",
-                        strerror(errno));
-                return;
-            }
+    for (i = 0; i < m->num_events; i++) {
+        sock = (struct sock *)m->events[i].data.ptr;
+        if (sock == NULL) {
+            continue;
+        }
+        if (sock->flags & SOCK_EDGE_TRIGGERED) {
+            sockmstr_serve_edge(m, sock);
         } else {
-            break;
+            (*sock->recv_cb)(sock);
         }
     }
+    m->num_events = 0;
 
-    sock_process_fd(&m->read, &m->readfds);
+    for (i = 0; i < npending && m->pending_head != NULL; i++) {
+        sock = m->pending_head;
+        sockmstr_pending_remove(m, sock);
+        sockmstr_serve_edge(m, sock);
+    }
 }
 
+/* Wait until any of the registered sockets is ready to be read. Periodic
+ * tasks are driven by the timers fd, so there is no need of a timeout.
+ * It doesn't block while there are sockets pending to be served */
 void
 sockmstr_wait_on_all_read(sockmstr_t *m)
 {
-    struct sock *sit;
-    for (sit = m->read.head; sit; sit = sit->next) {
-        FD_SET(sit->fd, &m->readfds);
+    int n;
+
+    while (1) {
+        /* Sockets left with data don't report new events */
+        n = epoll_wait(m->epoll_fd, m->events, SOCKMSTR_MAX_EVENTS,
+                m->num_pending > 0 ? 0 : -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            OOR_LOG(LDBG_2, "sockmstr_wait_on_all_read: epoll_wait error: %s",
+                    strerror(errno));
+            n = 0;
+        }
+        break;
     }
+    m->num_events = n;
 }
 
 int
@@ -338,6 +450,11 @@ open_data_raw_input_socket(int afi, uint16_t port)
         return (ERR_SOCKET);
     }
 
+    /* The raw socket receives a copy of every UDP packet of the host. Discard
+     * the ones that are not data packets in the kernel. If the filter can't
+     * be attached, they are discarded during the decapsulation */
+    socket_attach_data_filter(sock, afi, port);
+
     return (sock);
 }
 
@@ -359,10 +476,32 @@ open_data_datagram_input_socket(int afi, int port)
         close(sock);
         return (ERR_SOCKET);
     }
+    /* Older kernels drop them. Not an error */
+    socket_conf_udp_no_check_rx(sock, afi);
 
     return (sock);
 }
 
+/* Datagram socket bound to the data port that shares it with the other
+ * sockets opened by this function. Each one gets a share of the flows */
+int
+open_data_reuseport_input_socket(int afi, int port)
+{
+    int sock;
+
+    if ((sock = open_udp_datagram_socket(afi)) < 0){
+        return(ERR_SOCKET);
+    }
+    if (socket_conf_reuseport(sock) != GOOD
+            || bind_socket(sock,afi,NULL,port) != GOOD
+            || socket_conf_req_ttl_tos(sock,afi) != GOOD){
+        close(sock);
+        return(ERR_SOCKET);
+    }
+    socket_conf_udp_no_check_rx(sock, afi);
+
+    return (sock);
+}
 
 int
 sock_recv(int sfd, lbuf_t *b)
@@ -449,20 +588,72 @@ sock_ctrl_recv(int sock, struct lbuf *buf, uconn_t *uc)
     return (GOOD);
 }
 
-int
-sock_data_recv(int sock, lbuf_t *b, int *afi, uint8_t *ttl, uint8_t *tos)
+/* Space for TTL, TOS and UDP GRO data */
+union data_control_data {
+    struct cmsghdr cmsg;
+    u_char data[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(int))
+                + CMSG_SPACE(sizeof(int))];
+};
+
+/* Extract the outer TTL and TOS of a received data packet and the size of
+ * the coalesced datagrams from the ancillary data of its message. The afi is
+ * obtained from the source address of the message */
+void
+sock_data_parse_cmsg(struct msghdr *msg, union sockunion *su,
+        data_recv_md_t *md)
 {
-    /* Space for TTL and TOS data */
-    union control_data {
-        struct cmsghdr cmsg;
-        u_char data[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(int))];
-    };
+    struct cmsghdr *cmsgptr = NULL;
+
+    md->ttl = md->tos = 0;
+    md->gso_size = 0;
+    for (cmsgptr = CMSG_FIRSTHDR(msg); cmsgptr != NULL; cmsgptr =
+            CMSG_NXTHDR(msg, cmsgptr)) {
+        if (cmsgptr->cmsg_level == IPPROTO_UDP
+                && cmsgptr->cmsg_type == UDP_GRO) {
+            md->gso_size = *((int *) CMSG_DATA(cmsgptr));
+        }
+    }
+
+    if (su->s4.sin_family == AF_INET) {
+        for (cmsgptr = CMSG_FIRSTHDR(msg); cmsgptr != NULL; cmsgptr =
+                CMSG_NXTHDR(msg, cmsgptr)) {
+
+            if (cmsgptr->cmsg_level == IPPROTO_IP
+                    && cmsgptr->cmsg_type == IP_TTL) {
+                md->ttl = *((uint8_t *) CMSG_DATA(cmsgptr));
+            }
+
+            if (cmsgptr->cmsg_level == IPPROTO_IP
+                    && cmsgptr->cmsg_type == IP_TOS) {
+                md->tos = *((uint8_t *) CMSG_DATA(cmsgptr));
+            }
+        }
+        md->afi = AF_INET;
+    } else {
+        for (cmsgptr = CMSG_FIRSTHDR(msg); cmsgptr != NULL; cmsgptr =
+                CMSG_NXTHDR(msg, cmsgptr)) {
+
+            if (cmsgptr->cmsg_level == IPPROTO_IPV6
+                    && cmsgptr->cmsg_type == IPV6_HOPLIMIT) {
+                md->ttl = *((uint8_t *) CMSG_DATA(cmsgptr));
+            }
+
+            if (cmsgptr->cmsg_level == IPPROTO_IPV6
+                    && cmsgptr->cmsg_type == IPV6_TCLASS) {
+                md->tos = *((uint8_t *) CMSG_DATA(cmsgptr));
+            }
+        }
+        md->afi = AF_INET6;
+    }
+}
 
+static int
+sock_data_recv_md(int sock, lbuf_t *b, data_recv_md_t *md)
+{
     union sockunion su;
     struct msghdr msg;
     struct iovec iov[1];
-    union control_data cmsg;
-    struct cmsghdr *cmsgptr = NULL;
+    union data_control_data cmsg;
     int nbytes = 0;
 
     iov[0].iov_base = lbuf_data(b);
@@ -478,45 +669,83 @@ sock_data_recv(int sock, lbuf_t *b, int *afi, uint8_t *ttl, uint8_t *tos)
 
     nbytes = recvmsg(sock, &msg, 0);
     if (nbytes == -1) {
-        OOR_LOG(LWRN, "read_packet: recvmsg error: %s", strerror(errno));
+        /* Non blocking sockets are read until they are drained */
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            OOR_LOG(LWRN, "read_packet: recvmsg error: %s", strerror(errno));
+        }
         return (BAD);
     }
 
     lbuf_set_size(b, lbuf_size(b) + nbytes);
 
-    if (su.s4.sin_family == AF_INET) {
-        for (cmsgptr = CMSG_FIRSTHDR(&msg); cmsgptr != NULL; cmsgptr =
-                CMSG_NXTHDR(&msg, cmsgptr)) {
+    sock_data_parse_cmsg(&msg, &su, md);
 
-            if (cmsgptr->cmsg_level == IPPROTO_IP
-                    && cmsgptr->cmsg_type == IP_TTL) {
-                *ttl = *((uint8_t *) CMSG_DATA(cmsgptr));
-            }
+    return (GOOD);
+}
 
-            if (cmsgptr->cmsg_level == IPPROTO_IP
-                    && cmsgptr->cmsg_type == IP_TOS) {
-                *tos = *((uint8_t *) CMSG_DATA(cmsgptr));
-            }
-        }
-        *afi = AF_INET;
-    } else {
-        for (cmsgptr = CMSG_FIRSTHDR(&msg); cmsgptr != NULL; cmsgptr =
-                CMSG_NXTHDR(&msg, cmsgptr)) {
+int
+sock_data_recv(int sock, lbuf_t *b, int *afi, uint8_t *ttl, uint8_t *tos)
+{
+    data_recv_md_t md;
 
-            if (cmsgptr->cmsg_level == IPPROTO_IPV6
-                    && cmsgptr->cmsg_type == IPV6_HOPLIMIT) {
-                *ttl = *((uint8_t *) CMSG_DATA(cmsgptr));
-            }
+    if (sock_data_recv_md(sock, b, &md) != GOOD) {
+        return (BAD);
+    }
+    *afi = md.afi;
+    *ttl = md.ttl;
+    *tos = md.tos;
 
-            if (cmsgptr->cmsg_level == IPPROTO_IPV6
-                    && cmsgptr->cmsg_type == IPV6_TCLASS) {
-                *tos = *((uint8_t *) CMSG_DATA(cmsgptr));
-            }
+    return (GOOD);
+}
+
+/* Drain up to 'nbufs' packets from the data socket with a single system call.
+ * The outer header information of the i-th packet is returned in md[i].
+ * Returns the number of packets received. Zero means that an error happened */
+int
+sock_data_recv_batch(int sock, lbuf_t *bufs, data_recv_md_t *md, int nbufs)
+{
+    union sockunion su[DPLANE_MAX_RX_BATCH];
+    struct mmsghdr msgs[DPLANE_MAX_RX_BATCH];
+    struct iovec iov[DPLANE_MAX_RX_BATCH];
+    union data_control_data cmsg[DPLANE_MAX_RX_BATCH];
+    int npkts, i;
+
+    if (nbufs == 1) {
+        return (sock_data_recv_md(sock, &bufs[0], &md[0]) == GOOD ? 1 : 0);
+    }
+
+    if (nbufs > DPLANE_MAX_RX_BATCH) {
+        nbufs = DPLANE_MAX_RX_BATCH;
+    }
+
+    memset(msgs, 0, nbufs * sizeof(struct mmsghdr));
+    for (i = 0; i < nbufs; i++) {
+        iov[i].iov_base = lbuf_data(&bufs[i]);
+        iov[i].iov_len = lbuf_tailroom(&bufs[i]);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = &cmsg[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(union data_control_data);
+        msgs[i].msg_hdr.msg_name = &su[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(union sockunion);
+    }
+
+    /* The socket is ready to read. Don't block once the first packet has
+     * been received */
+    npkts = recvmmsg(sock, msgs, nbufs, MSG_WAITFORONE, NULL);
+    if (npkts == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            OOR_LOG(LWRN, "read_packet: recvmmsg error: %s", strerror(errno));
         }
-        *afi = AF_INET6;
+        return (0);
     }
 
-    return (GOOD);
+    for (i = 0; i < npkts; i++) {
+        lbuf_set_size(&bufs[i], lbuf_size(&bufs[i]) + msgs[i].msg_len);
+        sock_data_parse_cmsg(&msgs[i].msg_hdr, &su[i], &md[i]);
+    }
+
+    return (npkts);
 }
 
 inline int
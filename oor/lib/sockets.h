@@ -20,6 +20,7 @@
 #ifndef SOCKETS_H_
 #define SOCKETS_H_
 
+#include <sys/epoll.h>
 #include "../defs.h"
 #include "sockets-util.h"
 #include "packets.h"
@@ -39,11 +40,27 @@ typedef enum {
  */
 
 
+/* Maximum number of ready sockets returned by one wait */
+#define SOCKMSTR_MAX_EVENTS     64
+
+/* Flags of the read listeners */
+/* The callback is only invoked when new data arrives to the socket. It is
+ * called repeatedly until it returns something different from GOOD, which
+ * it should do once the socket is drained (EAGAIN) */
+#define SOCK_EDGE_TRIGGERED     0x01
+/* The file descriptor belongs to a library that closes it. It is not closed
+ * when the listener is removed */
+#define SOCK_NOT_OWNED          0x02
+
+/* Maximum consecutive calls to the callback of an edge triggered socket in
+ * one pass. A socket that still has data is served again after the rest of
+ * ready sockets, so that a busy one doesn't hold the loop */
+#define SOCKMSTR_MAX_EDGE_CALLS 16
+
 typedef struct sock_list {
     struct sock *head;
     struct sock *tail;
     int count;
-    int maxfd;
 }sock_list_t;
 
 typedef struct sock {
@@ -51,8 +68,12 @@ typedef struct sock {
     int (*recv_cb)(struct sock *);
     void *arg;
     int fd;
+    int flags;
     struct sock *next;
     struct sock *prev;
+    /* Edge triggered socket left with data to be read in the next pass */
+    int pending;
+    struct sock *pending_next;
 }sock_t;
 
 typedef struct uconn {
@@ -67,11 +88,29 @@ typedef struct sockmstr {
     sock_list_t read;
 //    struct sock_list *write;
 //    struct sock_list *netlink;
-    fd_set readfds;
-//    fd_set *writefds;
-//    fd_set *netlinkfds;
+    int epoll_fd;
+    /* Sockets ready to be processed. The pointer to the sock_t of each
+     * socket is stored in the data of its epoll event */
+    struct epoll_event events[SOCKMSTR_MAX_EVENTS];
+    int num_events;
+    /* Edge triggered sockets not drained, in the order they are served */
+    struct sock *pending_head;
+    struct sock *pending_tail;
+    int num_pending;
+    /* Socket whose callback is running. Cleared if it is unregistered */
+    struct sock *serving;
 } sockmstr_t;
 
+/* Outer header information of a datagram received from a data socket */
+typedef struct data_recv_md {
+    int afi;
+    uint8_t ttl;
+    uint8_t tos;
+    /* Size of the datagrams coalesced in the buffer with UDP GRO. 0 if the
+     * buffer contains a single datagram */
+    uint16_t gso_size;
+} data_recv_md_t;
+
 union sockunion {
     struct sockaddr_in s4;
     struct sockaddr_in6 s6;
@@ -83,6 +122,9 @@ typedef struct fwd_entry {
     lisp_addr_t *drloc;
     int *out_sock;
     uint32_t iid;
+    /* Outer headers of the encapsulated packets. Built by the data plane
+     * when the entry is cached. Not used while its length is 0 */
+    pkt_outer_hdr_t outer_hdr;
 } fwd_entry_t;
 
 fwd_entry_t *fwd_entry_new_init(lisp_addr_t *srloc, lisp_addr_t *drloc,
@@ -98,6 +140,8 @@ sock_t *sockmstr_register_get_by_fd(sockmstr_t *m, int fd);
 sock_t *sockmstr_register_get_by_bind_port (sockmstr_t *m, int afi, uint16_t port);
 sock_t *sockmstr_register_read_listener(sockmstr_t *m,
         int (*)(struct sock *), void *arg, int fd);
+sock_t *sockmstr_register_read_listener_flags(sockmstr_t *m,
+        int (*)(struct sock *), void *arg, int fd, int flags);
 int sock_fd(struct sock * sock);
 int sockmstr_unregister_read_listenedr(sockmstr_t *m, struct sock *sock);
 void sockmstr_process_all(sockmstr_t *m);
@@ -105,11 +149,15 @@ void sockmstr_wait_on_all_read(sockmstr_t *m);
 
 int open_data_raw_input_socket(int afi, uint16_t port);
 int open_data_datagram_input_socket(int afi, int port);
+int open_data_reuseport_input_socket(int afi, int port);
 int open_control_input_socket(int afi);
 
 int sock_recv(int, lbuf_t *);
 int sock_ctrl_recv(int, lbuf_t *, uconn_t *);
 int sock_data_recv(int sock, lbuf_t *b, int *afi, uint8_t *ttl, uint8_t *tos);
+int sock_data_recv_batch(int sock, lbuf_t *bufs, data_recv_md_t *md, int nbufs);
+void sock_data_parse_cmsg(struct msghdr *msg, union sockunion *su,
+        data_recv_md_t *md);
 int uconn_init(uconn_t *uc, int lp, int rp, lisp_addr_t *la,
         lisp_addr_t *ra);
 
@@ -0,0 +1,49 @@
+/*
+ *
+ * Copyright (C) 2011, 2015 Cisco Systems, Inc.
+ * Copyright (C) 2015 CBA research group, Technical University of Catalonia.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "spsc_queue.h"
+#include "mem_util.h"
+
+/* The size is rounded up to a power of 2 */
+spsc_queue_t *
+spsc_queue_new(uint32_t size)
+{
+    spsc_queue_t *q;
+    uint32_t n = 1;
+
+    while (n < size) {
+        n <<= 1;
+    }
+    q = xzalloc(sizeof(spsc_queue_t));
+    q->items = xzalloc(n * sizeof(void *));
+    q->mask = n - 1;
+
+    return (q);
+}
+
+/* The items still queued are not released */
+void
+spsc_queue_del(spsc_queue_t *q)
+{
+    if (!q) {
+        return;
+    }
+    free(q->items);
+    free(q);
+}
@@ -0,0 +1,74 @@
+/*
+ *
+ * Copyright (C) 2011, 2015 Cisco Systems, Inc.
+ * Copyright (C) 2015 CBA research group, Technical University of Catalonia.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../defs.h"
+
+#define SPSC_QUEUE_CACHE_LINE   64
+
+/* Bounded queue of pointers between a single producer thread and a single
+ * consumer thread, without locks. Each index is only written by one of them
+ * and is kept in its own cache line */
+typedef struct spsc_queue_ {
+    void **items;
+    uint32_t mask;
+    uint8_t pad0[SPSC_QUEUE_CACHE_LINE];
+    uint32_t head;
+    uint8_t pad1[SPSC_QUEUE_CACHE_LINE];
+    uint32_t tail;
+    uint8_t pad2[SPSC_QUEUE_CACHE_LINE];
+} spsc_queue_t;
+
+spsc_queue_t *spsc_queue_new(uint32_t size);
+void spsc_queue_del(spsc_queue_t *q);
+
+/* Only called by the producer. Returns BAD if the queue is full */
+static inline int
+spsc_queue_push(spsc_queue_t *q, void *item)
+{
+    uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+
+    if (q->tail - head > q->mask) {
+        return (BAD);
+    }
+    q->items[q->tail & q->mask] = item;
+    __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+    return (GOOD);
+}
+
+/* Only called by the consumer. Returns NULL if the queue is empty */
+static inline void *
+spsc_queue_pop(spsc_queue_t *q)
+{
+    uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    void *item;
+
+    if (q->head == tail) {
+        return (NULL);
+    }
+    item = q->items[q->head & q->mask];
+    __atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+    return (item);
+}
+
+#endif /* SPSC_QUEUE_H_ */
@@ -33,7 +33,9 @@ typedef enum {
     INFO_REQUEST_TIMER,
     RE_UPSTREAM_JOIN_TIMER,
     RE_ITR_RESOLUTION_TIMER,
-    REG_SITE_EXPRY_TIMER
+    REG_SITE_EXPRY_TIMER,
+    DATA_PLANE_STATS_TIMER,
+    API_POLL_TIMER
 } timer_type;
 
 #define TIMER_NAME_LEN          64
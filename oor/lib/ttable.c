@@ -17,6 +17,10 @@
  *
  */
 
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <time.h>
 #include "ttable.h"
 #include "mem_util.h"
 #include "packets.h"
@@ -25,74 +29,241 @@
 #include "../fwd_policies/fwd_policy.h"
 #include "../liblisp/liblisp.h"
 
-/* Time after which an entry is considered to have timed out and
- * is removed from the table */
-#define TIMEOUT 3
+/* Time in ms after which an entry is considered to have timed out and
+ * is removed from the table. The entries are invalidated as soon as the
+ * state they were obtained from changes (see fwd_info_valid), so the timeout
+ * only bounds the time the flows of a policy keep their locators */
+#define TIMEOUT 60000
 
-/* Time after which a negative entry is considered to have timed
+/* Time in ms after which a negative entry is considered to have timed
  * out and is removed from the table */
-#define NEGATIVE_TIMEOUT 0.1
+#define NEGATIVE_TIMEOUT 100
+
+/* Time in ms a TCP flow is kept after a FIN or RST is seen, so that the
+ * last packets of the connection don't miss */
+#define TCP_CLOSE_TIMEOUT 1000
+
+#define TTABLE_TCP_CLOSE_FLAGS  (TH_FIN | TH_RST)
 
-/* Maximum size of the tuple table */
-#define MAX_SIZE 10000
-#define OLD_ENTRIES 1000
+/* Time of the flows in ms. The coarse clock is enough for the timeouts and
+ * much cheaper to read for each packet */
+static uint32_t
+ttable_now()
+{
+    struct timespec now;
 
-static void ttable_remove_with_khiter(ttable_t *tt, khiter_t k);
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return ((uint32_t)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
 
-static double
-time_diff(struct timespec *x , struct timespec *y)
+static inline int
+ttable_expired(uint32_t expires, uint32_t now)
 {
-    double x_s, y_s, diff;
+    return ((int32_t)(now - expires) >= 0);
+}
 
-    x_s = (double)x->tv_sec + 1.0e-9*x->tv_nsec;
-    y_s = (double)y->tv_sec + 1.0e-9*y->tv_nsec;
+/* Hash of the flow. The lower bits select the bucket and the upper ones are
+ * the tag of the flow in the bucket */
+static inline uint32_t
+ttable_hash(packet_tuple_t *tpl)
+{
+    return (tpl->key.h.hash);
+}
 
-    diff = (double)y_s - (double)x_s;
+/* Tag of the flow in its bucket. 0 marks the empty ways */
+static inline uint16_t
+ttable_tag(uint32_t hash)
+{
+    uint16_t tag = hash >> 16;
 
-    return diff;
+    return (tag ? tag : 1);
 }
 
-static double
-time_elapsed(struct timespec *time_node)
+static inline int
+ttable_lru_rank(ttable_bucket_t *b, int way)
 {
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    return(time_diff(time_node, &now));
+    return (b->lru[way] ^ way);
+}
+
+static inline void
+ttable_lru_set_rank(ttable_bucket_t *b, int way, int rank)
+{
+    b->lru[way] = rank ^ way;
+}
+
+/* Make the way the most recently used of its bucket */
+static inline void
+ttable_lru_touch(ttable_bucket_t *b, int way)
+{
+    int r = ttable_lru_rank(b, way);
+    int w, rw;
+
+    for (w = 0; w < TTABLE_BUCKET_WAYS; w++) {
+        rw = ttable_lru_rank(b, w);
+        if (rw < r) {
+            ttable_lru_set_rank(b, w, rw + 1);
+        }
+    }
+    ttable_lru_set_rank(b, way, 0);
 }
 
+/* Make the way the least recently used of its bucket */
+static inline void
+ttable_lru_demote(ttable_bucket_t *b, int way)
+{
+    int r = ttable_lru_rank(b, way);
+    int w, rw;
+
+    for (w = 0; w < TTABLE_BUCKET_WAYS; w++) {
+        rw = ttable_lru_rank(b, w);
+        if (rw > r) {
+            ttable_lru_set_rank(b, w, rw - 1);
+        }
+    }
+    ttable_lru_set_rank(b, way, TTABLE_BUCKET_WAYS - 1);
+}
+
+/* Record the use of the flow of a way by the eviction policy */
+static inline void
+ttable_way_used(ttable_t *tt, ttable_bucket_t *b, int way)
+{
+    if (tt->evict == TTABLE_EVICT_LRU) {
+        ttable_lru_touch(b, way);
+    } else {
+        b->ref |= 1 << way;
+    }
+}
+
+/* Way of a full bucket whose flow is evicted according to the policy of the
+ * table */
+static int
+ttable_evict_way(ttable_t *tt, ttable_bucket_t *b)
+{
+    int w;
+
+    if (tt->evict == TTABLE_EVICT_LRU) {
+        for (w = 0; w < TTABLE_BUCKET_WAYS; w++) {
+            if (ttable_lru_rank(b, w) == TTABLE_BUCKET_WAYS - 1) {
+                return (w);
+            }
+        }
+        return (0);
+    }
+
+    /* The hand clears the reference bits it passes over, so it stops at
+     * the latest after a full turn */
+    for (;;) {
+        w = b->hand;
+        b->hand = (b->hand + 1) % TTABLE_BUCKET_WAYS;
+        if (!(b->ref & (1 << w))) {
+            return (w);
+        }
+        b->ref &= ~(1 << w);
+    }
+}
+
+static void *
+ttable_map(size_t len)
+{
+    void *mem;
+
+    /* Page aligned, so that the buckets are aligned to cache lines. The
+     * pages are only populated when used */
+    mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+            -1, 0);
+    if (mem == MAP_FAILED) {
+        OOR_LOG(LCRIT, "ttable_map: Couldn't allocate %zu bytes: %s", len,
+                strerror(errno));
+        abort();
+    }
+    return (mem);
+}
+
+/* Remove the flow of a way of a bucket */
 static void
-ttable_node_del(ttable_node_t *tn)
+ttable_way_clear(ttable_t *tt, uint32_t bucket, int way)
 {
-    pkt_tuple_del(tn->tpl);
-    fwd_info_del(tn->fi,(fwd_info_data_del)fwd_entry_del);
-    free(tn);
+    ttable_entry_t *e = &tt->entries[bucket * TTABLE_BUCKET_WAYS + way];
+
+    OOR_LOG(LDBG_3,"ttable_way_clear: Remove flow in bucket %u way %d",
+            bucket, way);
+    fwd_info_del(e->fi,(fwd_info_data_del)fwd_entry_del);
+    e->fi = NULL;
+    tt->buckets[bucket].tag[way] = 0;
+    tt->buckets[bucket].ref &= ~(1 << way);
+    tt->used--;
+}
+
+/* Way of the bucket with the flow of the key. -1 if not found */
+static inline int
+ttable_find(ttable_t *tt, uint32_t bucket, uint16_t tag, pkt_flow_key_t *key)
+{
+    ttable_bucket_t *b = &tt->buckets[bucket];
+    ttable_entry_t *e;
+    int w;
+
+    for (w = 0; w < TTABLE_BUCKET_WAYS; w++) {
+        if (b->tag[w] != tag) {
+            continue;
+        }
+        e = &tt->entries[bucket * TTABLE_BUCKET_WAYS + w];
+        if (pkt_flow_key_cmp(&e->key, key)) {
+            return (w);
+        }
+    }
+    return (-1);
 }
 
 void
-ttable_init(ttable_t *tt)
+ttable_init(ttable_t *tt, int size, ttable_evict_e evict,
+        int tcp_early_removal, uint32_t flowlet_gap)
 {
-    tt->htable =  kh_init(ttable);
-    list_init(&tt->head_list);
+    uint32_t nbuckets = 1;
+
+    if (size < TTABLE_BUCKET_WAYS) {
+        size = TTABLE_BUCKET_WAYS;
+    } else if (size > TTABLE_MAX_SIZE) {
+        size = TTABLE_MAX_SIZE;
+    }
+    while (nbuckets * TTABLE_BUCKET_WAYS < size) {
+        nbuckets <<= 1;
+    }
+
+    tt->mask = nbuckets - 1;
+    tt->buckets_len = nbuckets * sizeof(ttable_bucket_t);
+    tt->entries_len = nbuckets * TTABLE_BUCKET_WAYS * sizeof(ttable_entry_t);
+    tt->buckets = ttable_map(tt->buckets_len);
+    tt->entries = ttable_map(tt->entries_len);
+    tt->evict = evict;
+    tt->tcp_early_removal = tcp_early_removal;
+    tt->flowlet_gap = flowlet_gap;
+    tt->used = 0;
+    memset(&tt->stats, 0, sizeof(ttable_stats_t));
+    OOR_LOG(LDBG_2,"ttable_init: Flow table of %u flows (%zu KB), %s eviction",
+            nbuckets * TTABLE_BUCKET_WAYS,
+            (tt->buckets_len + tt->entries_len) / 1024,
+            evict == TTABLE_EVICT_LRU ? "LRU" : "CLOCK");
 }
 
 void
 ttable_uninit(ttable_t *tt)
 {
-    khiter_t k;
-
-    for (k = kh_begin(tt->htable); k != kh_end(tt->htable); ++k){
-        if (kh_exist(tt->htable, k)){
-            ttable_node_del(kh_value(tt->htable,k));
-        }
+    if (!tt->buckets) {
+        return;
     }
-    kh_destroy(ttable, tt->htable);
+    ttable_flush(tt);
+    munmap(tt->buckets, tt->buckets_len);
+    munmap(tt->entries, tt->entries_len);
+    tt->buckets = NULL;
+    tt->entries = NULL;
 }
 
 ttable_t *
-ttable_create()
+ttable_create(int size, ttable_evict_e evict, int tcp_early_removal,
+        uint32_t flowlet_gap)
 {
    ttable_t *tt = xzalloc(sizeof(ttable_t));
-   ttable_init(tt);
+   ttable_init(tt, size, evict, tcp_early_removal, flowlet_gap);
    return(tt);
 }
 
@@ -103,118 +274,185 @@ ttable_destroy(ttable_t *tt)
     free(tt);
 }
 
-static int
-tnode_expired(ttable_node_t *tn)
+/* Remove all the flows of the table */
+void
+ttable_flush(ttable_t *tt)
+{
+    uint32_t b;
+    int w;
+
+    for (b = 0; b <= tt->mask; b++) {
+        for (w = 0; w < TTABLE_BUCKET_WAYS; w++) {
+            if (tt->buckets[b].tag[w] != 0) {
+                ttable_way_clear(tt, b, w);
+            }
+        }
+    }
+}
+
+/* Number of flows the table can hold */
+int
+ttable_size(ttable_t *tt)
+{
+    return ((tt->mask + 1) * TTABLE_BUCKET_WAYS);
+}
+
+/* Largest number of flows of a table that uses at most 'mem' bytes. Each
+ * flow takes its entry and its share of the bucket */
+int
+ttable_size_for_memory(size_t mem)
 {
-    return(time_elapsed(&tn->ts) > TIMEOUT);
+    size_t bucket_mem = sizeof(ttable_bucket_t)
+            + TTABLE_BUCKET_WAYS * sizeof(ttable_entry_t);
+    uint32_t nbuckets = 1;
+
+    while (nbuckets * TTABLE_BUCKET_WAYS < TTABLE_MAX_SIZE
+            && 2 * nbuckets * bucket_mem <= mem) {
+        nbuckets <<= 1;
+    }
+    return (nbuckets * TTABLE_BUCKET_WAYS);
 }
 
+/* Insert the forwarding information of the flow of the tuple. The tuple is
+ * copied to the table, which becomes the owner of the information. The
+ * flowlet of the tuple is the one the information was obtained for */
 void
 ttable_insert(ttable_t *tt, packet_tuple_t *tpl, fwd_info_t *fi)
 {
-    khiter_t k;
-    int ret,i,removed,to_remove;
-    ttable_node_t *node;
-    struct ovs_list *list_elt;
-
-    /* If table is full, lookup and remove expired entries. If it is still
-     * full, remove old entries */
-    if (kh_size(tt->htable) >= MAX_SIZE) {
-        OOR_LOG(LDBG_1,"ttable_insert: Max size of forwarding table reached. Removing expired entries");
-        removed = 0;
-        for (k = kh_begin(tt->htable); k != kh_end(tt->htable); ++k){
-            if (!kh_exist(tt->htable, k)){
-                continue;
-            }
-            if (tnode_expired(kh_value(tt->htable,k))){
-                ttable_remove_with_khiter(tt,k);
-                removed++;
-            }
-        }
-        if (removed <  OLD_ENTRIES){
-            OOR_LOG(LDBG_1,"ttable_insert: Max size of forwarding table reached. Removing older entries");
-            to_remove = OLD_ENTRIES - removed;
-            for (i = 0 ; i < to_remove ; i++){
-                list_elt = list_back(&tt->head_list);
-                node = CONTAINER_OF(list_elt, ttable_node_t, list_elt);
-                ttable_remove(tt, node->tpl);
-            }
+    ttable_bucket_t *b;
+    ttable_entry_t *e;
+    uint32_t hash, bucket, now;
+    uint16_t tag;
+    int w, victim = -1;
+
+    hash = ttable_hash(tpl);
+    bucket = hash & tt->mask;
+    tag = ttable_tag(hash);
+    b = &tt->buckets[bucket];
+    now = ttable_now();
+
+    /* An existing entry of the flow is replaced. Otherwise, an empty,
+     * expired or invalid way is used, or the flow chosen by the eviction
+     * policy is replaced */
+    victim = ttable_find(tt, bucket, tag, &tpl->key);
+    for (w = 0; w < TTABLE_BUCKET_WAYS && victim < 0; w++) {
+        if (b->tag[w] == 0) {
+            victim = w;
+        } else if (ttable_expired(b->expires[w], now)
+                || !fwd_info_valid(tt->entries[bucket * TTABLE_BUCKET_WAYS + w].fi)) {
+            tt->stats.expirations++;
+            victim = w;
         }
     }
+    if (victim < 0) {
+        victim = ttable_evict_way(tt, b);
+        tt->stats.evictions++;
+        OOR_LOG(LDBG_3,"ttable_insert: Bucket %u full. Evicting flow of way %d",
+                bucket, victim);
+    }
+    if (b->tag[victim] != 0) {
+        ttable_way_clear(tt, bucket, victim);
+    }
 
-    node = xzalloc(sizeof(ttable_node_t));
-    node->fi = fi;
-    node->tpl = tpl;
-    clock_gettime(CLOCK_MONOTONIC, &node->ts);
-
-    list_init(&node->list_elt);
-    list_push_front(&tt->head_list, &node->list_elt);
-
-    k = kh_put(ttable,tt->htable,tpl,&ret);
-    kh_value(tt->htable, k) = node;
+    e = &tt->entries[bucket * TTABLE_BUCKET_WAYS + victim];
+    e->key = tpl->key;
+    e->fi = fi;
+    e->last = now;
+    e->flowlet = tpl->flowlet;
+    b->tag[victim] = tag;
+    b->expires[victim] = now + (fi->temporal ? NEGATIVE_TIMEOUT : TIMEOUT);
+    ttable_way_used(tt, b, victim);
+    tt->used++;
+    tt->stats.inserts++;
     OOR_LOG(LDBG_3,"ttable_insert: Inserted tupla: %s ", pkt_tuple_to_char(tpl));
 }
 
 void
 ttable_remove(ttable_t *tt, packet_tuple_t *tpl)
 {
-    khiter_t k;
-    ttable_node_t *tn;
+    uint32_t hash;
+    int w;
 
-    k = kh_get(ttable,tt->htable, tpl);
-    if (k == kh_end(tt->htable)){
+    hash = ttable_hash(tpl);
+    w = ttable_find(tt, hash & tt->mask, ttable_tag(hash), &tpl->key);
+    if (w < 0){
         return;
     }
-    tn = kh_value(tt->htable,k);
-    OOR_LOG(LDBG_3,"ttable_remove: Remove tupla: %s ", pkt_tuple_to_char(tn->tpl));
-    list_remove(&tn->list_elt);
-    ttable_node_del(tn);
-    kh_del(ttable,tt->htable,k);
+    OOR_LOG(LDBG_3,"ttable_remove: Remove tupla: %s ", pkt_tuple_to_char(tpl));
+    ttable_way_clear(tt, hash & tt->mask, w);
 }
 
+/* The flow of the way is ending. It is kept a little longer for the last
+ * packets of the connection and is the first one evicted from its bucket */
 static void
-ttable_remove_with_khiter(ttable_t *tt, khiter_t k)
+ttable_tcp_close(ttable_t *tt, ttable_bucket_t *b, int way, uint32_t now)
 {
-    ttable_node_t *node;
+    uint32_t expires = now + TCP_CLOSE_TIMEOUT;
 
-    node = kh_value(tt->htable,k);
-    OOR_LOG(LDBG_3,"ttable_remove_with_khiter: Remove tupla: %s ", pkt_tuple_to_char(node->tpl));
-    list_remove(&node->list_elt);
-    ttable_node_del(node);
-    kh_del(ttable,tt->htable,k);
+    if ((int32_t)(b->expires[way] - expires) <= 0) {
+        return;
+    }
+    b->expires[way] = expires;
+    if (tt->evict == TTABLE_EVICT_LRU) {
+        ttable_lru_demote(b, way);
+    } else {
+        b->ref &= ~(1 << way);
+    }
+    tt->stats.tcp_closes++;
 }
 
+/* Forwarding information of the flow of the tuple. NULL if it is not in the
+ * table or it has to be obtained again. When the flow starts a new flowlet,
+ * its number is set in the tuple to be used to select its locators */
 fwd_info_t *
 ttable_lookup(ttable_t *tt, packet_tuple_t *tpl)
 {
-    ttable_node_t *tn;
-    khiter_t k;
-    double elapsed;
-
-    k = kh_get(ttable,tt->htable, tpl);
-    if (k == kh_end(tt->htable)){
+    ttable_bucket_t *b;
+    ttable_entry_t *e;
+    fwd_info_t *fi;
+    uint32_t hash, bucket, now;
+    int w;
+
+    hash = ttable_hash(tpl);
+    bucket = hash & tt->mask;
+    b = &tt->buckets[bucket];
+    w = ttable_find(tt, bucket, ttable_tag(hash), &tpl->key);
+    if (w < 0){
+        tt->stats.misses++;
         return (NULL);
     }
-    tn = kh_value(tt->htable,k);
 
-    elapsed = time_elapsed(&tn->ts);
-    if (!tn->fi->temporal){
-        if (elapsed > TIMEOUT){
-            goto expired;
-        }
-    }else{
-        if (elapsed > NEGATIVE_TIMEOUT){
-            goto expired;
-        }
+    e = &tt->entries[bucket * TTABLE_BUCKET_WAYS + w];
+    fi = e->fi;
+    now = ttable_now();
+    if (!fwd_info_valid(fi) || ttable_expired(b->expires[w], now)){
+        ttable_way_clear(tt, bucket, w);
+        tt->stats.expirations++;
+        tt->stats.misses++;
+        return (NULL);
     }
 
-    list_remove(&tn->list_elt);
-    list_push_front(&tt->head_list, &tn->list_elt);
-
-    return (tn->fi);
+    /* The packets sent before a gap longer than the difference of delay of
+     * the paths have already arrived, so the flow can be moved to other
+     * locators without reordering them */
+    if (tt->flowlet_gap && now - e->last > tt->flowlet_gap) {
+        tpl->flowlet = e->flowlet + 1;
+        OOR_LOG(LDBG_3,"ttable_lookup: Flow idle for %u ms. Starting flowlet "
+                "%u", now - e->last, tpl->flowlet);
+        ttable_way_clear(tt, bucket, w);
+        tt->stats.flowlets++;
+        tt->stats.misses++;
+        return (NULL);
+    }
+    e->last = now;
+
+    tt->stats.hits++;
+    if (tt->tcp_early_removal && tpl->protocol == IPPROTO_TCP
+            && (tpl->tcp_flags & TTABLE_TCP_CLOSE_FLAGS)) {
+        ttable_tcp_close(tt, b, w, now);
+    } else {
+        ttable_way_used(tt, b, w);
+    }
 
-expired:
-    ttable_remove_with_khiter(tt, k);
-    return(NULL);
+    return (fi);
 }
-
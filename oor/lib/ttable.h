@@ -17,37 +17,107 @@
  *
  */
 
+
 #ifndef TTABLE_H_
 #define TTABLE_H_
 
-#include <time.h>
 #include "packets.h"
-#include "../elibs/khash/khash.h"
-#include "../elibs/ovs/list.h"
 
 typedef struct fwd_info_ fwd_info_t;
 
-typedef struct ttable_node {
-    struct ovs_list list_elt;
-    packet_tuple_t *tpl;
+/* Maximum number of flows of a table */
+#define TTABLE_MAX_SIZE         (1 << 24)
+
+/* Flows per bucket. The tags, the expiration times and the replacement
+ * state of a bucket fill a cache line */
+#define TTABLE_BUCKET_WAYS      8
+
+/* Policy used to choose the flow that is evicted from a full bucket */
+typedef enum {
+    /* The least recently used flow of the bucket */
+    TTABLE_EVICT_LRU,
+    /* Second chance: the first flow not used since the hand of the bucket
+     * passed over it */
+    TTABLE_EVICT_CLOCK
+} ttable_evict_e;
+
+typedef struct ttable_bucket_ {
+    /* Upper bits of the hash of the flow of each way, never 0. 0 if the way
+     * is empty */
+    uint16_t tag[TTABLE_BUCKET_WAYS];
+    /* Time in ms when the flow of each way expires */
+    uint32_t expires[TTABLE_BUCKET_WAYS];
+    /* LRU: position of each way in the recency order of the bucket, 0 being
+     * the most recently used. Stored XORed with the number of the way, so
+     * that a zeroed bucket holds a valid order */
+    uint8_t lru[TTABLE_BUCKET_WAYS];
+    /* CLOCK: bitmap of the ways used since the hand last passed over them,
+     * and way pointed by the hand */
+    uint8_t ref;
+    uint8_t hand;
+    uint8_t pad[6];
+} ttable_bucket_t;
+
+/* Entry of a flow. It fills a cache line */
+typedef struct ttable_entry_ {
+    pkt_flow_key_t key;
     fwd_info_t *fi;
-    struct timespec ts;
-} ttable_node_t;
+    /* Time in ms of the last packet of the flow */
+    uint32_t last;
+    /* Number of the current flowlet of the flow */
+    uint32_t flowlet;
+} ttable_entry_t;
 
-KHASH_INIT(ttable, packet_tuple_t *, ttable_node_t *, 1, pkt_tuple_hash, pkt_tuple_cmp)
+/* Counters of the activity of a table */
+typedef struct ttable_stats_ {
+    uint64_t hits;
+    uint64_t misses;
+    /* Flows inserted */
+    uint64_t inserts;
+    /* Valid flows replaced because their bucket was full */
+    uint64_t evictions;
+    /* Flows removed because they expired or their information changed */
+    uint64_t expirations;
+    /* Flows whose expiration was brought forward by a TCP FIN or RST */
+    uint64_t tcp_closes;
+    /* Flows removed to select again their locators after being idle */
+    uint64_t flowlets;
+} ttable_stats_t;
 
+/* Flow table with a fixed capacity, allocated when created. A flow can only
+ * be stored in one of the ways of the bucket selected by its hash. When they
+ * are all used, the flow chosen by the eviction policy is replaced */
 typedef struct ttable {
-    khash_t(ttable) *htable;
-    struct ovs_list head_list; /* To order flows */
+    ttable_bucket_t *buckets;
+    /* The entry of way 'w' of bucket 'b' is entries[b * WAYS + w] */
+    ttable_entry_t *entries;
+    uint32_t mask;
+    size_t buckets_len;
+    size_t entries_len;
+    ttable_evict_e evict;
+    /* Expire the TCP flows shortly after one of their packets has the FIN
+     * or RST flag set */
+    int tcp_early_removal;
+    /* Time in ms a flow has to be idle for its next packets to start a new
+     * flowlet, whose locators are selected again. 0 to disable it */
+    uint32_t flowlet_gap;
+    /* Flows in the table */
+    uint32_t used;
+    ttable_stats_t stats;
 } ttable_t;
 
-void ttable_init(ttable_t *tt);
+void ttable_init(ttable_t *tt, int size, ttable_evict_e evict,
+        int tcp_early_removal, uint32_t flowlet_gap);
 void ttable_uninit(ttable_t *tt);
-ttable_t *ttable_create();
+ttable_t *ttable_create(int size, ttable_evict_e evict, int tcp_early_removal,
+        uint32_t flowlet_gap);
 void ttable_destroy(ttable_t *tt);
+void ttable_flush(ttable_t *tt);
 void ttable_insert(ttable_t *, packet_tuple_t *tpl, fwd_info_t *fe);
 void ttable_remove(ttable_t *tt, packet_tuple_t *tpl);
 fwd_info_t *ttable_lookup(ttable_t *tt, packet_tuple_t *tpl);
+int ttable_size(ttable_t *tt);
+int ttable_size_for_memory(size_t mem);
 
 
 #endif /* TTABLE_H_ */
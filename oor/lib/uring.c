@@ -0,0 +1,304 @@
+/*
+ *
+ * Copyright (C) 2011, 2015 Cisco Systems, Inc.
+ * Copyright (C) 2015 CBA research group, Technical University of Catalonia.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+#include "mem_util.h"
+#include "oor_log.h"
+#include "../defs.h"
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup     425
+#define __NR_io_uring_enter     426
+#define __NR_io_uring_register  427
+#endif
+
+static int
+sys_io_uring_setup(uint32_t entries, struct io_uring_params *p)
+{
+    return (syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int
+sys_io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete,
+        uint32_t flags)
+{
+    return (syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+            NULL, 0));
+}
+
+static int
+sys_io_uring_register(int fd, uint32_t opcode, void *arg, uint32_t nr_args)
+{
+    return (syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+/* Create an io_uring instance with 'entries' submission entries and
+ * 'cq_entries' completion ones. Multishot operations need more completion
+ * entries than submission ones */
+uring_t *
+uring_new(uint32_t entries, uint32_t cq_entries)
+{
+    struct io_uring_params p;
+    uring_t *u;
+    uint8_t *sq, *cq;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cq_entries;
+
+    u = xzalloc(sizeof(uring_t));
+    u->fd = sys_io_uring_setup(entries, &p);
+    if (u->fd < 0) {
+        OOR_LOG(LERR, "uring_new: io_uring_setup: %s", strerror(errno));
+        free(u);
+        return (NULL);
+    }
+
+    u->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    u->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_map_len > u->sq_map_len) {
+            u->sq_map_len = u->cq_map_len;
+        }
+        u->cq_map_len = u->sq_map_len;
+    }
+
+    sq = mmap(NULL, u->sq_map_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        goto err;
+    }
+    u->sq_map = sq;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cq = sq;
+    } else {
+        cq = mmap(NULL, u->cq_map_len, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            goto err;
+        }
+        u->cq_map = cq;
+    }
+
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        u->sqes = NULL;
+        goto err;
+    }
+
+    u->sq_head = (uint32_t *)(sq + p.sq_off.head);
+    u->sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+    u->sq_array = (uint32_t *)(sq + p.sq_off.array);
+    u->sq_mask = *(uint32_t *)(sq + p.sq_off.ring_mask);
+    u->sq_entries = p.sq_entries;
+    u->sqe_tail = *u->sq_tail;
+
+    u->cq_head = (uint32_t *)(cq + p.cq_off.head);
+    u->cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+    u->cq_mask = *(uint32_t *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    return (u);
+err:
+    OOR_LOG(LERR, "uring_new: mmap: %s", strerror(errno));
+    uring_del(u);
+    return (NULL);
+}
+
+void
+uring_del(uring_t *u)
+{
+    if (!u) {
+        return;
+    }
+    if (u->sqes) {
+        munmap(u->sqes, u->sqes_len);
+    }
+    if (u->cq_map) {
+        munmap(u->cq_map, u->cq_map_len);
+    }
+    if (u->sq_map) {
+        munmap(u->sq_map, u->sq_map_len);
+    }
+    /* The descriptor may have been closed when removing it from the socket
+     * master */
+    if (u->fd != ERR_SOCKET) {
+        close(u->fd);
+    }
+    free(u);
+}
+
+/* Get a cleared submission entry. Returns NULL if the submission queue is
+ * full */
+struct io_uring_sqe *
+uring_get_sqe(uring_t *u)
+{
+    struct io_uring_sqe *sqe;
+    uint32_t head;
+
+    head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (u->sqe_tail - head >= u->sq_entries) {
+        return (NULL);
+    }
+
+    sqe = &u->sqes[u->sqe_tail & u->sq_mask];
+    u->sq_array[u->sqe_tail & u->sq_mask] = u->sqe_tail & u->sq_mask;
+    u->sqe_tail++;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    return (sqe);
+}
+
+/* Submit the pending entries and wait until at least 'wait_nr' completions
+ * are available. Returns the number of entries submitted or -1 */
+int
+uring_submit(uring_t *u, uint32_t wait_nr)
+{
+    uint32_t to_submit;
+    int ret;
+
+    to_submit = u->sqe_tail - *u->sq_tail;
+    if (to_submit == 0 && wait_nr == 0) {
+        return (0);
+    }
+    __atomic_store_n(u->sq_tail, u->sqe_tail, __ATOMIC_RELEASE);
+
+    do {
+        ret = sys_io_uring_enter(u->fd, to_submit, wait_nr,
+                wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        OOR_LOG(LWRN, "uring_submit: io_uring_enter: %s", strerror(errno));
+    }
+
+    return (ret);
+}
+
+/* Next completion entry, or NULL if there are no more. It should be
+ * released with uring_cqe_seen once processed */
+struct io_uring_cqe *
+uring_peek_cqe(uring_t *u)
+{
+    uint32_t head = *u->cq_head;
+
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+        return (NULL);
+    }
+
+    return (&u->cqes[head & u->cq_mask]);
+}
+
+void
+uring_cqe_seen(uring_t *u)
+{
+    __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/* Register a ring of 'nbufs' buffers in the buffer group 'bgid'. 'nbufs'
+ * should be a power of 2. All the buffers are initially available */
+uring_buf_ring_t *
+uring_buf_ring_new(uring_t *u, uint16_t bgid, int nbufs, int buf_len,
+        int headroom)
+{
+    struct io_uring_buf_reg reg;
+    uring_buf_ring_t *r;
+    int i;
+
+    r = xzalloc(sizeof(uring_buf_ring_t));
+    r->bgid = bgid;
+    r->nbufs = nbufs;
+    r->buf_len = buf_len;
+    r->headroom = headroom;
+
+    r->br_len = nbufs * sizeof(struct io_uring_buf);
+    r->br = mmap(NULL, r->br_len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r->br == MAP_FAILED) {
+        OOR_LOG(LERR, "uring_buf_ring_new: mmap: %s", strerror(errno));
+        free(r);
+        return (NULL);
+    }
+    r->mem = xmalloc((size_t)nbufs * buf_len);
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(unsigned long)r->br;
+    reg.ring_entries = nbufs;
+    reg.bgid = bgid;
+    if (sys_io_uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        OOR_LOG(LERR, "uring_buf_ring_new: IORING_REGISTER_PBUF_RING: %s",
+                strerror(errno));
+        munmap(r->br, r->br_len);
+        free(r->mem);
+        free(r);
+        return (NULL);
+    }
+
+    for (i = 0; i < nbufs; i++) {
+        uring_buf_ring_add(r, i);
+    }
+    uring_buf_ring_publish(r);
+
+    return (r);
+}
+
+void
+uring_buf_ring_del(uring_t *u, uring_buf_ring_t *r)
+{
+    struct io_uring_buf_reg reg;
+
+    if (!r) {
+        return;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = r->bgid;
+    sys_io_uring_register(u->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(r->br, r->br_len);
+    free(r->mem);
+    free(r);
+}
+
+/* Give back a buffer to the kernel. It is not visible until the ring is
+ * published */
+void
+uring_buf_ring_add(uring_buf_ring_t *r, uint16_t bid)
+{
+    struct io_uring_buf *buf;
+
+    buf = &r->br->bufs[r->tail & (r->nbufs - 1)];
+    buf->addr = (uint64_t)(unsigned long)(uring_buf(r, bid) + r->headroom);
+    buf->len = r->buf_len - r->headroom;
+    buf->bid = bid;
+    r->tail++;
+}
+
+void
+uring_buf_ring_publish(uring_buf_ring_t *r)
+{
+    __atomic_store_n(&r->br->tail, r->tail, __ATOMIC_RELEASE);
+}
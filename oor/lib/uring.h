@@ -0,0 +1,96 @@
+/*
+ *
+ * Copyright (C) 2011, 2015 Cisco Systems, Inc.
+ * Copyright (C) 2015 CBA research group, Technical University of Catalonia.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef URING_H_
+#define URING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/* Operations and flags more recent than some kernel headers */
+#ifndef IORING_RECV_MULTISHOT
+#define IORING_RECV_MULTISHOT   (1U << 1)
+#endif
+#define URING_OP_READ_MULTISHOT 49  /* Linux 6.7 */
+
+/* io_uring instance used through the raw system calls */
+typedef struct uring_ {
+    int fd;
+    /* Submission queue. 'sqe_tail' includes the entries not yet submitted */
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_array;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    uint32_t sqe_tail;
+    struct io_uring_sqe *sqes;
+    /* Completion queue */
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map;
+    size_t cq_map_len;
+    size_t sqes_len;
+} uring_t;
+
+/* Ring of buffers provided to the kernel. Multishot operations select one
+ * for each completion, identified by its bid. Each buffer has 'buf_len'
+ * bytes, and the kernel fills it after 'headroom' bytes */
+typedef struct uring_buf_ring_ {
+    struct io_uring_buf_ring *br;
+    size_t br_len;
+    uint8_t *mem;
+    int buf_len;
+    int headroom;
+    int nbufs;
+    uint16_t bgid;
+    uint16_t tail;
+} uring_buf_ring_t;
+
+uring_t *uring_new(uint32_t entries, uint32_t cq_entries);
+void uring_del(uring_t *u);
+struct io_uring_sqe *uring_get_sqe(uring_t *u);
+int uring_submit(uring_t *u, uint32_t wait_nr);
+struct io_uring_cqe *uring_peek_cqe(uring_t *u);
+void uring_cqe_seen(uring_t *u);
+
+uring_buf_ring_t *uring_buf_ring_new(uring_t *u, uint16_t bgid, int nbufs,
+        int buf_len, int headroom);
+void uring_buf_ring_del(uring_t *u, uring_buf_ring_t *r);
+void uring_buf_ring_add(uring_buf_ring_t *r, uint16_t bid);
+void uring_buf_ring_publish(uring_buf_ring_t *r);
+
+static inline uint8_t *
+uring_buf(uring_buf_ring_t *r, uint16_t bid)
+{
+    return (r->mem + (size_t)bid * r->buf_len);
+}
+
+/* Buffer selected by the kernel for a completion */
+static inline uint16_t
+uring_cqe_bid(struct io_uring_cqe *cqe)
+{
+    return (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+}
+
+#endif /* URING_H_ */
@@ -791,6 +791,18 @@ lisp_data_encap(lbuf_t *b, int lp, int rp, lisp_addr_t *la, lisp_addr_t *ra, uin
     return(lbuf_data(b));
 }
 
+/* Prebuild the headers pushed by lisp_data_encap */
+int
+lisp_data_outer_hdr_init(pkt_outer_hdr_t *oh, int lp, int rp, lisp_addr_t *la,
+        lisp_addr_t *ra, uint32_t iid)
+{
+    lisp_data_hdr_t lhdr;
+
+    lisp_data_hdr_init(&lhdr, iid);
+    return (pkt_outer_hdr_init(oh, lisp_addr_ip(la), lisp_addr_ip(ra), lp, rp,
+            &lhdr, sizeof(lisp_data_hdr_t)));
+}
+
 void *
 lisp_data_pull_hdr(lbuf_t *b)
 {
@@ -138,9 +138,35 @@ locator_clone(locator_t *loc)
     locator_t *locator = locator_new_init(loc->addr, loc->state,loc->L_bit, loc->R_bit,
             loc->priority, loc->weight, loc->mpriority, loc->mweight);
 
+    locator->rtt = loc->rtt;
     return (locator);
 }
 
+/* Update the RTT of the locator with the time in us it took to answer a
+ * probe */
+void
+locator_rtt_sample(locator_t *loc, uint32_t rtt)
+{
+    locator_rtt_t *r = &loc->rtt;
+
+    if (rtt == 0) {
+        rtt = 1;
+    }
+    if (r->srtt == 0) {
+        r->srtt = rtt;
+    } else {
+        r->srtt = r->srtt - r->srtt / 8 + rtt / 8;
+    }
+    r->loss -= r->loss / 8;
+}
+
+/* A probe sent to the locator was not answered */
+void
+locator_rtt_loss(locator_t *loc)
+{
+    loc->rtt.loss += (LOCATOR_LOSS_SCALE - loc->rtt.loss) / 8;
+}
+
 /*
  * Compare lisp_addr_t of two locators.
  * Returns:
@@ -30,6 +30,18 @@
 #define MIN_WEIGHT 0
 #define MAX_WEIGHT 255
 
+/* Scale of the fraction of lost RLOC probes of a locator */
+#define LOCATOR_LOSS_SCALE 65536
+
+/* Round trip time and loss of the RLOC probes sent to a remote locator,
+ * smoothed as the RTT of TCP (RFC 6298) */
+typedef struct locator_rtt_ {
+    /* Smoothed RTT in us. 0 until measured */
+    uint32_t srtt;
+    /* Fraction of lost probes, scaled by LOCATOR_LOSS_SCALE */
+    uint32_t loss;
+} locator_rtt_t;
+
 typedef struct locator {
     lisp_addr_t *addr;
     /* UP , DOWN */
@@ -40,6 +52,7 @@ typedef struct locator {
     uint8_t weight;
     uint8_t mpriority;
     uint8_t mweight;
+    locator_rtt_t rtt;
 } locator_t;
 
 
@@ -59,6 +72,8 @@ int locator_list_extract_locator_with_ptr(glist_t *loct_list,locator_t *locator)
 int locator_cmp_addr (locator_t *loct1,locator_t *loct2);
 glist_t *locator_list_clone(glist_t *llist);
 int locator_list_cmp_afi(glist_t *loct_list_a, glist_t *loct_list_b);
+void locator_rtt_sample(locator_t *loc, uint32_t rtt);
+void locator_rtt_loss(locator_t *loc);
 
 static inline lisp_addr_t *locator_addr(locator_t *);
 static inline uint8_t locator_state(locator_t *);
@@ -68,6 +83,8 @@ static inline uint8_t locator_priority(locator_t *);
 static inline uint8_t locator_weight(locator_t *);
 static inline uint8_t locator_mpriority(locator_t *);
 static inline uint8_t locator_mweight(locator_t *);
+static inline uint32_t locator_srtt(locator_t *);
+static inline uint32_t locator_loss(locator_t *);
 static inline void locator_set_addr(locator_t *, lisp_addr_t *);
 static inline void locator_clone_addr(locator_t *loc, lisp_addr_t *addr);
 static inline void locator_set_state(locator_t *locator, uint8_t state);
@@ -117,6 +134,16 @@ static inline uint8_t locator_mweight(locator_t *locator)
     return (locator->mweight);
 }
 
+static inline uint32_t locator_srtt(locator_t *locator)
+{
+    return (locator->rtt.srtt);
+}
+
+static inline uint32_t locator_loss(locator_t *locator)
+{
+    return (locator->rtt.loss);
+}
+
 static inline void locator_set_addr(locator_t *loc, lisp_addr_t *addr)
 {
     /* Addr is linked to corresponding interface address */
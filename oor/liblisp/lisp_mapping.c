@@ -279,13 +279,19 @@ mapping_remove_locators(mapping_t *mapping)
 }
 
 
+/* Replace the locators of the mapping with a copy of the ones of the lists.
+ * The locators whose address doesn't change keep the RTT and loss measured
+ * with the RLOC probes */
 void
 mapping_update_locators(mapping_t *mapping, glist_t *locts_lists)
 {
     glist_t *loct_list = NULL;
     glist_t *new_loct_list = NULL;
+    glist_t *new_locts_lists = NULL;
     glist_entry_t *it_list = NULL;
+    glist_entry_t *it_loct = NULL;
     locator_t *locator = NULL;
+    locator_t *old_locator = NULL;
 
     int loct_ctr = 0;
 
@@ -293,18 +299,35 @@ mapping_update_locators(mapping_t *mapping, glist_t *locts_lists)
         return;
     }
 
-    /* TODO: do a comparison first */
-    glist_remove_all(mapping->locators_lists);
-
+    new_locts_lists = glist_new();
     glist_for_each_entry(it_list,locts_lists){
         loct_list = (glist_t *)glist_entry_data(it_list);
         new_loct_list = locator_list_clone(loct_list);
+        if (!new_loct_list){
+            continue;
+        }
+        glist_for_each_entry(it_loct,new_loct_list){
+            locator = (locator_t *)glist_entry_data(it_loct);
+            old_locator = mapping_get_loct_with_addr(mapping, locator_addr(locator));
+            if (old_locator){
+                locator->rtt = old_locator->rtt;
+            }
+        }
+        glist_add_tail(new_loct_list,new_locts_lists);
+    }
+
+    /* TODO: do a comparison first */
+    glist_remove_all(mapping->locators_lists);
+
+    glist_for_each_entry(it_list,new_locts_lists){
+        new_loct_list = (glist_t *)glist_entry_data(it_list);
         glist_add(new_loct_list,mapping->locators_lists);
         locator = (locator_t*)glist_first_data(new_loct_list);
         if (lisp_addr_is_no_addr(locator_addr(locator)) == FALSE){
             loct_ctr = loct_ctr + glist_size(new_loct_list);
         }
     }
+    glist_destroy(new_locts_lists);
     mapping->locator_count = loct_ctr;
 }
 
@@ -41,6 +41,7 @@
 #include "control/lisp_xtr.h"
 #include "control/lisp_ms.h"
 #include "data-plane/data-plane.h"
+#include "lib/cksum.h"
 #include "lib/oor_log.h"
 #include "lib/nonces_table.h"
 #include "lib/pointers_table.h"
@@ -449,7 +450,9 @@ main(int argc, char **argv)
     demonize_start();
 
     /* create socket master, timer wheel, initialize interfaces */
-    smaster = sockmstr_create();
+    if ((smaster = sockmstr_create()) == NULL){
+        exit_cleanup();
+    }
     oor_timers_init();
     ifaces_init();
 
@@ -465,7 +468,9 @@ main(int argc, char **argv)
     if (parse_config_file() != GOOD){
         exit_cleanup();
     }
-
+    data_plane_select_from_conf();
+    /* Select the checksum implementation supported by the CPU */
+    cksum_init();
 
     dev_type = ctrl_dev_mode(ctrl_dev);
     if (dev_type == xTR_MODE || dev_type == RTR_MODE || dev_type == MN_MODE) {
@@ -498,7 +503,6 @@ main(int argc, char **argv)
     for (;;) {
         sockmstr_wait_on_all_read(smaster);
         sockmstr_process_all(smaster);
-        oor_api_loop(&oor_api_connection);
     }
 #else
     for (;;) {
@@ -0,0 +1,182 @@
+/*
+ * Compares the lookups of the compiled IPv4 LPM table (oor/lib/lpm4.c) with
+ * the ones of the patricia tree it replaces in the map databases, while
+ * nested prefixes are added and removed. Returns 0 if they always match.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <arpa/inet.h>
+
+#include "../oor/lib/lpm4.h"
+#include "../oor/elibs/patricia/patricia.h"
+
+#define NPREFS      4000
+#define NLOOKUPS    200000
+#define NROUNDS     4
+
+/* Symbols of the OOR daemon used by the linked files */
+int debug_level = 0;
+void llog(int level, const char *format, ...) {}
+void exit_cleanup() { exit(EXIT_FAILURE); }
+
+typedef struct pref {
+    uint32_t addr;
+    uint8_t plen;
+    uint32_t id;
+    patricia_node_t *node;
+} pref_t;
+
+static pref_t prefs[NPREFS];
+static const uint8_t plens[] = {8, 12, 16, 20, 22, 24, 25, 26, 28, 30, 32};
+
+static uint32_t
+mask(uint32_t addr, uint8_t plen)
+{
+    return (plen == 0 ? 0 : addr & (0xffffffffU << (32 - plen)));
+}
+
+/* Addresses of 10.0.0.0/8 concentrated in a few /16s, so that prefixes
+ * overlap at every length */
+static uint32_t
+rand_addr()
+{
+    return ((10U << 24) | ((rand() % 4) << 16) | (rand() & 0xffff));
+}
+
+static patricia_node_t *
+pt_best(patricia_tree_t *pt, uint32_t addr, uint8_t plen)
+{
+    struct in_addr in;
+    prefix_t *prefix;
+    patricia_node_t *node;
+
+    in.s_addr = htonl(addr);
+    prefix = New_Prefix(AF_INET, &in, plen);
+    node = patricia_search_best(pt, prefix);
+    Deref_Prefix(prefix);
+    return (node);
+}
+
+static int
+add(patricia_tree_t *pt, lpm4_t *lpm, pref_t *p)
+{
+    struct in_addr in;
+    prefix_t *prefix;
+
+    do {
+        p->plen = plens[rand() % sizeof(plens)];
+        p->addr = mask(rand_addr(), p->plen);
+        in.s_addr = htonl(p->addr);
+        prefix = New_Prefix(AF_INET, &in, p->plen);
+        p->node = patricia_search_exact(pt, prefix);
+        if (!p->node) {
+            p->node = patricia_lookup(pt, prefix);
+        } else {
+            p->node = NULL;
+        }
+        Deref_Prefix(prefix);
+    } while (!p->node);
+
+    p->node->data = p;
+    if (lpm4_add(lpm, p->addr, p->plen, p, &p->id) != 1) {
+        fprintf(stderr, "lpm4_add failed\n");
+        return (-1);
+    }
+    p->node->user1 = (void *)(uintptr_t)(p->id + 1);
+    return (0);
+}
+
+/* Remove the prefix as the map database does: its addresses go to the
+ * longest prefix that contains it */
+static void
+rm(patricia_tree_t *pt, lpm4_t *lpm, pref_t *p)
+{
+    patricia_node_t *parent;
+
+    p->node->user1 = NULL;
+    patricia_remove(pt, p->node);
+    p->node = NULL;
+    parent = pt_best(pt, p->addr, p->plen);
+    if (parent) {
+        lpm4_remove(lpm, p->addr, p->plen, p->id,
+                (uintptr_t)parent->user1 - 1, parent->prefix->bitlen);
+    } else {
+        lpm4_remove(lpm, p->addr, p->plen, p->id, -1, 0);
+    }
+}
+
+static int
+compare(patricia_tree_t *pt, lpm4_t *lpm)
+{
+    patricia_node_t *node;
+    uint32_t addr;
+    void *exp;
+    int i;
+
+    for (i = 0; i < NLOOKUPS; i++) {
+        /* Half of the lookups hit the boundaries of a prefix */
+        if (i % 2 && prefs[i % NPREFS].node) {
+            addr = prefs[i % NPREFS].addr;
+            addr |= (i % 4 == 1) ? 0 : ~mask(0xffffffffU, prefs[i % NPREFS].plen);
+        } else {
+            addr = rand_addr();
+        }
+        node = pt_best(pt, addr, 32);
+        exp = node ? node->data : NULL;
+        if (lpm4_lookup(lpm, addr) != exp) {
+            fprintf(stderr, "Mismatch for %08x: patricia %p, lpm4 %p\n", addr,
+                    exp, lpm4_lookup(lpm, addr));
+            return (-1);
+        }
+    }
+    return (0);
+}
+
+int main(int argc, char **argv)
+{
+    patricia_tree_t *pt;
+    lpm4_t *lpm;
+    int i, r;
+
+    srand(argc > 1 ? atoi(argv[1]) : 1);
+    pt = New_Patricia(32);
+    lpm = lpm4_new();
+    if (!lpm) {
+        return (EXIT_FAILURE);
+    }
+
+    for (i = 0; i < NPREFS; i++) {
+        if (add(pt, lpm, &prefs[i]) != 0) {
+            return (EXIT_FAILURE);
+        }
+    }
+    if (compare(pt, lpm) != 0) {
+        return (EXIT_FAILURE);
+    }
+
+    /* Replace a quarter of the prefixes in each round */
+    for (r = 0; r < NROUNDS; r++) {
+        for (i = r % 4; i < NPREFS; i += 4) {
+            rm(pt, lpm, &prefs[i]);
+        }
+        if (compare(pt, lpm) != 0) {
+            return (EXIT_FAILURE);
+        }
+        for (i = r % 4; i < NPREFS; i += 4) {
+            if (add(pt, lpm, &prefs[i]) != 0) {
+                return (EXIT_FAILURE);
+            }
+        }
+        if (compare(pt, lpm) != 0) {
+            return (EXIT_FAILURE);
+        }
+    }
+
+    printf("lpm4: %d prefixes, %d rounds, lookups match the patricia tree\n",
+            NPREFS, NROUNDS);
+    lpm4_del(lpm);
+    return (EXIT_SUCCESS);
+}